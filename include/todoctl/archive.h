@@ -0,0 +1,91 @@
+/*
+ * archive.h -- TodoCtl cold archive for old done tasks
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_ARCHIVE_H
+#define TODOCTL_ARCHIVE_H
+
+#include <stdint.h>
+
+#include "todoctl/entry.h"
+#include "todoctl/query.h"
+
+#define ARCHIVE_SUFFIX ".archive"
+#define ARCHIVE_INDEX_SUFFIX ".archive.idx"
+#define ARCHIVE_INDEX_MAGIC 0x4e4e41
+#define ARCHIVE_INDEX_VERSION 1
+#define ARCHIVE_INDEX_HEADER_SIZE 24
+#define ARCHIVE_BLOCK_SIZE 72
+#define ARCHIVE_NO_PENDING UINT32_MAX
+
+#define ARCHIVE_BLOCK_ENTRIES 4096
+#define ARCHIVE_DEFAULT_DAYS 30
+
+/* done tasks older than a threshold are moved out of the db and its
+ * segments into `~/.todo.db.archive`, an append only file of zlib
+ * compressed blocks. A block holds up to ARCHIVE_BLOCK_ENTRIES entries in
+ * the compact encoding (see entry.h), long and interned texts stay where
+ * they are and the block only references them.
+ *
+ * `~/.todo.db.archive.idx` lists the blocks and is only ever replaced as a
+ * whole through a rename, like the manifest
+ *
+ * |  MAGIC  | VERSION | BLOCKS  | PENDING |  PAD   |
+ * | 8 bytes | 4 bytes | 4 bytes | 4 bytes |4 bytes |
+ *
+ * |  OFFSET | PACKED  |   RAW   | ENTRIES | CRC32 | MIN_ID | MAX_ID | MIN_CREATED | ...
+ * | 8 bytes | 4 bytes | 4 bytes | 4 bytes |4 bytes|8 bytes |8 bytes |   8 bytes   | ...
+ *
+ * followed by MAX_CREATED, MIN_DONE and MAX_DONE. The CRC32 covers the
+ * packed bytes. Blocks from PENDING on were written but their entries may
+ * still be in the db, readers skip them until the `archive` that wrote
+ * them (or the next one after a crash) removed the entries and cleared it */
+typedef struct {
+  uint64_t offset;
+  uint32_t packed;
+  uint32_t raw;
+  uint32_t entries;
+  uint32_t checksum;
+  uint64_t min_id;
+  uint64_t max_id;
+  uint64_t min_created;
+  uint64_t max_created;
+  uint64_t min_done;
+  uint64_t max_done;
+} archive_block_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t pending; /* ARCHIVE_NO_PENDING when every block is published */
+  archive_block_t *blocks;
+} archive_index_t;
+
+typedef struct {
+  uint64_t entries;
+  uint32_t blocks;
+  uint64_t raw_bytes;
+  uint64_t packed_bytes;
+  uint64_t recovered; /* entries of an interrupted archive that were finished */
+} archive_report_t;
+
+/* loads the index, a missing index is an empty archive */
+int archive_index_load(archive_index_t *);
+
+/* atomically replaces the index */
+int archive_index_store(const archive_index_t *);
+
+void archive_index_free(archive_index_t *);
+
+/* moves the tasks done before the cutoff (in millis) out of the db and its
+ * segments into the archive. Takes the db lock */
+int archive_done_before(uint64_t, archive_report_t *);
+
+/* appends the archived tasks matching the query to `out`, blocks whose
+ * ranges rule the query out are not decompressed. A NULL query reads
+ * everything. Archived tasks never change, the delta log is not applied */
+int archive_read_entries(query_t *, todo_entry_t ***, size_t *);
+
+#endif // TODOCTL_ARCHIVE_H
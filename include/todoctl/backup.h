@@ -0,0 +1,72 @@
+/*
+ * backup.h -- TodoCtl incremental backups
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_BACKUP_H
+#define TODOCTL_BACKUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "todoctl/db.h"
+
+#define BACKUP_SUFFIX ".dirty" /* offsets patched since the last backup */
+#define BACKUP_MAGIC 0x4e4e42
+#define BACKUP_VERSION 1
+#define BACKUP_CHAIN "chain"
+#define BACKUP_CHAIN_SIZE 44
+#define BACKUP_DELTA_HEAD 40
+#define BACKUP_PATCH_SIZE 16
+
+/* the db features that keep tasks outside the db file, a backup of the
+ * file alone would not hold them */
+#define BACKUP_UNSUPPORTED                                                                         \
+  (DB_FEATURE_DELTA_LOG | DB_FEATURE_SEGMENTS | DB_FEATURE_BLOBS | DB_FEATURE_INTERN)
+
+#define RESTORE_NONE 0x00
+#define RESTORE_FORCE (1 << 0) /* replace an existing db */
+
+/* backups of the db file into a directory as a base and a chain of deltas.
+ * The file is appended to and only ever patched in place where done,
+ * undone and delete write a time, so a delta is the header, the patched
+ * times and the bytes appended since the last backup, copied with
+ * `copy_file_range`. With the `backup` feature, turned on by the first
+ * backup, every patch first appends its offset to `~/.todo.db.dirty`, the
+ * next backup reads those and starts the list over.
+ *
+ * `chain` says which base and how many deltas there are
+ *
+ * |  MAGIC  | VERSION | GENERATION |   DEV   |   INO   | OFFSET  | DELTAS  |
+ * | 8 bytes | 4 bytes |  4 bytes   | 8 bytes | 8 bytes | 8 bytes | 4 bytes |
+ *
+ * with DEV and INO the db file the chain follows and OFFSET how much of it
+ * is backed up. `base.<generation>` is a copy of the db up to its
+ * committed size and every `delta.<generation>.<n>`
+ *
+ * |  MAGIC  | VERSION | GENERATION |   SEQ   | PATCHES |  FROM   |   TO    |
+ * | 8 bytes | 4 bytes |  4 bytes   | 4 bytes | 4 bytes | 8 bytes | 8 bytes |
+ *
+ * followed by the db header, PATCHES times an OFFSET 8 and its VALUE 8,
+ * and the bytes in [FROM, TO). A rewrite of the db (compact, archive)
+ * gives it a new inode and the next backup a new generation, replacing
+ * `chain` is what commits it before the old generation is removed. */
+typedef struct {
+  bool full;       /* a new base rather than a delta */
+  uint32_t deltas; /* in the chain now */
+  uint64_t bytes;  /* written */
+} backup_report_t;
+
+/* notes an in place patch at an offset, called before the write while the
+ * db lock is held */
+int backup_record_patch(uint64_t);
+
+/* backs the db up into the directory */
+int backup_run(const char *, backup_report_t *);
+
+/* rebuilds the db from the base and the deltas in the directory */
+int backup_restore(const char *, int);
+
+#endif // TODOCTL_BACKUP_H
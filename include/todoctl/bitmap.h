@@ -0,0 +1,76 @@
+/*
+ * bitmap.h -- TodoCtl compressed id bitmaps
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_BITMAP_H
+#define TODOCTL_BITMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITMAP_ARRAY_MAX 4096 /* past this many ids a container is a bitset */
+#define BITMAP_WORDS 1024     /* 65536 bits */
+
+/* a set of entry ids in the roaring layout: ids are split by their high
+ * bits into containers of 65536, a container holding up to
+ * BITMAP_ARRAY_MAX ids keeps them as a sorted array of their low 16 bits,
+ * a fuller one as a bitset. Ids are handed out in order so a db of n tasks
+ * is a handful of dense containers, a tag on a few of them a short array.
+ * On disk
+ *
+ * |  COUNT  | per container: KEY 8 | KIND 1 | CARD 4 | values         |
+ * | 4 bytes |                                        | CARD * 2 or 8K |
+ *
+ * with every field big endian */
+typedef struct {
+  uint64_t key; /* id >> 16 */
+  uint32_t card;
+  uint32_t cap;    /* of the array */
+  uint16_t *array; /* sorted, NULL for a bitset */
+  uint64_t *bits;  /* BITMAP_WORDS words, NULL for an array */
+} bitmap_container_t;
+
+typedef struct {
+  bitmap_container_t *containers; /* sorted by key */
+  size_t count;
+  size_t cap;
+} bitmap_t;
+
+void bitmap_init(bitmap_t *);
+
+void bitmap_free(bitmap_t *);
+
+int bitmap_add(bitmap_t *, uint64_t);
+
+void bitmap_remove(bitmap_t *, uint64_t);
+
+bool bitmap_contains(const bitmap_t *, uint64_t);
+
+uint64_t bitmap_cardinality(const bitmap_t *);
+
+/* the ids in order as a fresh array, NULL when there are none */
+int bitmap_to_array(const bitmap_t *, uint64_t **, size_t *);
+
+/* true if any id in [lo, hi] is set, lets a reader skip a whole range */
+bool bitmap_intersects_range(const bitmap_t *, uint64_t, uint64_t);
+
+/* the set operations write a fresh bitmap into the first argument, which
+ * may not be one of the inputs */
+int bitmap_copy(bitmap_t *, const bitmap_t *);
+int bitmap_and(bitmap_t *, const bitmap_t *, const bitmap_t *);
+int bitmap_or(bitmap_t *, const bitmap_t *, const bitmap_t *);
+int bitmap_andnot(bitmap_t *, const bitmap_t *, const bitmap_t *);
+
+size_t bitmap_serialized_size(const bitmap_t *);
+
+/* writes the bitmap to a buffer of `bitmap_serialized_size` bytes */
+void bitmap_serialize(const bitmap_t *, char *);
+
+/* reads a bitmap back and tells how many bytes it took */
+int bitmap_deserialize(bitmap_t *, const char *, size_t, size_t *);
+
+#endif // TODOCTL_BITMAP_H
@@ -0,0 +1,43 @@
+/*
+ * blob.h -- TodoCtl blob file for long task texts
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_BLOB_H
+#define TODOCTL_BLOB_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BLOB_SUFFIX ".blobs"
+#define BLOB_HEADER_SIZE 12
+#define BLOB_READ_CHUNK (64 * 1024)
+
+/* texts longer than MAX_TODO_TEXT_LENGTH are appended to `~/.todo.db.blobs`
+ * and the entry only keeps where the text starts
+ *
+ * | LENGTH | CRC32 | TEXT  |
+ * |8 bytes |4 bytes|N bytes|
+ *
+ * the file is append only, texts of entries that went away are not
+ * reclaimed */
+
+/* appends a text straight from the buffer, `offset` receives where its
+ * record starts. Callers hold the db lock so appends never interleave */
+int blob_append(const char *, size_t, uint64_t *);
+
+/* reads the text of the record at the offset into a freshly allocated,
+ * NUL terminated buffer */
+int blob_read(uint64_t, uint64_t, char **);
+
+/* hands the text of the record at the offset to the callback chunk by
+ * chunk, the text is never held in memory as a whole. A callback that
+ * fails stops the stream */
+int blob_stream(uint64_t, uint64_t, int (*)(void *, const char *, size_t), void *);
+
+/* streams the text of the record at the offset to the stream */
+int blob_copy_to(uint64_t, uint64_t, FILE *);
+
+#endif // TODOCTL_BLOB_H
@@ -0,0 +1,69 @@
+/*
+ * bloom.h -- TodoCtl bloom filters
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_BLOOM_H
+#define TODOCTL_BLOOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "todoctl/entry.h"
+
+#define BLOOM_MAGIC 0x4e4e42
+#define BLOOM_BITS_PER_KEY 10 /* ~1% false positives with BLOOM_HASHES */
+#define BLOOM_HASHES 7
+#define BLOOM_FOOTER_SIZE 24
+
+/* a filter over the ids and the text tokens of a set of entries, written as
+ * a trailer at the end of a sealed segment
+ *
+ * |  BITS  |  NBITS  | HASHES |  KEYS   |  MAGIC  |
+ * |NBITS/8 | 4 bytes |4 bytes | 8 bytes | 8 bytes |
+ *
+ * the footer sits at the very end so it can be found from the file size */
+typedef struct {
+  uint32_t nbits;
+  uint32_t hashes;
+  uint64_t keys;
+  uint8_t *bits;
+} bloom_t;
+
+/* what lookups did with the filters, kept in the stats block */
+typedef struct {
+  uint64_t probes;          /* filters consulted */
+  uint64_t skips;           /* filters that ruled their segment out */
+  uint64_t false_positives; /* filters that said maybe for a segment without the key */
+} bloom_counters_t;
+
+/* sizes an empty filter for the expected number of keys */
+int bloom_init(bloom_t *, size_t);
+
+void bloom_free(bloom_t *);
+
+void bloom_add_id(bloom_t *, uint64_t);
+void bloom_add_token(bloom_t *, const char *, size_t);
+
+/* adds the id and every token of the text of an entry, a text that is
+ * still in the blob file has to be loaded first */
+void bloom_add_entry(bloom_t *, const todo_entry_t *);
+
+/* false means the key was definitely never added */
+bool bloom_has_id(const bloom_t *, uint64_t);
+bool bloom_has_token(const bloom_t *, const char *, size_t);
+
+/* number of keys `bloom_add_entry` would add for an entry */
+size_t bloom_entry_keys(const todo_entry_t *);
+
+/* appends the filter as a trailer to the file */
+int bloom_write(int, const bloom_t *);
+
+/* reads the trailer of a file that is the given size */
+int bloom_read(int, off_t, bloom_t *);
+
+#endif // TODOCTL_BLOOM_H
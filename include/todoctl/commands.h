@@ -11,13 +11,99 @@
 #include <stddef.h>
 #include <stdint.h>
 
-/* adds a task into db */
-int add_task_command(const char *);
+#include "todoctl/query.h"
 
-/* list all the tasks available */
-int list_tasks_command(int);
+/* adds a task into db with its tags (see tags.h) and a due time in millis,
+ * 0 for none (see due.h) */
+int add_task_command(const char *, char *const *, size_t, uint64_t);
+
+/* list all the tasks available, optionally only the top ones in an order */
+int list_tasks_command(int, const query_order_t *);
+
+/* lists the tasks as they were at a time in millis, needs the history
+ * feature (see history.h) */
+int list_tasks_as_of_command(int, const query_order_t *, uint64_t);
 
 /* marks a task done */
 int mark_task_done(const uint64_t id);
 
+/* reopens a task that was marked done */
+int mark_task_undone(const uint64_t id);
+
+/* marks a task deleted */
+int delete_task_command(const uint64_t id);
+
+/* folds the delta log into the entries and rewrites the db */
+int compact_command(void);
+
+/* moves the entries of the active db into a sealed segment */
+int seal_command(void);
+
+/* lists the sealed segments, verifying their checksums if asked */
+int segments_command(int);
+
+/* moves the tasks done more than the given number of days ago into the
+ * archive, see archive.h */
+int archive_command(uint64_t);
+
+/* checks the db and its segments, repairing the db unless it is a dry run */
+int fsck_command(int);
+
+/* lists the db features or enables/disables one by name */
+int feature_command(const char *, const char *);
+
+/* prints the counters from the stats block, see STATS_* flags */
+int stats_command(int);
+
+/* prints the counts as they were at a time in millis, needs the history
+ * feature */
+int stats_as_of_command(uint64_t);
+
+/* lists the tags with how many tasks carry them, see TAGS_* flags */
+int tags_command(int);
+
+/* lists the open tasks past their due time, most overdue first */
+int overdue_command(void);
+
+/* lists the open tasks due within the given millis, soonest first */
+int upcoming_command(uint64_t);
+
+#define QUERY_EXPLAIN (1 << 0)      /* the plan goes to stderr */
+#define QUERY_WITH_ARCHIVE (1 << 1) /* archived tasks are read too */
+
+/* lists the tasks matching a query (see query.h) in one of the OUTPUT_*
+ * formats, optionally sorted, see QUERY_* flags */
+int query_command(const char *, int, int, const query_order_t *);
+
+/* the same as `query_command` and `list_tasks_command` over several dbs
+ * (`--db`), merged into one list in created order unless another is given */
+int multi_query_command(char *const *, size_t, const char *, int, int, const query_order_t *);
+int multi_list_tasks_command(char *const *, size_t, int, const query_order_t *);
+
+/* lists the tasks containing a word, sealed segments whose filter rules
+ * the word out are not read */
+int find_command(const char *, int);
+
+/* lists the tasks whose text is most like the given one, typos included,
+ * best match first. With the trigram index only tasks sharing enough of
+ * its trigrams are read, see TRIGRAM_* flags */
+int search_command(const char *, int);
+
+/* prints the recorded run times per command and day, for one command or
+ * (NULL) all of them */
+int perf_report_command(const char *, uint32_t);
+
+/* backs the db up into a directory, a full copy the first time and only
+ * what changed since after that */
+int backup_command(const char *);
+
+/* rebuilds the db from the backups in a directory, see RESTORE_* flags */
+int restore_command(const char *, int);
+
+/* merges the tasks of another db file into the db, see merge.h */
+int merge_command(const char *);
+
+/* streams changes to the db as they happen, see WATCH_* flags */
+int watch_command(int);
+
 #endif // TODOCTL_COMMANDS_H
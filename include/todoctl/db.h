@@ -16,12 +16,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <wordexp.h>
 
+#include "todoctl/schema.h"
+
 #define DB_MAGIC 0x4e4e4e
 #define DEFAULT_DB_PATH "~/.todo.db"
 #define DB_HEADER_VERSION 1
+#define DB_HEADER_VERSION_FEATURES 2 /* written once any feature flag is enabled */
+#define DB_PATH_MAX 4096
+#define DB_APPEND_MAX_PARTS 4 /* iovecs `db_append_commit` takes */
+
+/* optional features, stored in the header flags. Binaries that predate a
+ * feature see version 2 and refuse to touch the db instead of corrupting it */
+#define DB_FEATURE_NONE 0x00
+#define DB_FEATURE_DELTA_LOG (1 << 0) /* status changes are appended to `~/.todo.db.log` */
+#define DB_FEATURE_SEGMENTS (1 << 1)  /* old entries are sealed into `~/.todo.db.d/` */
+#define DB_FEATURE_BLOBS (1 << 2)     /* long texts live in `~/.todo.db.blobs` */
+#define DB_FEATURE_INTERN (1 << 3)    /* texts are stored once in `~/.todo.db.dict` */
+#define DB_FEATURE_TAGS (1 << 4)      /* tags and states are indexed in `~/.todo.db.tags` */
+#define DB_FEATURE_DUE (1 << 5)       /* due times are indexed in `~/.todo.db.due` */
+#define DB_FEATURE_HISTORY (1 << 6)   /* status changes are kept in `~/.todo.db.history` */
+#define DB_FEATURE_TRIGRAMS (1 << 7)  /* texts are indexed in `~/.todo.db.trigrams` */
+#define DB_FEATURE_PERF (1 << 9)      /* run times are kept in `~/.todo.db.perf` */
+#define DB_FEATURE_BACKUP (1 << 10)   /* in place patches are listed in `~/.todo.db.dirty` */
+#define DB_FEATURE_ALL                                                                             \
+  (DB_FEATURE_DELTA_LOG | DB_FEATURE_SEGMENTS | DB_FEATURE_BLOBS | DB_FEATURE_INTERN |             \
+   DB_FEATURE_TAGS | DB_FEATURE_DUE | DB_FEATURE_HISTORY | DB_FEATURE_TRIGRAMS | DB_FEATURE_PERF | \
+   DB_FEATURE_BACKUP)
+
+/* the entries of the file use the compact encoding (see entry.h). Only
+ * sealed segments are written that way, the active db never has it */
+#define DB_FLAG_COMPACT_RECORDS (1 << 8)
 
 #define UPDATE_NONE 0x00
 #define UPDATE_FILESIZE (1 << 0)      /* sets the filesize to the new value */
@@ -30,6 +58,7 @@
 #define UPDATE_FILESIZE_ADD (1 << 4)  /* if set then filesize will be added to the current value */
 #define UPDATE_ENTRIES_COUNT_ADD (1 << 5)  /* if set adds the provided value to the count */
 #define UPDATE_ENTRIES_COUNT_INCR (1 << 6) /* if set increments the entries count by 1 */
+#define UPDATE_FLAGS (1 << 7) /* sets the feature flags, also bumps the version */
 #define UPDATE_ALL 0xFF
 
 typedef struct {
@@ -39,8 +68,13 @@ typedef struct {
 
   uint64_t _last_entry_id;
   uint32_t _entries;
+  uint32_t _flags; /* DB_FEATURE_*, this used to be padding so old dbs read 0 */
 } db_header_t;
 
+/* `db_header_encode` and `db_header_decode`, see schema.h */
+SCHEMA_CODEC(db_header, DB_HEADER_FIELDS, db_header_t, db_header_layout_t)
+_Static_assert(sizeof(db_header_t) == DB_HEADER_SIZE, "db_header_t must be the header on disk");
+
 /* validates if the db file already exists */
 int validate_db_exists(int *);
 
@@ -54,6 +88,15 @@ int read_header(int, db_header_t *);
  * Utils
  *----------------------------------------------------------------*/
 
+/* resolves the db path into `out`, if suffix is provided it is appended to
+ * the path, this is how sidecar files (eg. `~/.todo.db.stats`) are located */
+int db_resolve_path(const char *, char *, size_t);
+
+/* makes the calling thread use the db at the given path (`--db`) instead
+ * of DEFAULT_DB_PATH, NULL goes back to the default. The path is used as
+ * is and must outlive its use, its sidecars sit next to it */
+void db_use_path(const char *);
+
 /* gets the last entry that was created from the header */
 int get_last_entry(uint64_t *);
 
@@ -62,10 +105,10 @@ int get_last_entry(uint64_t *);
  *
  * Observe the `db_header_t` struct above we have the following:
  *
- * |  MAGIC  |  VERSION  |  FILE_SIZE  | _LAST_ENTRY_ID  | _ENTRIES |
- *   8 bytes    4 bytes     4 bytes         8 bytes         4 bytes
+ * |  MAGIC  |  VERSION  |  FILE_SIZE  | _LAST_ENTRY_ID  | _ENTRIES |  _FLAGS  |
+ *   8 bytes    4 bytes     4 bytes         8 bytes         4 bytes    4 bytes
  *
- * The file will have the first 28 bytes as header always! The only
+ * The file will have the first 32 bytes as header always! The only
  * problem we have is that we need to update the 4 bytes in the end
  * to contain the updated id. This function does exactly that.
  *
@@ -79,6 +122,12 @@ int get_last_entry(uint64_t *);
  */
 int __UNSAFE__update_db_header(int, const db_header_t *, int);
 
+/* returns the DB_FEATURE_* bit for a feature name or 0 if unknown */
+int db_feature_from_name(const char *);
+
+/* returns the name of a single DB_FEATURE_* bit */
+const char *db_feature_name(int);
+
 /*----------------------------------------------------------------
  * DB OPS
  *----------------------------------------------------------------*/
@@ -86,4 +135,37 @@ int __UNSAFE__update_db_header(int, const db_header_t *, int);
 /* writes a buffer to the disk */
 int write_to_db(char *, size_t);
 
+/* writes a complete db file (header followed by the encoded entries)
+ *
+ * The file is written as `<path>.tmp`, synced and then renamed over the
+ * path so a crash leaves either the old or the new file behind, never a
+ * mix. The header is taken from the provided one, filesize is computed. */
+int write_db_file(const char *, const db_header_t *, const char *, size_t);
+
+/* replaces the db with a fresh file holding the given encoded entries */
+int rewrite_db(const db_header_t *, const char *, size_t);
+
+/* opens the db and takes an exclusive lock on it, anything that appends
+ * to or rewrites the db holds this lock. A tail left by a crashed writer
+ * is recovered first (see recover.h). Taking it again while holding it
+ * hands out the same descriptor, every take is released with `db_unlock` */
+int db_lock(int *);
+
+/* takes the lock like `db_lock` but leaves the tail alone, for `fsck` */
+int db_lock_raw(int *);
+
+int db_unlock(int);
+
+/* the header fields that describe the entries (filesize, last entry id and
+ * count) sit next to each other and are written with a single 16 byte
+ * `pwrite`, so a crash leaves either the old or the new values and never a
+ * mix. FILESIZE is where the last committed entry ends, anything after it
+ * was appended by a writer that did not get to commit */
+int db_commit_header(int, const db_header_t *);
+
+/* appends the bytes at the end of the db and commits the header in one
+ * batch of writes that reach the file in that order, with io_uring it is a
+ * single submission (see storage.h). The caller holds the lock */
+int db_append_commit(int, const struct iovec *, int, const db_header_t *);
+
 #endif // TODOCTL_DB_H
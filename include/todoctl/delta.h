@@ -0,0 +1,81 @@
+/*
+ * delta.h -- TodoCtl status delta log
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_DELTA_H
+#define TODOCTL_DELTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "todoctl/entry.h"
+
+#define DELTA_SUFFIX ".log"
+
+/* every delta on disk looks like
+ *
+ * | KIND  | ENTRY_ID | TIMESTAMP |
+ * |1 byte | 8 bytes  |  8 bytes  |
+ *
+ * The log is only ever appended to with a single write per delta, if we
+ * crash mid write the log ends with less than DELTA_RECORD_SIZE bytes.
+ * Readers skip such a torn delta and the next append cuts it off first,
+ * deltas written after it would be read out of step otherwise. */
+#define DELTA_RECORD_SIZE 17
+
+typedef enum {
+  DELTA_DONE = 1,
+  DELTA_UNDONE = 2,
+  DELTA_DELETE = 3,
+} delta_kind_t;
+
+#define DELTA_SET_DONE (1 << 0)
+#define DELTA_SET_DELETED (1 << 1)
+
+typedef struct {
+  uint64_t entry_id; /* 0 marks an empty slot, ids start at 1 */
+  uint64_t done_at;
+  uint64_t deleted_at;
+  uint8_t mask; /* DELTA_SET_*, which of the above override the base entry */
+} delta_slot_t;
+
+/* folded view of the log, an open addressing table keyed by entry id so
+ * merging a delta into an entry during a scan is a single probe */
+typedef struct {
+  delta_slot_t *slots;
+  size_t cap; /* always a power of two */
+  size_t len;
+} delta_map_t;
+
+/* appends a single delta to the log, the caller holds the db lock */
+int delta_append(delta_kind_t, uint64_t, uint64_t);
+
+/* finds a torn delta at the end of the log and, with `repair`, cuts it
+ * off. Sets the bytes it is long, 0 when the log is whole or missing */
+int delta_repair(bool, uint64_t *);
+
+/* decodes a single delta from the buffer which must hold DELTA_RECORD_SIZE bytes */
+int delta_decode(const char *, delta_kind_t *, uint64_t *, uint64_t *);
+
+/* reads the whole log and folds it into the map, a missing log is empty */
+int delta_map_load(delta_map_t *);
+
+/* folds a single delta into the map */
+int delta_map_put(delta_map_t *, delta_kind_t, uint64_t, uint64_t);
+
+/* overrides the status of the entry with whatever the log says */
+void delta_map_apply(const delta_map_t *, todo_entry_t *);
+
+void delta_map_free(delta_map_t *);
+
+/* applies a delta to a decoded entry, returns 1 when nothing changes */
+int delta_apply_to_entry(delta_kind_t, uint64_t, todo_entry_t *);
+
+/* empties the log, only safe once every delta is folded into the db */
+int delta_truncate(void);
+
+#endif // TODOCTL_DELTA_H
@@ -0,0 +1,39 @@
+/*
+ * dict.h -- TodoCtl interned text dictionary
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_DICT_H
+#define TODOCTL_DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DICT_SUFFIX ".dict"
+#define DICT_HEADER_SIZE 12
+
+/* with the `intern` feature every text is stored once in `~/.todo.db.dict`
+ * and entries only carry its id, the offset of its record
+ *
+ * | LENGTH |  HASH  | TEXT  |
+ * |4 bytes |8 bytes |N bytes|
+ *
+ * HASH is the hash of the text, the index used for interning is rebuilt
+ * from the record headers alone. The file is append only and read through
+ * a mapping that lives as long as the process, so resolving a text is a
+ * lookup in memory instead of a read */
+
+/* returns the id of the text, appending it if it is not in there yet.
+ * Callers hold the db lock so appends never interleave */
+int dict_intern(const char *, size_t, uint64_t *);
+
+/* points `text` at the text with the id inside the mapping, it is not NUL
+ * terminated and stays valid until a later lookup grows the mapping */
+int dict_lookup(uint64_t, const char **, size_t *);
+
+/* drops the mapping and the index of the calling thread */
+void dict_close(void);
+
+#endif // TODOCTL_DICT_H
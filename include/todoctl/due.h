@@ -0,0 +1,71 @@
+/*
+ * due.h -- TodoCtl due dates
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_DUE_H
+#define TODOCTL_DUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "todoctl/entry.h"
+
+#define DUE_SUFFIX ".due"
+#define DUE_MAGIC 0x4e4e44
+#define DUE_VERSION 1
+#define DUE_HEADER_SIZE 24
+#define DUE_RECORD_SIZE 17
+#define DUE_MAX_RUNS 8 /* one more append merges the runs into one */
+
+#define DUE_DEFAULT_WITHIN (24ULL * 60 * 60 * 1000)
+
+#define DUE_OPEN 1   /* neither done nor deleted */
+#define DUE_CLOSED 0 /* done or deleted, kept so undone can open it again */
+
+/* the due dates of tasks, kept next to the db in `~/.todo.db.due` as
+ * sorted runs keyed by due time
+ *
+ * |  MAGIC  | VERSION |  RUNS   | LENGTH  |
+ * | 8 bytes | 4 bytes | 4 bytes | 8 bytes |
+ *
+ * followed by RUNS runs, each a count and that many records in (due, id)
+ * order
+ *
+ * |  COUNT  | per record: DUE 8 | ID 8 | STATE 1 |
+ * | 4 bytes |
+ *
+ * A change is a run of its own appended after LENGTH, updating RUNS and
+ * LENGTH is what commits it, whatever lies past LENGTH is the leftover of
+ * a crash and gets overwritten. For a (due, id) the record in the newest
+ * run wins, done, undone and delete append the new state of the task.
+ * Past DUE_MAX_RUNS the runs are merged into one that replaces the file
+ * through a rename. A range of due times is a binary search in each run
+ * and a read of the records inside it, nothing else is touched. Writers
+ * hold the db lock. */
+typedef struct {
+  uint64_t due_at;
+  uint64_t entry_id;
+} due_hit_t;
+
+/* parses a due time: `YYYY-MM-DD` (local midnight), `YYYY-MM-DD HH:MM` or
+ * a duration from now like `90m`, `24h`, `3d` or `2w` */
+int due_parse(const char *, uint64_t, uint64_t *);
+
+/* parses a duration (`90m`, `24h`, `3d`, `2w`) into millis */
+int due_parse_duration(const char *, uint64_t *);
+
+/* records the due time of a freshly added task */
+int due_record_add(uint64_t, uint64_t);
+
+/* records the new state of a task after done, undone or delete, tasks
+ * without a due time are left alone */
+int due_record_change(const todo_entry_t *);
+
+/* the open tasks due in [from, to), in due order */
+int due_range(uint64_t, uint64_t, due_hit_t **, size_t *);
+
+#endif // TODOCTL_DUE_H
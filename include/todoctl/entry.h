@@ -8,6 +8,7 @@
 #ifndef TODOCTL_ENTRY_H
 #define TODOCTL_ENTRY_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,28 +16,38 @@
 #include <time.h>
 
 #include "todoctl/db.h"
+#include "todoctl/util.h"
 
-#ifndef htonll
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-#define htonll(x) ((uint64_t)htonl((x) & 0xFFFFFFFF) << 32) | htonl((x) >> 32)
-#define ntohll(x) ((uint64_t)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32)
-#else
-#define htonll(x) (x)
-#define ntohll(x) (x)
-#endif
-#endif
-
-#define ENTRY_FIXED_SIZE (sizeof(uint64_t) * 4) // id + created + deleted + done = 32 bytes
+/* the fields between LENGTH and DATA_LEN, see ENTRY_FIELDS in schema.h */
+#define ENTRY_FIXED_SIZE (ENTRY_OFFSET(DATA_LEN) - ENTRY_OFFSET(ID))
 
 #define MAX_TODO_TEXT_LENGTH 4096
 #define TEXT_LENGTH_PREFIX sizeof(uint32_t) // 4 bytes
 
+/* length prefix + fixed fields + data length, everything before the text */
+#define ENTRY_HEADER_SIZE sizeof(entry_layout_t)
+
+/* position of `deleted_at` and `done_at` relative to the start of an encoded entry */
+#define ENTRY_DELETED_AT_OFFSET ENTRY_OFFSET(DELETED_AT)
+#define ENTRY_DONE_AT_OFFSET ENTRY_OFFSET(DONE_AT)
+
+/* texts longer than MAX_TODO_TEXT_LENGTH live in the blob file, the entry
+ * only carries a reference to them, marked by this bit in DATA_LEN */
+#define ENTRY_BLOB_REF (1U << 31)
+#define ENTRY_BLOB_REF_SIZE sizeof(entry_blob_ref_layout_t) /* offset + length */
+
+/* interned texts live in the text dictionary (see dict.h), DATA_LEN has
+ * this bit set and the entry carries the 8 byte id of the text */
+#define ENTRY_DICT_REF (1U << 30)
+#define ENTRY_DICT_REF_SIZE sizeof(entry_dict_ref_layout_t)
+
 /* total = 24 + 4 + 4096 = 4124 bytes */
 #define ENCODED_ENTRY_MAX_SIZE (ENTRY_FIXED_SIZE + TEXT_LENGTH_PREFIX + MAX_TODO_TEXT_LENGTH)
 
 #define PRINT_ALL 0x00
 #define PRINT_EXCEPT_DELETED (1 << 0) /* print all except deleted */
 #define PRINT_ONLY_ACTIVE (1 << 1)    /* print only currently active entries */
+#define PRINT_WITH_ARCHIVE (1 << 2)   /* archived tasks are listed too */
 
 typedef struct {
   uint64_t entry_id;
@@ -47,11 +58,32 @@ typedef struct {
   uint64_t _deleted_at; /* a background thread will clean this up, 0 means not
                            deleted */
   uint64_t _done_at;
+
+  /* the text lives in the blob file at this offset, `entry_raw_data` stays
+   * NULL until `entry_load_text` is called */
+  bool _in_blob;
+  uint64_t _blob_offset;
+
+  /* the text is the one with this id in the text dictionary, decoding
+   * resolves it so `entry_raw_data` is always there */
+  bool _interned;
+  uint64_t _text_id;
 } todo_entry_t;
 
+/* `entry_fields_encode` and `entry_fields_decode` move the ENTRY_FIELDS of
+ * an entry at the start of the buffer, see schema.h */
+SCHEMA_CODEC(entry_fields, ENTRY_FIELDS, todo_entry_t, entry_layout_t)
+
+/* and the references standing in for the text of blob and interned entries */
+SCHEMA_CODEC(entry_blob_ref, ENTRY_BLOB_REF_FIELDS, todo_entry_t, entry_blob_ref_layout_t)
+SCHEMA_CODEC(entry_dict_ref, ENTRY_DICT_REF_FIELDS, todo_entry_t, entry_dict_ref_layout_t)
+
 /* builds a new todo entry */
 int build_entry(const char *, todo_entry_t **);
 
+/* fills in a new entry that borrows the text instead of copying it */
+int init_entry(const char *, size_t, todo_entry_t *);
+
 /* converts an entry into its binary encoded form
  * encodes this entry to be written directly into the file
  * on a disk this is how an entry looks like
@@ -63,24 +95,144 @@ int build_entry(const char *, todo_entry_t **);
  * ^       ^
  * |  TLP  |                                      ^                 ^
  *                                                |  MAX TTLength   |
+ *
+ * For entries in the blob file DATA_LEN has ENTRY_BLOB_REF set and RAW_DATA
+ * is the 8 byte offset of the blob followed by the 8 byte text length.
+ * Interned entries have ENTRY_DICT_REF set and RAW_DATA is the text id.
  */
 int encode_entry(const todo_entry_t *, char *, size_t, size_t *);
 
-/* does what it says :) */
+/* size of the entry once encoded */
+size_t entry_encoded_size(const todo_entry_t *);
+
+/* appends an entry to the end of the db with a single `writev` straight
+ * from the text of the entry. Texts over MAX_TODO_TEXT_LENGTH go to the
+ * blob file first and the entry is updated to reference them. `written`
+ * receives the bytes appended to the db */
+int append_entry(int, todo_entry_t *, size_t *);
+
+/* moves a text over MAX_TODO_TEXT_LENGTH to the blob file and makes the
+ * entry reference it, a no-op for every other entry */
+int entry_spill_text(todo_entry_t *);
+
+/* appends the entry and commits the header given (see `db_append_commit`)
+ * in one batch, its counts already have to include the entry. Spill the
+ * text first, the encoded size depends on it */
+int append_entry_commit(int, todo_entry_t *, const db_header_t *);
+
+/* reads the text of an entry that lives in the blob file, a no-op for
+ * entries that already have their text */
+int entry_load_text(todo_entry_t *);
+
+/* stores the text of a new entry in the text dictionary and makes the
+ * entry reference it, texts that go to the blob file are left alone */
+int entry_intern(todo_entry_t *);
+
+/* encodes all the entries back to back into a freshly allocated buffer */
+int encode_entries(todo_entry_t **, size_t, char **, size_t *);
+
+/* files with DB_FLAG_COMPACT_RECORDS drop the fixed width fields, every
+ * entry is encoded relative to the one before it
+ *
+ * | FLAGS | ENTRY_ID | CREATED_AT | DELETED_AT | DONE_AT | DATA_LEN | RAW_DATA |
+ * |1 byte |  varint  |   varint   |  varint?   | varint? |  varint  | N bytes  |
+ *
+ * ENTRY_ID is the gap to the previous id and CREATED_AT the zigzagged
+ * difference to the previous creation time, the first entry of a file is
+ * relative to 0. DELETED_AT and DONE_AT are only there when their flag is
+ * set and count from CREATED_AT. For blob texts RAW_DATA is the blob offset
+ * and text length as two varints and there is no DATA_LEN, for interned
+ * texts it is the text id as a varint and there is no DATA_LEN. A short task
+ * spends 6 to 10 bytes on metadata instead of 40 */
+#define ENTRY_COMPACT_DELETED (1 << 0)
+#define ENTRY_COMPACT_DONE (1 << 1)
+#define ENTRY_COMPACT_BLOB (1 << 2)
+#define ENTRY_COMPACT_DICT (1 << 3)
+#define ENTRY_COMPACT_FLAGS                                                                        \
+  (ENTRY_COMPACT_DELETED | ENTRY_COMPACT_DONE | ENTRY_COMPACT_BLOB | ENTRY_COMPACT_DICT)
+#define ENTRY_COMPACT_MAX_OVERHEAD (1 + VARINT_MAX_LEN * 5)
+
+/* what a compact entry is relative to, plus which encoding the file uses */
+typedef struct {
+  bool compact;
+  uint64_t prev_id;
+  uint64_t prev_created;
+} entry_codec_t;
+
+/* starts decoding (or encoding) the entries of a file with the header */
+void entry_codec_init(entry_codec_t *, const db_header_t *);
+
+/* encodes the entry in the compact form and advances the codec */
+int encode_entry_compact(const todo_entry_t *, entry_codec_t *, char *, size_t, size_t *);
+
+/* encodes all the entries compactly back to back into a freshly allocated
+ * buffer */
+int encode_entries_compact(todo_entry_t **, size_t, char **, size_t *);
+
+/* decodes the next compact entry like `decode_entry_view` does, the codec
+ * only advances once a whole entry was there */
+int decode_entry_compact(const char *, size_t, entry_codec_t *, todo_entry_t *, size_t *);
+
+/* decodes the next entry of a file in whichever encoding it uses */
+int entry_codec_next(entry_codec_t *, const char *, size_t, todo_entry_t *, size_t *);
+
+#define ENTRY_SCAN_CHUNK (256 * 1024)
+
+/* walks the entries of an open db file through big reads instead of a few
+ * small reads per entry. Every entry is handed to the callback as a view
+ * into the read buffer (see `decode_entry_view`), a callback returning
+ * anything but 0 stops the walk and that is returned */
+int entry_scan(int, const db_header_t *, int (*)(void *, todo_entry_t *), void *);
+
+/* decodes a single entry encoded by `encode_entry` from the buffer, the
+ * text is copied into a freshly allocated `entry_raw_data`. On success
+ * `consumed` holds the encoded size, if the buffer ends before the entry
+ * does TODOCTL_ERR_INCOMPLETE_ENTRY is returned and nothing is allocated */
+int decode_entry(const char *, size_t, todo_entry_t *, size_t *);
+
+/* decodes the fixed fields of an entry and checks its lengths without
+ * touching the blob file or the dictionary, interned entries come back
+ * without their text. Safe to call from several threads at once */
+int entry_validate(const char *, size_t, todo_entry_t *, size_t *);
+
+/* like `decode_entry` but nothing is copied, `entry_raw_data` points into
+ * the buffer and is not NUL terminated (NULL for texts in the blob file).
+ * The entry is only valid for as long as the buffer is */
+int decode_entry_view(const char *, size_t, todo_entry_t *, size_t *);
+
+/* does what it says :) texts in the blob file are streamed out */
 int print_entry(const todo_entry_t *);
 
 /* prints multiple entries */
 int print_entries(const todo_entry_t **, size_t, int);
 
+/* prints multiple entries in one of the OUTPUT_* formats through the
+ * buffered writer, see output.h */
+int print_entries_as(const todo_entry_t **, size_t, int, int);
+
 /* reads entries from the database, if stopat is provided then the return value is
- * the amount of bytes read, otherwise return 0 or -1 */
+ * the amount of bytes read, otherwise return 0 or -1. When the db has the delta
+ * log enabled the logged status changes are merged into the returned entries */
 int read_entries_from_db(int, const db_header_t *, todo_entry_t **, size_t *, uint64_t *);
 
 /* mark an entry done by updating its done at timestamp
  *
  * We'll loop over entries and sequentially find one entry that matches
  * the provided entry id. Once we have that we'll use `lseek` to set our
- * cursor at the right position and update with the entry_id */
-int update_entry_done(int, const db_header_t *, const uint64_t);
+ * cursor at the right position and update with the entry_id
+ *
+ * If `out` is provided it receives the fixed fields of the entry after the
+ * update (the text is not copied). An entry that is already done keeps its
+ * original timestamp and 1 is returned instead of 0. */
+int update_entry_done(int, const db_header_t *, const uint64_t, todo_entry_t *);
+
+/* applies a status change (see `delta_kind_t`) to an entry
+ *
+ * Without DB_FEATURE_DELTA_LOG the timestamp is overwritten in place just
+ * like `update_entry_done`, with it the change is appended to the delta log.
+ * `before` and `after` receive the fixed fields around the change, 1 is
+ * returned when the entry already is in the requested state. */
+int update_entry_status(int, const db_header_t *, const uint64_t, int, todo_entry_t *,
+                        todo_entry_t *);
 
 #endif // TODOCTL_ENTRY_H
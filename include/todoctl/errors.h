@@ -15,3 +15,8 @@
 
 #define TODOCTL_ERR_BUFFER_TOO_SMALL -15
 #define TODOCTL_ERR_TODO_TOO_LONG -16
+#define TODOCTL_ERR_ENTRY_NOT_FOUND -17
+#define TODOCTL_ERR_STATS_MISMATCH -18
+#define TODOCTL_ERR_INCOMPLETE_ENTRY -19
+#define TODOCTL_ERR_INVALID_QUERY -20
+#define TODOCTL_ERR_INVALID_TAG -21
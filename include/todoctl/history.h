@@ -0,0 +1,82 @@
+/*
+ * history.h -- TodoCtl status history
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_HISTORY_H
+#define TODOCTL_HISTORY_H
+
+#include <stdint.h>
+
+#include "todoctl/bitmap.h"
+#include "todoctl/entry.h"
+
+#define HISTORY_SUFFIX ".history"
+#define HISTORY_MAGIC 0x4e4e48
+#define HISTORY_VERSION 1
+#define HISTORY_HEADER_SIZE 32
+#define HISTORY_EVENT_SIZE 17
+#define HISTORY_CHECKPOINT_HEAD 21
+#define HISTORY_CHECKPOINT_MIN 256 /* events between two checkpoints at least */
+
+typedef enum {
+  HISTORY_ADD = 1,
+  HISTORY_DONE = 2,
+  HISTORY_UNDONE = 3,
+  HISTORY_DELETE = 4,
+  HISTORY_CHECKPOINT = 5,
+} history_kind_t;
+
+/* every add, done, undone and delete with its time, kept next to the db in
+ * `~/.todo.db.history`
+ *
+ * |  MAGIC  | VERSION | PENDING |  LENGTH | CHECKPOINT |
+ * | 8 bytes | 4 bytes | 4 bytes | 8 bytes |  8 bytes   |
+ *
+ * followed by the events in the order they happened
+ *
+ * |  KIND  |   ID    |   AT    |
+ * | 1 byte | 8 bytes | 8 bytes |
+ *
+ * and every so often a checkpoint, the state after all the events before
+ * it as the ids of every task, the done ones and the deleted ones
+ *
+ * |  KIND  |  PREV   |   AT    |   LEN   | ALL | DONE | DELETED |
+ * | 1 byte | 8 bytes | 8 bytes | 4 bytes |    LEN bytes of bitmaps   |
+ *
+ * CHECKPOINT is the offset of the newest one and PREV of the one before,
+ * PENDING counts the events after the newest. The next checkpoint is
+ * written once those events take as many bytes as the newest did, so the
+ * file stays within a small multiple of the events. The state at a time
+ * starts from the last checkpoint before it and replays only the events up
+ * to it. Writes land past LENGTH and updating the header commits them,
+ * writers hold the db lock. Enabling the feature writes the history the
+ * timestamps of the entries tell, undone only shows up from then on. */
+typedef struct {
+  bitmap_t all;
+  bitmap_t done;
+  bitmap_t deleted; /* deleted tasks can be done too */
+} history_state_t;
+
+/* parses a point in time: `YYYY-MM-DD` (local midnight), `YYYY-MM-DD HH:MM`
+ * or a duration ago like `90m`, `24h`, `3d` or `2w` */
+int history_parse_time(const char *, uint64_t, uint64_t *);
+
+/* records a freshly added task */
+int history_record_add(const todo_entry_t *);
+
+/* records what done, undone or delete did to a task, given the entry
+ * before and after */
+int history_record_change(const todo_entry_t *, const todo_entry_t *);
+
+/* rewrites the history from a scan of the db and the archive */
+int history_rebuild(void);
+
+/* the state at a time, a missing history is an empty one */
+int history_state_at(uint64_t, history_state_t *);
+
+void history_state_free(history_state_t *);
+
+#endif // TODOCTL_HISTORY_H
@@ -0,0 +1,47 @@
+/*
+ * merge.h -- TodoCtl merging of two dbs
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_MERGE_H
+#define TODOCTL_MERGE_H
+
+#include <stdint.h>
+
+#include "todoctl/db.h"
+
+#define MERGE_CHUNK (64 * 1024)  /* read buffer of every run */
+#define MERGE_BATCH (256 * 1024) /* appended and committed at once */
+
+/* entries or texts outside the db file, or records the active db never has */
+#define MERGE_UNSUPPORTED                                                                          \
+  (DB_FEATURE_DELTA_LOG | DB_FEATURE_SEGMENTS | DB_FEATURE_BLOBS | DB_FEATURE_INTERN |             \
+   DB_FLAG_COMPACT_RECORDS)
+
+typedef struct {
+  uint32_t local;      /* entries the db had */
+  uint32_t added;      /* entries of the other db that were not in it */
+  uint32_t remapped;   /* of those, the ones given a new id */
+  uint32_t duplicates; /* entries of the other db that were in it already */
+  uint32_t updated;    /* duplicates done or deleted only on the other side */
+  uint32_t runs;       /* sorted runs read from both dbs */
+} merge_report_t;
+
+/* merges another db file into the active db. Entries are appended in
+ * `_created_at` order, so a db is a few runs sorted by it: the tasks added
+ * here and, after every merge, the tasks it brought in. A first scan finds
+ * the runs of both files and a second walks all of them at once, a chunk
+ * per run, always taking the oldest head. An entry of the other db meeting
+ * one of the db with the same creation time, text checksum and text is the
+ * same task and is kept once, a done or delete only on the other side is
+ * written over the entry in place. Every other entry is appended, in
+ * batches committed like an add, so an interrupted merge simply picks up
+ * where it stopped when run again. Ids of the db never change, an entry of
+ * the other db keeps its id unless the db may have handed it out already
+ * and gets the next free one otherwise. The caller holds the db lock, the
+ * indexes are left to it. */
+int db_merge(int, const char *, merge_report_t *);
+
+#endif // TODOCTL_MERGE_H
@@ -0,0 +1,37 @@
+/*
+ * multi.h -- TodoCtl queries across several dbs
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_MULTI_H
+#define TODOCTL_MULTI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "todoctl/entry.h"
+#include "todoctl/query.h"
+
+#define MULTI_MAX_THREADS 8
+#define MULTI_DB_SUFFIX ".db" /* what counts as a db when `--db` names a directory */
+
+/* adds the dbs named by one `--db` argument to the list: a comma separated
+ * list of files, a directory stands for every `*.db` file in it in name
+ * order. Files do not have to exist yet */
+int multi_add_paths(const char *, char ***, size_t *);
+
+void multi_free_paths(char **, size_t);
+
+/* reads the tasks matching a query out of every db. The dbs are handed out
+ * to a pool of threads, each runs the normal read path (segments, delta
+ * log, the filter and a top-k heap) against its db, see `db_use_path`.
+ * Every db comes back sorted and the results are merged into a single
+ * list in the order given, created time when there is none. With a top
+ * only that many are kept, with `archive` archived tasks are read too.
+ * Free with `db_free_entries` */
+int multi_read_entries(char *const *, size_t, const char *, bool, const query_order_t *,
+                       todo_entry_t ***, size_t *);
+
+#endif // TODOCTL_MULTI_H
@@ -0,0 +1,67 @@
+/*
+ * output.h -- TodoCtl buffered output writer
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_OUTPUT_H
+#define TODOCTL_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "todoctl/entry.h"
+
+#define OUTPUT_PLAIN 0 /* `<id>: <text>`, what -l always printed */
+#define OUTPUT_TSV 1   /* id, created_at, done_at, deleted_at, text with \t \n \\ escaped */
+#define OUTPUT_JSON 2  /* a single array of objects */
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define OUTPUT_IOV_MAX 64
+#define OUTPUT_ZERO_COPY_MIN 256 /* texts this long are not copied into the buffer */
+
+/* writes entries to a file descriptor
+ *
+ * Everything small (ids, timestamps, separators, escaped texts) is
+ * formatted by hand into one big buffer. Texts that need no escaping and
+ * are long enough are not copied, they go out as their own iovec pointing
+ * at the entry so a flush is a single `writev` of buffer pieces and texts.
+ * The entries handed in therefore must stay alive until the next flush,
+ * `output_end` flushes. Texts still in the blob file are streamed through
+ * the buffer. */
+typedef struct {
+  int fd;
+  int format;
+  size_t count; /* entries written so far */
+  int error;
+
+  char *buf;
+  size_t len;
+  size_t mark; /* start of the buffer bytes that are not in `iov` yet */
+
+  struct iovec iov[OUTPUT_IOV_MAX];
+  int iovcnt;
+} output_t;
+
+/* returns the OUTPUT_* for a name (plain, tsv, json) or -1 */
+int output_format_from_name(const char *);
+
+/* sets up a writer, anything pending on stdout should be flushed first */
+int output_open(output_t *, int, int);
+
+/* writes whatever the format needs before the first entry */
+int output_begin(output_t *);
+
+int output_entry(output_t *, const todo_entry_t *);
+
+/* writes whatever the format needs after the last entry and flushes */
+int output_end(output_t *);
+
+/* writes out everything pending */
+int output_flush(output_t *);
+
+void output_close(output_t *);
+
+#endif // TODOCTL_OUTPUT_H
@@ -0,0 +1,79 @@
+/*
+ * perf.h -- TodoCtl latency telemetry
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_PERF_H
+#define TODOCTL_PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PERF_SUFFIX ".perf"
+#define PERF_MAGIC 0x4e4e50
+#define PERF_VERSION 1
+
+#define PERF_COMMANDS 32 /* distinct command names kept */
+#define PERF_DAYS 64     /* the ring, one slot per local day */
+#define PERF_SUB_BITS 3  /* every power of two is split into 8 buckets */
+#define PERF_SUB_BUCKETS (1 << PERF_SUB_BITS)
+#define PERF_OCTAVES 28 /* microseconds up to 2^28, about four and a half minutes */
+#define PERF_BUCKETS (PERF_OCTAVES * PERF_SUB_BUCKETS)
+#define PERF_NAME_MAX 15
+
+#define PERF_DEFAULT_DAYS 14
+#define PERF_RESETTING (1ULL << 63) /* a day slot being cleared for a new day */
+
+/* the wall time of every run, kept next to the db in `~/.todo.db.perf`.
+ * The file has a fixed size and layout, it is mapped shared and every
+ * process adds its run with atomic operations, nothing is locked and
+ * nothing is appended. It is in host byte order, a foreign magic makes
+ * it unreadable rather than wrong. Every command gets a slot found by a
+ * hash of its name, claimed with a compare and swap, and every slot a
+ * ring of PERF_DAYS days, each an HDR style histogram: values below
+ * PERF_SUB_BUCKETS microseconds have a bucket each, every power of two
+ * above is split into PERF_SUB_BUCKETS, so a percentile is off by at most
+ * an eighth. Next to it a day keeps the size of the db and its entry count
+ * as the last run saw them, to see latency against growth. The first run
+ * on a new day clears the slot it wraps onto, a run racing that clear
+ * drops its sample. Only recorded with the `perf` feature on. */
+typedef struct {
+  uint64_t day; /* local days since the epoch, PERF_RESETTING while cleared */
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint64_t db_bytes; /* of the active db */
+  uint64_t entries;  /* in the active db */
+  uint32_t buckets[PERF_BUCKETS];
+} perf_day_t;
+
+typedef struct {
+  uint64_t key; /* a hash of the name, 0 for a free slot */
+  char name[PERF_NAME_MAX + 1];
+  perf_day_t days[PERF_DAYS];
+} perf_command_t;
+
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t commands; /* PERF_COMMANDS */
+  perf_command_t slots[PERF_COMMANDS];
+} perf_ring_t;
+
+/* starts the clock, called first thing */
+void perf_start(void);
+
+/* names the run, a named run is recorded when the process exits */
+int perf_command(const char *);
+
+/* adds a run of `us` microseconds of a command against a db of that many
+ * bytes and entries */
+int perf_record(const char *, uint64_t, uint64_t, uint64_t);
+
+/* prints p50, p99 and max per day of the last `days` days, for one
+ * command or (NULL) all of them */
+int perf_print(FILE *, const char *, uint32_t);
+
+#endif // TODOCTL_PERF_H
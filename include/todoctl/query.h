@@ -0,0 +1,171 @@
+/*
+ * query.h -- TodoCtl query language
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_QUERY_H
+#define TODOCTL_QUERY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "todoctl/bitmap.h"
+#include "todoctl/db.h"
+#include "todoctl/entry.h"
+
+#define QUERY_MAX_PREDICATES 16
+
+/* a query is a list of predicates joined by `and`
+ *
+ *   done=false and created>2026-10-01 and text~deploy
+ *
+ *   id        = != < <= > >=   a number
+ *   created   = != < <= > >=   a date (YYYY-MM-DD, local midnight) or millis
+ *   done      = != < <= > >=   true/false or a date/millis compared to done_at
+ *   deleted   = != < <= > >=   same as done against deleted_at
+ *   text      ~                case insensitive substring, quote values with spaces
+ *   word      =                a whole word, lets sealed segment filters skip
+ *   tag       = !=             a tag, see tags.h
+ *
+ * Compiling splits the predicates in two. Metadata predicates run on the
+ * fixed fields straight out of the read buffer, only records that pass
+ * them get their text copied (or loaded from the blob file) and checked
+ * against the text predicates. Bounds on id and created are collected so
+ * whole segments can be skipped through the manifest. Tag predicates are
+ * answered by the tag index before the read, together with done and
+ * deleted true/false they become the set of ids that can match: records
+ * outside of it are dropped on their id and segments without one of them
+ * are never opened. */
+typedef enum {
+  QUERY_FIELD_ID,
+  QUERY_FIELD_CREATED,
+  QUERY_FIELD_DONE,
+  QUERY_FIELD_DELETED,
+  QUERY_FIELD_TEXT,
+  QUERY_FIELD_WORD,
+  QUERY_FIELD_TAG,
+} query_field_t;
+
+typedef enum {
+  QUERY_OP_EQ,
+  QUERY_OP_NE,
+  QUERY_OP_LT,
+  QUERY_OP_LE,
+  QUERY_OP_GT,
+  QUERY_OP_GE,
+  QUERY_OP_CONTAINS,
+} query_op_t;
+
+typedef struct {
+  query_field_t field;
+  query_op_t op;
+  uint64_t value;
+  char *text; /* lowercased, for text, word and tag */
+  size_t text_len;
+} query_pred_t;
+
+/* the order results come out in, only id, created and done sort. With a
+ * `top` only that many entries are ever held: matches are kept in a heap
+ * with the one that ranks last on top and a record that can not beat it is
+ * dropped on its fixed fields before its text is even looked at. Sorting
+ * by done only considers tasks that are done */
+typedef struct {
+  query_field_t field;
+  bool desc;
+  size_t top; /* 0 keeps every match */
+} query_order_t;
+
+/* the fixed fields of a record, what metadata predicates look at */
+typedef struct {
+  uint64_t entry_id;
+  uint64_t created_at;
+  uint64_t deleted_at;
+  uint64_t done_at;
+} query_record_t;
+
+typedef struct {
+  query_pred_t meta[QUERY_MAX_PREDICATES];
+  size_t n_meta;
+  query_pred_t text[QUERY_MAX_PREDICATES];
+  size_t n_text;
+  query_pred_t tags[QUERY_MAX_PREDICATES];
+  size_t n_tags;
+
+  /* bounds pushed down to the manifest, zero for a max means unbounded */
+  uint64_t min_id;
+  uint64_t max_id;
+  uint64_t min_created;
+  uint64_t max_created;
+  const char *word;     /* first `word` predicate, probed in segment filters */
+  bool empty;           /* the bounds contradict each other, nothing can match */
+  bitmap_t *candidates; /* the ids the tag index allows, NULL until resolved */
+
+  query_order_t order;
+  bool ordered; /* matches are collected as a heap, see `query_sort` */
+  bool archive; /* archived tasks are read too, see archive.h */
+
+  /* what the last runs did */
+  uint64_t scanned;
+  uint64_t rejected_meta;
+  uint64_t rejected_text;
+  uint64_t rejected_top;
+  uint64_t rejected_index;
+} query_t;
+
+/* compiles the query, on a syntax error a message is written to `err` and
+ * TODOCTL_ERR_INVALID_QUERY is returned. NULL or "" matches everything */
+int query_compile(const char *, query_t *, char *, size_t);
+
+void query_free(query_t *);
+
+/* evaluates the metadata predicates */
+bool query_match_meta(const query_t *, const query_record_t *);
+
+/* evaluates the text predicates, the text must be loaded */
+bool query_match_text(const query_t *, const todo_entry_t *);
+
+/* reads the matching entries of an open db file with the delta log merged
+ * in, appending them to a growing array. Entries with an id up to
+ * `skip_through` are skipped */
+int query_scan(int, const db_header_t *, uint64_t, query_t *, todo_entry_t ***, size_t *);
+
+/* like `query_scan` over entries in the compact encoding held in memory,
+ * there is no delta log to merge */
+int query_scan_buffer(const char *, size_t, uint32_t, query_t *, todo_entry_t ***, size_t *);
+
+/* makes the query read the archive too. Archived tasks are older than most
+ * of the db, without an order of its own the query is put in id order so
+ * they end up where they belong */
+int query_with_archive(query_t *);
+
+/* returns the field for a sort name (id, created, done) or -1 */
+int query_order_field(const char *);
+
+/* orders the results of a compiled query */
+int query_order(query_t *, const query_order_t *);
+
+/* false when no id in [min, max] can match, for skipping whole segments
+ * and archive blocks once the tag predicates are resolved */
+bool query_wants_ids(const query_t *, uint64_t, uint64_t);
+
+/* false when the heap of an ordered query is full and nothing in the id
+ * and created bounds could rank before the last entry it holds, so the
+ * segment with those bounds does not have to be read */
+bool query_top_wants(const query_t *, todo_entry_t *const *, size_t, uint64_t, uint64_t, uint64_t,
+                     uint64_t);
+
+/* turns the heap collected for an ordered query into the final order */
+void query_sort(const query_t *, todo_entry_t **, size_t);
+
+/* true if the first entry comes before the second in the order of the
+ * query, for merging the sorted results of several dbs */
+bool query_ranks_before(const query_t *, const todo_entry_t *, const todo_entry_t *);
+
+/* prints the compiled plan and the counters of the last run */
+void query_explain(const query_t *, FILE *);
+
+#endif // TODOCTL_QUERY_H
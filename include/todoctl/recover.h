@@ -0,0 +1,75 @@
+/*
+ * recover.h -- TodoCtl crash recovery and fsck
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_RECOVER_H
+#define TODOCTL_RECOVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "todoctl/db.h"
+
+#define FSCK_MAX_THREADS 8
+#define FSCK_MIN_SLICE 4096 /* entries, smaller dbs are not worth a thread */
+
+/* an add appends its entry first and then commits it by moving FILESIZE,
+ * the count and the last id in the header (see `db_commit_header`). The
+ * committed FILESIZE is the checkpoint, everything before it is known to
+ * be good and a crash can only leave bytes after it:
+ *
+ * | HEADER | COMMITTED ENTRIES | COMPLETE ENTRIES | TORN ENTRY |
+ *                              ^ FILESIZE
+ *
+ * Recovery only walks the bytes after the checkpoint, complete entries are
+ * rolled forward into the header and a torn entry is cut off. The common
+ * case where the file ends at FILESIZE is a single `fstat`. Dbs written
+ * before the add committed FILESIZE carry a stale one and are walked from
+ * the start once */
+typedef struct {
+  uint32_t kept;    /* complete entries after the checkpoint now committed */
+  uint64_t dropped; /* bytes of a torn tail that were cut off */
+} recover_report_t;
+
+/* recovers the tail of the db open on the fd, the caller holds the db lock
+ * (`db_lock` does this right after taking it). The file offset is left
+ * alone. Returns TODOCTL_ERR_CORRUPTED_DB when committed entries are bad,
+ * that is for `fsck` to sort out */
+int db_recover(int, recover_report_t *);
+
+/* the full check behind `todoctl fsck` */
+typedef struct {
+  uint32_t entries;       /* good entries in the active db */
+  uint64_t last_entry_id; /* highest id seen, sealed segments included */
+  uint64_t good_bytes;    /* the size of the db once repaired */
+  uint64_t tail_at;       /* where the last good entry ends, a tail follows */
+  uint64_t file_bytes;
+  uint32_t bad_entries;   /* damaged entries before the last good one */
+  bool bad_entry;         /* what follows the last good entry is not just a torn tail */
+
+  db_header_t header; /* as it was found */
+  bool header_fixed;  /* a consistent header was written */
+
+  uint32_t segments;
+  uint32_t bad_segments;
+  int threads;
+
+  uint64_t delta_torn; /* bytes of a torn delta at the end of the delta log */
+  bool delta_fixed;    /* and it was cut off */
+} fsck_report_t;
+
+/* checks every entry of the active db and every sealed segment. Entries
+ * are found with a walk over the length prefixes alone, then verified
+ * (lengths and references) in slices on a pool of threads, the segments
+ * are checksummed on the same pool. Ids have to increase strictly and
+ * stay within the committed last id, an entry breaking that is damaged on
+ * its own. With `repair` damaged entries before the last good one are
+ * dropped by writing the db again without them, otherwise the db is cut
+ * after the last good entry and the header rewritten to match. A torn
+ * delta at the end of the delta log is cut off too */
+int db_fsck(bool, fsck_report_t *);
+
+#endif // TODOCTL_RECOVER_H
@@ -0,0 +1,116 @@
+/*
+ * schema.h -- TodoCtl on-disk schema
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_SCHEMA_H
+#define TODOCTL_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the fixed width parts of the db file, described once. Every list is
+ * `X(NAME, member, bits)` in the order the fields sit on disk, big endian.
+ * From a list come a layout (offsets and sizes through `offsetof`) and a
+ * codec, so nothing else spells out an offset by hand:
+ *
+ *   SCHEMA_LAYOUT(layout_t, LIST)            a struct of char arrays, one per field
+ *   SCHEMA_CODEC(prefix, LIST, type, layout) `prefix_encode(const type *, char *)`
+ *                                            and `prefix_decode(const char *, type *)`
+ *
+ * The codecs are one fixed load or store per field at a constant offset,
+ * there is no loop or lookup left for a decode to pay for. A new field
+ * goes into its list and the struct, a new version of a record gets a list
+ * of its own next to the old one. */
+
+/* the db header, the first DB_HEADER_SIZE bytes of the file */
+#define DB_HEADER_FIELDS(X)                                                                        \
+  X(MAGIC, magic, 64)                                                                              \
+  X(VERSION, version, 32)                                                                          \
+  X(FILESIZE, filesize, 32)                                                                        \
+  X(LAST_ENTRY_ID, _last_entry_id, 64)                                                             \
+  X(ENTRIES, _entries, 32)                                                                         \
+  X(FLAGS, _flags, 32)
+
+/* the fixed width fields of an entry */
+#define ENTRY_FIELDS(X)                                                                            \
+  X(ID, entry_id, 64)                                                                              \
+  X(CREATED_AT, _created_at, 64)                                                                   \
+  X(DELETED_AT, _deleted_at, 64)                                                                   \
+  X(DONE_AT, _done_at, 64)
+
+/* everything of an entry before its text, the fields framed by the total
+ * length in front and the length of the text behind */
+#define ENTRY_LAYOUT(X) X(LENGTH, _, 32) ENTRY_FIELDS(X) X(DATA_LEN, _, 32)
+
+/* what stands in for the text of an entry kept in the blob file or in the
+ * dictionary, right behind DATA_LEN */
+#define ENTRY_BLOB_REF_FIELDS(X)                                                                   \
+  X(BLOB_OFFSET, _blob_offset, 64)                                                                 \
+  X(BLOB_LENGTH, entry_raw_data_len, 64)
+#define ENTRY_DICT_REF_FIELDS(X) X(TEXT_ID, _text_id, 64)
+
+static inline void schema_put_16(char *buf, uint64_t value) {
+  buf[0] = (char)(value >> 8);
+  buf[1] = (char)value;
+}
+
+static inline void schema_put_32(char *buf, uint64_t value) {
+  buf[0] = (char)(value >> 24);
+  buf[1] = (char)(value >> 16);
+  buf[2] = (char)(value >> 8);
+  buf[3] = (char)value;
+}
+
+static inline void schema_put_64(char *buf, uint64_t value) {
+  schema_put_32(buf, value >> 32);
+  schema_put_32(buf + 4, value & 0xFFFFFFFF);
+}
+
+static inline uint16_t schema_get_16(const char *buf) {
+  const unsigned char *p = (const unsigned char *)buf;
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t schema_get_32(const char *buf) {
+  const unsigned char *p = (const unsigned char *)buf;
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline uint64_t schema_get_64(const char *buf) {
+  return (uint64_t)schema_get_32(buf) << 32 | schema_get_32(buf + 4);
+}
+
+#define __SCHEMA_BYTES(name, member, bits) char name[(bits) / 8];
+#define __SCHEMA_PUT(name, member, bits)                                                           \
+  schema_put_##bits(buf + offsetof(__schema_layout_t, name), src->member);
+#define __SCHEMA_GET(name, member, bits)                                                           \
+  dst->member = schema_get_##bits(buf + offsetof(__schema_layout_t, name));
+
+#define SCHEMA_LAYOUT(layout, LIST)                                                                \
+  typedef struct {                                                                                 \
+    LIST(__SCHEMA_BYTES)                                                                           \
+  } layout;
+
+#define SCHEMA_CODEC(prefix, LIST, type, layout)                                                   \
+  static inline void prefix##_encode(const type *src, char *buf) {                                 \
+    typedef layout __schema_layout_t;                                                              \
+    LIST(__SCHEMA_PUT)                                                                             \
+  }                                                                                                \
+  static inline void prefix##_decode(const char *buf, type *dst) {                                 \
+    typedef layout __schema_layout_t;                                                              \
+    LIST(__SCHEMA_GET)                                                                             \
+  }
+
+SCHEMA_LAYOUT(db_header_layout_t, DB_HEADER_FIELDS)
+SCHEMA_LAYOUT(entry_layout_t, ENTRY_LAYOUT)
+SCHEMA_LAYOUT(entry_blob_ref_layout_t, ENTRY_BLOB_REF_FIELDS)
+SCHEMA_LAYOUT(entry_dict_ref_layout_t, ENTRY_DICT_REF_FIELDS)
+
+#define DB_HEADER_SIZE sizeof(db_header_layout_t)
+#define DB_HEADER_OFFSET(name) offsetof(db_header_layout_t, name)
+#define ENTRY_OFFSET(name) offsetof(entry_layout_t, name)
+
+#endif // TODOCTL_SCHEMA_H
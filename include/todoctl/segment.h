@@ -0,0 +1,142 @@
+/*
+ * segment.h -- TodoCtl sealed segments and manifest
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_SEGMENT_H
+#define TODOCTL_SEGMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "todoctl/bloom.h"
+#include "todoctl/db.h"
+#include "todoctl/delta.h"
+#include "todoctl/entry.h"
+#include "todoctl/query.h"
+
+#define MANIFEST_MAGIC 0x4e4e4d
+#define MANIFEST_VERSION 1
+#define MANIFEST_SUFFIX ".manifest"
+#define SEGMENT_DIR_SUFFIX ".d"
+
+/* the active db is sealed into a segment once it holds this many entries */
+#define SEGMENT_MAX_ENTRIES 65536
+
+#define SEGMENT_FLAG_BLOOM (1 << 0)   /* the file ends in a bloom filter trailer */
+#define SEGMENT_FLAG_COMPACT (1 << 1) /* the entries use the compact encoding */
+
+#define MANIFEST_HEADER_SIZE 32
+#define MANIFEST_ENTRY_SIZE 64
+
+/* a sealed segment, the file is a regular db file (header + entries) that
+ * is never written again once it is listed in the manifest. Segments with
+ * SEGMENT_FLAG_BLOOM carry a filter over their ids and tokens after the
+ * entries, see bloom.h. Segments with SEGMENT_FLAG_COMPACT have
+ * DB_FLAG_COMPACT_RECORDS in their header, older ones use the fixed width
+ * encoding of the active db
+ *
+ * |  SEQ  | MIN_ID | MAX_ID | MIN_CREATED | MAX_CREATED | ENTRIES | CRC32 |  SIZE  | FLAGS | PAD |
+ * |8 bytes|8 bytes |8 bytes |   8 bytes   |   8 bytes   | 4 bytes |4 bytes|8 bytes |4 bytes|4 b  |
+ */
+typedef struct {
+  uint64_t seq;
+  uint64_t min_id;
+  uint64_t max_id;
+  uint64_t min_created;
+  uint64_t max_created;
+  uint32_t entries;
+  uint32_t checksum; /* crc32 of the entire segment file */
+  uint64_t size;
+  uint32_t flags; /* SEGMENT_FLAG_* */
+} segment_info_t;
+
+/* `~/.todo.db.manifest` lists the sealed segments ordered by id
+ *
+ * |  MAGIC  | VERSION | COUNT  | NEXT_SEQ | SEALED_THROUGH_ID |
+ * | 8 bytes | 4 bytes |4 bytes | 8 bytes  |      8 bytes      |
+ *
+ * followed by COUNT segments. It is only ever replaced as a whole through
+ * a rename. Entries in the active db with an id up to SEALED_THROUGH_ID are
+ * leftovers of a seal that crashed before the active db was emptied and
+ * readers skip them. */
+typedef struct {
+  uint32_t count;
+  uint64_t next_seq;
+  uint64_t sealed_through_id;
+  segment_info_t *segments;
+} manifest_t;
+
+/* restricts a read to segments that may hold matching entries, zero for a
+ * max means unbounded. With a token set segments whose filter rules the
+ * token out are skipped too, the entries read still need to be matched
+ * unless a compiled query is given, then only its matches are returned */
+typedef struct {
+  uint64_t min_id;
+  uint64_t max_id;
+  uint64_t min_created;
+  uint64_t max_created;
+  const char *token;          /* lowercased, see text_next_token */
+  bloom_counters_t *counters; /* optional, filter probes are counted here */
+  query_t *filter;            /* optional, evaluated while the records are read */
+} segment_range_t;
+
+/* a range that pushes the bounds of the query down to the manifest */
+void segment_range_from_query(query_t *, segment_range_t *, bloom_counters_t *);
+
+/* loads the manifest, a missing manifest is an empty one */
+int manifest_load(manifest_t *);
+
+/* atomically replaces the manifest */
+int manifest_store(const manifest_t *);
+
+void manifest_free(manifest_t *);
+
+/* resolves the path of a segment file */
+int segment_path(uint64_t, char *, size_t);
+
+/* returns the index of the segment holding the id or -1 */
+int segment_find(const manifest_t *, uint64_t);
+
+/* true if the segment may hold entries inside the range */
+bool segment_overlaps(const segment_info_t *, const segment_range_t *);
+
+/* consults the filter of the segment, false means the id is not in there */
+bool segment_may_hold_id(const segment_info_t *, uint64_t, bloom_counters_t *);
+
+/* opens a segment read only and reads its header */
+int segment_open(const segment_info_t *, int *, db_header_t *);
+
+/* checks size and checksum of a sealed segment against the manifest */
+int segment_verify(const segment_info_t *);
+
+/* like `segment_verify` for a path resolved up front, it touches nothing
+ * but that file so it can run on several threads at once */
+int segment_verify_file(const segment_info_t *, const char *);
+
+/* moves every entry of the active db into a new sealed segment, enables
+ * DB_FEATURE_SEGMENTS and DB_FEATURE_DELTA_LOG since sealed entries can
+ * only change through the log */
+int segment_seal(void);
+
+/* rewrites the sealed segments that have deltas in the map as new segments */
+int segment_fold_deltas(const delta_map_t *);
+
+/* rewrites the sealed segments holding any of the ids (sorted ascending)
+ * without them, segments left empty are dropped from the manifest */
+int segment_drop_ids(const uint64_t *, size_t);
+
+/* reads the entries of every sealed segment overlapping the range */
+int segment_read_sealed(const manifest_t *, const segment_range_t *, todo_entry_t ***, size_t *);
+
+/* reads entries across sealed segments (skipping the ones outside of the
+ * range, NULL reads all) followed by the active db, in id order. A filter
+ * with `archive` set reads the archive after them */
+int db_read_entries(const segment_range_t *, todo_entry_t ***, size_t *);
+
+/* frees what `db_read_entries` returned */
+void db_free_entries(todo_entry_t **, size_t);
+
+#endif // TODOCTL_SEGMENT_H
@@ -0,0 +1,104 @@
+/*
+ * stats.h -- TodoCtl stats block
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_STATS_H
+#define TODOCTL_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "todoctl/bloom.h"
+#include "todoctl/db.h"
+#include "todoctl/entry.h"
+
+#define STATS_MAGIC 0x4e4e53
+#define STATS_VERSION 2
+#define STATS_V1_FIELDS 17 /* version 1 blocks end after the histogram */
+#define STATS_SUFFIX ".stats"
+
+#define STATS_LATENCY_BUCKETS 8
+
+#define STATS_NONE 0x00
+#define STATS_VERIFY (1 << 0)  /* cross check the counters against a full scan */
+#define STATS_REBUILD (1 << 1) /* rewrite the counters from a full scan */
+
+/* counters that are kept next to the db in `~/.todo.db.stats`
+ *
+ * The header only has room for the last id and the count so instead of
+ * decoding the entire db for simple questions we maintain these counters
+ * on every add and done. On disk every field is a big endian 8 byte value
+ * written in the same order as below.
+ *
+ * The latency histogram buckets `_done_at - _created_at` as
+ *
+ *   < 1m | < 10m | < 1h | < 6h | < 1d | < 7d | < 30d | >= 30d
+ *
+ * The bloom counters record how useful the segment filters are, a scan
+ * can not recompute them so verify and rebuild leave them alone.
+ */
+typedef struct {
+  uint64_t magic;
+  uint64_t version;
+
+  uint64_t total;
+  uint64_t open;
+  uint64_t done;
+  uint64_t deleted;
+
+  uint64_t today;      /* local day key (year * 1000 + yday) the below belongs to */
+  uint64_t done_today; /* entries marked done on `today` */
+
+  uint64_t latency_sum_ms;
+  uint64_t latency_hist[STATS_LATENCY_BUCKETS];
+
+  uint64_t bloom_probes;
+  uint64_t bloom_skips;
+  uint64_t bloom_false_positives;
+} db_stats_t;
+
+#define STATS_FIELDS (sizeof(db_stats_t) / sizeof(uint64_t))
+#define STATS_SCANNED_FIELDS (offsetof(db_stats_t, bloom_probes) / sizeof(uint64_t))
+
+/* writes an empty stats block, called when a new db is created */
+int stats_reset(void);
+
+/* reads the stats block, returns TODOCTL_ERR_DB_DOES_NOT_EXIST if the
+ * db was created before stats were maintained */
+int stats_load(db_stats_t *);
+
+/* overwrites the stats block */
+int stats_store(const db_stats_t *);
+
+/* updates the counters for a freshly added entry */
+int stats_record_add(const todo_entry_t *);
+
+/* updates the counters for an entry that was just marked done, the
+ * entry is expected to carry the new `_done_at` */
+int stats_record_done(const todo_entry_t *);
+
+/* moves the contribution of an entry from its old state to its new one,
+ * used for undone and delete */
+int stats_record_change(const todo_entry_t *, const todo_entry_t *);
+
+/* adds what a lookup did with the segment filters */
+int stats_record_bloom(const bloom_counters_t *);
+
+/* computes the counters by scanning every entry, sealed segments included */
+int stats_scan(db_stats_t *);
+
+/* compares the scanned fields of two stats blocks, mismatching fields are reported on the
+ * stream and TODOCTL_ERR_STATS_MISMATCH is returned */
+int stats_compare(const db_stats_t *, const db_stats_t *, FILE *);
+
+/* prints the stats in a human readable form */
+void stats_print(const db_stats_t *);
+
+/* returns the local day key for a timestamp in millis */
+uint64_t stats_day_of(uint64_t);
+
+#endif // TODOCTL_STATS_H
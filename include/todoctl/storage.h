@@ -0,0 +1,172 @@
+/*
+ * storage.h -- TodoCtl storage backends
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_STORAGE_H
+#define TODOCTL_STORAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* everything that holds entries (the db and the sealed segments) is read
+ * and written through a storage backend instead of calling the system
+ * directly, so the command paths can run against something other than a
+ * home directory on disk. Files are named by path and used through an
+ * integer handle, for the POSIX backend that is simply the fd.
+ *
+ * Reads and writes are positional, nothing depends on a file offset. The
+ * wrappers below dispatch to the backend in use and turn short transfers
+ * into loops, a backend may return less than asked for like the system
+ * calls do. Errors are STATUS_ERROR with errno set. */
+
+/* a read or write handed to a backend that completes it later, `done` and
+ * `result` (the bytes moved or -1 with `error` set) are filled in by the
+ * backend's `wait` */
+typedef struct {
+  ssize_t result;
+  int error;
+  bool done;
+} storage_ticket_t;
+
+/* one part of a batch of positional writes */
+typedef struct {
+  const void *buf;
+  size_t len;
+  uint64_t offset;
+} storage_write_t;
+
+typedef struct {
+  const char *name;
+
+  /* O_RDONLY, O_WRONLY or O_RDWR with O_CREAT, O_EXCL, O_TRUNC */
+  int (*open)(const char *, int, int *);
+  int (*close)(int);
+
+  ssize_t (*read_at)(int, void *, size_t, uint64_t);
+  ssize_t (*write_at)(int, const void *, size_t, uint64_t);
+  /* writes at the end of the file, the offset it landed at is returned */
+  ssize_t (*append)(int, const struct iovec *, int, uint64_t *);
+  int (*sync)(int);
+  int (*size)(int, uint64_t *);
+  int (*truncate)(int, uint64_t);
+
+  /* exclusive, blocks until it is granted */
+  int (*lock)(int);
+  int (*unlock)(int);
+  /* false once another file was renamed over the path */
+  bool (*is_current)(int, const char *);
+
+  int (*rename)(const char *, const char *);
+  int (*remove)(const char *);
+
+  /* read only view of the first bytes of the file */
+  int (*map)(int, uint64_t, const char **);
+  void (*unmap)(const char *, uint64_t);
+
+  /* optional, without them streams read one chunk at a time and batches
+   * are written part by part. `read_start` queues a read, `wait` submits
+   * whatever is queued and waits until at least one ticket is done */
+  int (*read_start)(int, void *, size_t, uint64_t, storage_ticket_t *);
+  int (*wait)(void);
+  /* the parts are submitted together and reach the file in order */
+  int (*write_batch)(int, const storage_write_t *, int);
+} storage_t;
+
+/* files on disk, the default */
+extern const storage_t storage_posix;
+
+/* files live in the memory of the process and are gone when it exits,
+ * for tests and benchmarks that want the full command paths without a
+ * disk. Locks are no-ops, there is only one process */
+extern const storage_t storage_memory;
+
+#define STORAGE_ENV "TODOCTL_STORAGE"
+
+/* files on disk through io_uring: the chunks of a stream are read with
+ * several of them in flight and a batch of writes is one submission, the
+ * rest is POSIX. Rings are set up per thread with raw system calls. NULL
+ * when the kernel does not have it or TODOCTL_STORAGE=posix */
+const storage_t *storage_uring(void);
+
+/* switches the backend for every file opened from now on, handles opened
+ * before belong to the old one and must not be used anymore */
+void storage_use(const storage_t *);
+
+const storage_t *storage_current(void);
+
+int storage_open(const char *, int, int *);
+int storage_close(int);
+
+/* reads until the buffer is full or the file ends, returns the bytes read */
+ssize_t storage_read_at(int, void *, size_t, uint64_t);
+
+/* writes all of it or fails */
+int storage_write_at(int, const void *, size_t, uint64_t);
+
+/* appends all of it or fails, `offset` (optional) receives where */
+int storage_append(int, const struct iovec *, int, uint64_t *);
+
+int storage_sync(int);
+int storage_size(int, uint64_t *);
+int storage_truncate(int, uint64_t);
+int storage_lock(int);
+int storage_unlock(int);
+bool storage_is_current(int, const char *);
+int storage_rename(const char *, const char *);
+int storage_remove(const char *);
+int storage_map(int, uint64_t, const char **);
+void storage_unmap(const char *, uint64_t);
+
+/* writes every part in the order given or fails */
+int storage_write_batch(int, const storage_write_t *, int);
+
+#define STORAGE_STREAM_CHUNK (256 * 1024)
+#define STORAGE_STREAM_DEPTH 4 /* chunks in flight when the backend can */
+
+typedef struct {
+  char *buf;
+  uint64_t offset;
+  size_t len; /* asked for, the ticket says how much came back */
+  storage_ticket_t ticket;
+} storage_chunk_t;
+
+/* reads a file front to back in big chunks, the ones ahead of the reader
+ * are already in flight when the backend has `read_start`. Small reads of
+ * a scan are served from the chunks instead of going to the backend one
+ * by one */
+typedef struct {
+  int handle;
+  uint64_t pos;  /* where the next `storage_stream_read` starts */
+  uint64_t next; /* where the next chunk starts */
+  uint64_t end;  /* the size when opened, later bytes are read directly */
+  size_t chunk_size;
+  int depth;
+  int head;  /* the chunk holding `pos` */
+  int count; /* chunks started and not consumed yet */
+  storage_chunk_t chunks[STORAGE_STREAM_DEPTH];
+} storage_stream_t;
+
+int storage_stream_open(storage_stream_t *, int, uint64_t);
+
+/* like `storage_read_at` at the position of the stream, which moves on */
+ssize_t storage_stream_read(storage_stream_t *, void *, size_t);
+
+/* waits for the reads still in flight */
+void storage_stream_close(storage_stream_t *);
+
+/* drops every file of the memory backend */
+void storage_memory_reset(void);
+
+/* fault injection for the memory backend, after `n` more bytes every
+ * write comes back short and the one after fails with EIO. An overwrite
+ * within one sector is never cut, it fails whole. SIZE_MAX turns it off
+ * again */
+void storage_memory_fail_after(size_t);
+
+#endif // TODOCTL_STORAGE_H
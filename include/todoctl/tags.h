@@ -0,0 +1,88 @@
+/*
+ * tags.h -- TodoCtl tag index
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_TAGS_H
+#define TODOCTL_TAGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "todoctl/bitmap.h"
+#include "todoctl/entry.h"
+#include "todoctl/query.h"
+
+#define TAGS_MAGIC 0x4e4e54
+#define TAGS_VERSION 1
+#define TAGS_SUFFIX ".tags"
+#define TAGS_HEADER_SIZE 16
+
+#define TAGS_NAME_MAX 32 /* a-z, 0-9, '-' and '_' */
+#define TAGS_MAX_PER_TASK 8
+
+#define TAGS_NONE 0x00
+#define TAGS_REBUILD (1 << 0) /* recompute the state sets from a full scan */
+
+/* the state sets, '@' keeps them apart from tag names */
+#define TAGS_ALL "@all"
+#define TAGS_DONE "@done"
+#define TAGS_DELETED "@deleted"
+
+/* the tags of every task as id bitmaps (see bitmap.h), kept next to the db
+ * in `~/.todo.db.tags`
+ *
+ * |  MAGIC  | VERSION |  COUNT  | per set: NAME_LEN 1 | NAME | BITMAP |
+ * | 8 bytes | 4 bytes | 4 bytes |
+ *
+ * Next to one set per tag there are three state sets, every task, the
+ * done ones and the deleted ones, so `done=false and tag=infra and
+ * tag!=oncall` is answered with bitmap operations before a single record
+ * is read. Tags live nowhere else, the file is only ever replaced as a
+ * whole through a rename while the db lock is held. The state sets follow
+ * from the entries and `tags --rebuild` recomputes them with a scan.
+ * Archived tasks keep their tags. */
+typedef struct {
+  char name[TAGS_NAME_MAX + 1];
+  bitmap_t ids;
+} tags_set_t;
+
+typedef struct {
+  tags_set_t *sets; /* in name order */
+  size_t count;
+} tags_index_t;
+
+/* true for a name a tag can have */
+bool tags_valid_name(const char *);
+
+/* loads the index, a missing index is an empty one */
+int tags_load(tags_index_t *);
+
+/* atomically replaces the index */
+int tags_store(const tags_index_t *);
+
+void tags_free(tags_index_t *);
+
+/* the set with the name, with `create` an empty one is added when missing */
+bitmap_t *tags_find(tags_index_t *, const char *, bool);
+
+/* records a freshly added task and its tags, an index without state sets
+ * gets them built from a scan first */
+int tags_record_add(uint64_t, char *const *, size_t);
+
+/* moves a task between the state sets after done, undone or delete, the
+ * entry carries its new state */
+int tags_record_change(const todo_entry_t *);
+
+/* recomputes the state sets with a scan of the db and the archive, tags
+ * of tasks that are gone are dropped */
+int tags_rebuild(void);
+
+/* turns the tag predicates of a query (and its done and deleted ones) into
+ * the set of ids that can match, see `query_wants_ids` */
+int tags_resolve(query_t *);
+
+#endif // TODOCTL_TAGS_H
@@ -0,0 +1,60 @@
+/*
+ * trace.h -- TodoCtl timeline tracing
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_TRACE_H
+#define TODOCTL_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_ENV "TODOCTL_TRACE"
+#define TRACE_MAX_EVENTS (1 << 20) /* later spans are counted but not kept */
+
+/* with `TODOCTL_TRACE=<file>` set, spans around the core functions are kept
+ * in memory and written to the file at exit as Chrome trace-event JSON, it
+ * opens in chrome://tracing and ui.perfetto.dev. Without it a span is a
+ * branch on `trace_on` going in and one coming out */
+extern bool trace_on;
+
+typedef struct {
+  const char *name; /* static, it is kept as is */
+  uint64_t start;   /* nanoseconds, see `trace_now` */
+} trace_span_t;
+
+/* turns tracing on if TODOCTL_TRACE is set, the trace is written at exit */
+int trace_init(void);
+
+/* monotonic nanoseconds */
+uint64_t trace_now(void);
+
+/* keeps a finished span, only called while tracing */
+void trace_record(const char *, uint64_t);
+
+/* writes the kept spans out, called at exit */
+void trace_flush(void);
+
+static inline trace_span_t trace_begin(const char *name) {
+  trace_span_t span = {.name = name, .start = 0};
+  if (__builtin_expect(trace_on, 0)) { span.start = trace_now(); }
+  return span;
+}
+
+static inline void trace_end(trace_span_t *span) {
+  if (__builtin_expect(trace_on, 0)) { trace_record(span->name, span->start); }
+}
+
+#define __TRACE_CONCAT(a, b) a##b
+#define __TRACE_VAR(line) __TRACE_CONCAT(__trace_span_, line)
+
+/* a span from here to the end of the enclosing scope, however it is left */
+#define TRACE_SPAN(name)                                                                           \
+  trace_span_t __TRACE_VAR(__LINE__) __attribute__((cleanup(trace_end))) = trace_begin(name)
+
+/* a span named after the function */
+#define TRACE_FUNC() TRACE_SPAN(__func__)
+
+#endif // TODOCTL_TRACE_H
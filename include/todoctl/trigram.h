@@ -0,0 +1,81 @@
+/*
+ * trigram.h -- TodoCtl trigram index
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_TRIGRAM_H
+#define TODOCTL_TRIGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "todoctl/bitmap.h"
+#include "todoctl/query.h"
+
+#define TRIGRAM_SUFFIX ".trigrams"
+#define TRIGRAM_MAGIC 0x4e4e47
+#define TRIGRAM_VERSION 1
+#define TRIGRAM_HEADER_SIZE 32
+#define TRIGRAM_SLOT_SIZE 15         /* a directory slot */
+#define TRIGRAM_TAIL_MIN (64 * 1024) /* the tail is folded past this and a quarter of the rest */
+
+/* of the trigrams of a search a task needs, one swapped pair of letters
+ * in a six letter word keeps three of its seven */
+#define TRIGRAM_MATCH_PERCENT 40
+
+#define TRIGRAM_NONE 0x00
+#define TRIGRAM_REBUILD (1 << 0) /* rewrite the index from a full scan */
+
+/* three lowercased characters, the first in bits 16 to 23 */
+typedef uint32_t trigram_t;
+
+/* the trigrams of every task text, kept next to the db in
+ * `~/.todo.db.trigrams`. A text is split into words of letters and digits
+ * and every word, lowercased and padded with two blanks in front and one
+ * behind, gives its trigrams, `deploy` is `  d`, ` de`, `dep`, `epl`, `plo`,
+ * `loy` and `oy `.
+ *
+ * |  MAGIC  | VERSION |  KEYS   |  BASE   | LENGTH  |
+ * | 8 bytes | 4 bytes | 4 bytes | 8 bytes | 8 bytes |
+ *
+ * followed by a directory of KEYS slots sorted by trigram
+ *
+ * | TRIGRAM |  OFFSET |  SIZE   |
+ * | 3 bytes | 8 bytes | 4 bytes |
+ *
+ * pointing at the posting lists, the ids of the tasks with the trigram as
+ * a bitmap (see bitmap.h), up to BASE. Adds are appended after it as
+ *
+ * |   ID    |  COUNT  | COUNT trigrams |
+ * | 8 bytes | 4 bytes |  3 bytes each  |
+ *
+ * and updating LENGTH commits them. A lookup is a binary search of the
+ * directory and one read per trigram plus a pass over the tail, once the
+ * tail outgrows TRIGRAM_TAIL_MIN and a quarter of the postings it is
+ * folded into them and the file replaced through a rename. Writers hold
+ * the db lock. Texts never change, done and delete leave the index alone
+ * and the records are checked anyway. */
+
+/* the sorted, distinct trigrams of a text. A fragment only gives the ones
+ * every text containing it has too, its words are padded only where the
+ * fragment itself shows where they start or end */
+int trigram_extract(const char *, size_t, bool, trigram_t **, size_t *);
+
+/* records the text of a freshly added task */
+int trigram_record_add(uint64_t, const char *, size_t);
+
+/* rewrites the index from a scan of the db and the archive */
+int trigram_rebuild(void);
+
+/* the ids of the tasks holding at least `min` of the sorted trigrams, a
+ * missing index is an empty one */
+int trigram_lookup(const trigram_t *, size_t, size_t, bitmap_t *);
+
+/* narrows the candidates of a query to the tasks holding every trigram of
+ * its `text~` and `word=` predicates, callers check the feature */
+int trigram_resolve(query_t *);
+
+#endif // TODOCTL_TRIGRAM_H
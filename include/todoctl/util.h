@@ -10,9 +10,11 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 /*
  * Gets current time in millis
@@ -23,4 +25,36 @@ uint64_t get_time_in_millis(void);
 /* converts a string safely to a long long */
 int convert_to_uint64(const char *, long long *);
 
+/* updates a running crc32 (IEEE) with the buffer, start with 0 */
+uint32_t crc32_update(uint32_t, const void *, size_t);
+
+/* writes every byte described by the vector, retrying short writes. The
+ * vector is advanced in place as it is consumed */
+int writev_all(int, struct iovec *, int);
+
+/* longest token we care about, longer runs are cut */
+#define TEXT_TOKEN_MAX 64
+
+/* copies the next alphanumeric run of the text starting at the offset into
+ * the buffer lowercased, returns its length or 0 once the text runs out */
+size_t text_next_token(const char *, size_t, size_t *, char *);
+
+/* true if one of the tokens of the text equals the (lowercased) token */
+int text_has_token(const char *, size_t, const char *);
+
+/* LEB128 varints, 7 bits per byte least significant first with the high
+ * bit set on every byte but the last. A u64 takes at most 10 bytes */
+#define VARINT_MAX_LEN 10
+
+/* writes the value as a varint, returns the bytes written */
+size_t varint_put(uint64_t, char *);
+
+/* reads a varint from the buffer, returns the bytes consumed or 0 if the
+ * buffer ends before the varint does (or it runs past VARINT_MAX_LEN) */
+size_t varint_get(const char *, size_t, uint64_t *);
+
+/* maps signed differences onto small unsigned values, -1 -> 1, 1 -> 2 */
+uint64_t zigzag_encode(int64_t);
+int64_t zigzag_decode(uint64_t);
+
 #endif // TODOCTL_UTIL_H
@@ -0,0 +1,43 @@
+/*
+ * watch.h -- TodoCtl watch mode
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#ifndef TODOCTL_WATCH_H
+#define TODOCTL_WATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define WATCH_NONE 0x00
+#define WATCH_ONLY_NEW (1 << 0) /* do not emit the entries that already exist */
+
+#define WATCH_POLL_INTERVAL_MS 1000
+#define WATCH_READ_CHUNK (64 * 1024)
+
+/* tails the db and writes one line per change to the stream
+ *
+ *   add\t<id>\t<created_at>\t<done_at>\t<text>
+ *   done\t<id>\t<done_at>
+ *   undone\t<id>
+ *   delete\t<id>\t<deleted_at>
+ *   reset
+ *
+ * We remember the byte offset of the last complete entry we decoded so a
+ * wake up only reads what was appended since. Without the delta log done,
+ * undone and delete are in place writes, so for every entry we remember
+ * where its `deleted_at` and `done_at` live and re-read those in one pass
+ * over the file. With the delta log enabled nothing is written in place,
+ * the pass is skipped and we tail the log the same way we tail the db.
+ * `reset` is emitted when the file is truncated or replaced (sealing
+ * replaces it), everything including the sealed segments is sent again
+ * after.
+ *
+ * On Linux inotify wakes us up on writes, elsewhere we poll the file. Tabs,
+ * newlines and backslashes in the text are escaped. This never returns
+ * unless something fails. */
+int watch_db(FILE *, int);
+
+#endif // TODOCTL_WATCH_H
@@ -0,0 +1,512 @@
+#include "todoctl/archive.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/schema.h"
+#include "todoctl/segment.h"
+#include "todoctl/util.h"
+
+#include <inttypes.h>
+#include <zlib.h>
+
+int archive_index_load(archive_index_t *out) {
+  if (out == NULL) { return STATUS_ERROR; }
+  memset(out, 0, sizeof(archive_index_t));
+  out->pending = ARCHIVE_NO_PENDING;
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(ARCHIVE_INDEX_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) { return 0; }
+    DEBUG_ERROR("failed to open archive index\n");
+    return STATUS_ERROR;
+  }
+
+  char head[ARCHIVE_INDEX_HEADER_SIZE];
+  if (read(fd, head, sizeof(head)) != (ssize_t)sizeof(head)) {
+    DEBUG_ERROR("failed to read archive index header\n");
+    close(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  if (schema_get_64(head) != ARCHIVE_INDEX_MAGIC) {
+    DEBUG_ERROR("invalid archive index magic\n");
+    close(fd);
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(head + 8) != ARCHIVE_INDEX_VERSION) {
+    DEBUG_ERROR("invalid archive index version\n");
+    close(fd);
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+
+  out->count = schema_get_32(head + 12);
+  out->pending = schema_get_32(head + 16);
+  if (out->count == 0) {
+    close(fd);
+    return 0;
+  }
+
+  size_t body_len = (size_t)out->count * ARCHIVE_BLOCK_SIZE;
+  char *body = malloc(body_len);
+  out->blocks = calloc(out->count, sizeof(archive_block_t));
+  if (body == NULL || out->blocks == NULL) {
+    DEBUG_ERROR("failed to allocate archive index\n");
+    free(body);
+    archive_index_free(out);
+    close(fd);
+    return STATUS_ERROR;
+  }
+  if (read(fd, body, body_len) != (ssize_t)body_len) {
+    DEBUG_ERROR("archive index is shorter than its count\n");
+    free(body);
+    archive_index_free(out);
+    close(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  close(fd);
+
+  for (uint32_t i = 0; i < out->count; i++) {
+    const char *rec = body + (size_t)i * ARCHIVE_BLOCK_SIZE;
+    archive_block_t *block = &out->blocks[i];
+    block->offset = schema_get_64(rec);
+    block->packed = schema_get_32(rec + 8);
+    block->raw = schema_get_32(rec + 12);
+    block->entries = schema_get_32(rec + 16);
+    block->checksum = schema_get_32(rec + 20);
+    block->min_id = schema_get_64(rec + 24);
+    block->max_id = schema_get_64(rec + 32);
+    block->min_created = schema_get_64(rec + 40);
+    block->max_created = schema_get_64(rec + 48);
+    block->min_done = schema_get_64(rec + 56);
+    block->max_done = schema_get_64(rec + 64);
+  }
+
+  free(body);
+  return 0;
+}
+
+int archive_index_store(const archive_index_t *index) {
+  if (index == NULL) { return STATUS_ERROR; }
+
+  size_t len = ARCHIVE_INDEX_HEADER_SIZE + (size_t)index->count * ARCHIVE_BLOCK_SIZE;
+  char *buf = calloc(1, len);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate archive index buffer\n");
+    return STATUS_ERROR;
+  }
+
+  schema_put_64(buf, ARCHIVE_INDEX_MAGIC);
+  schema_put_32(buf + 8, ARCHIVE_INDEX_VERSION);
+  schema_put_32(buf + 12, index->count);
+  schema_put_32(buf + 16, index->pending);
+  for (uint32_t i = 0; i < index->count; i++) {
+    char *rec = buf + ARCHIVE_INDEX_HEADER_SIZE + (size_t)i * ARCHIVE_BLOCK_SIZE;
+    const archive_block_t *block = &index->blocks[i];
+    schema_put_64(rec, block->offset);
+    schema_put_32(rec + 8, block->packed);
+    schema_put_32(rec + 12, block->raw);
+    schema_put_32(rec + 16, block->entries);
+    schema_put_32(rec + 20, block->checksum);
+    schema_put_64(rec + 24, block->min_id);
+    schema_put_64(rec + 32, block->max_id);
+    schema_put_64(rec + 40, block->min_created);
+    schema_put_64(rec + 48, block->max_created);
+    schema_put_64(rec + 56, block->min_done);
+    schema_put_64(rec + 64, block->max_done);
+  }
+
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (db_resolve_path(ARCHIVE_INDEX_SUFFIX, path, sizeof(path)) < 0 ||
+      db_resolve_path(ARCHIVE_INDEX_SUFFIX ".tmp", tmp_path, sizeof(tmp_path)) < 0) {
+    free(buf);
+    return STATUS_ERROR;
+  }
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    free(buf);
+    return STATUS_ERROR;
+  }
+  if (write(fd, buf, len) != (ssize_t)len || fsync(fd) < 0) {
+    perror("write()");
+    close(fd);
+    unlink(tmp_path);
+    free(buf);
+    return STATUS_ERROR;
+  }
+  close(fd);
+  free(buf);
+
+  /* the rename is what publishes the new blocks */
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+void archive_index_free(archive_index_t *index) {
+  if (index == NULL) { return; }
+  free(index->blocks);
+  index->blocks = NULL;
+  index->count = 0;
+}
+
+static int __open_archive(int flags) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(ARCHIVE_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    DEBUG_ERROR("failed to open the archive\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  return fd;
+}
+
+/* compresses the entries into a block written at `at` */
+static int __write_block(int fd, uint64_t at, todo_entry_t **entries, size_t n,
+                         archive_block_t *out) {
+  char *raw = NULL;
+  size_t raw_len = 0;
+  if (encode_entries_compact(entries, n, &raw, &raw_len) < 0) { return STATUS_ERROR; }
+
+  uLongf packed_len = compressBound((uLong)raw_len);
+  char *packed = malloc(packed_len);
+  if (packed == NULL) {
+    DEBUG_ERROR("failed to allocate archive block\n");
+    free(raw);
+    return STATUS_ERROR;
+  }
+  int zrc = compress2((Bytef *)packed, &packed_len, (const Bytef *)raw, (uLong)raw_len,
+                     Z_DEFAULT_COMPRESSION);
+  free(raw);
+  if (zrc != Z_OK) {
+    DEBUG_ERROR("failed to compress archive block\n");
+    free(packed);
+    return STATUS_ERROR;
+  }
+  if (pwrite(fd, packed, packed_len, (off_t)at) != (ssize_t)packed_len) {
+    DEBUG_ERROR("failed to write archive block\n");
+#ifdef DEBUG
+    perror("pwrite()");
+#endif
+    free(packed);
+    return STATUS_ERROR;
+  }
+
+  memset(out, 0, sizeof(archive_block_t));
+  out->offset = at;
+  out->packed = (uint32_t)packed_len;
+  out->raw = (uint32_t)raw_len;
+  out->entries = (uint32_t)n;
+  out->checksum = crc32_update(0, packed, packed_len);
+  free(packed);
+
+  out->min_id = entries[0]->entry_id;
+  out->max_id = entries[n - 1]->entry_id;
+  out->min_created = out->min_done = UINT64_MAX;
+  for (size_t i = 0; i < n; i++) {
+    const todo_entry_t *entry = entries[i];
+    if (entry->_created_at < out->min_created) { out->min_created = entry->_created_at; }
+    if (entry->_created_at > out->max_created) { out->max_created = entry->_created_at; }
+    if (entry->_done_at < out->min_done) { out->min_done = entry->_done_at; }
+    if (entry->_done_at > out->max_done) { out->max_done = entry->_done_at; }
+  }
+  return 0;
+}
+
+/* reads a block back and inflates it into a fresh buffer */
+static int __read_block(int fd, const archive_block_t *block, char **out) {
+  char *packed = malloc(block->packed > 0 ? block->packed : 1);
+  char *raw = malloc(block->raw > 0 ? block->raw : 1);
+  if (packed == NULL || raw == NULL) {
+    DEBUG_ERROR("failed to allocate archive block\n");
+    free(packed);
+    free(raw);
+    return STATUS_ERROR;
+  }
+
+  int rc = 0;
+  uLongf raw_len = block->raw;
+  if (pread(fd, packed, block->packed, (off_t)block->offset) != (ssize_t)block->packed ||
+      crc32_update(0, packed, block->packed) != block->checksum ||
+      uncompress((Bytef *)raw, &raw_len, (const Bytef *)packed, block->packed) != Z_OK ||
+      raw_len != block->raw) {
+    DEBUG_ERROR("archive block at %" PRIu64 " is damaged\n", block->offset);
+    rc = TODOCTL_ERR_CORRUPTED_DB;
+  }
+  free(packed);
+  if (rc < 0) {
+    free(raw);
+    return rc;
+  }
+  *out = raw;
+  return 0;
+}
+
+/* collects the ids held by the blocks from `first` on */
+static int __block_ids(int fd, const archive_index_t *index, uint32_t first, uint64_t **out,
+                       size_t *n) {
+  size_t total = 0;
+  for (uint32_t i = first; i < index->count; i++) { total += index->blocks[i].entries; }
+  uint64_t *ids = malloc(sizeof(uint64_t) * (total > 0 ? total : 1));
+  if (ids == NULL) { return STATUS_ERROR; }
+
+  size_t len = 0;
+  int rc = 0;
+  for (uint32_t i = first; i < index->count && rc == 0; i++) {
+    const archive_block_t *block = &index->blocks[i];
+    char *raw = NULL;
+    if ((rc = __read_block(fd, block, &raw)) < 0) { break; }
+
+    db_header_t header = {._flags = DB_FLAG_COMPACT_RECORDS};
+    entry_codec_t codec;
+    entry_codec_init(&codec, &header);
+    size_t pos = 0;
+    for (uint32_t j = 0; j < block->entries && rc == 0; j++) {
+      todo_entry_t view;
+      size_t consumed = 0;
+      rc = entry_codec_next(&codec, raw + pos, block->raw - pos, &view, &consumed);
+      pos += consumed;
+      if (rc == 0) { ids[len++] = view.entry_id; }
+    }
+    free(raw);
+  }
+  if (rc < 0) {
+    free(ids);
+    return rc == TODOCTL_ERR_INCOMPLETE_ENTRY ? TODOCTL_ERR_CORRUPTED_DB : rc;
+  }
+  *out = ids;
+  *n = len;
+  return 0;
+}
+
+/* takes the archived ids (sorted) out of the sealed segments and the
+ * active db, the caller holds the db lock on `fd` */
+static int __drop_from_db(int fd, const db_header_t *header, const uint64_t *ids, size_t n_ids) {
+  if ((header->_flags & DB_FEATURE_SEGMENTS) && segment_drop_ids(ids, n_ids) < 0) {
+    return STATUS_ERROR;
+  }
+  if (header->_entries == 0) { return 0; }
+
+  todo_entry_t **entries = malloc(sizeof(todo_entry_t *) * header->_entries);
+  if (entries == NULL) {
+    DEBUG_ERROR("failed to allocate entries\n");
+    return STATUS_ERROR;
+  }
+  if (read_entries_from_db(fd, header, entries, NULL, NULL) < 0) {
+    free(entries);
+    return STATUS_ERROR;
+  }
+
+  /* both lists are in id order */
+  size_t kept = 0, at = 0;
+  for (size_t i = 0; i < header->_entries; i++) {
+    while (at < n_ids && ids[at] < entries[i]->entry_id) { at++; }
+    if (at < n_ids && ids[at] == entries[i]->entry_id) {
+      free(entries[i]->entry_raw_data);
+      free(entries[i]);
+      continue;
+    }
+    entries[kept++] = entries[i];
+  }
+
+  int rc = 0;
+  if (kept < header->_entries) {
+    /* the delta log is left alone, applying it again to the kept entries
+     * changes nothing and records of archived ids are never matched */
+    char *buf = NULL;
+    size_t len = 0;
+    rc = encode_entries(entries, kept, &buf, &len);
+    if (rc == 0) {
+      db_header_t rest = *header;
+      rest._entries = (uint32_t)kept;
+      rc = rewrite_db(&rest, buf, len);
+    }
+    free(buf);
+  }
+  db_free_entries(entries, kept);
+  return rc;
+}
+
+/* an archive interrupted after its blocks were published leaves their
+ * entries in the db, they are dropped now and the blocks made visible */
+static int __finish_pending(archive_report_t *report) {
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
+  db_header_t header;
+  archive_index_t index;
+  if (read_header(fd, &header) < 0 || archive_index_load(&index) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+
+  int rc = 0;
+  if (index.pending != ARCHIVE_NO_PENDING) {
+    int afd = __open_archive(O_RDONLY);
+    uint64_t *ids = NULL;
+    size_t n = 0;
+    rc = afd < 0 ? STATUS_ERROR : __block_ids(afd, &index, index.pending, &ids, &n);
+    if (afd >= 0) { close(afd); }
+    if (rc == 0) { rc = __drop_from_db(fd, &header, ids, n); }
+    if (rc == 0) {
+      index.pending = ARCHIVE_NO_PENDING;
+      rc = archive_index_store(&index);
+    }
+    if (rc == 0) { report->recovered += n; }
+    free(ids);
+  }
+
+  archive_index_free(&index);
+  db_unlock(fd);
+  return rc;
+}
+
+int archive_done_before(uint64_t cutoff, archive_report_t *report) {
+  if (report == NULL) { return STATUS_ERROR; }
+  memset(report, 0, sizeof(archive_report_t));
+  if (__finish_pending(report) < 0) { return STATUS_ERROR; }
+
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
+  db_header_t header;
+  if (read_header(fd, &header) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+
+  /* every task with the delta log applied, in id order */
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (db_read_entries(NULL, &entries, &n) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+  size_t victims = 0;
+  for (size_t i = 0; i < n; i++) {
+    todo_entry_t *entry = entries[i];
+    if (entry->_done_at == 0 || entry->_done_at >= cutoff) { continue; }
+    entries[i] = entries[victims];
+    entries[victims++] = entry;
+  }
+  if (victims == 0) {
+    db_free_entries(entries, n);
+    db_unlock(fd);
+    return 0;
+  }
+
+  archive_index_t index;
+  memset(&index, 0, sizeof(index));
+  uint64_t *ids = malloc(sizeof(uint64_t) * victims);
+  int afd = __open_archive(O_RDWR | O_CREAT);
+  int rc = ids == NULL || afd < 0 ? STATUS_ERROR : archive_index_load(&index);
+
+  /* whatever lies past the last published block is from a crashed run */
+  uint64_t end = 0;
+  uint32_t first = 0;
+  if (rc == 0) {
+    first = index.count;
+    if (index.count > 0) {
+      const archive_block_t *last = &index.blocks[index.count - 1];
+      end = last->offset + last->packed;
+    }
+    uint32_t blocks = (uint32_t)((victims + ARCHIVE_BLOCK_ENTRIES - 1) / ARCHIVE_BLOCK_ENTRIES);
+    archive_block_t *grown = realloc(index.blocks, sizeof(archive_block_t) * (index.count + blocks));
+    if (grown == NULL || ftruncate(afd, (off_t)end) < 0) {
+      rc = STATUS_ERROR;
+    } else {
+      index.blocks = grown;
+    }
+  }
+  for (size_t i = 0; rc == 0 && i < victims; i += ARCHIVE_BLOCK_ENTRIES) {
+    size_t take = victims - i < ARCHIVE_BLOCK_ENTRIES ? victims - i : ARCHIVE_BLOCK_ENTRIES;
+    archive_block_t *block = &index.blocks[index.count];
+    if ((rc = __write_block(afd, end, entries + i, take, block)) < 0) { break; }
+    end += block->packed;
+    index.count++;
+    report->raw_bytes += block->raw;
+    report->packed_bytes += block->packed;
+  }
+  if (rc == 0 && fsync(afd) < 0) { rc = STATUS_ERROR; }
+
+  /* the blocks are durable before the index points at them and the index
+   * is durable before the entries leave the db */
+  if (rc == 0) {
+    index.pending = first;
+    rc = archive_index_store(&index);
+  }
+  if (rc == 0) {
+    for (size_t i = 0; i < victims; i++) { ids[i] = entries[i]->entry_id; }
+    rc = __drop_from_db(fd, &header, ids, victims);
+  }
+  if (rc == 0) {
+    index.pending = ARCHIVE_NO_PENDING;
+    rc = archive_index_store(&index);
+  }
+  if (rc == 0) {
+    report->entries = victims;
+    report->blocks = index.count - first;
+  }
+
+  if (afd >= 0) { close(afd); }
+  archive_index_free(&index);
+  free(ids);
+  db_free_entries(entries, n);
+  db_unlock(fd);
+  return rc;
+}
+
+/* true if the block may hold tasks the query wants */
+static bool __block_wanted(const query_t *q, const archive_block_t *block,
+                           todo_entry_t *const *kept, size_t n) {
+  if (q->max_id != 0 && block->min_id > q->max_id) { return false; }
+  if (block->max_id < q->min_id) { return false; }
+  if (q->max_created != 0 && block->min_created > q->max_created) { return false; }
+  if (block->max_created < q->min_created) { return false; }
+  if (!query_wants_ids(q, block->min_id, block->max_id)) { return false; }
+  return query_top_wants(q, kept, n, block->min_id, block->max_id, block->min_created,
+                         block->max_created);
+}
+
+int archive_read_entries(query_t *q, todo_entry_t ***out, size_t *n) {
+  if (out == NULL || n == NULL) { return STATUS_ERROR; }
+
+  archive_index_t index;
+  int rc = archive_index_load(&index);
+  if (rc < 0) { return rc; }
+  /* blocks of an archive that did not finish are still in the db */
+  uint32_t visible = index.pending < index.count ? index.pending : index.count;
+  if (visible == 0) {
+    archive_index_free(&index);
+    return 0;
+  }
+
+  query_t everything;
+  if (q == NULL) {
+    query_compile(NULL, &everything, NULL, 0);
+    q = &everything;
+  }
+
+  int fd = __open_archive(O_RDONLY);
+  if (fd < 0) { rc = STATUS_ERROR; }
+  bool desc = q->ordered && q->order.desc;
+  for (uint32_t k = 0; rc == 0 && k < visible; k++) {
+    const archive_block_t *block = &index.blocks[desc ? visible - 1 - k : k];
+    if (q->empty || !__block_wanted(q, block, *out, *n)) { continue; }
+    char *raw = NULL;
+    if ((rc = __read_block(fd, block, &raw)) < 0) { break; }
+    rc = query_scan_buffer(raw, block->raw, block->entries, q, out, n);
+    free(raw);
+  }
+
+  if (fd >= 0) { close(fd); }
+  if (q == &everything) { query_free(&everything); }
+  archive_index_free(&index);
+  return rc;
+}
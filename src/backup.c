@@ -0,0 +1,555 @@
+#include "todoctl/backup.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <inttypes.h>
+#include <sys/syscall.h>
+
+#define BACKUP_NAME_MAX 64
+#define BACKUP_COPY_CHUNK (1 << 20)
+
+typedef struct {
+  uint32_t generation;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t offset; /* of the db file, backed up */
+  uint32_t deltas;
+} backup_chain_t;
+
+typedef struct {
+  uint32_t generation;
+  uint32_t seq;
+  uint32_t patches;
+  uint64_t from;
+  uint64_t to;
+} backup_delta_t;
+
+static int __path(const char *dir, const char *name, char *out, size_t len) {
+  int n = snprintf(out, len, "%s/%s", dir, name);
+  if (n < 0 || (size_t)n >= len) {
+    DEBUG_ERROR("backup path is too long\n");
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+static void __base_name(uint32_t generation, char *buf, size_t len) {
+  snprintf(buf, len, "base.%u", generation);
+}
+
+static void __delta_name(uint32_t generation, uint32_t seq, char *buf, size_t len) {
+  snprintf(buf, len, "delta.%u.%06u", generation, seq);
+}
+
+/* copies a range between two files, inside the kernel where it can so the
+ * bytes never pass through here. No copy_file_range (old kernels, other
+ * file systems) falls back to reads and writes */
+static int __copy_range(int in, uint64_t in_off, int out, uint64_t out_off, uint64_t len) {
+  int64_t src = (int64_t)in_off, dst = (int64_t)out_off;
+  bool kernel = true;
+  char *buf = NULL;
+  int rc = 0;
+  while (len > 0 && rc == 0) {
+    size_t chunk = len < BACKUP_COPY_CHUNK ? (size_t)len : BACKUP_COPY_CHUNK;
+    ssize_t n = -1;
+#ifdef SYS_copy_file_range
+    if (kernel) {
+      n = syscall(SYS_copy_file_range, in, &src, out, &dst, chunk, 0);
+      if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+        kernel = false;
+        continue;
+      }
+    }
+#else
+    kernel = false;
+#endif
+    if (!kernel) {
+      if (buf == NULL && (buf = malloc(BACKUP_COPY_CHUNK)) == NULL) {
+        rc = STATUS_ERROR;
+        break;
+      }
+      n = pread(in, buf, chunk, (off_t)src);
+      if (n > 0 && pwrite(out, buf, (size_t)n, (off_t)dst) != n) { n = -1; }
+      if (n > 0) {
+        src += n;
+        dst += n;
+      }
+    }
+    if (n <= 0) {
+      /* zero is a source shorter than it claimed */
+      DEBUG_ERROR("failed to copy backup range\n");
+#ifdef DEBUG
+      perror("copy_file_range()");
+#endif
+      rc = STATUS_ERROR;
+      break;
+    }
+    len -= (uint64_t)n;
+  }
+  free(buf);
+  return rc;
+}
+
+/* writes a small file whole through a rename */
+static int __replace(const char *path, const char *buf, size_t len) {
+  char tmp_path[DB_PATH_MAX];
+  int n = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  if (n < 0 || (size_t)n >= sizeof(tmp_path)) { return STATUS_ERROR; }
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    return STATUS_ERROR;
+  }
+  if (write(fd, buf, len) != (ssize_t)len || fsync(fd) < 0) {
+    perror("write()");
+    close(fd);
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  close(fd);
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+static int __read_chain(const char *dir, backup_chain_t *chain) {
+  char path[DB_PATH_MAX];
+  if (__path(dir, BACKUP_CHAIN, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    perror("open()");
+    return STATUS_ERROR;
+  }
+  char buf[BACKUP_CHAIN_SIZE];
+  ssize_t n = pread(fd, buf, sizeof(buf), 0);
+  close(fd);
+  if (n != (ssize_t)sizeof(buf) || schema_get_64(buf) != BACKUP_MAGIC) {
+    DEBUG_ERROR("invalid backup chain magic\n");
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(buf + 8) != BACKUP_VERSION) {
+    DEBUG_ERROR("invalid backup chain version\n");
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+  chain->generation = schema_get_32(buf + 12);
+  chain->dev = schema_get_64(buf + 16);
+  chain->ino = schema_get_64(buf + 24);
+  chain->offset = schema_get_64(buf + 32);
+  chain->deltas = schema_get_32(buf + 40);
+  return 0;
+}
+
+static int __write_chain(const char *dir, const backup_chain_t *chain) {
+  char path[DB_PATH_MAX];
+  if (__path(dir, BACKUP_CHAIN, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  char buf[BACKUP_CHAIN_SIZE];
+  schema_put_64(buf, BACKUP_MAGIC);
+  schema_put_32(buf + 8, BACKUP_VERSION);
+  schema_put_32(buf + 12, chain->generation);
+  schema_put_64(buf + 16, chain->dev);
+  schema_put_64(buf + 24, chain->ino);
+  schema_put_64(buf + 32, chain->offset);
+  schema_put_32(buf + 40, chain->deltas);
+  return __replace(path, buf, sizeof(buf));
+}
+
+int backup_record_patch(uint64_t offset) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(BACKUP_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    DEBUG_ERROR("failed to open patch list\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  char buf[8];
+  schema_put_64(buf, offset);
+  int rc = write(fd, buf, sizeof(buf)) == (ssize_t)sizeof(buf) ? 0 : STATUS_ERROR;
+  close(fd);
+  return rc;
+}
+
+static int __compare_offsets(const void *a, const void *b) {
+  uint64_t oa = *(const uint64_t *)a, ob = *(const uint64_t *)b;
+  return oa < ob ? -1 : oa > ob ? 1 : 0;
+}
+
+/* the distinct patched offsets below `below`, sorted */
+static int __read_patches(uint64_t below, uint64_t **out, uint32_t *n_out) {
+  *out = NULL;
+  *n_out = 0;
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(BACKUP_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return errno == ENOENT ? 0 : STATUS_ERROR; }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+  /* a torn last offset was never followed by its patch */
+  size_t count = (size_t)st.st_size / 8;
+  char *buf = malloc(count * 8 + 1);
+  uint64_t *offsets = malloc(sizeof(uint64_t) * (count + 1));
+  if (buf == NULL || offsets == NULL || pread(fd, buf, count * 8, 0) != (ssize_t)(count * 8)) {
+    close(fd);
+    free(buf);
+    free(offsets);
+    return STATUS_ERROR;
+  }
+  close(fd);
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t offset = schema_get_64(buf + i * 8);
+    /* patches past the backed up part travel with the appended bytes */
+    if (offset >= DB_HEADER_SIZE && offset + 8 <= below) { offsets[n++] = offset; }
+  }
+  free(buf);
+  if (n > 0) { qsort(offsets, n, sizeof(uint64_t), __compare_offsets); }
+  size_t kept = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (kept == 0 || offsets[i] != offsets[kept - 1]) { offsets[kept++] = offsets[i]; }
+  }
+  *out = offsets;
+  *n_out = (uint32_t)kept;
+  return 0;
+}
+
+/* starts the patch list over, the backup just taken holds every patch */
+static int __reset_patches(void) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(BACKUP_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    return STATUS_ERROR;
+  }
+  close(fd);
+  return 0;
+}
+
+/* copies the committed part of the db into a new base */
+static int __write_base(const char *dir, int db, uint32_t generation, uint64_t size) {
+  char name[BACKUP_NAME_MAX];
+  char path[DB_PATH_MAX];
+  __base_name(generation, name, sizeof(name));
+  if (__path(dir, name, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    return STATUS_ERROR;
+  }
+  int rc = __copy_range(db, 0, fd, 0, size);
+  if (rc == 0 && fsync(fd) < 0) { rc = STATUS_ERROR; }
+  close(fd);
+  if (rc < 0) { unlink(path); }
+  return rc;
+}
+
+/* writes the header, the patched times and the appended bytes as the next
+ * delta of the chain */
+static int __write_delta(const char *dir, int db, const backup_delta_t *delta,
+                         const char *header, const uint64_t *patches, uint64_t *written) {
+  size_t head_len = BACKUP_DELTA_HEAD + DB_HEADER_SIZE + (size_t)delta->patches * BACKUP_PATCH_SIZE;
+  char *head = malloc(head_len);
+  if (head == NULL) { return STATUS_ERROR; }
+  schema_put_64(head, BACKUP_MAGIC);
+  schema_put_32(head + 8, BACKUP_VERSION);
+  schema_put_32(head + 12, delta->generation);
+  schema_put_32(head + 16, delta->seq);
+  schema_put_32(head + 20, delta->patches);
+  schema_put_64(head + 24, delta->from);
+  schema_put_64(head + 32, delta->to);
+  memcpy(head + BACKUP_DELTA_HEAD, header, DB_HEADER_SIZE);
+  int rc = 0;
+  for (uint32_t i = 0; i < delta->patches && rc == 0; i++) {
+    char *patch = head + BACKUP_DELTA_HEAD + DB_HEADER_SIZE + (size_t)i * BACKUP_PATCH_SIZE;
+    schema_put_64(patch, patches[i]);
+    /* the value is copied as it sits in the file */
+    if (pread(db, patch + 8, 8, (off_t)patches[i]) != 8) { rc = STATUS_ERROR; }
+  }
+
+  char name[BACKUP_NAME_MAX];
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  __delta_name(delta->generation, delta->seq, name, sizeof(name));
+  if (rc == 0 && (__path(dir, name, path, sizeof(path)) < 0 ||
+                  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))) {
+    rc = STATUS_ERROR;
+  }
+  int fd = rc == 0 ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+  if (rc == 0 && fd < 0) {
+    perror("open()");
+    rc = STATUS_ERROR;
+  }
+  if (rc == 0 && write(fd, head, head_len) != (ssize_t)head_len) { rc = STATUS_ERROR; }
+  if (rc == 0) { rc = __copy_range(db, delta->from, fd, head_len, delta->to - delta->from); }
+  if (rc == 0 && fsync(fd) < 0) { rc = STATUS_ERROR; }
+  if (fd >= 0) { close(fd); }
+  free(head);
+  if (rc == 0 && rename(tmp_path, path) < 0) {
+    perror("rename()");
+    rc = STATUS_ERROR;
+  }
+  if (rc < 0 && fd >= 0) { unlink(tmp_path); }
+  if (rc == 0) { *written = head_len + (delta->to - delta->from); }
+  return rc;
+}
+
+/* removes the files of a generation the chain moved past */
+static void __remove_generation(const char *dir, uint32_t generation, uint32_t deltas) {
+  char name[BACKUP_NAME_MAX];
+  char path[DB_PATH_MAX];
+  __base_name(generation, name, sizeof(name));
+  if (__path(dir, name, path, sizeof(path)) == 0) { unlink(path); }
+  for (uint32_t seq = 1; seq <= deltas; seq++) {
+    __delta_name(generation, seq, name, sizeof(name));
+    if (__path(dir, name, path, sizeof(path)) == 0) { unlink(path); }
+  }
+}
+
+/* the incremental or full backup, the db is locked and `db` a plain
+ * descriptor of the same file */
+static int __backup(const char *dir, int lock, int db, backup_report_t *report) {
+  struct stat st;
+  db_header_t header;
+  if (fstat(db, &st) < 0 || read_header(lock, &header) < 0) { return STATUS_ERROR; }
+  if (header._flags & BACKUP_UNSUPPORTED) {
+    fprintf(stderr, "backup copies the db file alone, it can not hold a db with delta-log, "
+                    "segments, blobs or intern\n");
+    return STATUS_ERROR;
+  }
+
+  backup_chain_t chain;
+  int rc = __read_chain(dir, &chain);
+  if (rc < 0 && rc != TODOCTL_ERR_DB_DOES_NOT_EXIST) { return rc; }
+  bool exists = rc == 0;
+  /* patches made before the feature was on were never listed, the same
+   * goes for a db that was replaced or cut short since */
+  bool full = !exists || !(header._flags & DB_FEATURE_BACKUP) || chain.dev != (uint64_t)st.st_dev ||
+              chain.ino != (uint64_t)st.st_ino || chain.offset > header.filesize;
+  memset(report, 0, sizeof(backup_report_t));
+  report->full = full;
+
+  if (full) {
+    if (!(header._flags & DB_FEATURE_BACKUP)) {
+      db_header_t update = header;
+      update._flags |= DB_FEATURE_BACKUP;
+      if (__UNSAFE__update_db_header(lock, &update, UPDATE_FLAGS) < 0) { return STATUS_ERROR; }
+    }
+    backup_chain_t next = {.generation = exists ? chain.generation + 1 : 1,
+                           .dev = (uint64_t)st.st_dev,
+                           .ino = (uint64_t)st.st_ino,
+                           .offset = header.filesize,
+                           .deltas = 0};
+    if ((rc = __reset_patches()) < 0 ||
+        (rc = __write_base(dir, db, next.generation, header.filesize)) < 0 ||
+        (rc = __write_chain(dir, &next)) < 0) {
+      return rc;
+    }
+    if (exists) { __remove_generation(dir, chain.generation, chain.deltas); }
+    report->deltas = 0;
+    report->bytes = header.filesize;
+    return 0;
+  }
+
+  uint64_t *patches;
+  backup_delta_t delta = {.generation = chain.generation,
+                          .seq = chain.deltas + 1,
+                          .from = chain.offset,
+                          .to = header.filesize};
+  if ((rc = __read_patches(chain.offset, &patches, &delta.patches)) < 0) { return rc; }
+  /* nothing appended or patched, the chain already holds the db */
+  report->deltas = chain.deltas;
+  if (delta.patches == 0 && delta.from == delta.to) {
+    free(patches);
+    return 0;
+  }
+  char raw_header[DB_HEADER_SIZE];
+  if (pread(db, raw_header, sizeof(raw_header), 0) != (ssize_t)sizeof(raw_header)) {
+    free(patches);
+    return STATUS_ERROR;
+  }
+  rc = __write_delta(dir, db, &delta, raw_header, patches, &report->bytes);
+  free(patches);
+  if (rc < 0) { return rc; }
+
+  chain.offset = header.filesize;
+  chain.deltas = delta.seq;
+  if ((rc = __write_chain(dir, &chain)) < 0) { return rc; }
+  report->deltas = chain.deltas;
+  /* a crash before this leaves patches the next delta copies again */
+  return __reset_patches();
+}
+
+int backup_run(const char *dir, backup_report_t *report) {
+  TRACE_FUNC();
+  if (dir == NULL || report == NULL) { return STATUS_ERROR; }
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    perror("mkdir()");
+    return STATUS_ERROR;
+  }
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  /* the lock keeps writers out, a torn tail is recovered before the copy */
+  int lock;
+  if (db_lock(&lock) < 0) { return STATUS_ERROR; }
+  int db = open(path, O_RDONLY);
+  if (db < 0) {
+    perror("open()");
+    db_unlock(lock);
+    return STATUS_ERROR;
+  }
+  int rc = __backup(dir, lock, db, report);
+  close(db);
+  db_unlock(lock);
+  return rc;
+}
+
+static int __read_delta(int fd, backup_delta_t *delta) {
+  char head[BACKUP_DELTA_HEAD];
+  if (pread(fd, head, sizeof(head), 0) != (ssize_t)sizeof(head) ||
+      schema_get_64(head) != BACKUP_MAGIC) {
+    DEBUG_ERROR("invalid backup delta magic\n");
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(head + 8) != BACKUP_VERSION) {
+    DEBUG_ERROR("invalid backup delta version\n");
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+  delta->generation = schema_get_32(head + 12);
+  delta->seq = schema_get_32(head + 16);
+  delta->patches = schema_get_32(head + 20);
+  delta->from = schema_get_64(head + 24);
+  delta->to = schema_get_64(head + 32);
+  return 0;
+}
+
+/* lays one delta over the restored file, which must end where it starts */
+static int __apply_delta(const char *dir, const backup_chain_t *chain, uint32_t seq, int out,
+                         uint64_t *size) {
+  char name[BACKUP_NAME_MAX];
+  char path[DB_PATH_MAX];
+  __delta_name(chain->generation, seq, name, sizeof(name));
+  if (__path(dir, name, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Backup delta %s is missing\n", name);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  backup_delta_t delta;
+  int rc = __read_delta(fd, &delta);
+  if (rc == 0 && (delta.generation != chain->generation || delta.seq != seq ||
+                  delta.from != *size || delta.to < delta.from)) {
+    fprintf(stderr, "Backup delta %s does not follow the chain\n", name);
+    rc = TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  size_t head_len = 0;
+  char *head = NULL;
+  if (rc == 0) {
+    head_len = BACKUP_DELTA_HEAD + DB_HEADER_SIZE + (size_t)delta.patches * BACKUP_PATCH_SIZE;
+    head = malloc(head_len);
+    if (head == NULL) { rc = STATUS_ERROR; }
+  }
+  if (rc == 0 && pread(fd, head, head_len, 0) != (ssize_t)head_len) {
+    rc = TODOCTL_ERR_CORRUPTED_DB;
+  }
+  /* appended bytes first, the patches and header land on top of them */
+  if (rc == 0) { rc = __copy_range(fd, head_len, out, delta.from, delta.to - delta.from); }
+  for (uint32_t i = 0; i < delta.patches && rc == 0; i++) {
+    const char *patch = head + BACKUP_DELTA_HEAD + DB_HEADER_SIZE + (size_t)i * BACKUP_PATCH_SIZE;
+    uint64_t offset = schema_get_64(patch);
+    if (offset + 8 > delta.from || pwrite(out, patch + 8, 8, (off_t)offset) != 8) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+    }
+  }
+  if (rc == 0 && pwrite(out, head + BACKUP_DELTA_HEAD, DB_HEADER_SIZE, 0) != DB_HEADER_SIZE) {
+    rc = STATUS_ERROR;
+  }
+  free(head);
+  close(fd);
+  if (rc == 0) { *size = delta.to; }
+  return rc;
+}
+
+int backup_restore(const char *dir, int flags) {
+  TRACE_FUNC();
+  if (dir == NULL) { return STATUS_ERROR; }
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0 ||
+      db_resolve_path(".restore", tmp_path, sizeof(tmp_path)) < 0) {
+    return STATUS_ERROR;
+  }
+  struct stat st;
+  if (!(flags & RESTORE_FORCE) && stat(path, &st) == 0) {
+    fprintf(stderr, "%s exists, restore --force replaces it\n", path);
+    return STATUS_ERROR;
+  }
+
+  backup_chain_t chain;
+  int rc = __read_chain(dir, &chain);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) { fprintf(stderr, "No backup in %s\n", dir); }
+  if (rc < 0) { return rc; }
+
+  char name[BACKUP_NAME_MAX];
+  char base_path[DB_PATH_MAX];
+  __base_name(chain.generation, name, sizeof(name));
+  if (__path(dir, name, base_path, sizeof(base_path)) < 0) { return STATUS_ERROR; }
+  int base = open(base_path, O_RDONLY);
+  if (base < 0 || fstat(base, &st) < 0) {
+    fprintf(stderr, "Backup base %s is missing\n", name);
+    if (base >= 0) { close(base); }
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  int out = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    perror("open()");
+    close(base);
+    return STATUS_ERROR;
+  }
+  uint64_t size = (uint64_t)st.st_size;
+  rc = __copy_range(base, 0, out, 0, size);
+  close(base);
+  for (uint32_t seq = 1; seq <= chain.deltas && rc == 0; seq++) {
+    rc = __apply_delta(dir, &chain, seq, out, &size);
+  }
+  if (rc == 0 && size != chain.offset) {
+    fprintf(stderr, "Backup chain ends at %" PRIu64 " bytes, expected %" PRIu64 "\n", size,
+            chain.offset);
+    rc = TODOCTL_ERR_CORRUPTED_DB;
+  }
+  if (rc == 0 && fsync(out) < 0) { rc = STATUS_ERROR; }
+  close(out);
+  if (rc < 0) {
+    unlink(tmp_path);
+    return rc;
+  }
+
+  /* writers that hold the old db find it replaced and open the new one */
+  int lock = -1;
+  if (stat(path, &st) == 0 && db_lock_raw(&lock) < 0) {
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    rc = STATUS_ERROR;
+  }
+  if (lock >= 0) { db_unlock(lock); }
+  return rc;
+}
@@ -0,0 +1,485 @@
+#include "todoctl/bitmap.h"
+#include "todoctl/debug.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+
+#define BITMAP_KIND_ARRAY 0
+#define BITMAP_KIND_BITS 1
+#define BITMAP_CONTAINER_HEAD 13
+
+void bitmap_init(bitmap_t *b) {
+  if (b == NULL) { return; }
+  memset(b, 0, sizeof(bitmap_t));
+}
+
+static void __container_free(bitmap_container_t *c) {
+  free(c->array);
+  free(c->bits);
+  memset(c, 0, sizeof(bitmap_container_t));
+}
+
+void bitmap_free(bitmap_t *b) {
+  if (b == NULL) { return; }
+  for (size_t i = 0; i < b->count; i++) { __container_free(&b->containers[i]); }
+  free(b->containers);
+  memset(b, 0, sizeof(bitmap_t));
+}
+
+/* the index of the container with the key, or where it would go */
+static bool __find(const bitmap_t *b, uint64_t key, size_t *idx) {
+  size_t lo = 0, hi = b->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (b->containers[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *idx = lo;
+  return lo < b->count && b->containers[lo].key == key;
+}
+
+/* the first slot of a sorted array holding a value of at least `low` */
+static uint32_t __lower_bound(const bitmap_container_t *c, uint16_t low) {
+  uint32_t lo = 0, hi = c->card;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (c->array[mid] < low) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static bitmap_container_t *__insert_container(bitmap_t *b, size_t idx, uint64_t key) {
+  if (b->count == b->cap) {
+    size_t cap = b->cap < 4 ? 4 : b->cap * 2;
+    bitmap_container_t *grown = realloc(b->containers, sizeof(bitmap_container_t) * cap);
+    if (grown == NULL) {
+      DEBUG_ERROR("failed to grow bitmap\n");
+      return NULL;
+    }
+    b->containers = grown;
+    b->cap = cap;
+  }
+  memmove(&b->containers[idx + 1], &b->containers[idx],
+          sizeof(bitmap_container_t) * (b->count - idx));
+  b->count++;
+  bitmap_container_t *c = &b->containers[idx];
+  memset(c, 0, sizeof(bitmap_container_t));
+  c->key = key;
+  return c;
+}
+
+static void __remove_container(bitmap_t *b, size_t idx) {
+  __container_free(&b->containers[idx]);
+  memmove(&b->containers[idx], &b->containers[idx + 1],
+          sizeof(bitmap_container_t) * (b->count - idx - 1));
+  b->count--;
+}
+
+static void __to_words(const bitmap_container_t *c, uint64_t *words) {
+  if (c->bits != NULL) {
+    memcpy(words, c->bits, sizeof(uint64_t) * BITMAP_WORDS);
+    return;
+  }
+  memset(words, 0, sizeof(uint64_t) * BITMAP_WORDS);
+  for (uint32_t i = 0; i < c->card; i++) { words[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63); }
+}
+
+/* fills an empty container from a bitset in whichever form is smaller */
+static int __from_words(bitmap_container_t *c, const uint64_t *words) {
+  uint32_t card = 0;
+  for (size_t i = 0; i < BITMAP_WORDS; i++) { card += (uint32_t)__builtin_popcountll(words[i]); }
+  if (card > BITMAP_ARRAY_MAX) {
+    c->bits = malloc(sizeof(uint64_t) * BITMAP_WORDS);
+    if (c->bits == NULL) { return STATUS_ERROR; }
+    memcpy(c->bits, words, sizeof(uint64_t) * BITMAP_WORDS);
+    c->card = card;
+    return 0;
+  }
+
+  c->array = malloc(sizeof(uint16_t) * (card > 0 ? card : 1));
+  if (c->array == NULL) { return STATUS_ERROR; }
+  c->cap = card;
+  for (size_t i = 0; i < BITMAP_WORDS; i++) {
+    for (uint64_t w = words[i]; w != 0; w &= w - 1) {
+      c->array[c->card++] = (uint16_t)(i * 64 + (size_t)__builtin_ctzll(w));
+    }
+  }
+  return 0;
+}
+
+static int __container_add(bitmap_container_t *c, uint16_t low) {
+  if (c->bits != NULL) {
+    uint64_t bit = 1ULL << (low & 63);
+    if (!(c->bits[low >> 6] & bit)) {
+      c->bits[low >> 6] |= bit;
+      c->card++;
+    }
+    return 0;
+  }
+
+  uint32_t pos = __lower_bound(c, low);
+  if (pos < c->card && c->array[pos] == low) { return 0; }
+  /* a full array turns into a bitset */
+  if (c->card == BITMAP_ARRAY_MAX) {
+    uint64_t *bits = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    if (bits == NULL) { return STATUS_ERROR; }
+    for (uint32_t i = 0; i < c->card; i++) { bits[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63); }
+    bits[low >> 6] |= 1ULL << (low & 63);
+    free(c->array);
+    c->array = NULL;
+    c->cap = 0;
+    c->bits = bits;
+    c->card++;
+    return 0;
+  }
+  if (c->card == c->cap) {
+    uint32_t cap = c->cap < 4 ? 4 : c->cap * 2;
+    if (cap > BITMAP_ARRAY_MAX) { cap = BITMAP_ARRAY_MAX; }
+    uint16_t *grown = realloc(c->array, sizeof(uint16_t) * cap);
+    if (grown == NULL) { return STATUS_ERROR; }
+    c->array = grown;
+    c->cap = cap;
+  }
+  memmove(&c->array[pos + 1], &c->array[pos], sizeof(uint16_t) * (c->card - pos));
+  c->array[pos] = low;
+  c->card++;
+  return 0;
+}
+
+int bitmap_add(bitmap_t *b, uint64_t id) {
+  if (b == NULL) { return STATUS_ERROR; }
+  size_t idx;
+  bitmap_container_t *c = __find(b, id >> 16, &idx) ? &b->containers[idx]
+                                                    : __insert_container(b, idx, id >> 16);
+  if (c == NULL || __container_add(c, (uint16_t)(id & 0xffff)) < 0) {
+    DEBUG_ERROR("failed to add to bitmap\n");
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+void bitmap_remove(bitmap_t *b, uint64_t id) {
+  size_t idx;
+  if (b == NULL || !__find(b, id >> 16, &idx)) { return; }
+  bitmap_container_t *c = &b->containers[idx];
+  uint16_t low = (uint16_t)(id & 0xffff);
+
+  if (c->bits != NULL) {
+    uint64_t bit = 1ULL << (low & 63);
+    if (!(c->bits[low >> 6] & bit)) { return; }
+    c->bits[low >> 6] &= ~bit;
+    c->card--;
+    /* back to an array once it fits, a failed shrink just stays a bitset */
+    if (c->card <= BITMAP_ARRAY_MAX && c->card > 0) {
+      bitmap_container_t smaller = {.key = c->key};
+      if (__from_words(&smaller, c->bits) == 0) {
+        __container_free(c);
+        *c = smaller;
+      }
+    }
+  } else {
+    uint32_t pos = __lower_bound(c, low);
+    if (pos == c->card || c->array[pos] != low) { return; }
+    memmove(&c->array[pos], &c->array[pos + 1], sizeof(uint16_t) * (c->card - pos - 1));
+    c->card--;
+  }
+  if (c->card == 0) { __remove_container(b, idx); }
+}
+
+bool bitmap_contains(const bitmap_t *b, uint64_t id) {
+  size_t idx;
+  if (b == NULL || !__find(b, id >> 16, &idx)) { return false; }
+  const bitmap_container_t *c = &b->containers[idx];
+  uint16_t low = (uint16_t)(id & 0xffff);
+  if (c->bits != NULL) { return (c->bits[low >> 6] >> (low & 63)) & 1; }
+  uint32_t pos = __lower_bound(c, low);
+  return pos < c->card && c->array[pos] == low;
+}
+
+uint64_t bitmap_cardinality(const bitmap_t *b) {
+  if (b == NULL) { return 0; }
+  uint64_t card = 0;
+  for (size_t i = 0; i < b->count; i++) { card += b->containers[i].card; }
+  return card;
+}
+
+int bitmap_to_array(const bitmap_t *b, uint64_t **out, size_t *n) {
+  if (b == NULL || out == NULL || n == NULL) { return STATUS_ERROR; }
+  *out = NULL;
+  *n = 0;
+  uint64_t card = bitmap_cardinality(b);
+  if (card == 0) { return 0; }
+  uint64_t *ids = malloc(sizeof(uint64_t) * card);
+  if (ids == NULL) {
+    DEBUG_ERROR("failed to allocate id array\n");
+    return STATUS_ERROR;
+  }
+  size_t pos = 0;
+  for (size_t i = 0; i < b->count; i++) {
+    const bitmap_container_t *c = &b->containers[i];
+    uint64_t high = c->key << 16;
+    if (c->bits == NULL) {
+      for (uint32_t j = 0; j < c->card; j++) { ids[pos++] = high | c->array[j]; }
+      continue;
+    }
+    for (size_t w = 0; w < BITMAP_WORDS; w++) {
+      for (uint64_t bits = c->bits[w]; bits != 0; bits &= bits - 1) {
+        ids[pos++] = high | (w * 64 + (uint64_t)__builtin_ctzll(bits));
+      }
+    }
+  }
+  *out = ids;
+  *n = pos;
+  return 0;
+}
+
+static bool __container_intersects(const bitmap_container_t *c, uint16_t lo, uint16_t hi) {
+  if (c->bits == NULL) {
+    uint32_t pos = __lower_bound(c, lo);
+    return pos < c->card && c->array[pos] <= hi;
+  }
+  for (uint32_t v = lo; v <= hi;) {
+    uint64_t word = c->bits[v >> 6] >> (v & 63);
+    uint32_t word_end = (v | 63) + 1;
+    if (word_end > (uint32_t)hi + 1) { word &= (1ULL << ((uint32_t)hi + 1 - v)) - 1; }
+    if (word != 0) { return true; }
+    v = word_end;
+  }
+  return false;
+}
+
+bool bitmap_intersects_range(const bitmap_t *b, uint64_t lo, uint64_t hi) {
+  if (b == NULL || lo > hi) { return false; }
+  size_t idx;
+  __find(b, lo >> 16, &idx);
+  for (; idx < b->count && b->containers[idx].key <= hi >> 16; idx++) {
+    const bitmap_container_t *c = &b->containers[idx];
+    uint16_t c_lo = c->key == lo >> 16 ? (uint16_t)(lo & 0xffff) : 0;
+    uint16_t c_hi = c->key == hi >> 16 ? (uint16_t)(hi & 0xffff) : 0xffff;
+    if (__container_intersects(c, c_lo, c_hi)) { return true; }
+  }
+  return false;
+}
+
+static int __copy_container(bitmap_container_t *dst, const bitmap_container_t *src) {
+  *dst = *src;
+  dst->array = NULL;
+  dst->bits = NULL;
+  if (src->bits != NULL) {
+    dst->bits = malloc(sizeof(uint64_t) * BITMAP_WORDS);
+    if (dst->bits == NULL) { return STATUS_ERROR; }
+    memcpy(dst->bits, src->bits, sizeof(uint64_t) * BITMAP_WORDS);
+    return 0;
+  }
+  dst->cap = src->card;
+  dst->array = malloc(sizeof(uint16_t) * (src->card > 0 ? src->card : 1));
+  if (dst->array == NULL) { return STATUS_ERROR; }
+  memcpy(dst->array, src->array, sizeof(uint16_t) * src->card);
+  return 0;
+}
+
+/* appends a container, empty ones are dropped */
+static int __push_container(bitmap_t *out, const bitmap_container_t *c) {
+  if (c->card == 0) { return 0; }
+  bitmap_container_t *slot = __insert_container(out, out->count, c->key);
+  if (slot == NULL) { return STATUS_ERROR; }
+  *slot = *c;
+  return 0;
+}
+
+int bitmap_copy(bitmap_t *out, const bitmap_t *b) {
+  if (out == NULL || b == NULL) { return STATUS_ERROR; }
+  bitmap_init(out);
+  for (size_t i = 0; i < b->count; i++) {
+    bitmap_container_t c;
+    if (__copy_container(&c, &b->containers[i]) < 0 || __push_container(out, &c) < 0) {
+      __container_free(&c);
+      bitmap_free(out);
+      return STATUS_ERROR;
+    }
+  }
+  return 0;
+}
+
+typedef enum { BITMAP_OP_AND, BITMAP_OP_OR, BITMAP_OP_ANDNOT } bitmap_op_t;
+
+/* containers are combined word by word on a bitset, the result goes back
+ * to an array when that is smaller */
+static int __combine(bitmap_t *out, const bitmap_container_t *a, const bitmap_container_t *b,
+                     uint64_t key, bitmap_op_t op) {
+  uint64_t wa[BITMAP_WORDS], wb[BITMAP_WORDS];
+  if (a != NULL) {
+    __to_words(a, wa);
+  } else {
+    memset(wa, 0, sizeof(wa));
+  }
+  if (b != NULL) {
+    __to_words(b, wb);
+  } else {
+    memset(wb, 0, sizeof(wb));
+  }
+  for (size_t i = 0; i < BITMAP_WORDS; i++) {
+    switch (op) {
+    case BITMAP_OP_AND: wa[i] &= wb[i]; break;
+    case BITMAP_OP_OR: wa[i] |= wb[i]; break;
+    case BITMAP_OP_ANDNOT: wa[i] &= ~wb[i]; break;
+    }
+  }
+  bitmap_container_t c = {.key = key};
+  if (__from_words(&c, wa) < 0 || __push_container(out, &c) < 0) {
+    __container_free(&c);
+    return STATUS_ERROR;
+  }
+  if (c.card == 0) { __container_free(&c); }
+  return 0;
+}
+
+static int __apply(bitmap_t *out, const bitmap_t *a, const bitmap_t *b, bitmap_op_t op) {
+  if (out == NULL || a == NULL || b == NULL) { return STATUS_ERROR; }
+  bitmap_init(out);
+  size_t i = 0, j = 0;
+  int rc = 0;
+  while (rc == 0 && (i < a->count || j < b->count)) {
+    const bitmap_container_t *ca = i < a->count ? &a->containers[i] : NULL;
+    const bitmap_container_t *cb = j < b->count ? &b->containers[j] : NULL;
+    if (ca != NULL && (cb == NULL || ca->key < cb->key)) {
+      /* only in a */
+      if (op != BITMAP_OP_AND) {
+        bitmap_container_t c;
+        rc = __copy_container(&c, ca);
+        if (rc == 0) { rc = __push_container(out, &c); }
+        if (rc < 0) { __container_free(&c); }
+      }
+      i++;
+    } else if (ca == NULL || cb->key < ca->key) {
+      /* only in b */
+      if (op == BITMAP_OP_OR) {
+        bitmap_container_t c;
+        rc = __copy_container(&c, cb);
+        if (rc == 0) { rc = __push_container(out, &c); }
+        if (rc < 0) { __container_free(&c); }
+      }
+      j++;
+    } else {
+      rc = __combine(out, ca, cb, ca->key, op);
+      i++;
+      j++;
+    }
+  }
+  if (rc < 0) {
+    DEBUG_ERROR("failed to combine bitmaps\n");
+    bitmap_free(out);
+  }
+  return rc;
+}
+
+int bitmap_and(bitmap_t *out, const bitmap_t *a, const bitmap_t *b) {
+  return __apply(out, a, b, BITMAP_OP_AND);
+}
+
+int bitmap_or(bitmap_t *out, const bitmap_t *a, const bitmap_t *b) {
+  return __apply(out, a, b, BITMAP_OP_OR);
+}
+
+int bitmap_andnot(bitmap_t *out, const bitmap_t *a, const bitmap_t *b) {
+  return __apply(out, a, b, BITMAP_OP_ANDNOT);
+}
+
+static size_t __container_size(const bitmap_container_t *c) {
+  return BITMAP_CONTAINER_HEAD +
+         (c->bits != NULL ? sizeof(uint64_t) * BITMAP_WORDS : sizeof(uint16_t) * c->card);
+}
+
+size_t bitmap_serialized_size(const bitmap_t *b) {
+  size_t size = 4;
+  for (size_t i = 0; b != NULL && i < b->count; i++) {
+    size += __container_size(&b->containers[i]);
+  }
+  return size;
+}
+
+void bitmap_serialize(const bitmap_t *b, char *buf) {
+  schema_put_32(buf, (uint32_t)b->count);
+  char *p = buf + 4;
+  for (size_t i = 0; i < b->count; i++) {
+    const bitmap_container_t *c = &b->containers[i];
+    schema_put_64(p, c->key);
+    p[8] = c->bits != NULL ? BITMAP_KIND_BITS : BITMAP_KIND_ARRAY;
+    schema_put_32(p + 9, c->card);
+    p += BITMAP_CONTAINER_HEAD;
+    if (c->bits != NULL) {
+      for (size_t w = 0; w < BITMAP_WORDS; w++, p += 8) { schema_put_64(p, c->bits[w]); }
+    } else {
+      for (uint32_t v = 0; v < c->card; v++, p += 2) { schema_put_16(p, c->array[v]); }
+    }
+  }
+}
+
+/* reads one container at `pos`, checking it is in the form the writer
+ * would have picked */
+static int __read_container(const char *buf, size_t len, size_t *pos, const bitmap_t *b,
+                            bitmap_container_t *c) {
+  memset(c, 0, sizeof(bitmap_container_t));
+  if (len - *pos < BITMAP_CONTAINER_HEAD) { return TODOCTL_ERR_CORRUPTED_DB; }
+  c->key = schema_get_64(buf + *pos);
+  uint8_t kind = (uint8_t)buf[*pos + 8];
+  c->card = schema_get_32(buf + *pos + 9);
+  *pos += BITMAP_CONTAINER_HEAD;
+  if ((b->count > 0 && c->key <= b->containers[b->count - 1].key) || c->card == 0 ||
+      kind > BITMAP_KIND_BITS || (kind == BITMAP_KIND_ARRAY) != (c->card <= BITMAP_ARRAY_MAX)) {
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  size_t body =
+      kind == BITMAP_KIND_BITS ? sizeof(uint64_t) * BITMAP_WORDS : sizeof(uint16_t) * c->card;
+  if (len - *pos < body) { return TODOCTL_ERR_CORRUPTED_DB; }
+  const char *p = buf + *pos;
+  *pos += body;
+
+  if (kind == BITMAP_KIND_BITS) {
+    c->bits = malloc(body);
+    if (c->bits == NULL) { return STATUS_ERROR; }
+    uint32_t bits_set = 0;
+    for (size_t w = 0; w < BITMAP_WORDS; w++) {
+      c->bits[w] = schema_get_64(p + w * 8);
+      bits_set += (uint32_t)__builtin_popcountll(c->bits[w]);
+    }
+    return bits_set == c->card ? 0 : TODOCTL_ERR_CORRUPTED_DB;
+  }
+  c->array = malloc(body);
+  if (c->array == NULL) { return STATUS_ERROR; }
+  c->cap = c->card;
+  for (uint32_t v = 0; v < c->card; v++) {
+    c->array[v] = schema_get_16(p + v * 2);
+    if (v > 0 && c->array[v] <= c->array[v - 1]) { return TODOCTL_ERR_CORRUPTED_DB; }
+  }
+  return 0;
+}
+
+int bitmap_deserialize(bitmap_t *b, const char *buf, size_t len, size_t *consumed) {
+  if (b == NULL || buf == NULL) { return STATUS_ERROR; }
+  bitmap_init(b);
+  if (len < 4) { return TODOCTL_ERR_CORRUPTED_DB; }
+  uint32_t count = schema_get_32(buf);
+  size_t pos = 4;
+
+  for (uint32_t i = 0; i < count; i++) {
+    /* anything left in `c` on failure is its own, never a pushed container */
+    bitmap_container_t c = {0};
+    int rc = __read_container(buf, len, &pos, b, &c);
+    if (rc == 0) { rc = __push_container(b, &c); }
+    if (rc < 0) {
+      DEBUG_ERROR("failed to read bitmap\n");
+      __container_free(&c);
+      bitmap_free(b);
+      return rc;
+    }
+  }
+  if (consumed != NULL) { *consumed = pos; }
+  return 0;
+}
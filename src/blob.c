@@ -0,0 +1,157 @@
+#include "todoctl/blob.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+#include "todoctl/util.h"
+
+static int __open_blobs(int flags) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(BLOB_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    DEBUG_ERROR("failed to open blob file\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return errno == ENOENT ? TODOCTL_ERR_DB_DOES_NOT_EXIST : STATUS_ERROR;
+  }
+  return fd;
+}
+
+int blob_append(const char *text, size_t n, uint64_t *offset) {
+  if (text == NULL || offset == NULL) { return STATUS_ERROR; }
+
+  int fd = __open_blobs(O_WRONLY | O_APPEND | O_CREAT);
+  if (fd < 0) { return STATUS_ERROR; }
+
+  off_t end = lseek(fd, 0, SEEK_END);
+  if (end < 0) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  char header[BLOB_HEADER_SIZE];
+  schema_put_64(header, n);
+  schema_put_32(header + 8, crc32_update(0, text, n));
+
+  /* the text goes out from the caller's buffer as is */
+  struct iovec iov[2] = {
+      {.iov_base = header, .iov_len = sizeof(header)},
+      {.iov_base = (void *)text, .iov_len = n},
+  };
+  if (writev_all(fd, iov, 2) < 0) {
+    DEBUG_ERROR("failed to append blob\n");
+#ifdef DEBUG
+    perror("writev()");
+#endif
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  close(fd);
+  *offset = (uint64_t)end;
+  return 0;
+}
+
+/* reads and checks the record header, returns the crc it carries */
+static int __read_header(int fd, uint64_t offset, uint64_t len, uint32_t *crc) {
+  char header[BLOB_HEADER_SIZE];
+  if (pread(fd, header, sizeof(header), (off_t)offset) != (ssize_t)sizeof(header)) {
+    DEBUG_ERROR("failed to read blob header\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  if (schema_get_64(header) != len) {
+    DEBUG_ERROR("blob length does not match the entry\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  *crc = schema_get_32(header + 8);
+  return 0;
+}
+
+int blob_read(uint64_t offset, uint64_t len, char **out) {
+  if (out == NULL) { return STATUS_ERROR; }
+  int fd = __open_blobs(O_RDONLY);
+  if (fd < 0) { return fd; }
+
+  uint32_t crc;
+  int rc = __read_header(fd, offset, len, &crc);
+  if (rc < 0) {
+    close(fd);
+    return rc;
+  }
+
+  char *text = malloc((size_t)len + 1);
+  if (text == NULL) {
+    DEBUG_ERROR("failed to allocate blob text\n");
+    close(fd);
+    return STATUS_ERROR;
+  }
+  if (pread(fd, text, (size_t)len, (off_t)(offset + BLOB_HEADER_SIZE)) != (ssize_t)len) {
+    DEBUG_ERROR("failed to read blob text\n");
+    free(text);
+    close(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  close(fd);
+
+  if (crc32_update(0, text, (size_t)len) != crc) {
+    DEBUG_ERROR("blob checksum mismatch\n");
+    free(text);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  text[len] = '\0';
+  *out = text;
+  return 0;
+}
+
+int blob_stream(uint64_t offset, uint64_t len, int (*fn)(void *, const char *, size_t),
+                void *ctx) {
+  if (fn == NULL) { return STATUS_ERROR; }
+  int fd = __open_blobs(O_RDONLY);
+  if (fd < 0) { return fd; }
+
+  uint32_t expected;
+  int rc = __read_header(fd, offset, len, &expected);
+  if (rc < 0) {
+    close(fd);
+    return rc;
+  }
+
+  char chunk[BLOB_READ_CHUNK];
+  uint32_t crc = 0;
+  uint64_t done = 0;
+  while (done < len) {
+    size_t want = len - done < sizeof(chunk) ? (size_t)(len - done) : sizeof(chunk);
+    ssize_t n = pread(fd, chunk, want, (off_t)(offset + BLOB_HEADER_SIZE + done));
+    if (n <= 0) {
+      DEBUG_ERROR("failed to read blob text\n");
+      close(fd);
+      return TODOCTL_ERR_CORRUPTED_DB;
+    }
+    crc = crc32_update(crc, chunk, (size_t)n);
+    if (fn(ctx, chunk, (size_t)n) < 0) {
+      close(fd);
+      return STATUS_ERROR;
+    }
+    done += (uint64_t)n;
+  }
+  close(fd);
+
+  /* what was handed out is already out, at least say it was wrong */
+  if (crc != expected) {
+    DEBUG_ERROR("blob checksum mismatch\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  return 0;
+}
+
+static int __to_stream(void *ctx, const char *chunk, size_t n) {
+  return fwrite(chunk, 1, n, (FILE *)ctx) == n ? 0 : STATUS_ERROR;
+}
+
+int blob_copy_to(uint64_t offset, uint64_t len, FILE *stream) {
+  if (stream == NULL) { return STATUS_ERROR; }
+  return blob_stream(offset, len, __to_stream, stream);
+}
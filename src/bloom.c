@@ -0,0 +1,176 @@
+#include "todoctl/bloom.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/storage.h"
+#include "todoctl/util.h"
+
+#define BLOOM_KEY_ID 'i'
+#define BLOOM_KEY_TOKEN 't'
+
+/* fnv-1a over a tagged key, the tag keeps ids and tokens from colliding */
+static uint64_t __hash(char tag, const void *key, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  h = (h ^ (uint8_t)tag) * 0x100000001b3ULL;
+  const uint8_t *bytes = (const uint8_t *)key;
+  for (size_t i = 0; i < n; i++) { h = (h ^ bytes[i]) * 0x100000001b3ULL; }
+  /* fnv leaves the low bits poorly mixed for short keys, finish it off */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* the k probes are derived from two halves of one hash (Kirsch-Mitzenmacher)
+ * instead of hashing the key k times */
+static void __add(bloom_t *bloom, uint64_t h) {
+  uint32_t h1 = (uint32_t)h;
+  uint32_t h2 = (uint32_t)(h >> 32) | 1;
+  for (uint32_t i = 0; i < bloom->hashes; i++) {
+    uint32_t bit = (h1 + i * h2) % bloom->nbits;
+    bloom->bits[bit / 8] |= (uint8_t)(1 << (bit % 8));
+  }
+  bloom->keys++;
+}
+
+static bool __has(const bloom_t *bloom, uint64_t h) {
+  if (bloom->nbits == 0) { return false; }
+  uint32_t h1 = (uint32_t)h;
+  uint32_t h2 = (uint32_t)(h >> 32) | 1;
+  for (uint32_t i = 0; i < bloom->hashes; i++) {
+    uint32_t bit = (h1 + i * h2) % bloom->nbits;
+    if (!(bloom->bits[bit / 8] & (1 << (bit % 8)))) { return false; }
+  }
+  return true;
+}
+
+int bloom_init(bloom_t *bloom, size_t keys) {
+  if (bloom == NULL) { return STATUS_ERROR; }
+  memset(bloom, 0, sizeof(bloom_t));
+
+  /* round up to whole bytes, never go below a single word */
+  size_t nbits = keys * BLOOM_BITS_PER_KEY;
+  if (nbits < 64) { nbits = 64; }
+  nbits = (nbits + 7) & ~(size_t)7;
+  if (nbits > UINT32_MAX) { return TODOCTL_ERR_BUFFER_TOO_SMALL; }
+
+  bloom->bits = calloc(nbits / 8, 1);
+  if (bloom->bits == NULL) {
+    DEBUG_ERROR("failed to allocate bloom filter\n");
+    return STATUS_ERROR;
+  }
+  bloom->nbits = (uint32_t)nbits;
+  bloom->hashes = BLOOM_HASHES;
+  return 0;
+}
+
+void bloom_free(bloom_t *bloom) {
+  if (bloom == NULL) { return; }
+  free(bloom->bits);
+  memset(bloom, 0, sizeof(bloom_t));
+}
+
+void bloom_add_id(bloom_t *bloom, uint64_t entry_id) {
+  char key[8];
+  schema_put_64(key, entry_id);
+  __add(bloom, __hash(BLOOM_KEY_ID, key, sizeof(key)));
+}
+
+void bloom_add_token(bloom_t *bloom, const char *token, size_t n) {
+  __add(bloom, __hash(BLOOM_KEY_TOKEN, token, n));
+}
+
+bool bloom_has_id(const bloom_t *bloom, uint64_t entry_id) {
+  char key[8];
+  schema_put_64(key, entry_id);
+  return __has(bloom, __hash(BLOOM_KEY_ID, key, sizeof(key)));
+}
+
+bool bloom_has_token(const bloom_t *bloom, const char *token, size_t n) {
+  return __has(bloom, __hash(BLOOM_KEY_TOKEN, token, n));
+}
+
+size_t bloom_entry_keys(const todo_entry_t *entry) {
+  char token[TEXT_TOKEN_MAX];
+  size_t pos = 0;
+  size_t keys = 1;
+  if (entry->entry_raw_data == NULL) { return keys; }
+  while (text_next_token(entry->entry_raw_data, entry->entry_raw_data_len, &pos, token) > 0) {
+    keys++;
+  }
+  return keys;
+}
+
+void bloom_add_entry(bloom_t *bloom, const todo_entry_t *entry) {
+  bloom_add_id(bloom, entry->entry_id);
+  if (entry->entry_raw_data == NULL) { return; }
+
+  char token[TEXT_TOKEN_MAX];
+  size_t pos = 0;
+  size_t len;
+  while ((len = text_next_token(entry->entry_raw_data, entry->entry_raw_data_len, &pos, token)) >
+         0) {
+    bloom_add_token(bloom, token, len);
+  }
+}
+
+int bloom_write(int fd, const bloom_t *bloom) {
+  char footer[BLOOM_FOOTER_SIZE];
+  schema_put_32(footer, bloom->nbits);
+  schema_put_32(footer + 4, bloom->hashes);
+  schema_put_64(footer + 8, bloom->keys);
+  schema_put_64(footer + 16, BLOOM_MAGIC);
+
+  struct iovec iov[2] = {
+      {.iov_base = bloom->bits, .iov_len = bloom->nbits / 8},
+      {.iov_base = footer, .iov_len = sizeof(footer)},
+  };
+  if (storage_append(fd, iov, 2, NULL) < 0) {
+    DEBUG_ERROR("failed to write bloom filter\n");
+#ifdef DEBUG
+    perror("storage_append()");
+#endif
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int bloom_read(int fd, off_t size, bloom_t *out) {
+  if (out == NULL || size < BLOOM_FOOTER_SIZE) { return TODOCTL_ERR_CORRUPTED_DB; }
+  memset(out, 0, sizeof(bloom_t));
+
+  char footer[BLOOM_FOOTER_SIZE];
+  if (storage_read_at(fd, footer, sizeof(footer), (uint64_t)(size - BLOOM_FOOTER_SIZE)) !=
+      (ssize_t)sizeof(footer)) {
+    DEBUG_ERROR("failed to read bloom footer\n");
+    return STATUS_ERROR;
+  }
+
+  if (schema_get_64(footer + 16) != BLOOM_MAGIC) {
+    DEBUG_ERROR("invalid bloom magic\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  out->nbits = schema_get_32(footer);
+  out->hashes = schema_get_32(footer + 4);
+  out->keys = schema_get_64(footer + 8);
+
+  size_t nbytes = out->nbits / 8;
+  if (out->nbits == 0 || out->nbits % 8 != 0 || (off_t)nbytes > size - BLOOM_FOOTER_SIZE) {
+    DEBUG_ERROR("invalid bloom size\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  out->bits = malloc(nbytes);
+  if (out->bits == NULL) {
+    DEBUG_ERROR("failed to allocate bloom filter\n");
+    return STATUS_ERROR;
+  }
+  uint64_t bits_at = (uint64_t)(size - BLOOM_FOOTER_SIZE - (off_t)nbytes);
+  if (storage_read_at(fd, out->bits, nbytes, bits_at) != (ssize_t)nbytes) {
+    DEBUG_ERROR("failed to read bloom filter\n");
+    bloom_free(out);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
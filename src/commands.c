@@ -1,59 +1,310 @@
 #include "todoctl/commands.h"
+#include "todoctl/archive.h"
+#include "todoctl/backup.h"
 #include "todoctl/db.h"
 #include "todoctl/debug.h"
+#include "todoctl/delta.h"
+#include "todoctl/due.h"
 #include "todoctl/entry.h"
 #include "todoctl/errors.h"
+#include "todoctl/history.h"
+#include "todoctl/merge.h"
+#include "todoctl/multi.h"
+#include "todoctl/output.h"
+#include "todoctl/perf.h"
+#include "todoctl/recover.h"
+#include "todoctl/segment.h"
+#include "todoctl/stats.h"
+#include "todoctl/storage.h"
+#include "todoctl/tags.h"
+#include "todoctl/trace.h"
+#include "todoctl/trigram.h"
+#include "todoctl/util.h"
+#include "todoctl/watch.h"
+
+#include <inttypes.h>
 #include <unistd.h>
 
-int add_task_command(const char *task) {
+int add_task_command(const char *task, char *const *tags, size_t n_tags, uint64_t due_at) {
+  TRACE_FUNC();
   if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
-  /* build this entry from the user's task */
-  todo_entry_t *entry = NULL;
-  if (build_entry(task, &entry) < 0) { return STATUS_ERROR; }
-  /* encode and flush into the database */
-  char encoded_buffer[MAX_TODO_TEXT_LENGTH];
-  size_t bytes_written = 0;
-  if (encode_entry(entry, encoded_buffer, MAX_TODO_TEXT_LENGTH, &bytes_written)) {
+  if (n_tags > TAGS_MAX_PER_TASK) {
+    fprintf(stderr, "A task takes at most %d tags\n", TAGS_MAX_PER_TASK);
+    return TODOCTL_ERR_INVALID_TAG;
+  }
+  for (size_t i = 0; i < n_tags; i++) {
+    if (!tags_valid_name(tags[i])) {
+      fprintf(stderr, "Invalid tag: %s (a-z, 0-9, '-' and '_', at most %d)\n", tags[i],
+              TAGS_NAME_MAX);
+      return TODOCTL_ERR_INVALID_TAG;
+    }
+  }
+  /* appends are serialized with each other and with rewrites of the db */
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
+  db_header_t header;
+  if (read_header(fd, &header) < 0) {
+    db_unlock(fd);
     return STATUS_ERROR;
   }
-  if (write_to_db(encoded_buffer, bytes_written) < 0) { return STATUS_ERROR; }
-  wordexp_t exp_res;
-  wordexp(DEFAULT_DB_PATH, &exp_res, 0);
-  int fd = open(exp_res.we_wordv[0], O_RDWR);
-  wordfree(&exp_res);
-  if (fd < 0) {
-    DEBUG_ERROR("failed to open db file\n");
-#ifdef DEBUG
-    perror("open()");
-#endif
-    close(fd);
+  /* build this entry from the user's task, the text is never copied */
+  todo_entry_t entry;
+  if (init_entry(task, strlen(task), &entry) < 0) {
+    db_unlock(fd);
     return STATUS_ERROR;
   }
-  /* update the header with the details */
+  /* the same text added again only costs a reference */
+  if ((header._flags & DB_FEATURE_INTERN) && entry_intern(&entry) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+  /* long texts go to the blob file, the entry only references them */
+  if (entry_spill_text(&entry) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+  /* older binaries must not read a db that references the blob file, nor
+   * change one without keeping the tag index up to date */
+  db_header_t update = header;
+  update._flags = header._flags | (entry._in_blob ? DB_FEATURE_BLOBS : 0) |
+                  (n_tags > 0 ? DB_FEATURE_TAGS : 0) | (due_at > 0 ? DB_FEATURE_DUE : 0);
+  if (update._flags != header._flags && __UNSAFE__update_db_header(fd, &update, UPDATE_FLAGS) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+  /* the entry and its commit go out as one batch, a crash before the
+   * header lands leaves an uncommitted tail that the next open recovers
+   * (see recover.h) */
+  update._entries = header._entries + 1;
+  update._last_entry_id = entry.entry_id;
+  update.filesize = header.filesize + (uint32_t)entry_encoded_size(&entry);
+  if (append_entry_commit(fd, &entry, &update) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+  /* see if the active db grew big enough to be sealed */
+  bool seal = (header._flags & DB_FEATURE_SEGMENTS) && header._entries + 1 >= SEGMENT_MAX_ENTRIES;
+  db_unlock(fd);
+  if (stats_record_add(&entry) < 0) { DEBUG_WARN("failed to update stats block\n"); }
+  /* the first tag builds the index from what is there, the new task included */
+  if ((update._flags & DB_FEATURE_TAGS) && tags_record_add(entry.entry_id, tags, n_tags) < 0) {
+    fprintf(stderr, "Added task %" PRIu64 " but failed to record its tags.\n", entry.entry_id);
+  }
+  if (due_at > 0 && due_record_add(entry.entry_id, due_at) < 0) {
+    fprintf(stderr, "Added task %" PRIu64 " but failed to record its due time.\n",
+            entry.entry_id);
+  }
+  if ((update._flags & DB_FEATURE_HISTORY) && history_record_add(&entry) < 0) {
+    DEBUG_WARN("failed to update history\n");
+  }
+  /* substring queries trust the index, a task missing from it goes unseen */
+  if ((update._flags & DB_FEATURE_TRIGRAMS) &&
+      trigram_record_add(entry.entry_id, task, strlen(task)) < 0) {
+    fprintf(stderr, "Added task %" PRIu64 " but failed to index it, run `search --rebuild`.\n",
+            entry.entry_id);
+  }
+  if (seal && segment_seal() < 0) { DEBUG_WARN("failed to seal the active db\n"); }
+  return 0;
+}
+
+/* runs a compiled query across the sealed segments and the active db */
+static int __run_query(query_t *q, int explain, int format) {
+  TRACE_FUNC();
+  bloom_counters_t counters = {0};
+  segment_range_t range;
+  segment_range_from_query(q, &range, &counters);
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (db_read_entries(&range, &entries, &n) < 0) { return STATUS_ERROR; }
+  if (stats_record_bloom(&counters) < 0) { DEBUG_WARN("failed to update stats block\n"); }
+
+  /* the query already dropped everything that does not match, a top-k
+   * heap still needs putting in order */
+  query_sort(q, entries, n);
+  int rc = print_entries_as((const todo_entry_t **)entries, n, PRINT_ALL, format);
+  db_free_entries(entries, n);
+  if (explain) { query_explain(q, stderr); }
+  return rc;
+}
+
+/* the print flags are just canned queries */
+static const char *__list_query(int flags) {
+  if ((flags & PRINT_ONLY_ACTIVE) && (flags & PRINT_EXCEPT_DELETED)) {
+    return "done=false and deleted=false";
+  } else if (flags & PRINT_ONLY_ACTIVE) {
+    return "done=false";
+  } else if (flags & PRINT_EXCEPT_DELETED) {
+    return "deleted=false";
+  }
+  return "";
+}
+
+int list_tasks_command(int flags, const query_order_t *order) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  const char *src = __list_query(flags);
+
+  query_t q;
+  if (query_compile(src, &q, NULL, 0) < 0) { return STATUS_ERROR; }
+  if ((order != NULL && query_order(&q, order) < 0) ||
+      ((flags & PRINT_WITH_ARCHIVE) && query_with_archive(&q) < 0)) {
+    query_free(&q);
+    return STATUS_ERROR;
+  }
+  int rc = __run_query(&q, 0, OUTPUT_PLAIN);
+  query_free(&q);
+  return rc;
+}
+
+/* the feature flags of the db */
+static int __read_flags(uint32_t *flags) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd;
+  if (storage_open(path, O_RDONLY, &fd) < 0) { return STATUS_ERROR; }
   db_header_t header;
-  header._entries = 1;
-  header._last_entry_id = entry->entry_id;
-  header.filesize = (uint32_t)bytes_written;
-  __UNSAFE__update_db_header(fd, &header,
-                             UPDATE_LAST_ENTRY | UPDATE_FILESIZE_ADD | UPDATE_ENTRIES_COUNT |
-                                 UPDATE_ENTRIES_COUNT_INCR);
-  close(fd);
+  int rc = read_header(fd, &header);
+  storage_close(fd);
+  if (rc < 0) { return rc; }
+  *flags = header._flags;
   return 0;
 }
 
-int list_tasks_command(int flags) {
+/* the state of the db at a time, only kept with the history feature */
+static int __history_at(uint64_t as_of, history_state_t *state) {
+  uint32_t flags = 0;
+  int rc = __read_flags(&flags);
+  if (rc < 0) { return rc; }
+  if (!(flags & DB_FEATURE_HISTORY)) {
+    fprintf(stderr, "--as-of needs the history, run `feature enable history` first\n");
+    return STATUS_ERROR;
+  }
+  return history_state_at(as_of, state);
+}
+
+/* the entries say what is true now, make them say what was true then.
+ * When a task was done back then, undone and done again since, the first
+ * time is gone and it shows as done at `as_of` */
+static void __entry_as_of(todo_entry_t *entry, const history_state_t *state, uint64_t as_of) {
+  if (!bitmap_contains(&state->done, entry->entry_id)) {
+    entry->_done_at = 0;
+  } else if (entry->_done_at == 0 || entry->_done_at > as_of) {
+    entry->_done_at = as_of;
+  }
+  if (!bitmap_contains(&state->deleted, entry->entry_id)) { entry->_deleted_at = 0; }
+}
+
+int list_tasks_as_of_command(int flags, const query_order_t *order, uint64_t as_of) {
+  TRACE_FUNC();
   if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
-  wordexp_t exp_res;
-  wordexp(DEFAULT_DB_PATH, &exp_res, 0);
-  int fd = open(exp_res.we_wordv[0], O_RDONLY);
-  wordfree(&exp_res);
-  if (fd < 0) {
-    DEBUG_ERROR("failed to open db file\n");
-#ifdef DEBUG
-    perror("open()");
-#endif
+  history_state_t state;
+  if (__history_at(as_of, &state) < 0) { return STATUS_ERROR; }
+
+  /* the ids come from the state back then, no predicate on what the
+   * entries say now. Tasks open back then may well be archived by now */
+  query_t q;
+  if (query_compile("", &q, NULL, 0) < 0) {
+    history_state_free(&state);
+    return STATUS_ERROR;
+  }
+  int rc = 0;
+  q.candidates = calloc(1, sizeof(bitmap_t));
+  if (q.candidates == NULL) {
+    rc = STATUS_ERROR;
+  } else if (flags & PRINT_EXCEPT_DELETED) {
+    rc = bitmap_andnot(q.candidates, &state.all, &state.deleted);
+  } else {
+    rc = bitmap_copy(q.candidates, &state.all);
+  }
+  if (rc == 0 && (flags & PRINT_ONLY_ACTIVE)) {
+    bitmap_t open;
+    rc = bitmap_andnot(&open, q.candidates, &state.done);
+    if (rc == 0) {
+      bitmap_free(q.candidates);
+      *q.candidates = open;
+    }
+  }
+  if (rc == 0 && ((order != NULL && query_order(&q, order) < 0) || query_with_archive(&q) < 0)) {
+    rc = STATUS_ERROR;
+  }
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (rc == 0) {
+    segment_range_t range;
+    segment_range_from_query(&q, &range, NULL);
+    rc = db_read_entries(&range, &entries, &n);
+  }
+  for (size_t i = 0; rc == 0 && i < n; i++) { __entry_as_of(entries[i], &state, as_of); }
+  if (rc == 0) {
+    query_sort(&q, entries, n);
+    rc = print_entries_as((const todo_entry_t **)entries, n, PRINT_ALL, OUTPUT_PLAIN);
+  }
+  db_free_entries(entries, n);
+  query_free(&q);
+  history_state_free(&state);
+  return rc;
+}
+
+int query_command(const char *src, int flags, int format, const query_order_t *order) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  query_t q;
+  char err[256];
+  if (query_compile(src, &q, err, sizeof(err)) < 0) {
+    fprintf(stderr, "Invalid query: %s\n", err);
+    return TODOCTL_ERR_INVALID_QUERY;
+  }
+  if (order != NULL && query_order(&q, order) < 0) {
+    fprintf(stderr, "Invalid query: too many predicates to sort by done\n");
+    query_free(&q);
+    return TODOCTL_ERR_INVALID_QUERY;
+  }
+  if ((flags & QUERY_WITH_ARCHIVE) && query_with_archive(&q) < 0) {
+    query_free(&q);
+    return STATUS_ERROR;
+  }
+  int rc = __run_query(&q, flags & QUERY_EXPLAIN, format);
+  query_free(&q);
+  return rc;
+}
+
+int multi_query_command(char *const *dbs, size_t n, const char *src, int flags, int format,
+                        const query_order_t *order) {
+  TRACE_FUNC();
+  /* a bad query is reported once here instead of by every worker */
+  query_t q;
+  char err[256];
+  if (query_compile(src, &q, err, sizeof(err)) < 0) {
+    fprintf(stderr, "Invalid query: %s\n", err);
+    return TODOCTL_ERR_INVALID_QUERY;
+  }
+  query_free(&q);
+
+  todo_entry_t **entries = NULL;
+  size_t count = 0;
+  bool archive = (flags & QUERY_WITH_ARCHIVE) != 0;
+  if (multi_read_entries(dbs, n, src, archive, order, &entries, &count) < 0) {
     return STATUS_ERROR;
   }
+  int rc = print_entries_as((const todo_entry_t **)entries, count, PRINT_ALL, format);
+  db_free_entries(entries, count);
+  return rc;
+}
+
+int multi_list_tasks_command(char *const *dbs, size_t n, int flags, const query_order_t *order) {
+  int query_flags = (flags & PRINT_WITH_ARCHIVE) ? QUERY_WITH_ARCHIVE : 0;
+  return multi_query_command(dbs, n, __list_query(flags), query_flags, OUTPUT_PLAIN, order);
+}
+
+static int __update_task_status(const uint64_t id, delta_kind_t kind) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  /* the lookup and the patch are one read-modify-write, the stats, the
+   * indexes and the history follow the patch under the same lock */
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
   /* read into header */
   db_header_t *header = (db_header_t *)malloc(sizeof(db_header_t));
   if (header == NULL) {
@@ -61,74 +312,762 @@ int list_tasks_command(int flags) {
 #ifdef DEBUG
     perror("malloc()");
 #endif
-    close(fd);
+    db_unlock(fd);
     return STATUS_ERROR;
   }
   if (read_header(fd, header) < 0) {
     free(header);
-    close(fd);
+    db_unlock(fd);
     return STATUS_ERROR;
   }
-  /* read entries from the db */
-  todo_entry_t **entries = malloc(sizeof(todo_entry_t *) * header->_entries);
-  if (entries == NULL) {
-    DEBUG_ERROR("failed to allocate entries\n");
-#ifdef DEBUG
-    perror("malloc()");
-#endif
+  /* sealed entries live in their segment, only the manifest knows which */
+  int target_fd = fd;
+  db_header_t target_header = *header;
+  if (header->_flags & DB_FEATURE_SEGMENTS) {
+    manifest_t manifest;
+    if (manifest_load(&manifest) < 0) {
+      free(header);
+      db_unlock(fd);
+      return STATUS_ERROR;
+    }
+    if (id <= manifest.sealed_through_id) {
+      bloom_counters_t counters = {0};
+      int idx = segment_find(&manifest, id);
+      if (idx < 0 || !segment_may_hold_id(&manifest.segments[idx], id, &counters) ||
+          segment_open(&manifest.segments[idx], &target_fd, &target_header) < 0) {
+        DEBUG_ERROR("no segment holds the entry\n");
+        stats_record_bloom(&counters);
+        manifest_free(&manifest);
+        free(header);
+        db_unlock(fd);
+        return STATUS_ERROR;
+      }
+      stats_record_bloom(&counters);
+    }
+    manifest_free(&manifest);
+  }
+  /* find the entry and apply the change, in place or through the log */
+  todo_entry_t before, after;
+  int rc = update_entry_status(target_fd, &target_header, id, kind, &before, &after);
+  if (target_fd != fd) { storage_close(target_fd); }
+  if (rc < 0) {
+    DEBUG_ERROR("failed to update entry\n");
     free(header);
-    close(fd);
+    db_unlock(fd);
     return STATUS_ERROR;
   }
-  if (read_entries_from_db(fd, header, entries, NULL, NULL) < 0) { return STATUS_ERROR; }
-  /* print entries */
-  print_entries((const todo_entry_t **)entries, header->_entries, flags);
-  /* free all the entries */
-  for (size_t i = 0; i < header->_entries; i++) {
-    free(entries[i]->entry_raw_data);
-    free(entries[i]);
+  if (rc == 0 && stats_record_change(&before, &after) < 0) {
+    DEBUG_WARN("failed to update stats block\n");
+  }
+  if (rc == 0 && (header->_flags & DB_FEATURE_TAGS) && tags_record_change(&after) < 0) {
+    DEBUG_WARN("failed to update tag index\n");
+  }
+  if (rc == 0 && (header->_flags & DB_FEATURE_DUE) && due_record_change(&after) < 0) {
+    DEBUG_WARN("failed to update due index\n");
+  }
+  if (rc == 0 && (header->_flags & DB_FEATURE_HISTORY) &&
+      history_record_change(&before, &after) < 0) {
+    DEBUG_WARN("failed to update history\n");
   }
   free(header);
-  close(fd);
+  db_unlock(fd);
   return 0;
 }
 
 int mark_task_done(const uint64_t id) {
+  return __update_task_status(id, DELTA_DONE);
+}
+
+int mark_task_undone(const uint64_t id) {
+  return __update_task_status(id, DELTA_UNDONE);
+}
+
+int delete_task_command(const uint64_t id) {
+  return __update_task_status(id, DELTA_DELETE);
+}
+
+/* folds the delta log into the entries and rewrites the db with them */
+static int __compact(int fd, const db_header_t *header) {
+  manifest_t manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  if (header->_flags & DB_FEATURE_SEGMENTS) {
+    delta_map_t deltas;
+    if (delta_map_load(&deltas) < 0) { return STATUS_ERROR; }
+    int rc = segment_fold_deltas(&deltas);
+    delta_map_free(&deltas);
+    if (rc < 0 || manifest_load(&manifest) < 0) { return STATUS_ERROR; }
+    manifest_free(&manifest);
+  }
+
+  todo_entry_t **entries = malloc(sizeof(todo_entry_t *) * (header->_entries + 1));
+  if (entries == NULL) {
+    DEBUG_ERROR("failed to allocate entries\n");
+    return STATUS_ERROR;
+  }
+  if (header->_entries > 0 && read_entries_from_db(fd, header, entries, NULL, NULL) < 0) {
+    free(entries);
+    return STATUS_ERROR;
+  }
+
+  /* drop leftovers of a seal that crashed before emptying the active db */
+  size_t kept = 0;
+  for (size_t i = 0; i < header->_entries; i++) {
+    if (entries[i]->entry_id <= manifest.sealed_through_id) {
+      free(entries[i]->entry_raw_data);
+      free(entries[i]);
+      continue;
+    }
+    entries[kept++] = entries[i];
+  }
+
+  /* texts added before interning was turned on get interned on the way */
+  int rc = 0;
+  for (size_t i = 0; i < kept && rc == 0 && (header->_flags & DB_FEATURE_INTERN); i++) {
+    rc = entry_intern(entries[i]);
+  }
+
+  char *buf = NULL;
+  size_t len = 0;
+  if (rc == 0) { rc = encode_entries(entries, kept, &buf, &len); }
+  db_free_entries(entries, kept);
+  if (rc < 0) { return STATUS_ERROR; }
+
+  /* the new db is in place before the log is emptied, if we crash in
+   * between the deltas are simply applied again on top of themselves */
+  db_header_t compacted = *header;
+  compacted._entries = (uint32_t)kept;
+  rc = rewrite_db(&compacted, buf, len);
+  free(buf);
+  if (rc < 0) { return STATUS_ERROR; }
+  return delta_truncate();
+}
+
+int compact_command(void) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+
+  /* keep appends and other rewrites out while we rewrite */
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
+  db_header_t header;
+  int rc = read_header(fd, &header);
+  if (rc == 0) { rc = __compact(fd, &header); }
+  db_unlock(fd);
+  if (rc == 0) { printf("compacted %u entries\n", header._entries); }
+  return rc;
+}
+
+int seal_command(void) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  return segment_seal();
+}
+
+int segments_command(int verify) {
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  manifest_t manifest;
+  if (manifest_load(&manifest) < 0) { return STATUS_ERROR; }
+
+  int rc = 0;
+  for (uint32_t i = 0; i < manifest.count; i++) {
+    const segment_info_t *seg = &manifest.segments[i];
+    const char *state = "";
+    if (verify) {
+      state = segment_verify(seg) == 0 ? "  ok" : "  CORRUPTED";
+      if (state[2] == 'C') { rc = TODOCTL_ERR_CORRUPTED_DB; }
+    }
+    printf("%06" PRIu64 "  ids %" PRIu64 "-%" PRIu64 "  created %" PRIu64 "-%" PRIu64
+           "  %u entries  %" PRIu64 " bytes%s  crc %08x%s\n",
+           seg->seq, seg->min_id, seg->max_id, seg->min_created, seg->max_created, seg->entries,
+           seg->size, (seg->flags & SEGMENT_FLAG_COMPACT) ? " compact" : "", seg->checksum, state);
+  }
+  printf("%u sealed segments, sealed through id %" PRIu64 "\n", manifest.count,
+         manifest.sealed_through_id);
+  manifest_free(&manifest);
+  return rc;
+}
+
+int archive_command(uint64_t days) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  uint64_t now = get_time_in_millis();
+  uint64_t age = days * 86400000ULL;
+  archive_report_t report;
+  int rc = archive_done_before(age < now ? now - age : 0, &report);
+  if (rc < 0) { return rc; }
+
+  if (report.recovered > 0) {
+    printf("finished an interrupted archive of %" PRIu64 " tasks\n", report.recovered);
+  }
+  printf("archived %" PRIu64 " tasks into %u blocks, %" PRIu64 " -> %" PRIu64 " bytes\n",
+         report.entries, report.blocks, report.raw_bytes, report.packed_bytes);
+  return 0;
+}
+
+/* brings the stats and the indexes a scan can give in line with a db that
+ * was replaced as a whole, the bloom counters are kept */
+static int __rebuild_indexes(db_stats_t *stats) {
+  uint32_t features;
+  db_stats_t current;
+  bool keep = stats_load(&current) == 0;
+  if (__read_flags(&features) < 0 || stats_scan(stats) < 0) { return STATUS_ERROR; }
+  if (keep) {
+    stats->bloom_probes = current.bloom_probes;
+    stats->bloom_skips = current.bloom_skips;
+    stats->bloom_false_positives = current.bloom_false_positives;
+  }
+  if (stats_store(stats) < 0 || ((features & DB_FEATURE_TAGS) && tags_rebuild() < 0) ||
+      ((features & DB_FEATURE_HISTORY) && history_rebuild() < 0) ||
+      ((features & DB_FEATURE_TRIGRAMS) && trigram_rebuild() < 0)) {
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int backup_command(const char *dir) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  backup_report_t report;
+  int rc = backup_run(dir, &report);
+  if (rc < 0) { return rc; }
+
+  if (report.full) {
+    printf("wrote a full backup of %" PRIu64 " bytes\n", report.bytes);
+  } else if (report.bytes == 0) {
+    printf("nothing changed since delta %u\n", report.deltas);
+  } else {
+    printf("wrote delta %u of %" PRIu64 " bytes\n", report.deltas, report.bytes);
+  }
+  return 0;
+}
+
+int restore_command(const char *dir, int flags) {
+  TRACE_FUNC();
+  int rc = backup_restore(dir, flags);
+  if (rc < 0) { return rc; }
+
+  /* the sidecars are not backed up, the ones a scan can give are rebuilt */
+  db_stats_t stats;
+  if (__rebuild_indexes(&stats) < 0) {
+    fprintf(stderr, "Restored the db but failed to rebuild its indexes.\n");
+    return STATUS_ERROR;
+  }
+  printf("restored %" PRIu64 " tasks\n", stats.total);
+  return 0;
+}
+
+int merge_command(const char *other) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
+  merge_report_t report;
+  int rc = db_merge(fd, other, &report);
+  db_unlock(fd);
+  if (rc < 0) { return rc; }
+
+  printf("merged %u tasks into %u: %u added (%u with new ids), %u already here (%u updated)\n",
+         report.added + report.duplicates, report.local, report.added, report.remapped,
+         report.duplicates, report.updated);
+  /* the tasks came in without going through add, done or delete */
+  db_stats_t stats;
+  if (__rebuild_indexes(&stats) < 0) {
+    fprintf(stderr, "Merged the db but failed to rebuild its indexes.\n");
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int fsck_command(int dry_run) {
+  TRACE_FUNC();
   if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
-  wordexp_t exp_res;
-  wordexp(DEFAULT_DB_PATH, &exp_res, 0);
-  int fd = open(exp_res.we_wordv[0], O_RDWR);
-  wordfree(&exp_res);
-  if (fd < 0) {
+  fsck_report_t report;
+  int rc = db_fsck(!dry_run, &report);
+  if (rc < 0) { return rc; }
+
+  printf("%u entries, %" PRIu64 " of %" PRIu64 " bytes good, %u segments checked on %d threads\n",
+         report.entries, report.good_bytes, report.file_bytes, report.segments, report.threads);
+  if (report.bad_entries > 0) {
+    printf("%u damaged entries, repairing drops just those\n", report.bad_entries);
+  }
+  if (report.bad_entry) {
+    printf("damaged entry at byte %" PRIu64 ", repairing drops everything after it\n",
+           report.tail_at);
+  } else if (report.file_bytes > report.tail_at) {
+    printf("torn tail of %" PRIu64 " bytes\n", report.file_bytes - report.tail_at);
+  }
+
+  const db_header_t *header = &report.header;
+  bool stale = header->_entries != report.entries || header->filesize != report.good_bytes ||
+               header->_last_entry_id < report.last_entry_id;
+  if (stale) {
+    printf("header: %u entries, filesize %u, last id %" PRIu64 " -> %u entries, filesize %" PRIu64
+           ", last id %" PRIu64 "\n",
+           header->_entries, header->filesize, header->_last_entry_id, report.entries,
+           report.good_bytes,
+           report.last_entry_id > header->_last_entry_id ? report.last_entry_id
+                                                         : header->_last_entry_id);
+  }
+  stale = stale || report.file_bytes != report.good_bytes;
+  if (stale && report.header_fixed) { printf("repaired\n"); }
+  if (report.delta_torn > 0) {
+    printf("torn delta of %" PRIu64 " bytes at the end of the delta log%s\n", report.delta_torn,
+           report.delta_fixed ? ", cut off" : "");
+  }
+  if (report.bad_segments > 0) {
+    printf("%u segments do not match the manifest, see `segments --verify`\n",
+           report.bad_segments);
+  }
+  bool torn = report.delta_torn > 0 && !report.delta_fixed;
+  if (!stale && report.delta_torn == 0 && report.bad_segments == 0) { printf("ok\n"); }
+  return (stale && !report.header_fixed) || torn || report.bad_segments > 0
+             ? TODOCTL_ERR_CORRUPTED_DB
+             : 0;
+}
+
+int feature_command(const char *action, const char *name) {
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd;
+  if (storage_open(path, O_RDWR, &fd) < 0) {
     DEBUG_ERROR("failed to open db file\n");
 #ifdef DEBUG
-    perror("open()");
+    perror("storage_open()");
 #endif
     return STATUS_ERROR;
   }
-  /* read into header */
-  db_header_t *header = (db_header_t *)malloc(sizeof(db_header_t));
-  if (header == NULL) {
-    DEBUG_ERROR("failed to allocate header\n");
-#ifdef DEBUG
-    perror("malloc()");
-#endif
-    close(fd);
+
+  db_header_t header;
+  if (read_header(fd, &header) < 0) {
+    storage_close(fd);
     return STATUS_ERROR;
   }
-  if (read_header(fd, header) < 0) {
-    free(header);
-    close(fd);
+
+  /* without an action just show what is enabled */
+  if (action == NULL) {
+    for (int bit = 1; bit != 0 && bit <= DB_FEATURE_ALL; bit <<= 1) {
+      if (!(bit & DB_FEATURE_ALL)) { continue; }
+      printf("%-12s %s\n", db_feature_name(bit), (header._flags & bit) ? "on" : "off");
+    }
+    storage_close(fd);
+    return 0;
+  }
+
+  int feature = db_feature_from_name(name);
+  if (feature == 0) {
+    fprintf(stderr, "Unknown feature: %s\n", name != NULL ? name : "");
+    storage_close(fd);
     return STATUS_ERROR;
   }
-  /* find and mark the entry as done */
-  if (update_entry_done(fd, header, id) < 0) {
-    DEBUG_ERROR("failed to update entry\n");
-    free(header);
-    close(fd);
+
+  db_header_t update = header;
+  if (strcmp(action, "enable") == 0) {
+    update._flags |= (uint32_t)feature;
+    if (feature == DB_FEATURE_SEGMENTS) { update._flags |= DB_FEATURE_DELTA_LOG; }
+  } else if (strcmp(action, "disable") == 0) {
+    update._flags &= ~(uint32_t)feature;
+  } else {
+    fprintf(stderr, "Unknown feature action: %s\n", action);
+    storage_close(fd);
     return STATUS_ERROR;
   }
-  free(header);
-  close(fd);
+
+  /* sealed segments can only change through the log */
+  if ((update._flags & DB_FEATURE_SEGMENTS) && !(update._flags & DB_FEATURE_DELTA_LOG)) {
+    fprintf(stderr, "segments need the delta-log feature\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  if ((header._flags & DB_FEATURE_SEGMENTS) && !(update._flags & DB_FEATURE_SEGMENTS)) {
+    fprintf(stderr, "segments can not be disabled once enabled\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  if ((header._flags & DB_FEATURE_BLOBS) && !(update._flags & DB_FEATURE_BLOBS)) {
+    fprintf(stderr, "blobs can not be disabled once enabled\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  if ((header._flags & DB_FEATURE_INTERN) && !(update._flags & DB_FEATURE_INTERN)) {
+    fprintf(stderr, "intern can not be disabled once enabled\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  /* the index is the only place tags are kept */
+  if ((header._flags & DB_FEATURE_TAGS) && !(update._flags & DB_FEATURE_TAGS)) {
+    fprintf(stderr, "tags can not be disabled once enabled\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  if ((header._flags & DB_FEATURE_DUE) && !(update._flags & DB_FEATURE_DUE)) {
+    fprintf(stderr, "due can not be disabled once enabled\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  /* undone is only ever recorded in the history */
+  if ((header._flags & DB_FEATURE_HISTORY) && !(update._flags & DB_FEATURE_HISTORY)) {
+    fprintf(stderr, "history can not be disabled once enabled\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+
+  /* turning the log off means it must be folded into the entries first */
+  int rc = 0;
+  if ((header._flags & DB_FEATURE_DELTA_LOG) && !(update._flags & DB_FEATURE_DELTA_LOG)) {
+    storage_lock(fd);
+    rc = __compact(fd, &header);
+    storage_unlock(fd);
+    storage_close(fd);
+    if (rc < 0 || storage_open(path, O_RDWR, &fd) < 0) { return STATUS_ERROR; }
+  }
+
+  if (__UNSAFE__update_db_header(fd, &update, UPDATE_FLAGS) < 0) {
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  storage_close(fd);
+  /* tasks from before the index are in its state sets from the start */
+  if ((update._flags & DB_FEATURE_TAGS) && !(header._flags & DB_FEATURE_TAGS)) {
+    return tags_rebuild();
+  }
+  /* the history starts with what the timestamps tell */
+  if ((update._flags & DB_FEATURE_HISTORY) && !(header._flags & DB_FEATURE_HISTORY) &&
+      history_rebuild() < 0) {
+    return STATUS_ERROR;
+  }
+  /* the index missed every add while it was off */
+  if ((update._flags & DB_FEATURE_TRIGRAMS) && !(header._flags & DB_FEATURE_TRIGRAMS)) {
+    return trigram_rebuild();
+  }
+  return 0;
+}
+
+int stats_command(int flags) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+
+  db_stats_t stats;
+  int rc = stats_load(&stats);
+  if (rc < 0 && rc != TODOCTL_ERR_DB_DOES_NOT_EXIST) {
+    fprintf(stderr, "Stats block is unreadable, run with --rebuild.\n");
+    return STATUS_ERROR;
+  }
+
+  /* dbs created before the stats block existed get one built on first use */
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) { flags |= STATS_REBUILD; }
+  if (flags & (STATS_VERIFY | STATS_REBUILD)) {
+    db_stats_t scanned;
+    if (stats_scan(&scanned) < 0) { return STATUS_ERROR; }
+
+    if (flags & STATS_VERIFY) {
+      if (stats_compare(&scanned, &stats, stderr) < 0) {
+        fprintf(stderr, "Counters do not match a full scan, run with --rebuild.\n");
+        return TODOCTL_ERR_STATS_MISMATCH;
+      }
+      printf("counters match a full scan of %" PRIu64 " entries\n", scanned.total);
+    }
+
+    if (flags & STATS_REBUILD) {
+      /* a scan knows nothing about past lookups, keep what we have */
+      if (rc == 0) {
+        scanned.bloom_probes = stats.bloom_probes;
+        scanned.bloom_skips = stats.bloom_skips;
+        scanned.bloom_false_positives = stats.bloom_false_positives;
+      }
+      if (stats_store(&scanned) < 0) { return STATUS_ERROR; }
+      stats = scanned;
+    }
+  }
+
+  stats_print(&stats);
+  return 0;
+}
+
+/* formats a time in millis as local `YYYY-MM-DD HH:MM` */
+static void __format_time(uint64_t at, char *buf, size_t len) {
+  time_t t = (time_t)(at / 1000);
+  struct tm tm_info;
+  localtime_r(&t, &tm_info);
+  strftime(buf, len, "%Y-%m-%d %H:%M", &tm_info);
+}
+
+int stats_as_of_command(uint64_t as_of) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  history_state_t state;
+  if (__history_at(as_of, &state) < 0) { return STATUS_ERROR; }
+
+  /* counted the same as the stats block, deleted wins over done */
+  bitmap_t done;
+  if (bitmap_andnot(&done, &state.done, &state.deleted) < 0) {
+    history_state_free(&state);
+    return STATUS_ERROR;
+  }
+  uint64_t total = bitmap_cardinality(&state.all);
+  uint64_t n_done = bitmap_cardinality(&done);
+  uint64_t n_deleted = bitmap_cardinality(&state.deleted);
+  bitmap_free(&done);
+  history_state_free(&state);
+
+  char when[32];
+  __format_time(as_of, when, sizeof(when));
+  printf("as of:        %s\n", when);
+  printf("total:        %" PRIu64 "\n", total);
+  printf("open:         %" PRIu64 "\n", total - n_done - n_deleted);
+  printf("done:         %" PRIu64 "\n", n_done);
+  printf("deleted:      %" PRIu64 "\n", n_deleted);
   return 0;
 }
+
+int tags_command(int flags) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  if ((flags & TAGS_REBUILD) && tags_rebuild() < 0) { return STATUS_ERROR; }
+
+  tags_index_t index;
+  if (tags_load(&index) < 0) {
+    fprintf(stderr, "Tag index is unreadable.\n");
+    return STATUS_ERROR;
+  }
+  for (size_t i = 0; i < index.count; i++) {
+    const tags_set_t *set = &index.sets[i];
+    if (set->name[0] == '@') { continue; }
+    printf("%-16s %" PRIu64 "\n", set->name, bitmap_cardinality(&set->ids));
+  }
+  tags_free(&index);
+  return 0;
+}
+
+static int __compare_ids(const void *key, const void *elem) {
+  uint64_t id = *(const uint64_t *)key;
+  uint64_t other = (*(todo_entry_t *const *)elem)->entry_id;
+  return id < other ? -1 : id > other ? 1 : 0;
+}
+
+/* the due index hands out the ids, they become the candidates of a query
+ * so only their records are decoded and segments without them are skipped */
+static int __list_due(uint64_t from, uint64_t to) {
+  due_hit_t *hits;
+  size_t n_hits;
+  if (due_range(from, to, &hits, &n_hits) < 0) { return STATUS_ERROR; }
+  if (n_hits == 0) {
+    free(hits);
+    return 0;
+  }
+
+  query_t q;
+  if (query_compile("done=false and deleted=false", &q, NULL, 0) < 0) {
+    free(hits);
+    return STATUS_ERROR;
+  }
+  int rc = 0;
+  q.candidates = calloc(1, sizeof(bitmap_t));
+  if (q.candidates == NULL) { rc = STATUS_ERROR; }
+  for (size_t i = 0; rc == 0 && i < n_hits; i++) {
+    rc = bitmap_add(q.candidates, hits[i].entry_id);
+  }
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (rc == 0) {
+    segment_range_t range;
+    segment_range_from_query(&q, &range, NULL);
+    rc = db_read_entries(&range, &entries, &n);
+  }
+  query_free(&q);
+
+  /* the entries come in id order, they are printed in due order */
+  for (size_t i = 0; rc == 0 && i < n_hits; i++) {
+    todo_entry_t **found =
+        bsearch(&hits[i].entry_id, entries, n, sizeof(todo_entry_t *), __compare_ids);
+    if (found == NULL) { continue; }
+    if ((rc = entry_load_text(*found)) < 0) { break; }
+
+    char when[32];
+    __format_time(hits[i].due_at, when, sizeof(when));
+    printf("%" PRIu64 ": %.*s (due %s)\n", (*found)->entry_id, (int)(*found)->entry_raw_data_len,
+           (*found)->entry_raw_data, when);
+  }
+  db_free_entries(entries, n);
+  free(hits);
+  return rc;
+}
+
+int overdue_command(void) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  return __list_due(0, get_time_in_millis());
+}
+
+int upcoming_command(uint64_t within) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  uint64_t now = get_time_in_millis();
+  return __list_due(now, within < UINT64_MAX - now ? now + within : UINT64_MAX);
+}
+
+int find_command(const char *query, int flags) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+
+  /* the query is normalized the same way the filters were built */
+  char token[TEXT_TOKEN_MAX + 1];
+  size_t pos = 0;
+  size_t len = text_next_token(query, strlen(query), &pos, token);
+  if (len == 0) {
+    fprintf(stderr, "Nothing to search for in: %s\n", query);
+    return STATUS_ERROR;
+  }
+  token[len] = '\0';
+
+  bloom_counters_t counters = {0};
+  segment_range_t range = {0};
+  range.token = token;
+  range.counters = &counters;
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (db_read_entries(&range, &entries, &n) < 0) { return STATUS_ERROR; }
+  if (stats_record_bloom(&counters) < 0) { DEBUG_WARN("failed to update stats block\n"); }
+
+  size_t matched = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (entry_load_text(entries[i]) < 0 ||
+        !text_has_token(entries[i]->entry_raw_data, entries[i]->entry_raw_data_len, token)) {
+      free(entries[i]->entry_raw_data);
+      free(entries[i]);
+      continue;
+    }
+    entries[matched++] = entries[i];
+  }
+  print_entries((const todo_entry_t **)entries, matched, flags);
+  db_free_entries(entries, matched);
+  return 0;
+}
+
+typedef struct {
+  todo_entry_t *entry;
+  size_t shared; /* trigrams of the search the text has */
+  size_t keys;   /* trigrams of the text */
+} search_hit_t;
+
+/* more of the search first, then the closer text, then the older task */
+static int __compare_hits(const void *a, const void *b) {
+  const search_hit_t *ha = a, *hb = b;
+  if (ha->shared != hb->shared) { return ha->shared > hb->shared ? -1 : 1; }
+  if (ha->keys != hb->keys) { return ha->keys < hb->keys ? -1 : 1; }
+  return ha->entry->entry_id < hb->entry->entry_id ? -1 : 1;
+}
+
+/* how many of the sorted trigrams `a` are in the sorted `b` */
+static size_t __shared_trigrams(const trigram_t *a, size_t n_a, const trigram_t *b, size_t n_b) {
+  size_t i = 0, j = 0, shared = 0;
+  while (i < n_a && j < n_b) {
+    if (a[i] == b[j]) {
+      shared++;
+      i++;
+      j++;
+    } else if (a[i] < b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return shared;
+}
+
+/* scores the texts against the search, the ones sharing enough trigrams
+ * end up in `hits`, best first */
+static int __rank(todo_entry_t **entries, size_t n, const trigram_t *keys, size_t n_keys,
+                  size_t min, search_hit_t *hits, size_t *n_hits) {
+  *n_hits = 0;
+  for (size_t i = 0; i < n; i++) {
+    trigram_t *text;
+    size_t n_text;
+    if (entry_load_text(entries[i]) < 0 ||
+        trigram_extract(entries[i]->entry_raw_data, entries[i]->entry_raw_data_len, false, &text,
+                        &n_text) < 0) {
+      return STATUS_ERROR;
+    }
+    size_t shared = __shared_trigrams(keys, n_keys, text, n_text);
+    free(text);
+    if (shared < min) { continue; }
+    hits[(*n_hits)++] = (search_hit_t){.entry = entries[i], .shared = shared, .keys = n_text};
+  }
+  qsort(hits, *n_hits, sizeof(search_hit_t), __compare_hits);
+  return 0;
+}
+
+int search_command(const char *text, int flags) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  if ((flags & TRIGRAM_REBUILD) && trigram_rebuild() < 0) { return STATUS_ERROR; }
+  if (text == NULL) { return 0; }
+
+  trigram_t *keys;
+  size_t n_keys;
+  if (trigram_extract(text, strlen(text), false, &keys, &n_keys) < 0) { return STATUS_ERROR; }
+  if (n_keys == 0) {
+    fprintf(stderr, "Nothing to search for in: %s\n", text);
+    free(keys);
+    return STATUS_ERROR;
+  }
+  size_t min = (n_keys * TRIGRAM_MATCH_PERCENT + 99) / 100;
+
+  uint32_t db_flags = 0;
+  query_t q;
+  if (__read_flags(&db_flags) < 0 || query_compile("deleted=false", &q, NULL, 0) < 0) {
+    free(keys);
+    return STATUS_ERROR;
+  }
+  /* with the index only tasks sharing enough trigrams are read, without
+   * it every text gets scored */
+  int rc = 0;
+  if (db_flags & DB_FEATURE_TRIGRAMS) {
+    q.candidates = calloc(1, sizeof(bitmap_t));
+    rc = q.candidates == NULL ? STATUS_ERROR : trigram_lookup(keys, n_keys, min, q.candidates);
+    if (rc == 0 && q.candidates->count == 0) { q.empty = true; }
+  }
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (rc == 0) {
+    segment_range_t range;
+    segment_range_from_query(&q, &range, NULL);
+    rc = db_read_entries(&range, &entries, &n);
+  }
+  query_free(&q);
+
+  search_hit_t *hits = NULL;
+  size_t n_hits = 0;
+  if (rc == 0 && n > 0 && (hits = malloc(sizeof(search_hit_t) * n)) == NULL) { rc = STATUS_ERROR; }
+  if (rc == 0 && n > 0) { rc = __rank(entries, n, keys, n_keys, min, hits, &n_hits); }
+  free(keys);
+
+  const todo_entry_t **ranked = NULL;
+  if (rc == 0 && n_hits > 0 && (ranked = malloc(sizeof(todo_entry_t *) * n_hits)) == NULL) {
+    rc = STATUS_ERROR;
+  }
+  for (size_t i = 0; rc == 0 && i < n_hits; i++) { ranked[i] = hits[i].entry; }
+  if (rc == 0) { print_entries(ranked, n_hits, PRINT_EXCEPT_DELETED); }
+  free(ranked);
+  free(hits);
+  db_free_entries(entries, n);
+  return rc;
+}
+
+int perf_report_command(const char *command, uint32_t days) {
+  TRACE_FUNC();
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  int rc = perf_print(stdout, command, days);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) {
+    printf("No runs recorded yet, `feature enable perf` starts recording them.\n");
+    return 0;
+  }
+  return rc;
+}
+
+int watch_command(int flags) {
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+  return watch_db(stdout, flags);
+}
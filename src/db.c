@@ -1,6 +1,12 @@
 #include "todoctl/db.h"
 #include "todoctl/debug.h"
 #include "todoctl/errors.h"
+#include "todoctl/recover.h"
+#include "todoctl/stats.h"
+#include "todoctl/storage.h"
+#include "todoctl/trace.h"
+
+#include <inttypes.h>
 
 static int __write_db_header(int fd) {
   if (fd < 0) {
@@ -8,25 +14,17 @@ static int __write_db_header(int fd) {
     return STATUS_ERROR;
   }
 
-  db_header_t *header = (db_header_t *)calloc(1, sizeof(db_header_t));
-  if (header == NULL) {
-    DEBUG_ERROR("failed to alloc db_header");
-    return STATUS_ERROR;
-  }
-
   /* this method will be called only when creating the file
    * for the frist time so creating the last entry as 0 should
    * be fine to do */
-  header->_last_entry_id = htonll(0);
-  header->magic = htonll(DB_MAGIC);
-  header->version = htonl(DB_HEADER_VERSION);
-  header->filesize = htonl(sizeof(db_header_t));
-  header->_entries = htonl(0);
+  db_header_t header = {
+      .magic = DB_MAGIC, .version = DB_HEADER_VERSION, .filesize = DB_HEADER_SIZE};
+  char buf[DB_HEADER_SIZE];
+  db_header_encode(&header, buf);
 
-  if (write(fd, header, sizeof(db_header_t)) < 0) {
+  if (storage_write_at(fd, buf, sizeof(buf), 0) < 0) {
     DEBUG_ERROR("write(): failed to alloc db_header");
-    perror("write()");
-    free(header);
+    perror("storage_write_at()");
     return STATUS_ERROR;
   }
 
@@ -34,25 +32,24 @@ static int __write_db_header(int fd) {
 }
 
 int read_header(int fd, db_header_t *out_header) {
+  TRACE_FUNC();
   if (fd < 0) {
     DEBUG_ERROR("invalid fd provided\n");
     return STATUS_ERROR;
   }
 
-  if (read(fd, out_header, sizeof(db_header_t)) < 0) {
+  char buf[DB_HEADER_SIZE];
+  if (storage_read_at(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
     DEBUG_ERROR("failed to read db header\n");
     return STATUS_ERROR;
   }
 
-  out_header->_last_entry_id = ntohll(out_header->_last_entry_id);
-  out_header->magic = ntohll(out_header->magic);
-  out_header->version = ntohl(out_header->version);
-  out_header->filesize = ntohl(out_header->filesize);
-  out_header->_entries = ntohl(out_header->_entries);
+  db_header_decode(buf, out_header);
   return 0;
 }
 
 static int __validate_db_header(int fd) {
+  TRACE_FUNC();
   if (fd < 0) {
     DEBUG_ERROR("invalid fd provided\n");
     return STATUS_ERROR;
@@ -64,14 +61,14 @@ static int __validate_db_header(int fd) {
     return STATUS_ERROR;
   }
 
-  if (read(fd, header, sizeof(db_header_t)) < 0) {
+  char buf[DB_HEADER_SIZE];
+  if (storage_read_at(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
     DEBUG_ERROR("failed to read db header\n");
+    free(header);
     return STATUS_ERROR;
   }
 
-  header->magic = ntohll(header->magic);
-  header->version = ntohl(header->version);
-  header->filesize = ntohl(header->filesize);
+  db_header_decode(buf, header);
 
   if (header->magic != DB_MAGIC) {
     DEBUG_ERROR("invalid magic db header\n");
@@ -79,7 +76,7 @@ static int __validate_db_header(int fd) {
     return TODOCTL_ERR_INVALID_HEADER_MAGIC;
   }
 
-  if (header->version != DB_HEADER_VERSION) {
+  if (header->version != DB_HEADER_VERSION && header->version != DB_HEADER_VERSION_FEATURES) {
     DEBUG_ERROR("invalid db version\n");
     free(header);
     return TODOCTL_ERR_INVALID_VERSION;
@@ -99,13 +96,13 @@ static int __validate_db_header(int fd) {
 }
 
 int validate_db_exists(int *_fd) {
+  TRACE_FUNC();
   int fd;
   if (_fd == NULL) {
-    wordexp_t exp_res;
-    wordexp(DEFAULT_DB_PATH, &exp_res, 0);
-    fd = open(exp_res.we_wordv[0], O_RDWR);
-    wordfree(&exp_res);
-    if (fd < 0) {
+    char path[DB_PATH_MAX];
+    if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+    int rc = storage_open(path, O_RDWR, &fd);
+    if (rc < 0) {
       fprintf(stderr, "TodoCtl db file does not exist! Please initialize first.\n");
       return TODOCTL_ERR_DB_DOES_NOT_EXIST;
     }
@@ -116,65 +113,105 @@ int validate_db_exists(int *_fd) {
   /* if the file exists validate if the headers are valid */
   if (__validate_db_header(fd) < 0) {
     // fprintf(stderr, "Failed to validate DB header possibly corrupted or invalid.\n");
-    if (_fd == NULL) { close(fd); }
+    if (_fd == NULL) { storage_close(fd); }
     return STATUS_ERROR;
   }
 
-  if (_fd == NULL) { close(fd); }
+  if (_fd == NULL) { storage_close(fd); }
   return 0;
 }
 
 int create_new_todo_db(void) {
-  wordexp_t exp_res;
-  wordexp(DEFAULT_DB_PATH, &exp_res, 0);
+  TRACE_FUNC();
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return TODOCTL_ERR_FAILED_DB_CREATE; }
 
   /* create a file O_EXCL makes sure if it already exists we won't overwrite it */
-  int fd = open(exp_res.we_wordv[0], O_RDWR | O_CREAT | O_EXCL, 0644);
-  wordfree(&exp_res);
-  if (fd < 0) {
+  int fd;
+  int rc = storage_open(path, O_RDWR | O_CREAT | O_EXCL, &fd);
+  if (rc < 0) {
     if (errno == EEXIST) {
       fprintf(stderr, "TODO DB already exists.\n");
       return TODOCTL_ERR_FAILED_DB_CREATE;
     }
 
-    perror("open()");
+    perror("storage_open()");
     return TODOCTL_ERR_FAILED_DB_CREATE;
   }
 
   if (__write_db_header(fd) < 0) {
     fprintf(stderr, "Failed to write db headers.\n");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+
+  storage_close(fd);
+  if (stats_reset() < 0) {
+    fprintf(stderr, "Failed to write stats block.\n");
     return STATUS_ERROR;
   }
+  return 0;
+}
+
+/* per thread so several dbs can be read at once, see multi.h */
+static _Thread_local const char *db_path;
+
+void db_use_path(const char *path) { db_path = path; }
+
+int db_resolve_path(const char *suffix, char *out, size_t n) {
+  if (out == NULL || n == 0) { return STATUS_ERROR; }
+
+  int written;
+  if (db_path != NULL) {
+    written = snprintf(out, n, "%s%s", db_path, suffix != NULL ? suffix : "");
+  } else {
+    wordexp_t exp_res;
+    if (wordexp(DEFAULT_DB_PATH, &exp_res, 0) != 0) {
+      DEBUG_ERROR("failed to expand db path\n");
+      return STATUS_ERROR;
+    }
+    written = snprintf(out, n, "%s%s", exp_res.we_wordv[0], suffix != NULL ? suffix : "");
+    wordfree(&exp_res);
+  }
+  if (written < 0 || (size_t)written >= n) {
+    DEBUG_ERROR("db path does not fit into %zu bytes\n", n);
+    return TODOCTL_ERR_BUFFER_TOO_SMALL;
+  }
 
-  close(fd);
   return 0;
 }
 
 int get_last_entry(uint64_t *value) {
-  wordexp_t exp_res;
-  wordexp(DEFAULT_DB_PATH, &exp_res, 0);
+  TRACE_FUNC();
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
 
   /* we'll assume that the file exists */
-  int fd = open(exp_res.we_wordv[0], O_RDONLY);
-  wordfree(&exp_res);
-  if (fd < 0) {
-    perror("open()");
+  int fd;
+  int rc = storage_open(path, O_RDONLY, &fd);
+  if (rc < 0) {
+    perror("storage_open()");
     return STATUS_ERROR;
   }
 
   db_header_t *header = (db_header_t *)calloc(1, sizeof(db_header_t));
   if (header == NULL) {
     fprintf(stderr, "Failed to alloc db_header\n");
-    close(fd);
+    storage_close(fd);
     return STATUS_ERROR;
   }
 
-  read(fd, header, sizeof(db_header_t));
-  header->_last_entry_id = ntohll(header->_last_entry_id);
+  char buf[DB_HEADER_SIZE];
+  if (storage_read_at(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
+    free(header);
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+  db_header_decode(buf, header);
   *value = header->_last_entry_id;
 
   free(header);
-  close(fd);
+  storage_close(fd);
   return 0;
 }
 
@@ -184,10 +221,6 @@ int __UNSAFE__update_db_header(int fd, const db_header_t *update, int flags) {
     return STATUS_ERROR;
   }
 
-  const size_t SKIP_FOR_FILE_SIZE = 12;
-  const size_t SKIP_FOR_LAST_ENTRY = 16;
-  const size_t SKIP_FOR_TOTAL_ENTRIES = 24;
-
   if (flags == UPDATE_NONE) { return 0; }
   db_header_t *header = (db_header_t *)malloc(sizeof(db_header_t));
   if (header == NULL) {
@@ -199,39 +232,29 @@ int __UNSAFE__update_db_header(int fd, const db_header_t *update, int flags) {
   }
 
   /* read into header */
-  if (read(fd, header, 28) != 28) {
+  char buf[DB_HEADER_SIZE];
+  if (storage_read_at(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
     DEBUG_ERROR("failed to read into header\n");
 #ifdef DEBUG
-    perror("read()");
+    perror("storage_read_at()");
 #endif
     free(header);
     return STATUS_ERROR;
   }
+  db_header_decode(buf, header);
 
-  header->magic = ntohll(header->magic);
-  header->version = ntohl(header->version);
-  header->filesize = ntohl(header->filesize);
-  header->_last_entry_id = ntohll(header->_last_entry_id);
-  header->_entries = ntohl(header->_entries);
+  /* every field is written where the schema puts it */
+  char field[8];
 
   /* update file size */
   if (flags & UPDATE_FILESIZE) {
     uint32_t new_file_size = update->filesize;
     if (flags & UPDATE_FILESIZE_ADD) { new_file_size = header->filesize + new_file_size; }
-    if (lseek(fd, SKIP_FOR_FILE_SIZE, SEEK_SET) != SKIP_FOR_FILE_SIZE) {
-      DEBUG_ERROR("failed to seek for updating filesize\n");
-#ifdef DEBUG
-      perror("lseek()");
-#endif
-      free(header);
-      return STATUS_ERROR;
-    }
-
-    new_file_size = htonl(new_file_size);
-    if (write(fd, &new_file_size, 4) != 4) {
+    schema_put_32(field, new_file_size);
+    if (storage_write_at(fd, field, 4, DB_HEADER_OFFSET(FILESIZE)) < 0) {
       DEBUG_ERROR("failed to write update for filesize\n");
 #ifdef DEBUG
-      perror("lseek()");
+      perror("storage_write_at()");
 #endif
       free(header);
       return STATUS_ERROR;
@@ -240,21 +263,11 @@ int __UNSAFE__update_db_header(int fd, const db_header_t *update, int flags) {
 
   /* update last entry */
   if (flags & UPDATE_LAST_ENTRY) {
-    uint64_t new_last_entry = update->_last_entry_id;
-    if (lseek(fd, SKIP_FOR_LAST_ENTRY, SEEK_SET) != SKIP_FOR_LAST_ENTRY) {
-      DEBUG_ERROR("failed to seek for updating last entry\n");
-#ifdef DEBUG
-      perror("lseek()");
-#endif
-      free(header);
-      return STATUS_ERROR;
-    }
-
-    new_last_entry = htonll(new_last_entry);
-    if (write(fd, &new_last_entry, 8) != 8) {
+    schema_put_64(field, update->_last_entry_id);
+    if (storage_write_at(fd, field, 8, DB_HEADER_OFFSET(LAST_ENTRY_ID)) < 0) {
       DEBUG_ERROR("failed to write update for last entry\n");
 #ifdef DEBUG
-      perror("lseek()");
+      perror("storage_write_at()");
 #endif
       free(header);
       return STATUS_ERROR;
@@ -264,62 +277,288 @@ int __UNSAFE__update_db_header(int fd, const db_header_t *update, int flags) {
   /* update total entries */
   if (flags & UPDATE_ENTRIES_COUNT) {
     uint32_t new_total_entries = update->_entries;
-    if (lseek(fd, SKIP_FOR_TOTAL_ENTRIES, SEEK_SET) != SKIP_FOR_TOTAL_ENTRIES) {
-      DEBUG_ERROR("failed to seek for updating total entries\n");
-#ifdef DEBUG
-      perror("lseek()");
-#endif
-      free(header);
-      return STATUS_ERROR;
-    }
-
     if (flags & UPDATE_ENTRIES_COUNT_ADD) {
       new_total_entries = header->_entries + update->_entries;
     }
 
     if (flags & UPDATE_ENTRIES_COUNT_INCR) { new_total_entries = header->_entries + 1; }
 
-    new_total_entries = htonl(new_total_entries);
-    if (write(fd, &new_total_entries, 4) != 4) {
+    schema_put_32(field, new_total_entries);
+    if (storage_write_at(fd, field, 4, DB_HEADER_OFFSET(ENTRIES)) < 0) {
       DEBUG_ERROR("failed to write update for last entry\n");
 #ifdef DEBUG
-      perror("lseek()");
+      perror("storage_write_at()");
+#endif
+      free(header);
+      return STATUS_ERROR;
+    }
+  }
+
+  /* update feature flags, any feature means a version bump */
+  if (flags & UPDATE_FLAGS) {
+    char flags_field[4];
+    schema_put_32(field, update->_flags ? DB_HEADER_VERSION_FEATURES : DB_HEADER_VERSION);
+    schema_put_32(flags_field, update->_flags);
+    if (storage_write_at(fd, field, 4, DB_HEADER_OFFSET(VERSION)) < 0 ||
+        storage_write_at(fd, flags_field, 4, DB_HEADER_OFFSET(FLAGS)) < 0) {
+      DEBUG_ERROR("failed to write update for flags\n");
+#ifdef DEBUG
+      perror("storage_write_at()");
 #endif
       free(header);
       return STATUS_ERROR;
     }
   }
 
+  free(header);
+  return 0;
+}
+
+static const struct {
+  int feature;
+  const char *name;
+} db_features[] = {
+    {DB_FEATURE_DELTA_LOG, "delta-log"},
+    {DB_FEATURE_SEGMENTS, "segments"},
+    {DB_FEATURE_BLOBS, "blobs"},
+    {DB_FEATURE_INTERN, "intern"},
+    {DB_FEATURE_TAGS, "tags"},
+    {DB_FEATURE_DUE, "due"},
+    {DB_FEATURE_HISTORY, "history"},
+    {DB_FEATURE_TRIGRAMS, "trigrams"},
+    {DB_FEATURE_PERF, "perf"},
+    {DB_FEATURE_BACKUP, "backup"},
+};
+
+int db_feature_from_name(const char *name) {
+  if (name == NULL) { return 0; }
+  for (size_t i = 0; i < sizeof(db_features) / sizeof(db_features[0]); i++) {
+    if (strcmp(db_features[i].name, name) == 0) { return db_features[i].feature; }
+  }
   return 0;
 }
 
+const char *db_feature_name(int feature) {
+  for (size_t i = 0; i < sizeof(db_features) / sizeof(db_features[0]); i++) {
+    if (db_features[i].feature == feature) { return db_features[i].name; }
+  }
+  return "unknown";
+}
+
 int write_to_db(char *buf, size_t n) {
+  TRACE_FUNC();
   if (buf == NULL) {
     fprintf(stderr, "Empty buffer provided.");
     return STATUS_ERROR;
   }
 
-  wordexp_t exp_res;
-  wordexp(DEFAULT_DB_PATH, &exp_res, 0);
-  /* open in append mode */
-  FILE *fp = fopen(exp_res.we_wordv[0], "a");
-  wordfree(&exp_res);
-  if (fp == NULL) {
-    perror("fopen()");
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd;
+  int rc = storage_open(path, O_WRONLY | O_CREAT, &fd);
+  if (rc < 0) {
+    perror("storage_open()");
+    return STATUS_ERROR;
+  }
+
+  /* append into the file */
+  struct iovec iov = {.iov_base = buf, .iov_len = n};
+  if (storage_append(fd, &iov, 1, NULL) < 0) {
+    perror("storage_append()");
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+
+  if (storage_close(fd) != 0) {
+    perror("storage_close()");
+    return STATUS_ERROR;
+  }
+
+  return 0;
+}
+
+int write_db_file(const char *path, const db_header_t *header, const char *buf, size_t n) {
+  TRACE_FUNC();
+  if (path == NULL || header == NULL || (buf == NULL && n > 0)) { return STATUS_ERROR; }
+
+  char tmp_path[DB_PATH_MAX];
+  int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  if (written < 0 || (size_t)written >= sizeof(tmp_path)) { return TODOCTL_ERR_BUFFER_TOO_SMALL; }
+
+  int fd;
+  if (storage_open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, &fd) < 0) {
+    perror("storage_open()");
+    return STATUS_ERROR;
+  }
+
+  db_header_t out = *header;
+  out.magic = DB_MAGIC;
+  out.version = header->_flags ? DB_HEADER_VERSION_FEATURES : DB_HEADER_VERSION;
+  out.filesize = (uint32_t)(DB_HEADER_SIZE + n);
+  char out_buf[DB_HEADER_SIZE];
+  db_header_encode(&out, out_buf);
+
+  if (storage_write_at(fd, out_buf, sizeof(out_buf), 0) < 0 ||
+      storage_write_at(fd, buf, n, sizeof(out_buf)) < 0 || storage_sync(fd) < 0) {
+    perror("storage_write_at()");
+    storage_close(fd);
+    storage_remove(tmp_path);
+    return STATUS_ERROR;
+  }
+  storage_close(fd);
+
+  if (storage_rename(tmp_path, path) < 0) {
+    perror("storage_rename()");
+    storage_remove(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int rewrite_db(const db_header_t *header, const char *buf, size_t n) {
+  TRACE_FUNC();
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  return write_db_file(path, header, buf, n);
+}
+
+/* the lock this thread holds. The index and history writers take the
+ * lock themselves and are also called by commands already holding it, a
+ * second flock from the same process would wait on the first forever */
+static _Thread_local struct {
+  int fd;
+  int depth;
+  char path[DB_PATH_MAX];
+} held;
+
+int db_lock_raw(int *out_fd) {
+  if (out_fd == NULL) { return STATUS_ERROR; }
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  if (held.depth > 0 && strcmp(held.path, path) == 0) {
+    held.depth++;
+    *out_fd = held.fd;
+    return 0;
+  }
+
+  /* a rewrite renames a new file over the db, if that happened while we
+   * waited for the lock we hold the old file and have to try again */
+  for (;;) {
+    int fd;
+    if (storage_open(path, O_RDWR, &fd) < 0) {
+      DEBUG_ERROR("failed to open db file\n");
+#ifdef DEBUG
+      perror("storage_open()");
+#endif
+      return TODOCTL_ERR_DB_DOES_NOT_EXIST;
+    }
+    if (storage_lock(fd) < 0) {
+      storage_close(fd);
+      return STATUS_ERROR;
+    }
+
+    if (storage_is_current(fd, path)) {
+      if (held.depth == 0) {
+        held.fd = fd;
+        held.depth = 1;
+        snprintf(held.path, sizeof(held.path), "%s", path);
+      }
+      *out_fd = fd;
+      return 0;
+    }
+    storage_close(fd);
+  }
+}
+
+int db_lock(int *out_fd) {
+  TRACE_FUNC();
+  int fd;
+  int rc = db_lock_raw(&fd);
+  if (rc < 0) { return rc; }
+
+  /* a writer that crashed may have left a tail behind, it has to be dealt
+   * with before anything is appended after it */
+  recover_report_t report;
+  if ((rc = db_recover(fd, &report)) < 0) {
+    if (rc == TODOCTL_ERR_CORRUPTED_DB) {
+      fprintf(stderr, "TodoCtl db is damaged, run `todoctl fsck`.\n");
+    }
+    db_unlock(fd);
+    return rc;
+  }
+  if (report.kept > 0 || report.dropped > 0) {
+    fprintf(stderr, "Recovered an interrupted write: %" PRIu32 " entries kept, %" PRIu64
+                    " bytes dropped.\n",
+            report.kept, report.dropped);
+  }
+  *out_fd = fd;
+  return 0;
+}
+
+int db_unlock(int fd) {
+  if (fd < 0) { return STATUS_ERROR; }
+  if (held.depth > 0 && fd == held.fd && --held.depth > 0) { return 0; }
+  storage_unlock(fd);
+  return storage_close(fd);
+}
+
+/* filesize, last entry id and count, the span of the header a commit
+ * rewrites */
+#define DB_COMMIT_OFFSET DB_HEADER_OFFSET(FILESIZE)
+#define DB_COMMIT_SIZE (DB_HEADER_OFFSET(FLAGS) - DB_HEADER_OFFSET(FILESIZE))
+
+static void __commit_fields(const db_header_t *header, char *out) {
+  char buf[DB_HEADER_SIZE];
+  db_header_encode(header, buf);
+  memcpy(out, buf + DB_COMMIT_OFFSET, DB_COMMIT_SIZE);
+}
+
+int db_commit_header(int fd, const db_header_t *header) {
+  TRACE_FUNC();
+  if (fd < 0 || header == NULL) { return STATUS_ERROR; }
+
+  char fields[DB_COMMIT_SIZE];
+  __commit_fields(header, fields);
+  if (storage_write_at(fd, fields, sizeof(fields), DB_COMMIT_OFFSET) < 0) {
+    DEBUG_ERROR("failed to commit db header\n");
+#ifdef DEBUG
+    perror("storage_write_at()");
+#endif
     return STATUS_ERROR;
   }
+  return 0;
+}
 
-  /* write to the stream, append into the file */
-  if (fwrite(buf, 1, n, fp) < n) {
-    perror("fwrite()");
-    fclose(fp);
+int db_append_commit(int fd, const struct iovec *iov, int iovcnt, const db_header_t *header) {
+  TRACE_FUNC();
+  if (fd < 0 || iov == NULL || iovcnt < 1 || iovcnt > DB_APPEND_MAX_PARTS || header == NULL) {
     return STATUS_ERROR;
   }
 
-  if (fclose(fp) != 0) {
-    perror("fclose()");
+  /* the tail was recovered when the lock was taken, the end of the file is
+   * where the last committed entry ends */
+  uint64_t at;
+  if (storage_size(fd, &at) < 0) {
+    DEBUG_ERROR("failed to size db file\n");
     return STATUS_ERROR;
   }
 
+  storage_write_t parts[DB_APPEND_MAX_PARTS + 1];
+  for (int i = 0; i < iovcnt; i++) {
+    parts[i] = (storage_write_t){.buf = iov[i].iov_base, .len = iov[i].iov_len, .offset = at};
+    at += iov[i].iov_len;
+  }
+  char fields[DB_COMMIT_SIZE];
+  __commit_fields(header, fields);
+  parts[iovcnt] =
+      (storage_write_t){.buf = fields, .len = sizeof(fields), .offset = DB_COMMIT_OFFSET};
+
+  if (storage_write_batch(fd, parts, iovcnt + 1) < 0) {
+    DEBUG_ERROR("failed to append and commit\n");
+#ifdef DEBUG
+    perror("storage_write_batch()");
+#endif
+    return STATUS_ERROR;
+  }
   return 0;
 }
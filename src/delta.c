@@ -0,0 +1,261 @@
+#include "todoctl/delta.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+
+#include <inttypes.h>
+
+#define DELTA_MAP_MIN_CAP 64
+#define DELTA_READ_CHUNK (DELTA_RECORD_SIZE * 4096)
+
+static int __open_log(int flags) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(DELTA_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open delta log\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  return fd;
+}
+
+/* the bytes of a torn delta at the end of the log, cut off with `repair` */
+static int __torn_tail(int fd, bool repair, uint64_t *torn) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    DEBUG_ERROR("failed to stat delta log\n");
+#ifdef DEBUG
+    perror("fstat()");
+#endif
+    return STATUS_ERROR;
+  }
+
+  *torn = (uint64_t)st.st_size % DELTA_RECORD_SIZE;
+  if (repair && *torn > 0 && ftruncate(fd, st.st_size - (off_t)*torn) < 0) {
+    DEBUG_ERROR("failed to cut the torn delta off the log\n");
+#ifdef DEBUG
+    perror("ftruncate()");
+#endif
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int delta_repair(bool repair, uint64_t *torn) {
+  if (torn == NULL) { return STATUS_ERROR; }
+  *torn = 0;
+  int fd = __open_log(repair ? O_RDWR : O_RDONLY);
+  if (fd == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (fd < 0) { return STATUS_ERROR; }
+  int rc = __torn_tail(fd, repair, torn);
+  close(fd);
+  return rc;
+}
+
+int delta_append(delta_kind_t kind, uint64_t entry_id, uint64_t timestamp) {
+  char record[DELTA_RECORD_SIZE];
+  record[0] = (char)kind;
+  schema_put_64(record + 1, entry_id);
+  schema_put_64(record + 9, timestamp);
+
+  int fd = __open_log(O_WRONLY | O_APPEND | O_CREAT);
+  if (fd < 0) { return STATUS_ERROR; }
+
+  /* behind a torn delta the new one would be read out of step */
+  uint64_t torn;
+  if (__torn_tail(fd, true, &torn) < 0) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+  if (torn > 0) { DEBUG_WARN("dropped %" PRIu64 " trailing bytes of the delta log\n", torn); }
+
+  /* one write per delta so a crash can only ever tear the last one */
+  if (write(fd, record, DELTA_RECORD_SIZE) != DELTA_RECORD_SIZE) {
+    DEBUG_ERROR("failed to append delta\n");
+#ifdef DEBUG
+    perror("write()");
+#endif
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  close(fd);
+  return 0;
+}
+
+int delta_decode(const char *buf, delta_kind_t *kind, uint64_t *entry_id, uint64_t *timestamp) {
+  if (buf == NULL || kind == NULL || entry_id == NULL || timestamp == NULL) {
+    return STATUS_ERROR;
+  }
+
+  *kind = (delta_kind_t)(uint8_t)buf[0];
+  if (*kind != DELTA_DONE && *kind != DELTA_UNDONE && *kind != DELTA_DELETE) {
+    DEBUG_ERROR("Corrupted delta: unknown kind %d\n", (int)*kind);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  *entry_id = schema_get_64(buf + 1);
+  *timestamp = schema_get_64(buf + 9);
+  return 0;
+}
+
+static size_t __slot_of(uint64_t entry_id, size_t cap) {
+  /* fibonacci hashing, ids are sequential so spread them out */
+  return (size_t)((entry_id * 0x9E3779B97F4A7C15ULL) >> 17) & (cap - 1);
+}
+
+static delta_slot_t *__find_slot(delta_slot_t *slots, size_t cap, uint64_t entry_id) {
+  size_t i = __slot_of(entry_id, cap);
+  while (slots[i].entry_id != 0 && slots[i].entry_id != entry_id) { i = (i + 1) & (cap - 1); }
+  return &slots[i];
+}
+
+static int __grow(delta_map_t *map) {
+  size_t new_cap = map->cap == 0 ? DELTA_MAP_MIN_CAP : map->cap * 2;
+  delta_slot_t *slots = calloc(new_cap, sizeof(delta_slot_t));
+  if (slots == NULL) {
+    DEBUG_ERROR("failed to grow delta map\n");
+    return STATUS_ERROR;
+  }
+
+  for (size_t i = 0; i < map->cap; i++) {
+    if (map->slots[i].entry_id == 0) { continue; }
+    *__find_slot(slots, new_cap, map->slots[i].entry_id) = map->slots[i];
+  }
+
+  free(map->slots);
+  map->slots = slots;
+  map->cap = new_cap;
+  return 0;
+}
+
+int delta_map_put(delta_map_t *map, delta_kind_t kind, uint64_t entry_id, uint64_t timestamp) {
+  if (map == NULL || entry_id == 0) { return STATUS_ERROR; }
+
+  /* keep the load under 3/4 so probes stay short */
+  if ((map->len + 1) * 4 > map->cap * 3 && __grow(map) < 0) { return STATUS_ERROR; }
+
+  delta_slot_t *slot = __find_slot(map->slots, map->cap, entry_id);
+  if (slot->entry_id == 0) {
+    slot->entry_id = entry_id;
+    map->len++;
+  }
+
+  /* the log is in the order things happened, last writer wins */
+  switch (kind) {
+  case DELTA_DONE:
+    slot->done_at = timestamp;
+    slot->mask |= DELTA_SET_DONE;
+    break;
+  case DELTA_UNDONE:
+    slot->done_at = 0;
+    slot->mask |= DELTA_SET_DONE;
+    break;
+  case DELTA_DELETE:
+    slot->deleted_at = timestamp;
+    slot->mask |= DELTA_SET_DELETED;
+    break;
+  }
+  return 0;
+}
+
+int delta_map_load(delta_map_t *map) {
+  if (map == NULL) { return STATUS_ERROR; }
+  memset(map, 0, sizeof(delta_map_t));
+
+  int fd = __open_log(O_RDONLY);
+  if (fd == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (fd < 0) { return STATUS_ERROR; }
+
+  char *buf = malloc(DELTA_READ_CHUNK);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate delta buffer\n");
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  size_t pending = 0;
+  for (;;) {
+    ssize_t n = read(fd, buf + pending, DELTA_READ_CHUNK - pending);
+    if (n < 0) {
+      DEBUG_ERROR("failed to read delta log\n");
+#ifdef DEBUG
+      perror("read()");
+#endif
+      free(buf);
+      close(fd);
+      delta_map_free(map);
+      return STATUS_ERROR;
+    }
+    if (n == 0) { break; }
+    pending += (size_t)n;
+
+    size_t pos = 0;
+    for (; pos + DELTA_RECORD_SIZE <= pending; pos += DELTA_RECORD_SIZE) {
+      delta_kind_t kind;
+      uint64_t entry_id, timestamp;
+      if (delta_decode(buf + pos, &kind, &entry_id, &timestamp) < 0 ||
+          delta_map_put(map, kind, entry_id, timestamp) < 0) {
+        free(buf);
+        close(fd);
+        delta_map_free(map);
+        return STATUS_ERROR;
+      }
+    }
+    memmove(buf, buf + pos, pending - pos);
+    pending -= pos;
+  }
+
+  /* a torn delta from a crash mid append, the next append cuts it off */
+  if (pending > 0) { DEBUG_WARN("ignoring %zu trailing bytes in delta log\n", pending); }
+
+  free(buf);
+  close(fd);
+  return 0;
+}
+
+void delta_map_apply(const delta_map_t *map, todo_entry_t *entry) {
+  if (map == NULL || map->len == 0 || entry == NULL) { return; }
+  const delta_slot_t *slot = __find_slot(map->slots, map->cap, entry->entry_id);
+  if (slot->entry_id == 0) { return; }
+  if (slot->mask & DELTA_SET_DONE) { entry->_done_at = slot->done_at; }
+  if (slot->mask & DELTA_SET_DELETED) { entry->_deleted_at = slot->deleted_at; }
+}
+
+void delta_map_free(delta_map_t *map) {
+  if (map == NULL) { return; }
+  free(map->slots);
+  memset(map, 0, sizeof(delta_map_t));
+}
+
+int delta_apply_to_entry(delta_kind_t kind, uint64_t timestamp, todo_entry_t *entry) {
+  if (entry == NULL) { return STATUS_ERROR; }
+  switch (kind) {
+  case DELTA_DONE:
+    if (entry->_done_at > 0) { return 1; }
+    entry->_done_at = timestamp;
+    return 0;
+  case DELTA_UNDONE:
+    if (entry->_done_at == 0) { return 1; }
+    entry->_done_at = 0;
+    return 0;
+  case DELTA_DELETE:
+    if (entry->_deleted_at > 0) { return 1; }
+    entry->_deleted_at = timestamp;
+    return 0;
+  }
+  return STATUS_ERROR;
+}
+
+int delta_truncate(void) {
+  int fd = __open_log(O_WRONLY | O_TRUNC);
+  if (fd == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (fd < 0) { return STATUS_ERROR; }
+  fsync(fd);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,215 @@
+#include "todoctl/dict.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+#include "todoctl/util.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+  uint64_t hash;
+  uint64_t id; /* id + 1 so an empty slot is 0 */
+} dict_slot_t;
+
+/* one mapping and one index per thread (each may read another db), texts
+ * are resolved constantly while scanning so none of this is redone per
+ * entry */
+static _Thread_local struct {
+  int fd;
+  char *map;
+  size_t map_len;
+
+  dict_slot_t *slots;
+  size_t cap;
+  size_t len;
+  size_t indexed; /* bytes of the file already walked into the index */
+} dict = {.fd = -1};
+
+/* fnv-1a, finished off so the low bits used by the index are mixed */
+static uint64_t __hash(const char *text, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < n; i++) { h = (h ^ (uint8_t)text[i]) * 0x100000001b3ULL; }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static int __open(void) {
+  if (dict.fd >= 0) { return 0; }
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(DICT_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  dict.fd = open(path, O_RDONLY);
+  if (dict.fd < 0) {
+    DEBUG_ERROR("failed to open text dictionary\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return errno == ENOENT ? TODOCTL_ERR_DB_DOES_NOT_EXIST : STATUS_ERROR;
+  }
+  return 0;
+}
+
+/* maps the whole file again once it grew past what is mapped */
+static int __remap(size_t need) {
+  if (dict.map_len >= need) { return 0; }
+  int rc = __open();
+  if (rc < 0) { return rc; }
+
+  struct stat st;
+  if (fstat(dict.fd, &st) < 0) { return STATUS_ERROR; }
+  if ((size_t)st.st_size < need) {
+    DEBUG_ERROR("text id past the end of the dictionary\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, dict.fd, 0);
+  if (map == MAP_FAILED) {
+    DEBUG_ERROR("failed to map text dictionary\n");
+#ifdef DEBUG
+    perror("mmap()");
+#endif
+    return STATUS_ERROR;
+  }
+  if (dict.map != NULL) { munmap(dict.map, dict.map_len); }
+  dict.map = map;
+  dict.map_len = (size_t)st.st_size;
+  return 0;
+}
+
+static void __read_record(size_t id, uint32_t *len, uint64_t *hash) {
+  *len = schema_get_32(dict.map + id);
+  *hash = schema_get_64(dict.map + id + 4);
+}
+
+int dict_lookup(uint64_t id, const char **text, size_t *n) {
+  if (text == NULL || n == NULL) { return STATUS_ERROR; }
+  int rc = __remap((size_t)id + DICT_HEADER_SIZE);
+  if (rc < 0) { return rc; }
+
+  uint32_t len;
+  uint64_t hash;
+  __read_record((size_t)id, &len, &hash);
+  if ((rc = __remap((size_t)id + DICT_HEADER_SIZE + len)) < 0) { return rc; }
+
+  *text = dict.map + id + DICT_HEADER_SIZE;
+  *n = len;
+  return 0;
+}
+
+static int __insert(uint64_t hash, uint64_t id) {
+  if ((dict.len + 1) * 10 > dict.cap * 7) {
+    size_t cap = dict.cap == 0 ? 1024 : dict.cap * 2;
+    dict_slot_t *slots = calloc(cap, sizeof(dict_slot_t));
+    if (slots == NULL) {
+      DEBUG_ERROR("failed to grow the dictionary index\n");
+      return STATUS_ERROR;
+    }
+    for (size_t i = 0; i < dict.cap; i++) {
+      if (dict.slots[i].id == 0) { continue; }
+      size_t at = dict.slots[i].hash & (cap - 1);
+      while (slots[at].id != 0) { at = (at + 1) & (cap - 1); }
+      slots[at] = dict.slots[i];
+    }
+    free(dict.slots);
+    dict.slots = slots;
+    dict.cap = cap;
+  }
+
+  size_t at = hash & (dict.cap - 1);
+  while (dict.slots[at].id != 0) { at = (at + 1) & (dict.cap - 1); }
+  dict.slots[at].hash = hash;
+  dict.slots[at].id = id + 1;
+  dict.len++;
+  return 0;
+}
+
+/* walks the records appended since the last call into the index, only
+ * their headers are touched */
+static int __index(void) {
+  struct stat st;
+  if (fstat(dict.fd, &st) < 0) { return STATUS_ERROR; }
+  int rc = __remap((size_t)st.st_size);
+  if (rc < 0) { return rc; }
+
+  while (dict.indexed + DICT_HEADER_SIZE <= dict.map_len) {
+    uint32_t len;
+    uint64_t hash;
+    __read_record(dict.indexed, &len, &hash);
+    /* a record cut short by a crash, whatever comes next is appended after */
+    if (dict.indexed + DICT_HEADER_SIZE + len > dict.map_len) { break; }
+    if (__insert(hash, dict.indexed) < 0) { return STATUS_ERROR; }
+    dict.indexed += DICT_HEADER_SIZE + len;
+  }
+  return 0;
+}
+
+int dict_intern(const char *text, size_t n, uint64_t *id) {
+  if (text == NULL || id == NULL || n > UINT32_MAX) { return STATUS_ERROR; }
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(DICT_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    DEBUG_ERROR("failed to open text dictionary\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+
+  uint64_t hash = __hash(text, n);
+  int rc = __open();
+  if (rc == 0) { rc = __index(); }
+  if (rc < 0) {
+    close(fd);
+    return rc;
+  }
+
+  /* the same hash may still be a different text */
+  for (size_t at = dict.cap > 0 ? hash & (dict.cap - 1) : 0;
+       dict.cap > 0 && dict.slots[at].id != 0; at = (at + 1) & (dict.cap - 1)) {
+    if (dict.slots[at].hash != hash) { continue; }
+    uint64_t candidate = dict.slots[at].id - 1;
+    uint32_t len;
+    uint64_t stored;
+    __read_record((size_t)candidate, &len, &stored);
+    if (len == n && memcmp(dict.map + candidate + DICT_HEADER_SIZE, text, n) == 0) {
+      close(fd);
+      *id = candidate;
+      return 0;
+    }
+  }
+
+  /* appended after whatever the index has seen, a cut record included */
+  off_t end = lseek(fd, 0, SEEK_END);
+  char header[DICT_HEADER_SIZE];
+  schema_put_32(header, n);
+  schema_put_64(header + 4, hash);
+  struct iovec iov[2] = {
+      {.iov_base = header, .iov_len = sizeof(header)},
+      {.iov_base = (void *)text, .iov_len = n},
+  };
+  if (end < 0 || writev_all(fd, iov, 2) < 0) {
+    DEBUG_ERROR("failed to append to the text dictionary\n");
+#ifdef DEBUG
+    perror("writev()");
+#endif
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  close(fd);
+  *id = (uint64_t)end;
+  return 0;
+}
+
+void dict_close(void) {
+  if (dict.map != NULL) { munmap(dict.map, dict.map_len); }
+  if (dict.fd >= 0) { close(dict.fd); }
+  free(dict.slots);
+  memset(&dict, 0, sizeof(dict));
+  dict.fd = -1;
+}
@@ -0,0 +1,475 @@
+#include "todoctl/due.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <ctype.h>
+
+typedef struct {
+  uint64_t due_at;
+  uint64_t entry_id;
+  uint8_t state;
+  uint32_t run; /* newer runs are higher */
+} due_record_t;
+
+typedef struct {
+  uint32_t runs;
+  uint64_t length; /* committed bytes, the header included */
+} due_head_t;
+
+int due_parse_duration(const char *src, uint64_t *out) {
+  if (src == NULL || out == NULL || !isdigit((unsigned char)*src)) { return STATUS_ERROR; }
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(src, &end, 10);
+  if (errno != 0 || end[0] == '\0' || end[1] != '\0') { return STATUS_ERROR; }
+
+  uint64_t unit;
+  switch (*end) {
+  case 'm': unit = 60ULL * 1000; break;
+  case 'h': unit = 60ULL * 60 * 1000; break;
+  case 'd': unit = 24ULL * 60 * 60 * 1000; break;
+  case 'w': unit = 7ULL * 24 * 60 * 60 * 1000; break;
+  default: return STATUS_ERROR;
+  }
+  if (value > UINT64_MAX / unit) { return STATUS_ERROR; }
+  *out = (uint64_t)value * unit;
+  return 0;
+}
+
+int due_parse(const char *src, uint64_t now, uint64_t *out) {
+  if (src == NULL || out == NULL) { return STATUS_ERROR; }
+  uint64_t within;
+  if (due_parse_duration(src, &within) == 0) {
+    *out = now + within;
+    return 0;
+  }
+
+  /* a date, optionally with a time of day */
+  int year, month, day, hour = 0, minute = 0, used = 0;
+  if (sscanf(src, "%4d-%2d-%2d%n", &year, &month, &day, &used) != 3) { return STATUS_ERROR; }
+  const char *rest = src + used;
+  if (*rest != '\0') {
+    int time_used = 0;
+    if ((*rest != ' ' && *rest != 'T') ||
+        sscanf(rest + 1, "%2d:%2d%n", &hour, &minute, &time_used) != 2 ||
+        rest[1 + time_used] != '\0') {
+      return STATUS_ERROR;
+    }
+  }
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 ||
+      minute > 59) {
+    return STATUS_ERROR;
+  }
+
+  struct tm tm_info;
+  memset(&tm_info, 0, sizeof(tm_info));
+  tm_info.tm_year = year - 1900;
+  tm_info.tm_mon = month - 1;
+  tm_info.tm_mday = day;
+  tm_info.tm_hour = hour;
+  tm_info.tm_min = minute;
+  tm_info.tm_isdst = -1;
+  time_t t = mktime(&tm_info);
+  if (t < 0) { return STATUS_ERROR; }
+  *out = (uint64_t)t * 1000;
+  return 0;
+}
+
+static int __open_due(int flags, int *out) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(DUE_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open due index\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  *out = fd;
+  return 0;
+}
+
+static int __read_head(int fd, due_head_t *head) {
+  char buf[DUE_HEADER_SIZE];
+  ssize_t n = pread(fd, buf, sizeof(buf), 0);
+  /* a file that never got its header is an empty index */
+  if (n == 0) {
+    head->runs = 0;
+    head->length = DUE_HEADER_SIZE;
+    return 0;
+  }
+  if (n != (ssize_t)sizeof(buf) || schema_get_64(buf) != DUE_MAGIC) {
+    DEBUG_ERROR("invalid due index magic\n");
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(buf + 8) != DUE_VERSION) {
+    DEBUG_ERROR("invalid due index version\n");
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+  head->runs = schema_get_32(buf + 12);
+  head->length = schema_get_64(buf + 16);
+  if (head->length < DUE_HEADER_SIZE) {
+    DEBUG_ERROR("due index is corrupted\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  return 0;
+}
+
+static void __encode_head(char *buf, const due_head_t *head) {
+  schema_put_64(buf, DUE_MAGIC);
+  schema_put_32(buf + 8, DUE_VERSION);
+  schema_put_32(buf + 12, head->runs);
+  schema_put_64(buf + 16, head->length);
+}
+
+static void __decode(const char *buf, uint32_t run, due_record_t *record) {
+  record->due_at = schema_get_64(buf);
+  record->entry_id = schema_get_64(buf + 8);
+  record->state = (uint8_t)buf[16];
+  record->run = run;
+}
+
+/* due order, the newest run first for the same task */
+static int __compare_records(const void *a, const void *b) {
+  const due_record_t *ra = a, *rb = b;
+  if (ra->due_at != rb->due_at) { return ra->due_at < rb->due_at ? -1 : 1; }
+  if (ra->entry_id != rb->entry_id) { return ra->entry_id < rb->entry_id ? -1 : 1; }
+  if (ra->run != rb->run) { return ra->run > rb->run ? -1 : 1; }
+  return 0;
+}
+
+/* sorts and keeps only the newest record of every task */
+static size_t __settle(due_record_t *records, size_t n) {
+  if (n == 0) { return 0; }
+  qsort(records, n, sizeof(due_record_t), __compare_records);
+  size_t kept = 1;
+  for (size_t i = 1; i < n; i++) {
+    if (records[i].due_at == records[kept - 1].due_at &&
+        records[i].entry_id == records[kept - 1].entry_id) {
+      continue;
+    }
+    records[kept++] = records[i];
+  }
+  return kept;
+}
+
+static int __push(due_record_t **records, size_t *n, size_t *cap, const due_record_t *record) {
+  if (*n == *cap) {
+    size_t new_cap = *cap < 16 ? 16 : *cap * 2;
+    due_record_t *grown = realloc(*records, sizeof(due_record_t) * new_cap);
+    if (grown == NULL) {
+      DEBUG_ERROR("failed to grow due records\n");
+      return STATUS_ERROR;
+    }
+    *records = grown;
+    *cap = new_cap;
+  }
+  (*records)[(*n)++] = *record;
+  return 0;
+}
+
+/* every committed record, runs are numbered in the order they were written */
+static int __load_all(int fd, const due_head_t *head, due_record_t **out, size_t *n) {
+  *out = NULL;
+  *n = 0;
+  size_t len = (size_t)(head->length - DUE_HEADER_SIZE);
+  if (len == 0) { return 0; }
+  char *body = malloc(len);
+  if (body == NULL) { return STATUS_ERROR; }
+  if (pread(fd, body, len, DUE_HEADER_SIZE) != (ssize_t)len) {
+    DEBUG_ERROR("due index is shorter than its length\n");
+    free(body);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  size_t pos = 0, cap = 0;
+  int rc = 0;
+  for (uint32_t run = 0; run < head->runs && rc == 0; run++) {
+    uint32_t count = len - pos >= 4 ? schema_get_32(body + pos) : UINT32_MAX;
+    if (count == UINT32_MAX || (len - pos - 4) / DUE_RECORD_SIZE < count) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    pos += 4;
+    for (uint32_t i = 0; i < count && rc == 0; i++, pos += DUE_RECORD_SIZE) {
+      due_record_t record;
+      __decode(body + pos, run, &record);
+      rc = __push(out, n, &cap, &record);
+    }
+  }
+  free(body);
+  if (rc < 0) {
+    free(*out);
+    *out = NULL;
+    *n = 0;
+  }
+  return rc;
+}
+
+static char *__encode_run(const due_record_t *records, size_t n, size_t *len) {
+  *len = 4 + n * DUE_RECORD_SIZE;
+  char *buf = malloc(*len);
+  if (buf == NULL) { return NULL; }
+  schema_put_32(buf, (uint32_t)n);
+  for (size_t i = 0; i < n; i++) {
+    char *p = buf + 4 + i * DUE_RECORD_SIZE;
+    schema_put_64(p, records[i].due_at);
+    schema_put_64(p + 8, records[i].entry_id);
+    p[16] = (char)records[i].state;
+  }
+  return buf;
+}
+
+/* replaces the file with a single run holding the newest record of every
+ * task */
+static int __merge(int fd, const due_head_t *head, const due_record_t *extra, size_t n_extra) {
+  due_record_t *records;
+  size_t n;
+  int rc = __load_all(fd, head, &records, &n);
+  if (rc < 0) { return rc; }
+  size_t cap = n;
+  for (size_t i = 0; i < n_extra && rc == 0; i++) {
+    due_record_t record = extra[i];
+    record.run = head->runs;
+    rc = __push(&records, &n, &cap, &record);
+  }
+  if (rc < 0) {
+    free(records);
+    return rc;
+  }
+  n = __settle(records, n);
+
+  size_t run_len;
+  char *run = __encode_run(records, n, &run_len);
+  free(records);
+  if (run == NULL) { return STATUS_ERROR; }
+  char header[DUE_HEADER_SIZE];
+  due_head_t merged = {.runs = 1, .length = DUE_HEADER_SIZE + run_len};
+  __encode_head(header, &merged);
+
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (db_resolve_path(DUE_SUFFIX, path, sizeof(path)) < 0 ||
+      db_resolve_path(DUE_SUFFIX ".tmp", tmp_path, sizeof(tmp_path)) < 0) {
+    free(run);
+    return STATUS_ERROR;
+  }
+  int tmp = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (tmp < 0) {
+    perror("open()");
+    free(run);
+    return STATUS_ERROR;
+  }
+  struct iovec iov[2] = {{header, sizeof(header)}, {run, run_len}};
+  if (writev(tmp, iov, 2) != (ssize_t)merged.length || fsync(tmp) < 0) {
+    perror("writev()");
+    close(tmp);
+    unlink(tmp_path);
+    free(run);
+    return STATUS_ERROR;
+  }
+  close(tmp);
+  free(run);
+
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+/* appends the records (in due order) as a new run, callers hold the db lock */
+static int __append_run(const due_record_t *records, size_t n) {
+  int fd;
+  int rc = __open_due(O_RDWR | O_CREAT, &fd);
+  if (rc < 0) { return rc; }
+  due_head_t head;
+  if ((rc = __read_head(fd, &head)) < 0) {
+    close(fd);
+    return rc;
+  }
+  if (head.runs >= DUE_MAX_RUNS) {
+    rc = __merge(fd, &head, records, n);
+    close(fd);
+    return rc;
+  }
+
+  size_t run_len;
+  char *run = __encode_run(records, n, &run_len);
+  if (run == NULL) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+  /* the run lands first, the header moving past it commits it */
+  char header[DUE_HEADER_SIZE];
+  uint64_t offset = head.length;
+  head.runs++;
+  head.length += run_len;
+  __encode_head(header, &head);
+  if (pwrite(fd, run, run_len, (off_t)offset) != (ssize_t)run_len || fdatasync(fd) < 0 ||
+      pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(fd) < 0) {
+    DEBUG_ERROR("failed to append to due index\n");
+#ifdef DEBUG
+    perror("pwrite()");
+#endif
+    rc = STATUS_ERROR;
+  }
+  free(run);
+  close(fd);
+  return rc;
+}
+
+int due_record_add(uint64_t id, uint64_t due_at) {
+  TRACE_FUNC();
+  int lock;
+  if (db_lock_raw(&lock) < 0) { return STATUS_ERROR; }
+  due_record_t record = {.due_at = due_at, .entry_id = id, .state = DUE_OPEN};
+  int rc = __append_run(&record, 1);
+  db_unlock(lock);
+  return rc;
+}
+
+int due_record_change(const todo_entry_t *entry) {
+  TRACE_FUNC();
+  if (entry == NULL) { return STATUS_ERROR; }
+  int lock;
+  if (db_lock_raw(&lock) < 0) { return STATUS_ERROR; }
+
+  int fd;
+  int rc = __open_due(O_RDONLY, &fd);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) {
+    db_unlock(lock);
+    return 0;
+  }
+  due_head_t head;
+  due_record_t *records = NULL;
+  size_t n = 0;
+  if (rc == 0) {
+    rc = __read_head(fd, &head);
+    if (rc == 0) { rc = __load_all(fd, &head, &records, &n); }
+    close(fd);
+  }
+
+  /* only the id is known here, the newest record of it has the due time */
+  const due_record_t *latest = NULL;
+  for (size_t i = 0; rc == 0 && i < n; i++) {
+    if (records[i].entry_id != entry->entry_id) { continue; }
+    if (latest == NULL || records[i].run >= latest->run) { latest = &records[i]; }
+  }
+  uint8_t state = entry->_done_at == 0 && entry->_deleted_at == 0 ? DUE_OPEN : DUE_CLOSED;
+  if (rc == 0 && latest != NULL && latest->state != state) {
+    due_record_t record = {.due_at = latest->due_at, .entry_id = latest->entry_id, .state = state};
+    rc = __append_run(&record, 1);
+  }
+  free(records);
+  db_unlock(lock);
+  return rc;
+}
+
+/* the first record of the run at `offset` with a due time of at least `due` */
+static int __lower_bound(int fd, uint64_t offset, uint32_t count, uint64_t due, uint32_t *out) {
+  uint32_t lo = 0, hi = count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    char key[8];
+    if (pread(fd, key, sizeof(key), (off_t)(offset + (uint64_t)mid * DUE_RECORD_SIZE)) !=
+        (ssize_t)sizeof(key)) {
+      return TODOCTL_ERR_CORRUPTED_DB;
+    }
+    if (schema_get_64(key) < due) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *out = lo;
+  return 0;
+}
+
+/* reads the records of one run with a due time in [from, to) */
+static int __read_range(int fd, uint64_t offset, uint32_t count, uint32_t run, uint64_t from,
+                        uint64_t to, due_record_t **records, size_t *n, size_t *cap) {
+  uint32_t first, last;
+  int rc = __lower_bound(fd, offset, count, from, &first);
+  if (rc == 0) { rc = __lower_bound(fd, offset, count, to, &last); }
+  if (rc < 0 || first >= last) { return rc; }
+
+  size_t len = (size_t)(last - first) * DUE_RECORD_SIZE;
+  char *buf = malloc(len);
+  if (buf == NULL) { return STATUS_ERROR; }
+  if (pread(fd, buf, len, (off_t)(offset + (uint64_t)first * DUE_RECORD_SIZE)) != (ssize_t)len) {
+    free(buf);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  for (uint32_t i = 0; i < last - first && rc == 0; i++) {
+    due_record_t record;
+    __decode(buf + (size_t)i * DUE_RECORD_SIZE, run, &record);
+    rc = __push(records, n, cap, &record);
+  }
+  free(buf);
+  return rc;
+}
+
+int due_range(uint64_t from, uint64_t to, due_hit_t **out, size_t *n_out) {
+  TRACE_FUNC();
+  if (out == NULL || n_out == NULL) { return STATUS_ERROR; }
+  *out = NULL;
+  *n_out = 0;
+
+  int fd;
+  int rc = __open_due(O_RDONLY, &fd);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (rc < 0) { return rc; }
+  due_head_t head;
+  if ((rc = __read_head(fd, &head)) < 0) {
+    close(fd);
+    return rc;
+  }
+
+  due_record_t *records = NULL;
+  size_t n = 0, cap = 0;
+  uint64_t offset = DUE_HEADER_SIZE;
+  for (uint32_t run = 0; run < head.runs && rc == 0; run++) {
+    char count_buf[4];
+    if (offset + 4 > head.length || pread(fd, count_buf, 4, (off_t)offset) != 4) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    uint32_t count = schema_get_32(count_buf);
+    offset += 4;
+    if ((head.length - offset) / DUE_RECORD_SIZE < count) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    rc = __read_range(fd, offset, count, run, from, to, &records, &n, &cap);
+    offset += (uint64_t)count * DUE_RECORD_SIZE;
+  }
+  close(fd);
+  if (rc < 0) {
+    DEBUG_ERROR("failed to read due index\n");
+    free(records);
+    return rc;
+  }
+
+  n = __settle(records, n);
+  due_hit_t *hits = malloc(sizeof(due_hit_t) * (n > 0 ? n : 1));
+  if (hits == NULL) {
+    free(records);
+    return STATUS_ERROR;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (records[i].state != DUE_OPEN) { continue; }
+    hits[kept++] = (due_hit_t){.due_at = records[i].due_at, .entry_id = records[i].entry_id};
+  }
+  free(records);
+  *out = hits;
+  *n_out = kept;
+  return 0;
+}
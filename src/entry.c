@@ -1,9 +1,33 @@
 #include "todoctl/entry.h"
+#include "todoctl/backup.h"
+#include "todoctl/blob.h"
 #include "todoctl/db.h"
 #include "todoctl/debug.h"
+#include "todoctl/delta.h"
+#include "todoctl/dict.h"
 #include "todoctl/errors.h"
+#include "todoctl/output.h"
+#include "todoctl/storage.h"
+#include "todoctl/trace.h"
 #include "todoctl/util.h"
 
+#include <inttypes.h>
+
+int init_entry(const char *task, size_t task_len, todo_entry_t *out) {
+  if (task == NULL || out == NULL) { return STATUS_ERROR; }
+
+  /* get last entry id from the db header */
+  uint64_t last_entry = 0;
+  if (get_last_entry(&last_entry) < 0) { return STATUS_ERROR; }
+
+  memset(out, 0, sizeof(todo_entry_t));
+  out->entry_id = last_entry + 1;
+  out->_created_at = get_time_in_millis();
+  out->entry_raw_data = (char *)task;
+  out->entry_raw_data_len = task_len;
+  return 0;
+}
+
 int build_entry(const char *task, todo_entry_t **out) {
   if (task == NULL) { return STATUS_ERROR; }
 
@@ -14,28 +38,116 @@ int build_entry(const char *task, todo_entry_t **out) {
   }
 
   size_t task_len = strlen(task);
+  if (init_entry(task, task_len, entry) < 0) {
+    free(entry);
+    return STATUS_ERROR;
+  }
+
   entry->entry_raw_data = malloc(task_len + 1);
   if (entry->entry_raw_data == NULL) {
     perror("malloc()");
     free(entry);
     return STATUS_ERROR;
   }
+  memcpy(entry->entry_raw_data, task, task_len + 1);
 
-  /* get last entry id from the db header */
-  uint64_t last_entry = 0;
-  if (get_last_entry(&last_entry) < 0) {
-    free(entry);
+  *out = entry;
+  return 0;
+}
+
+size_t entry_encoded_size(const todo_entry_t *entry) {
+  if (entry->_in_blob) { return ENTRY_HEADER_SIZE + ENTRY_BLOB_REF_SIZE; }
+  if (entry->_interned) { return ENTRY_HEADER_SIZE + ENTRY_DICT_REF_SIZE; }
+  return ENTRY_HEADER_SIZE + entry->entry_raw_data_len;
+}
+
+/* writes everything up to and including DATA_LEN */
+static void __encode_header(const todo_entry_t *entry, char *out) {
+  uint32_t data_len = (uint32_t)entry->entry_raw_data_len;
+  if (entry->_in_blob) { data_len = (uint32_t)(ENTRY_BLOB_REF | ENTRY_BLOB_REF_SIZE); }
+  if (entry->_interned) { data_len = (uint32_t)(ENTRY_DICT_REF | ENTRY_DICT_REF_SIZE); }
+  schema_put_32(out + ENTRY_OFFSET(LENGTH), (uint32_t)entry_encoded_size(entry));
+  entry_fields_encode(entry, out);
+  schema_put_32(out + ENTRY_OFFSET(DATA_LEN), data_len);
+}
+
+int entry_spill_text(todo_entry_t *entry) {
+  if (entry == NULL) { return STATUS_ERROR; }
+  if (entry->entry_raw_data_len <= MAX_TODO_TEXT_LENGTH || entry->_in_blob) { return 0; }
+  if (blob_append(entry->entry_raw_data, entry->entry_raw_data_len, &entry->_blob_offset) < 0) {
     return STATUS_ERROR;
   }
+  entry->_in_blob = true;
+  return 0;
+}
 
-  entry->entry_id = last_entry + 1;
-  entry->_created_at = get_time_in_millis();
-  entry->_deleted_at = 0;
-  entry->_done_at = 0;
-  memcpy(entry->entry_raw_data, task, task_len + 1);
-  entry->entry_raw_data_len = task_len;
+/* the encoded entry as two parts, the header and the text (or the
+ * reference to it) straight from the entry */
+static void __entry_iov(const todo_entry_t *entry, char *header, char *ref, struct iovec *iov) {
+  __encode_header(entry, header);
+  iov[0] = (struct iovec){.iov_base = header, .iov_len = ENTRY_HEADER_SIZE};
+  iov[1] = (struct iovec){.iov_base = entry->entry_raw_data, .iov_len = entry->entry_raw_data_len};
+  if (entry->_in_blob) {
+    entry_blob_ref_encode(entry, ref);
+    iov[1].iov_base = ref;
+    iov[1].iov_len = ENTRY_BLOB_REF_SIZE;
+  } else if (entry->_interned) {
+    entry_dict_ref_encode(entry, ref);
+    iov[1].iov_base = ref;
+    iov[1].iov_len = ENTRY_DICT_REF_SIZE;
+  }
+}
 
-  *out = entry;
+int append_entry(int fd, todo_entry_t *entry, size_t *written) {
+  TRACE_FUNC();
+  if (fd < 0 || entry == NULL || written == NULL) { return STATUS_ERROR; }
+  if (entry_spill_text(entry) < 0) { return STATUS_ERROR; }
+
+  char header[ENTRY_HEADER_SIZE];
+  char ref[ENTRY_BLOB_REF_SIZE];
+  struct iovec iov[2];
+  __entry_iov(entry, header, ref, iov);
+
+  if (storage_append(fd, iov, 2, NULL) < 0) {
+    DEBUG_ERROR("failed to append entry\n");
+#ifdef DEBUG
+    perror("storage_append()");
+#endif
+    return STATUS_ERROR;
+  }
+
+  *written = entry_encoded_size(entry);
+  return 0;
+}
+
+int append_entry_commit(int fd, todo_entry_t *entry, const db_header_t *update) {
+  TRACE_FUNC();
+  if (fd < 0 || entry == NULL || update == NULL) { return STATUS_ERROR; }
+  if (entry_spill_text(entry) < 0) { return STATUS_ERROR; }
+
+  char header[ENTRY_HEADER_SIZE];
+  char ref[ENTRY_BLOB_REF_SIZE];
+  struct iovec iov[2];
+  __entry_iov(entry, header, ref, iov);
+  return db_append_commit(fd, iov, 2, update);
+}
+
+int entry_load_text(todo_entry_t *entry) {
+  if (entry == NULL) { return STATUS_ERROR; }
+  if (!entry->_in_blob || entry->entry_raw_data != NULL) { return 0; }
+  return blob_read(entry->_blob_offset, entry->entry_raw_data_len, &entry->entry_raw_data);
+}
+
+int entry_intern(todo_entry_t *entry) {
+  if (entry == NULL) { return STATUS_ERROR; }
+  if (entry->_in_blob || entry->_interned || entry->entry_raw_data_len > MAX_TODO_TEXT_LENGTH) {
+    return 0;
+  }
+  if (entry->entry_raw_data == NULL) { return STATUS_ERROR; }
+  if (dict_intern(entry->entry_raw_data, entry->entry_raw_data_len, &entry->_text_id) < 0) {
+    return STATUS_ERROR;
+  }
+  entry->_interned = true;
   return 0;
 }
 
@@ -47,6 +159,22 @@ int encode_entry(const todo_entry_t *entry, char *out, size_t out_size, size_t *
 
   *bytes_written = 0;
 
+  /* the text stays where it is in the blob file, only the reference moves */
+  if (entry->_in_blob) {
+    if (out_size < ENTRY_HEADER_SIZE + ENTRY_BLOB_REF_SIZE) { return TODOCTL_ERR_BUFFER_TOO_SMALL; }
+    __encode_header(entry, out);
+    entry_blob_ref_encode(entry, out + ENTRY_HEADER_SIZE);
+    *bytes_written = ENTRY_HEADER_SIZE + ENTRY_BLOB_REF_SIZE;
+    return 0;
+  }
+  if (entry->_interned) {
+    if (out_size < ENTRY_HEADER_SIZE + ENTRY_DICT_REF_SIZE) { return TODOCTL_ERR_BUFFER_TOO_SMALL; }
+    __encode_header(entry, out);
+    entry_dict_ref_encode(entry, out + ENTRY_HEADER_SIZE);
+    *bytes_written = ENTRY_HEADER_SIZE + ENTRY_DICT_REF_SIZE;
+    return 0;
+  }
+
   /* calculate required data sizes */
   uint32_t raw_data_length = entry->entry_raw_data_len;
   if (raw_data_length != strlen(entry->entry_raw_data)) {
@@ -55,9 +183,7 @@ int encode_entry(const todo_entry_t *entry, char *out, size_t out_size, size_t *
     return STATUS_ERROR;
   }
 
-  size_t required_size = /* Length */ 4 + /* entry id */ 8 + /* created at */ 8 +
-                         /* deleted at */ 8 + /* done at */ 8 + /* data length */ 4 +
-                         raw_data_length;
+  size_t required_size = ENTRY_HEADER_SIZE + raw_data_length;
   if (out_size < required_size) {
     DEBUG_ERROR("Buffer too small: need %zu bytes, have %zu\n", required_size, out_size);
     return TODOCTL_ERR_BUFFER_TOO_SMALL;
@@ -68,51 +194,355 @@ int encode_entry(const todo_entry_t *entry, char *out, size_t out_size, size_t *
     return TODOCTL_ERR_TODO_TOO_LONG;
   }
 
+  /* the fields and lengths, then the task */
+  __encode_header(entry, out);
+  if (raw_data_length > 0) {
+    memcpy(out + ENTRY_HEADER_SIZE, entry->entry_raw_data, raw_data_length);
+  }
+
+  *bytes_written = required_size;
+  return 0;
+}
+
+int encode_entries(todo_entry_t **entries, size_t n, char **out, size_t *out_len) {
+  TRACE_FUNC();
+  size_t total = 0;
+  for (size_t i = 0; i < n; i++) { total += entry_encoded_size(entries[i]); }
+
+  char *buf = malloc(total > 0 ? total : 1);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate encode buffer\n");
+    return STATUS_ERROR;
+  }
+
   size_t offset = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t bytes_written = 0;
+    if (encode_entry(entries[i], buf + offset, total - offset, &bytes_written) < 0) {
+      free(buf);
+      return STATUS_ERROR;
+    }
+    offset += bytes_written;
+  }
 
-  /* assign zero we'll calculate and set this later */
-  uint32_t total_length = 0;
-  uint32_t total_length_net = htonl(total_length);
-  memcpy(out + offset, &total_length_net, sizeof(uint32_t));
-  offset += sizeof(uint32_t);
-
-  /* write the id */
-  uint64_t entry_id = htonll(entry->entry_id);
-  memcpy(out + offset, &entry_id, sizeof(uint64_t));
-  offset += sizeof(uint64_t);
-
-  /* write the timestamps */
-  uint64_t created_at = htonll(entry->_created_at);
-  memcpy(out + offset, &created_at, sizeof(uint64_t));
-  offset += sizeof(uint64_t);
-  uint64_t deleted_at = htonll(entry->_deleted_at);
-  memcpy(out + offset, &deleted_at, sizeof(uint64_t));
-  offset += sizeof(uint64_t);
-  uint64_t done_at = htonll(entry->_done_at);
-  memcpy(out + offset, &done_at, sizeof(uint64_t));
-  offset += sizeof(uint64_t);
-
-  /* write the task */
-  uint32_t data_len = htonl(raw_data_length);
-  memcpy(out + offset, &data_len, sizeof(uint32_t));
-  offset += sizeof(uint32_t);
-  if (raw_data_length > 0) {
-    memcpy(out + offset, entry->entry_raw_data, raw_data_length);
-    offset += raw_data_length;
+  *out = buf;
+  *out_len = offset;
+  return 0;
+}
+
+/* points the entry at its text inside the mapped dictionary */
+static int __resolve_text(todo_entry_t *entry) {
+  const char *text;
+  int rc = dict_lookup(entry->_text_id, &text, &entry->entry_raw_data_len);
+  if (rc < 0) {
+    DEBUG_ERROR("failed to resolve interned text\n");
+    return rc;
+  }
+  entry->entry_raw_data = (char *)text;
+  return 0;
+}
+
+int entry_validate(const char *buf, size_t n, todo_entry_t *out, size_t *consumed) {
+  if (buf == NULL || out == NULL || consumed == NULL) { return STATUS_ERROR; }
+  if (n < ENTRY_HEADER_SIZE) { return TODOCTL_ERR_INCOMPLETE_ENTRY; }
+
+  uint32_t total_length = schema_get_32(buf + ENTRY_OFFSET(LENGTH));
+  uint32_t data_len = schema_get_32(buf + ENTRY_OFFSET(DATA_LEN));
+  bool in_blob = (data_len & ENTRY_BLOB_REF) != 0;
+  bool interned = (data_len & ENTRY_DICT_REF) != 0;
+  data_len &= ~(ENTRY_BLOB_REF | ENTRY_DICT_REF);
+
+  if (total_length != ENTRY_HEADER_SIZE + (size_t)data_len || (in_blob && interned) ||
+      (in_blob && data_len != ENTRY_BLOB_REF_SIZE) ||
+      (interned && data_len != ENTRY_DICT_REF_SIZE)) {
+    DEBUG_ERROR("Corrupted entry: length mismatch\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  if (n < total_length) { return TODOCTL_ERR_INCOMPLETE_ENTRY; }
+
+  entry_fields_decode(buf, out);
+  out->_in_blob = in_blob;
+  out->_blob_offset = 0;
+  out->_interned = interned;
+  out->_text_id = 0;
+
+  if (in_blob) {
+    entry_blob_ref_decode(buf + ENTRY_HEADER_SIZE, out);
+    out->entry_raw_data = NULL;
+  } else if (interned) {
+    entry_dict_ref_decode(buf + ENTRY_HEADER_SIZE, out);
+    out->entry_raw_data = NULL;
+    out->entry_raw_data_len = 0;
+  } else {
+    out->entry_raw_data = (char *)buf + ENTRY_HEADER_SIZE;
+    out->entry_raw_data_len = (size_t)data_len;
+  }
+
+  *consumed = total_length;
+  return 0;
+}
+
+int decode_entry_view(const char *buf, size_t n, todo_entry_t *out, size_t *consumed) {
+  int rc = entry_validate(buf, n, out, consumed);
+  if (rc == 0 && out->_interned) { rc = __resolve_text(out); }
+  return rc;
+}
+
+int decode_entry(const char *buf, size_t n, todo_entry_t *out, size_t *consumed) {
+  int rc = decode_entry_view(buf, n, out, consumed);
+  if (rc < 0 || out->_in_blob) { return rc; }
+
+  const char *text = out->entry_raw_data;
+  out->entry_raw_data = malloc(out->entry_raw_data_len + 1);
+  if (out->entry_raw_data == NULL) {
+#ifdef DEBUG
+    perror("malloc()");
+#endif
+    DEBUG_ERROR("failed alloc raw data bytes\n");
+    return STATUS_ERROR;
+  }
+  memcpy(out->entry_raw_data, text, out->entry_raw_data_len);
+  out->entry_raw_data[out->entry_raw_data_len] = '\0';
+  return 0;
+}
+
+void entry_codec_init(entry_codec_t *codec, const db_header_t *header) {
+  memset(codec, 0, sizeof(entry_codec_t));
+  codec->compact = header != NULL && (header->_flags & DB_FLAG_COMPACT_RECORDS);
+}
+
+int encode_entry_compact(const todo_entry_t *entry, entry_codec_t *codec, char *out,
+                         size_t out_size, size_t *bytes_written) {
+  if (entry == NULL || codec == NULL || out == NULL || bytes_written == NULL) {
+    return STATUS_ERROR;
   }
+  size_t text_len = entry->_in_blob || entry->_interned ? 0 : entry->entry_raw_data_len;
+  if (out_size < ENTRY_COMPACT_MAX_OVERHEAD + text_len) { return TODOCTL_ERR_BUFFER_TOO_SMALL; }
 
-  /* update the total length */
-  total_length = (uint32_t)offset;
-  total_length_net = htonl(total_length);
-  memcpy(out, &total_length_net, sizeof(uint32_t));
+  uint8_t flags = 0;
+  if (entry->_deleted_at != 0) { flags |= ENTRY_COMPACT_DELETED; }
+  if (entry->_done_at != 0) { flags |= ENTRY_COMPACT_DONE; }
+  if (entry->_in_blob) { flags |= ENTRY_COMPACT_BLOB; }
+  if (entry->_interned) { flags |= ENTRY_COMPACT_DICT; }
 
+  size_t offset = 0;
+  out[offset++] = (char)flags;
+  offset += varint_put(entry->entry_id - codec->prev_id, out + offset);
+  offset += varint_put(zigzag_encode((int64_t)(entry->_created_at - codec->prev_created)),
+                       out + offset);
+  if (flags & ENTRY_COMPACT_DELETED) {
+    offset += varint_put(entry->_deleted_at - entry->_created_at, out + offset);
+  }
+  if (flags & ENTRY_COMPACT_DONE) {
+    offset += varint_put(entry->_done_at - entry->_created_at, out + offset);
+  }
+
+  if (entry->_in_blob) {
+    offset += varint_put(entry->_blob_offset, out + offset);
+    offset += varint_put((uint64_t)entry->entry_raw_data_len, out + offset);
+  } else if (entry->_interned) {
+    offset += varint_put(entry->_text_id, out + offset);
+  } else {
+    offset += varint_put((uint64_t)text_len, out + offset);
+    memcpy(out + offset, entry->entry_raw_data, text_len);
+    offset += text_len;
+  }
+
+  codec->prev_id = entry->entry_id;
+  codec->prev_created = entry->_created_at;
   *bytes_written = offset;
   return 0;
 }
 
+int encode_entries_compact(todo_entry_t **entries, size_t n, char **out, size_t *out_len) {
+  TRACE_FUNC();
+  size_t total = 0;
+  for (size_t i = 0; i < n; i++) {
+    bool by_ref = entries[i]->_in_blob || entries[i]->_interned;
+    total += ENTRY_COMPACT_MAX_OVERHEAD + (by_ref ? 0 : entries[i]->entry_raw_data_len);
+  }
+
+  char *buf = malloc(total > 0 ? total : 1);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate encode buffer\n");
+    return STATUS_ERROR;
+  }
+
+  entry_codec_t codec;
+  entry_codec_init(&codec, NULL);
+  size_t offset = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t bytes_written = 0;
+    if (encode_entry_compact(entries[i], &codec, buf + offset, total - offset, &bytes_written) <
+        0) {
+      free(buf);
+      return STATUS_ERROR;
+    }
+    offset += bytes_written;
+  }
+
+  *out = buf;
+  *out_len = offset;
+  return 0;
+}
+
+static int __next_varint(const char *buf, size_t n, size_t *offset, uint64_t *out) {
+  size_t r = varint_get(buf + *offset, n - *offset, out);
+  if (r == 0) {
+    /* cut by the end of the buffer unless it had all the room it could need */
+    return n - *offset >= VARINT_MAX_LEN ? TODOCTL_ERR_CORRUPTED_DB : TODOCTL_ERR_INCOMPLETE_ENTRY;
+  }
+  *offset += r;
+  return 0;
+}
+
+int decode_entry_compact(const char *buf, size_t n, entry_codec_t *codec, todo_entry_t *out,
+                         size_t *consumed) {
+  if (buf == NULL || codec == NULL || out == NULL || consumed == NULL) { return STATUS_ERROR; }
+  if (n == 0) { return TODOCTL_ERR_INCOMPLETE_ENTRY; }
+
+  uint8_t flags = (uint8_t)buf[0];
+  if (flags & ~ENTRY_COMPACT_FLAGS) {
+    DEBUG_ERROR("Corrupted entry: unknown flags\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  bool in_blob = (flags & ENTRY_COMPACT_BLOB) != 0;
+  bool interned = (flags & ENTRY_COMPACT_DICT) != 0;
+  size_t offset = 1;
+  uint64_t id_gap, created_diff, deleted = 0, done = 0, len = 0, ref = 0;
+  int rc = __next_varint(buf, n, &offset, &id_gap);
+  if (rc == 0) { rc = __next_varint(buf, n, &offset, &created_diff); }
+  if (rc == 0 && (flags & ENTRY_COMPACT_DELETED)) { rc = __next_varint(buf, n, &offset, &deleted); }
+  if (rc == 0 && (flags & ENTRY_COMPACT_DONE)) { rc = __next_varint(buf, n, &offset, &done); }
+  if (rc == 0 && (in_blob || interned)) { rc = __next_varint(buf, n, &offset, &ref); }
+  if (rc == 0 && !interned) { rc = __next_varint(buf, n, &offset, &len); }
+  if (rc < 0) { return rc; }
+
+  bool inline_text = !in_blob && !interned;
+  if (id_gap == 0 || (in_blob && interned) || (inline_text && len > MAX_TODO_TEXT_LENGTH)) {
+    DEBUG_ERROR("Corrupted entry: invalid compact fields\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  if (inline_text && n - offset < len) { return TODOCTL_ERR_INCOMPLETE_ENTRY; }
+
+  out->entry_id = codec->prev_id + id_gap;
+  out->_created_at = codec->prev_created + (uint64_t)zigzag_decode(created_diff);
+  out->_deleted_at = (flags & ENTRY_COMPACT_DELETED) ? out->_created_at + deleted : 0;
+  out->_done_at = (flags & ENTRY_COMPACT_DONE) ? out->_created_at + done : 0;
+  out->_in_blob = in_blob;
+  out->_blob_offset = in_blob ? ref : 0;
+  out->_interned = interned;
+  out->_text_id = interned ? ref : 0;
+  out->entry_raw_data_len = (size_t)len;
+  if (in_blob) {
+    out->entry_raw_data = NULL;
+  } else if (interned) {
+    if ((rc = __resolve_text(out)) < 0) { return rc; }
+  } else {
+    out->entry_raw_data = (char *)buf + offset;
+    offset += (size_t)len;
+  }
+
+  codec->prev_id = out->entry_id;
+  codec->prev_created = out->_created_at;
+  *consumed = offset;
+  return 0;
+}
+
+int entry_codec_next(entry_codec_t *codec, const char *buf, size_t n, todo_entry_t *out,
+                     size_t *consumed) {
+  TRACE_FUNC();
+  if (codec->compact) { return decode_entry_compact(buf, n, codec, out, consumed); }
+  return decode_entry_view(buf, n, out, consumed);
+}
+
+int entry_scan(int fd, const db_header_t *header, int (*fn)(void *, todo_entry_t *), void *ctx) {
+  TRACE_FUNC();
+  if (fd < 0 || header == NULL || fn == NULL) { return STATUS_ERROR; }
+  if (header->_entries == 0) { return 0; }
+
+  size_t buf_cap = ENTRY_SCAN_CHUNK;
+  char *buf = malloc(buf_cap);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate scan buffer\n");
+    return STATUS_ERROR;
+  }
+
+  /* the reads ahead of the decoder are already in flight when the
+   * storage backend can do that */
+  storage_stream_t stream;
+  if (storage_stream_open(&stream, fd, sizeof(db_header_t)) < 0) {
+    DEBUG_ERROR("failed to open scan stream\n");
+    storage_stream_close(&stream);
+    free(buf);
+    return STATUS_ERROR;
+  }
+
+  /* an entry cut by the end of the buffer is moved to the front and
+   * completed by the next read */
+  entry_codec_t codec;
+  entry_codec_init(&codec, header);
+  size_t len = 0, pos = 0;
+  uint32_t seen = 0;
+  int rc = 0;
+  while (seen < header->_entries && rc == 0) {
+    todo_entry_t view;
+    size_t consumed = 0;
+    rc = entry_codec_next(&codec, buf + pos, len - pos, &view, &consumed);
+    if (rc == 0) {
+      seen++;
+      pos += consumed;
+      rc = fn(ctx, &view);
+      continue;
+    }
+    if (rc != TODOCTL_ERR_INCOMPLETE_ENTRY) { break; }
+
+    memmove(buf, buf + pos, len - pos);
+    len -= pos;
+    pos = 0;
+    /* an entry bigger than the buffer, make room for all of it. Compact
+     * entries are bounded by MAX_TODO_TEXT_LENGTH and always fit */
+    if (!codec.compact && len >= 4) {
+      uint32_t total_length = schema_get_32(buf + ENTRY_OFFSET(LENGTH));
+      if (total_length > buf_cap) {
+        char *grown = realloc(buf, total_length);
+        if (grown == NULL) {
+          rc = STATUS_ERROR;
+          break;
+        }
+        buf = grown;
+        buf_cap = total_length;
+      }
+    }
+
+    ssize_t r = storage_stream_read(&stream, buf + len, buf_cap - len);
+    if (r <= 0) {
+      DEBUG_ERROR("db ends before its last entry\n");
+#ifdef DEBUG
+      perror("storage_stream_read()");
+#endif
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    len += (size_t)r;
+    rc = 0;
+  }
+
+  storage_stream_close(&stream);
+  free(buf);
+  return rc;
+}
+
 int print_entry(const todo_entry_t *entry) {
   if (entry == NULL) return STATUS_ERROR;
-  printf("%llu: %s\n", entry->entry_id, entry->entry_raw_data);
+  if (entry->_in_blob && entry->entry_raw_data == NULL) {
+    printf("%" PRIu64 ": ", entry->entry_id);
+    int rc = blob_copy_to(entry->_blob_offset, entry->entry_raw_data_len, stdout);
+    putchar('\n');
+    return rc;
+  }
+  printf("%" PRIu64 ": %s\n", entry->entry_id, entry->entry_raw_data);
   return 0;
 }
 
@@ -120,20 +550,46 @@ int print_entries(const todo_entry_t **entries, size_t n, int flags) {
   if (n == 0) return 0;
   if (entries == NULL) return STATUS_ERROR;
 
-  for (size_t i = 0; i < n; i++) {
+  return print_entries_as(entries, n, flags, OUTPUT_PLAIN);
+}
+
+int print_entries_as(const todo_entry_t **entries, size_t n, int flags, int format) {
+  TRACE_FUNC();
+  if (entries == NULL && n > 0) return STATUS_ERROR;
+
+  /* the writer goes around stdio, anything printed before has to be out */
+  fflush(stdout);
+  output_t out;
+  if (output_open(&out, STDOUT_FILENO, format) < 0) { return STATUS_ERROR; }
+
+  int rc = output_begin(&out);
+  for (size_t i = 0; i < n && rc == 0; i++) {
     const todo_entry_t *current_entry = entries[i];
     if ((flags & PRINT_EXCEPT_DELETED) && current_entry->_deleted_at > 0) { continue; }
     if ((flags & PRINT_ONLY_ACTIVE) && current_entry->_done_at > 0) { continue; }
-    print_entry(entries[i]);
+    rc = output_entry(&out, current_entry);
   }
-  return 0;
+  if (rc == 0) { rc = output_end(&out); }
+  output_close(&out);
+  return rc;
 }
 
-int update_entry_done(int fd, const db_header_t *header, const uint64_t entry_id) {
+static void __free_entries(todo_entry_t **entries, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    free(entries[i]->entry_raw_data);
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+int update_entry_status(int fd, const db_header_t *header, const uint64_t entry_id, int kind,
+                        todo_entry_t *before, todo_entry_t *after) {
+  TRACE_FUNC();
   if (fd < 0) {
     DEBUG_ERROR("invalid fd provided\n");
     return STATUS_ERROR;
   }
+  if (header->_entries == 0) { return TODOCTL_ERR_ENTRY_NOT_FOUND; }
 
   todo_entry_t **entries = malloc(sizeof(todo_entry_t *) * header->_entries);
   if (entries == NULL) {
@@ -144,54 +600,80 @@ int update_entry_done(int fd, const db_header_t *header, const uint64_t entry_id
     return STATUS_ERROR;
   }
 
-  /* read entries from the db */
+  /* read entries from the db, with the delta log merged in */
   uint64_t stop_at = entry_id;
   size_t bytes_read = 0;
   /* this will be the last entry read and is the one we need to mark */
   int entries_read = read_entries_from_db(fd, header, entries, &bytes_read, &stop_at);
   if (entries_read < 0) {
     DEBUG_ERROR("failed to read entries from db\n");
-    /* free all the entries */
-    for (size_t i = 0; i < (size_t)entries_read; i++) {
-      free(entries[i]->entry_raw_data);
-      free(entries[i]);
-    }
+    free(entries);
     return STATUS_ERROR;
   }
 
-  size_t last_entry_data_len = entries[entries_read]->entry_raw_data_len;
-  size_t total_seek = (sizeof(db_header_t) + bytes_read) - (last_entry_data_len + 4 + 8);
+  /* we walked past the last entry without finding the id */
+  if ((size_t)entries_read >= header->_entries) {
+    DEBUG_ERROR("entry %" PRIu64 " not found\n", entry_id);
+    __free_entries(entries, (size_t)entries_read);
+    return TODOCTL_ERR_ENTRY_NOT_FOUND;
+  }
 
-  if (lseek(fd, total_seek, SEEK_SET) < 0) {
-    DEBUG_ERROR("failed to seek for setting the entry done\n");
-#ifdef DEBUG
-    perror("lseek()");
-#endif
+  todo_entry_t *target = entries[entries_read];
+  size_t loaded = (size_t)entries_read + 1;
+  if (before != NULL) {
+    *before = *target;
+    before->entry_raw_data = NULL;
+  }
 
-    /* free all the entries */
-    for (size_t i = 0; i < (size_t)entries_read; i++) {
-      free(entries[i]->entry_raw_data);
-      free(entries[i]);
+  /* keep the first completion time, re-marking must not skew the latency */
+  uint64_t now = get_time_in_millis();
+  int rc = delta_apply_to_entry((delta_kind_t)kind, now, target);
+  if (rc != 0) {
+    if (after != NULL) {
+      *after = *target;
+      after->entry_raw_data = NULL;
     }
-    return STATUS_ERROR;
+    __free_entries(entries, loaded);
+    return rc;
   }
 
-  uint64_t done_at = htonll(get_time_in_millis());
-  if (write(fd, &done_at, 8) != 8) {
-    DEBUG_ERROR("failed to write update for last entry\n");
+  if (header->_flags & DB_FEATURE_DELTA_LOG) {
+    /* a sequential append instead of a write in the middle of the file */
+    rc = delta_append((delta_kind_t)kind, entry_id, now);
+  } else {
+    size_t entry_start = (sizeof(db_header_t) + bytes_read) - entry_encoded_size(target);
+    size_t total_seek = entry_start + ENTRY_DONE_AT_OFFSET;
+    char value[8];
+    schema_put_64(value, target->_done_at);
+    if (kind == DELTA_DELETE) {
+      total_seek = entry_start + ENTRY_DELETED_AT_OFFSET;
+      schema_put_64(value, target->_deleted_at);
+    }
+
+    /* the next backup copies the patch over, the offset is listed first */
+    if ((header->_flags & DB_FEATURE_BACKUP) && backup_record_patch(total_seek) < 0) {
+      rc = STATUS_ERROR;
+    } else if (storage_write_at(fd, value, sizeof(value), total_seek) < 0) {
+      DEBUG_ERROR("failed to write update for entry\n");
 #ifdef DEBUG
-    perror("write()");
+      perror("storage_write_at()");
 #endif
-
-    /* free all the entries */
-    for (size_t i = 0; i < (size_t)entries_read; i++) {
-      free(entries[i]->entry_raw_data);
-      free(entries[i]);
+      rc = STATUS_ERROR;
     }
-    return STATUS_ERROR;
   }
 
-  return 0;
+  if (rc == 0 && after != NULL) {
+    *after = *target;
+    after->entry_raw_data = NULL;
+  }
+
+  __free_entries(entries, loaded);
+  return rc;
+}
+
+int update_entry_done(int fd, const db_header_t *header, const uint64_t entry_id,
+                      todo_entry_t *out) {
+  return update_entry_status(fd, header, entry_id, DELTA_DONE, NULL, out);
 }
 
 // ✦ ❯ xxd ~/.todo.db
@@ -207,8 +689,14 @@ int update_entry_done(int fd, const db_header_t *header, const uint64_t entry_id
 // 00000040: 736f 7572 6176 0000 0026 0000 0000 0000  sourav...&......
 // 00000050: 0002 0000 019c 13fa 1537 0000 0000 0000  .........7......
 // 00000060: 0000 0000 0006 736f 7572 6176            ......sourav
+static int __read_entries(storage_stream_t *, const db_header_t *, todo_entry_t **, size_t *,
+                          uint64_t *, const delta_map_t *);
+static int __read_compact_entries(int, const db_header_t *, todo_entry_t **, size_t *, uint64_t *,
+                                  const delta_map_t *);
+
 int read_entries_from_db(int fd, const db_header_t *header, todo_entry_t **entries,
                          size_t *bytes_read, uint64_t *stopat) {
+  TRACE_FUNC();
   if (fd < 0) {
     DEBUG_ERROR("invalid fd provided\n");
     return STATUS_ERROR;
@@ -222,31 +710,103 @@ int read_entries_from_db(int fd, const db_header_t *header, todo_entry_t **entri
     return STATUS_ERROR;
   }
 
-  if (lseek(fd, sizeof(db_header_t), SEEK_SET) < 0) {
-    DEBUG_ERROR("failed to offset the cursor ahead of the header\n");
+  /* status changes living in the delta log override the base entries */
+  delta_map_t deltas;
+  memset(&deltas, 0, sizeof(deltas));
+  if ((header->_flags & DB_FEATURE_DELTA_LOG) && delta_map_load(&deltas) < 0) {
+    DEBUG_ERROR("failed to load the delta log\n");
     return STATUS_ERROR;
   }
 
+  int rc;
+  if (header->_flags & DB_FLAG_COMPACT_RECORDS) {
+    rc = __read_compact_entries(fd, header, entries, bytes_read, stopat, &deltas);
+  } else {
+    /* the fields of an entry are small reads, they are served out of big
+     * ones that the backend may already have in flight */
+    storage_stream_t stream;
+    rc = storage_stream_open(&stream, fd, sizeof(db_header_t));
+    if (rc == 0) { rc = __read_entries(&stream, header, entries, bytes_read, stopat, &deltas); }
+    storage_stream_close(&stream);
+  }
+  delta_map_free(&deltas);
+  return rc;
+}
+
+typedef struct {
+  todo_entry_t **entries;
+  size_t n;
+  const uint64_t *stopat;
+  const delta_map_t *deltas;
+} read_ctx_t;
+
+static int __collect_entry(void *ctx, todo_entry_t *view) {
+  read_ctx_t *read = ctx;
+  todo_entry_t *entry = malloc(sizeof(todo_entry_t));
+  if (entry == NULL) {
+    DEBUG_ERROR("failed to alloc entry\n");
+    return STATUS_ERROR;
+  }
+  *entry = *view;
+  if (!view->_in_blob) {
+    entry->entry_raw_data = malloc(view->entry_raw_data_len + 1);
+    if (entry->entry_raw_data == NULL) {
+      DEBUG_ERROR("failed alloc raw data bytes\n");
+      free(entry);
+      return STATUS_ERROR;
+    }
+    memcpy(entry->entry_raw_data, view->entry_raw_data, view->entry_raw_data_len);
+    entry->entry_raw_data[view->entry_raw_data_len] = '\0';
+  }
+
+  delta_map_apply(read->deltas, entry);
+  read->entries[read->n++] = entry;
+  return read->stopat != NULL && *read->stopat == entry->entry_id ? 1 : 0;
+}
+
+/* compact entries depend on the ones before them so they are decoded out
+ * of big reads. Such files are sealed segments that only ever change
+ * through the delta log, `bytes_read` is always 0 for them */
+static int __read_compact_entries(int fd, const db_header_t *header, todo_entry_t **entries,
+                                  size_t *bytes_read, uint64_t *stopat,
+                                  const delta_map_t *deltas) {
+  if (bytes_read != NULL) { *bytes_read = 0; }
+  read_ctx_t read = {.entries = entries, .n = 0, .stopat = stopat, .deltas = deltas};
+  int rc = entry_scan(fd, header, __collect_entry, &read);
+  if (rc < 0) {
+    for (size_t i = 0; i < read.n; i++) {
+      free(entries[i]->entry_raw_data);
+      free(entries[i]);
+    }
+    return rc;
+  }
+
+  /* like `__read_entries` the index of the entry we stopped at */
+  if (stopat != NULL) { return rc > 0 ? (int)read.n - 1 : (int)read.n; }
+  return 0;
+}
+
+static int __read_entries(storage_stream_t *stream, const db_header_t *header,
+                          todo_entry_t **entries, size_t *bytes_read, uint64_t *stopat,
+                          const delta_map_t *deltas) {
   /* track the amount of bytes we're reading */
   if (bytes_read != NULL) { *bytes_read = 0; }
 
   /* loop over and get all the entries */
   size_t i = 0;
   for (; i < header->_entries; i++) {
-    uint8_t length_buf[4];
-    if (read(fd, &length_buf, 4) != 4) {
+    char fixed[ENTRY_HEADER_SIZE];
+    if (storage_stream_read(stream, fixed, TEXT_LENGTH_PREFIX) != (ssize_t)TEXT_LENGTH_PREFIX) {
 #ifdef DEBUG
-      perror("read()");
+      perror("storage_stream_read()");
 #endif
       DEBUG_ERROR("failed to read length from buffer\n");
       return STATUS_ERROR;
     }
-    if (bytes_read != NULL) { *bytes_read += 4; }
+    if (bytes_read != NULL) { *bytes_read += TEXT_LENGTH_PREFIX; }
 
     /* get total length */
-    uint32_t total_length;
-    memcpy(&total_length, length_buf, 4);
-    total_length = ntohl(total_length);
+    uint32_t total_length = schema_get_32(fixed + ENTRY_OFFSET(LENGTH));
 
     todo_entry_t *entry = (todo_entry_t *)malloc(sizeof(todo_entry_t));
     if (entry == NULL) {
@@ -257,49 +817,89 @@ int read_entries_from_db(int fd, const db_header_t *header, todo_entry_t **entri
       return STATUS_ERROR;
     }
 
-    uint8_t buffer[36];
     /* read from entry_id to data len all into the buffer */
-    if (read(fd, &buffer, 36) != 36) {
+    const size_t rest = ENTRY_HEADER_SIZE - TEXT_LENGTH_PREFIX;
+    if (storage_stream_read(stream, fixed + TEXT_LENGTH_PREFIX, rest) != (ssize_t)rest) {
 #ifdef DEBUG
-      perror("read()");
+      perror("storage_stream_read()");
 #endif
       DEBUG_ERROR("failed to read entry id from buffer\n");
+      free(entry);
       return STATUS_ERROR;
     }
-    if (bytes_read != NULL) { *bytes_read += 36; }
-
-    /* parse entry id from the buffer */
-    uint64_t entry_id;
-    memcpy(&entry_id, buffer, 8);
-    entry->entry_id = ntohll(entry_id);
-
-    /* parse created_at from the buffer */
-    uint64_t created_at;
-    memcpy(&created_at, buffer + 8, 8);
-    entry->_created_at = ntohll(created_at);
-
-    /* parse deleted_at from the buffer */
-    uint64_t deleted_at;
-    memcpy(&deleted_at, buffer + 16, 8);
-    entry->_deleted_at = ntohll(deleted_at);
+    if (bytes_read != NULL) { *bytes_read += rest; }
 
-    /* parse done_at from the buffer */
-    uint64_t done_at;
-    memcpy(&done_at, buffer + 24, 8);
-    entry->_done_at = ntohll(done_at);
-
-    /* parse data_len from the buffer */
-    uint32_t data_len;
-    memcpy(&data_len, buffer + 32, 4);
-    data_len = ntohl(data_len);
+    /* the fixed fields and the length of the text */
+    entry_fields_decode(fixed, entry);
+    uint32_t data_len = schema_get_32(fixed + ENTRY_OFFSET(DATA_LEN));
+    entry->_in_blob = (data_len & ENTRY_BLOB_REF) != 0;
+    entry->_blob_offset = 0;
+    entry->_interned = (data_len & ENTRY_DICT_REF) != 0;
+    entry->_text_id = 0;
+    data_len &= ~(ENTRY_BLOB_REF | ENTRY_DICT_REF);
 
     /* match if the total length matches the actual bytes */
-    size_t expected = 4 + 8 + 8 + 8 + 8 + 4 + data_len;
-    if (total_length != expected) {
+    size_t expected = ENTRY_HEADER_SIZE + data_len;
+    if (total_length != expected || (entry->_in_blob && data_len != ENTRY_BLOB_REF_SIZE) ||
+        (entry->_interned && (entry->_in_blob || data_len != ENTRY_DICT_REF_SIZE))) {
       DEBUG_ERROR("Corrupted entry: length mismatch\n");
+      free(entry);
       return STATUS_ERROR;
     }
 
+    /* long texts are left in the blob file until somebody asks for them */
+    if (entry->_in_blob) {
+      char ref[ENTRY_BLOB_REF_SIZE];
+      if (storage_stream_read(stream, ref, sizeof(ref)) != (ssize_t)sizeof(ref)) {
+        DEBUG_ERROR("failed to read blob reference\n");
+        free(entry);
+        return STATUS_ERROR;
+      }
+      if (bytes_read) { *bytes_read += sizeof(ref); }
+
+      entry_blob_ref_decode(ref, entry);
+      entry->entry_raw_data = NULL;
+
+      delta_map_apply(deltas, entry);
+      entries[i] = entry;
+      if (stopat != NULL && *stopat == entry->entry_id) { break; }
+      continue;
+    }
+
+    /* interned texts are copied out of the mapped dictionary */
+    if (entry->_interned) {
+      char ref[ENTRY_DICT_REF_SIZE];
+      const char *text;
+      size_t text_len;
+      if (storage_stream_read(stream, ref, sizeof(ref)) != (ssize_t)sizeof(ref)) {
+        DEBUG_ERROR("failed to read dictionary reference\n");
+        free(entry);
+        return STATUS_ERROR;
+      }
+      if (bytes_read) { *bytes_read += sizeof(ref); }
+
+      entry_dict_ref_decode(ref, entry);
+      if (dict_lookup(entry->_text_id, &text, &text_len) < 0) {
+        DEBUG_ERROR("failed to resolve interned text\n");
+        free(entry);
+        return STATUS_ERROR;
+      }
+      entry->entry_raw_data = malloc(text_len + 1);
+      if (entry->entry_raw_data == NULL) {
+        DEBUG_ERROR("failed alloc raw data bytes\n");
+        free(entry);
+        return STATUS_ERROR;
+      }
+      memcpy(entry->entry_raw_data, text, text_len);
+      entry->entry_raw_data[text_len] = '\0';
+      entry->entry_raw_data_len = text_len;
+
+      delta_map_apply(deltas, entry);
+      entries[i] = entry;
+      if (stopat != NULL && *stopat == entry->entry_id) { break; }
+      continue;
+    }
+
     /* allocate space for the string */
     entry->entry_raw_data = malloc(data_len + 1);
     if (entry->entry_raw_data == NULL) {
@@ -311,9 +911,9 @@ int read_entries_from_db(int fd, const db_header_t *header, todo_entry_t **entri
       return STATUS_ERROR;
     }
 
-    if (read(fd, entry->entry_raw_data, data_len) != data_len) {
+    if (storage_stream_read(stream, entry->entry_raw_data, data_len) != (ssize_t)data_len) {
 #ifdef DEBUG
-      perror("read()");
+      perror("storage_stream_read()");
 #endif
       free(entry->entry_raw_data);
       free(entry);
@@ -324,6 +924,7 @@ int read_entries_from_db(int fd, const db_header_t *header, todo_entry_t **entri
     entry->entry_raw_data_len = (size_t)data_len;
     if (bytes_read) { *bytes_read += data_len; }
 
+    delta_map_apply(deltas, entry);
     entries[i] = entry;
 
     /* check if we wanna stop here */
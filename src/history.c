@@ -0,0 +1,490 @@
+#include "todoctl/history.h"
+#include "todoctl/archive.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/due.h"
+#include "todoctl/errors.h"
+#include "todoctl/segment.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#define HISTORY_READ_CHUNK (64 * 1024)
+
+typedef struct {
+  uint8_t kind;
+  uint64_t entry_id;
+  uint64_t at;
+} history_event_t;
+
+typedef struct {
+  uint32_t pending;    /* events after the newest checkpoint */
+  uint64_t length;     /* committed bytes, the header included */
+  uint64_t checkpoint; /* offset of the newest checkpoint, 0 for none */
+} history_head_t;
+
+/* a growing buffer of encoded records */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} history_buf_t;
+
+int history_parse_time(const char *src, uint64_t now, uint64_t *out) {
+  if (src == NULL || out == NULL) { return STATUS_ERROR; }
+  uint64_t ago;
+  if (due_parse_duration(src, &ago) == 0) {
+    *out = ago < now ? now - ago : 0;
+    return 0;
+  }
+  /* dates read the same as due dates */
+  return due_parse(src, now, out);
+}
+
+static void __state_init(history_state_t *state) {
+  bitmap_init(&state->all);
+  bitmap_init(&state->done);
+  bitmap_init(&state->deleted);
+}
+
+void history_state_free(history_state_t *state) {
+  if (state == NULL) { return; }
+  bitmap_free(&state->all);
+  bitmap_free(&state->done);
+  bitmap_free(&state->deleted);
+}
+
+static int __apply(history_state_t *state, uint8_t kind, uint64_t id) {
+  switch (kind) {
+  case HISTORY_ADD: return bitmap_add(&state->all, id);
+  case HISTORY_DONE: return bitmap_add(&state->done, id);
+  case HISTORY_UNDONE: bitmap_remove(&state->done, id); return 0;
+  case HISTORY_DELETE: return bitmap_add(&state->deleted, id);
+  }
+  DEBUG_ERROR("unknown history event\n");
+  return TODOCTL_ERR_CORRUPTED_DB;
+}
+
+static int __buf_reserve(history_buf_t *buf, size_t extra) {
+  if (buf->len + extra <= buf->cap) { return 0; }
+  size_t cap = buf->cap < 4096 ? 4096 : buf->cap;
+  while (cap < buf->len + extra) { cap *= 2; }
+  char *grown = realloc(buf->data, cap);
+  if (grown == NULL) {
+    DEBUG_ERROR("failed to grow history buffer\n");
+    return STATUS_ERROR;
+  }
+  buf->data = grown;
+  buf->cap = cap;
+  return 0;
+}
+
+static int __encode_event(history_buf_t *buf, const history_event_t *event) {
+  if (__buf_reserve(buf, HISTORY_EVENT_SIZE) < 0) { return STATUS_ERROR; }
+  char *p = buf->data + buf->len;
+  p[0] = (char)event->kind;
+  schema_put_64(p + 1, event->entry_id);
+  schema_put_64(p + 9, event->at);
+  buf->len += HISTORY_EVENT_SIZE;
+  return 0;
+}
+
+static size_t __checkpoint_size(const history_state_t *state) {
+  return HISTORY_CHECKPOINT_HEAD + bitmap_serialized_size(&state->all) +
+         bitmap_serialized_size(&state->done) + bitmap_serialized_size(&state->deleted);
+}
+
+static int __encode_checkpoint(history_buf_t *buf, const history_state_t *state, uint64_t at,
+                               uint64_t prev) {
+  size_t size = __checkpoint_size(state);
+  if (__buf_reserve(buf, size) < 0) { return STATUS_ERROR; }
+  char *p = buf->data + buf->len;
+  p[0] = (char)HISTORY_CHECKPOINT;
+  schema_put_64(p + 1, prev);
+  schema_put_64(p + 9, at);
+  schema_put_32(p + 17, (uint32_t)(size - HISTORY_CHECKPOINT_HEAD));
+  p += HISTORY_CHECKPOINT_HEAD;
+  bitmap_serialize(&state->all, p);
+  p += bitmap_serialized_size(&state->all);
+  bitmap_serialize(&state->done, p);
+  p += bitmap_serialized_size(&state->done);
+  bitmap_serialize(&state->deleted, p);
+  buf->len += size;
+  return 0;
+}
+
+/* a checkpoint is due once the events since the newest one take as many
+ * bytes as it did */
+static bool __checkpoint_due(uint32_t pending, uint64_t newest_size) {
+  uint64_t bytes = (uint64_t)pending * HISTORY_EVENT_SIZE;
+  return pending >= HISTORY_CHECKPOINT_MIN && bytes >= newest_size;
+}
+
+static void __encode_head(char *buf, const history_head_t *head) {
+  schema_put_64(buf, HISTORY_MAGIC);
+  schema_put_32(buf + 8, HISTORY_VERSION);
+  schema_put_32(buf + 12, head->pending);
+  schema_put_64(buf + 16, head->length);
+  schema_put_64(buf + 24, head->checkpoint);
+}
+
+static int __open_history(int flags, int *out) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(HISTORY_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open history\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  *out = fd;
+  return 0;
+}
+
+static int __read_head(int fd, history_head_t *head) {
+  char buf[HISTORY_HEADER_SIZE];
+  ssize_t n = pread(fd, buf, sizeof(buf), 0);
+  /* a file that never got its header is an empty history */
+  if (n == 0) {
+    head->pending = 0;
+    head->length = HISTORY_HEADER_SIZE;
+    head->checkpoint = 0;
+    return 0;
+  }
+  if (n != (ssize_t)sizeof(buf) || schema_get_64(buf) != HISTORY_MAGIC) {
+    DEBUG_ERROR("invalid history magic\n");
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(buf + 8) != HISTORY_VERSION) {
+    DEBUG_ERROR("invalid history version\n");
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+  head->pending = schema_get_32(buf + 12);
+  head->length = schema_get_64(buf + 16);
+  head->checkpoint = schema_get_64(buf + 24);
+  if (head->length < HISTORY_HEADER_SIZE || head->checkpoint >= head->length) {
+    DEBUG_ERROR("history is corrupted\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  return 0;
+}
+
+/* reads the fixed part of the checkpoint at `offset` */
+static int __read_checkpoint_head(int fd, const history_head_t *head, uint64_t offset,
+                                  uint64_t *at, uint64_t *prev, uint32_t *len) {
+  char buf[HISTORY_CHECKPOINT_HEAD];
+  if (offset < HISTORY_HEADER_SIZE || offset + sizeof(buf) > head->length ||
+      pread(fd, buf, sizeof(buf), (off_t)offset) != (ssize_t)sizeof(buf) ||
+      buf[0] != HISTORY_CHECKPOINT) {
+    DEBUG_ERROR("history checkpoint is corrupted\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  *prev = schema_get_64(buf + 1);
+  *at = schema_get_64(buf + 9);
+  *len = schema_get_32(buf + 17);
+  if (offset + sizeof(buf) + *len > head->length || *prev >= offset) {
+    DEBUG_ERROR("history checkpoint is corrupted\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  return 0;
+}
+
+static int __load_checkpoint(int fd, uint64_t offset, uint32_t len, history_state_t *state) {
+  char *buf = malloc(len > 0 ? len : 1);
+  if (buf == NULL) { return STATUS_ERROR; }
+  if (pread(fd, buf, len, (off_t)(offset + HISTORY_CHECKPOINT_HEAD)) != (ssize_t)len) {
+    free(buf);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  size_t pos = 0, used = 0;
+  bitmap_t *sets[] = {&state->all, &state->done, &state->deleted};
+  int rc = 0;
+  for (size_t i = 0; i < 3 && rc == 0; i++, pos += used) {
+    bitmap_free(sets[i]);
+    rc = bitmap_deserialize(sets[i], buf + pos, len - pos, &used);
+  }
+  free(buf);
+  return rc;
+}
+
+/* the state at `at`: the newest checkpoint not after it followed by the
+ * events up to it */
+static int __state_at(int fd, const history_head_t *head, uint64_t at, history_state_t *state) {
+  __state_init(state);
+  uint64_t pos = HISTORY_HEADER_SIZE;
+  int rc = 0;
+  for (uint64_t offset = head->checkpoint; offset != 0 && rc == 0;) {
+    uint64_t cp_at, prev;
+    uint32_t len;
+    if ((rc = __read_checkpoint_head(fd, head, offset, &cp_at, &prev, &len)) < 0) { break; }
+    if (cp_at <= at) {
+      rc = __load_checkpoint(fd, offset, len, state);
+      pos = offset + HISTORY_CHECKPOINT_HEAD + len;
+      break;
+    }
+    offset = prev;
+  }
+
+  char *chunk = rc == 0 ? malloc(HISTORY_READ_CHUNK) : NULL;
+  if (rc == 0 && chunk == NULL) { rc = STATUS_ERROR; }
+  bool reached = false;
+  while (rc == 0 && !reached && pos < head->length) {
+    size_t want = (size_t)(head->length - pos);
+    if (want > HISTORY_READ_CHUNK) { want = HISTORY_READ_CHUNK; }
+    if (pread(fd, chunk, want, (off_t)pos) != (ssize_t)want) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    size_t i = 0;
+    while (rc == 0 && i + HISTORY_EVENT_SIZE <= want) {
+      uint64_t event_at = schema_get_64(chunk + i + 9);
+      if (event_at > at) {
+        reached = true;
+        break;
+      }
+      if (chunk[i] == HISTORY_CHECKPOINT) {
+        /* a newer checkpoint not after `at` means the clock went back,
+         * the events before it are the same either way */
+        if (i + HISTORY_CHECKPOINT_HEAD > want) { break; }
+        i += HISTORY_CHECKPOINT_HEAD + schema_get_32(chunk + i + 17);
+        continue;
+      }
+      rc = __apply(state, (uint8_t)chunk[i], schema_get_64(chunk + i + 1));
+      i += HISTORY_EVENT_SIZE;
+    }
+    if (i == 0 && rc == 0 && !reached) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    pos += i;
+  }
+  free(chunk);
+  if (rc < 0) {
+    DEBUG_ERROR("failed to replay history\n");
+    history_state_free(state);
+  }
+  return rc;
+}
+
+int history_state_at(uint64_t at, history_state_t *state) {
+  TRACE_FUNC();
+  if (state == NULL) { return STATUS_ERROR; }
+  int fd;
+  int rc = __open_history(O_RDONLY, &fd);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) {
+    __state_init(state);
+    return 0;
+  }
+  if (rc < 0) { return rc; }
+  history_head_t head;
+  rc = __read_head(fd, &head);
+  if (rc == 0) { rc = __state_at(fd, &head, at, state); }
+  close(fd);
+  return rc;
+}
+
+/* appends the events, with a checkpoint after them when one is due, callers
+ * hold the db lock */
+static int __append(const history_event_t *events, size_t n) {
+  int fd;
+  int rc = __open_history(O_RDWR | O_CREAT, &fd);
+  if (rc < 0) { return rc; }
+  history_head_t head;
+  if ((rc = __read_head(fd, &head)) < 0) {
+    close(fd);
+    return rc;
+  }
+
+  history_buf_t buf = {0};
+  for (size_t i = 0; i < n && rc == 0; i++) { rc = __encode_event(&buf, &events[i]); }
+  uint64_t checkpoint = head.checkpoint;
+  uint32_t pending = head.pending + (uint32_t)n;
+  uint64_t newest_size = 0;
+  if (rc == 0 && pending >= HISTORY_CHECKPOINT_MIN && head.checkpoint != 0) {
+    uint64_t at, prev;
+    uint32_t len;
+    rc = __read_checkpoint_head(fd, &head, head.checkpoint, &at, &prev, &len);
+    newest_size = HISTORY_CHECKPOINT_HEAD + (uint64_t)len;
+  }
+  /* only a checkpoint that is written needs the state */
+  if (rc == 0 && __checkpoint_due(pending, newest_size)) {
+    history_state_t state;
+    rc = __state_at(fd, &head, UINT64_MAX, &state);
+    if (rc == 0) {
+      for (size_t i = 0; i < n && rc == 0; i++) {
+        rc = __apply(&state, events[i].kind, events[i].entry_id);
+      }
+      checkpoint = head.length + buf.len;
+      pending = 0;
+      if (rc == 0) { rc = __encode_checkpoint(&buf, &state, events[n - 1].at, head.checkpoint); }
+      history_state_free(&state);
+    }
+  }
+
+  /* the records land first, the header moving past them commits them */
+  if (rc == 0) {
+    char header[HISTORY_HEADER_SIZE];
+    uint64_t offset = head.length;
+    head.pending = pending;
+    head.length += buf.len;
+    head.checkpoint = checkpoint;
+    __encode_head(header, &head);
+    if (pwrite(fd, buf.data, buf.len, (off_t)offset) != (ssize_t)buf.len || fdatasync(fd) < 0 ||
+        pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(fd) < 0) {
+      DEBUG_ERROR("failed to append to history\n");
+#ifdef DEBUG
+      perror("pwrite()");
+#endif
+      rc = STATUS_ERROR;
+    }
+  }
+  free(buf.data);
+  close(fd);
+  return rc;
+}
+
+static int __record(const history_event_t *events, size_t n) {
+  if (n == 0) { return 0; }
+  int lock;
+  if (db_lock_raw(&lock) < 0) { return STATUS_ERROR; }
+  int rc = __append(events, n);
+  db_unlock(lock);
+  return rc;
+}
+
+int history_record_add(const todo_entry_t *entry) {
+  TRACE_FUNC();
+  if (entry == NULL) { return STATUS_ERROR; }
+  history_event_t event = {.kind = HISTORY_ADD, .entry_id = entry->entry_id,
+                           .at = entry->_created_at};
+  return __record(&event, 1);
+}
+
+int history_record_change(const todo_entry_t *before, const todo_entry_t *after) {
+  TRACE_FUNC();
+  if (before == NULL || after == NULL) { return STATUS_ERROR; }
+  history_event_t events[2];
+  size_t n = 0;
+  uint64_t id = after->entry_id;
+  if (before->_done_at == 0 && after->_done_at > 0) {
+    events[n++] = (history_event_t){.kind = HISTORY_DONE, .entry_id = id, .at = after->_done_at};
+  } else if (before->_done_at > 0 && after->_done_at == 0) {
+    events[n++] =
+        (history_event_t){.kind = HISTORY_UNDONE, .entry_id = id, .at = get_time_in_millis()};
+  }
+  if (before->_deleted_at == 0 && after->_deleted_at > 0) {
+    events[n++] =
+        (history_event_t){.kind = HISTORY_DELETE, .entry_id = id, .at = after->_deleted_at};
+  }
+  return __record(events, n);
+}
+
+/* time order, an add before anything else that happened at the same time */
+static int __compare_events(const void *a, const void *b) {
+  const history_event_t *ea = a, *eb = b;
+  if (ea->at != eb->at) { return ea->at < eb->at ? -1 : 1; }
+  if (ea->kind != eb->kind) { return ea->kind < eb->kind ? -1 : 1; }
+  if (ea->entry_id != eb->entry_id) { return ea->entry_id < eb->entry_id ? -1 : 1; }
+  return 0;
+}
+
+/* the events the timestamps of the entries tell, in time order */
+static int __scan_events(history_event_t **out, size_t *n_out) {
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (db_read_entries(NULL, &entries, &n) < 0) { return STATUS_ERROR; }
+  if (archive_read_entries(NULL, &entries, &n) < 0) {
+    db_free_entries(entries, n);
+    return STATUS_ERROR;
+  }
+  history_event_t *events = malloc(sizeof(history_event_t) * (n * 3 + 1));
+  if (events == NULL) {
+    db_free_entries(entries, n);
+    return STATUS_ERROR;
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    const todo_entry_t *entry = entries[i];
+    events[count++] = (history_event_t){HISTORY_ADD, entry->entry_id, entry->_created_at};
+    if (entry->_done_at > 0) {
+      events[count++] = (history_event_t){HISTORY_DONE, entry->entry_id, entry->_done_at};
+    }
+    if (entry->_deleted_at > 0) {
+      events[count++] = (history_event_t){HISTORY_DELETE, entry->entry_id, entry->_deleted_at};
+    }
+  }
+  db_free_entries(entries, n);
+  qsort(events, count, sizeof(history_event_t), __compare_events);
+  *out = events;
+  *n_out = count;
+  return 0;
+}
+
+/* encodes a whole history, checkpoints included, after the header */
+static int __encode_history(const history_event_t *events, size_t n, history_buf_t *buf,
+                            history_head_t *head) {
+  history_state_t state;
+  __state_init(&state);
+  head->pending = 0;
+  head->checkpoint = 0;
+  uint64_t newest_size = 0;
+  int rc = __buf_reserve(buf, HISTORY_HEADER_SIZE);
+  buf->len = HISTORY_HEADER_SIZE;
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    rc = __encode_event(buf, &events[i]);
+    if (rc == 0) { rc = __apply(&state, events[i].kind, events[i].entry_id); }
+    if (rc == 0 && __checkpoint_due(++head->pending, newest_size)) {
+      uint64_t offset = buf->len;
+      rc = __encode_checkpoint(buf, &state, events[i].at, head->checkpoint);
+      newest_size = buf->len - offset;
+      head->checkpoint = offset;
+      head->pending = 0;
+    }
+  }
+  history_state_free(&state);
+  head->length = buf->len;
+  if (rc == 0) { __encode_head(buf->data, head); }
+  return rc;
+}
+
+int history_rebuild(void) {
+  TRACE_FUNC();
+  int lock;
+  if (db_lock_raw(&lock) < 0) { return STATUS_ERROR; }
+  history_event_t *events = NULL;
+  size_t n = 0;
+  history_buf_t buf = {0};
+  history_head_t head;
+  int rc = __scan_events(&events, &n);
+  if (rc == 0) { rc = __encode_history(events, n, &buf, &head); }
+  free(events);
+
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (rc == 0 && (db_resolve_path(HISTORY_SUFFIX, path, sizeof(path)) < 0 ||
+                  db_resolve_path(HISTORY_SUFFIX ".tmp", tmp_path, sizeof(tmp_path)) < 0)) {
+    rc = STATUS_ERROR;
+  }
+  int tmp = rc == 0 ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+  if (rc == 0 && tmp < 0) {
+    perror("open()");
+    rc = STATUS_ERROR;
+  }
+  if (rc == 0) {
+    if (write(tmp, buf.data, buf.len) != (ssize_t)buf.len || fsync(tmp) < 0) {
+      perror("write()");
+      rc = STATUS_ERROR;
+    }
+    close(tmp);
+    if (rc == 0 && rename(tmp_path, path) < 0) {
+      perror("rename()");
+      rc = STATUS_ERROR;
+    }
+    if (rc < 0) { unlink(tmp_path); }
+  }
+  free(buf.data);
+  db_unlock(lock);
+  return rc;
+}
@@ -1,28 +1,613 @@
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "todoctl/archive.h"
+#include "todoctl/backup.h"
 #include "todoctl/commands.h"
 #include "todoctl/db.h"
+#include "todoctl/due.h"
 #include "todoctl/entry.h"
+#include "todoctl/history.h"
+#include "todoctl/multi.h"
+#include "todoctl/output.h"
+#include "todoctl/perf.h"
+#include "todoctl/stats.h"
+#include "todoctl/storage.h"
+#include "todoctl/tags.h"
+#include "todoctl/trace.h"
+#include "todoctl/trigram.h"
+#include "todoctl/util.h"
+#include "todoctl/watch.h"
 
 void print_usage(char *argv[]) {
-  printf("Usage: %s [-a <task>] [-i]\n", argv[0]);
+  printf("Usage: %s [--db <path>]... [-a <task>] [-i]\n", argv[0]);
+  printf("       %s [--db <path>]... <command> [options]\n", argv[0]);
+  printf("\t --db uses another db than ~/.todo.db, several (a,b or a directory of\n");
+  printf("\t      *.db files) are read in parallel by -l, query and export\n");
   printf("\t -i initialize todoctl\n");
   printf("\t -a adds a new task\n");
+  printf("\t    --tag <name>             tags it, repeat for more (infra, on-call, ...)\n");
+  printf("\t    --due <when>             due at YYYY-MM-DD[ HH:MM] or in 3h, 2d, 1w\n");
   printf("\t -l list all the tasks\n");
+  printf("\t    --sort id|created|done   lists them in that order instead\n");
+  printf("\t    --top <k>                only the first k of them\n");
+  printf("\t    --desc                   newest first\n");
+  printf("\t    --include-archive        archived tasks too\n");
+  printf("\t    --as-of <when>           as they were at YYYY-MM-DD[ HH:MM] or 30d ago\n");
   printf("\t -k marks a task as done\n");
+  printf("\nCommands:\n");
+  printf("\t stats [--verify] [--rebuild]  counters, done today and time to done\n");
+  printf("\t       [--as-of <when>]        the counts as they were back then (history)\n");
+  printf("\t watch [--new]                 stream adds and dones as they happen\n");
+  printf("\t query [--explain] [--format f] [--sort f] [--top k] [--desc] <query>\n");
+  printf("\t                               lists the tasks matching a query, e.g.\n");
+  printf("\t                               'done=false and created>2026-10-01 and text~deploy'\n");
+  printf("\t                               --include-archive reads archived tasks too\n");
+  printf("\t export [--format f] [query]   dumps the tasks as json (or plain, tsv)\n");
+  printf("\t find <word>                   lists the tasks containing a word\n");
+  printf("\t search [--rebuild] <text>     lists the tasks most like a text, typos included\n");
+  printf("\t tags [--rebuild]              lists the tags, query them with tag=x and tag!=x\n");
+  printf("\t overdue                       lists the open tasks past their due time\n");
+  printf("\t upcoming [--within <dur>]     lists the open tasks due within dur (24h)\n");
+  printf("\t undone <id>                   reopens a task marked done\n");
+  printf("\t delete <id>                   marks a task deleted\n");
+  printf("\t compact                       folds the delta log into the db\n");
+  printf("\t seal                          moves the active entries into a sealed segment\n");
+  printf("\t segments [--verify]           lists the sealed segments\n");
+  printf("\t archive [--older-than <days>] moves tasks done that long ago (30) to the archive\n");
+  printf("\t backup <dir>                  copies what changed since the last backup into dir\n");
+  printf("\t restore [--force] <dir>       rebuilds the db from the backups in dir\n");
+  printf("\t merge <other.db>              adds the tasks of another db, done state included\n");
+  printf("\t fsck [--dry-run]              checks the db and repairs a damaged tail\n");
+  printf("\t perf-report [--days n] [cmd]  p50/p99 run times per command and day (14)\n");
+  printf("\t feature [enable|disable <f>]  shows or toggles db features: delta-log, segments,\n");
+  printf("\t                               blobs, intern, tags, due, history, trigrams, perf,\n");
+  printf("\t                               backup\n");
 }
 
+/* the dbs given with `--db`, with one of them it simply replaces the
+ * default and only the listing commands know what to do with more */
+static char **dbs;
+static size_t n_dbs;
+
+static int stats_main(int argc, char *argv[]) {
+  int flags = STATS_NONE;
+  uint64_t as_of = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verify") == 0) {
+      flags |= STATS_VERIFY;
+    } else if (strcmp(argv[i], "--rebuild") == 0) {
+      flags |= STATS_REBUILD;
+    } else if (strcmp(argv[i], "--as-of") == 0 && i + 1 < argc) {
+      if (history_parse_time(argv[++i], get_time_in_millis(), &as_of) < 0) {
+        fprintf(stderr, "Invalid time: %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else {
+      fprintf(stderr, "Unknown stats option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* the past has no counters to verify or rebuild */
+  if (as_of > 0) {
+    if (flags != STATS_NONE) {
+      fprintf(stderr, "--as-of does not go with --verify or --rebuild\n");
+      return EXIT_FAILURE;
+    }
+    if (stats_as_of_command(as_of) < 0) {
+      fprintf(stderr, "Failed to read stats!");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  if (stats_command(flags) < 0) {
+    fprintf(stderr, "Failed to read stats!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int tags_main(int argc, char *argv[]) {
+  int flags = TAGS_NONE;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rebuild") == 0) {
+      flags |= TAGS_REBUILD;
+    } else {
+      fprintf(stderr, "Unknown tags option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (tags_command(flags) < 0) {
+    fprintf(stderr, "Failed to read tags!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int overdue_main(int argc, char *argv[]) {
+  if (argc != 1) {
+    fprintf(stderr, "Unknown overdue option: %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (overdue_command() < 0) {
+    fprintf(stderr, "Failed to list overdue tasks!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int upcoming_main(int argc, char *argv[]) {
+  uint64_t within = DUE_DEFAULT_WITHIN;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--within") == 0 && i + 1 < argc) {
+      if (due_parse_duration(argv[++i], &within) < 0) {
+        fprintf(stderr, "Invalid duration: %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else {
+      fprintf(stderr, "Unknown upcoming option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (upcoming_command(within) < 0) {
+    fprintf(stderr, "Failed to list upcoming tasks!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int watch_main(int argc, char *argv[]) {
+  int flags = WATCH_NONE;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--new") == 0) {
+      flags |= WATCH_ONLY_NEW;
+    } else {
+      fprintf(stderr, "Unknown watch option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (watch_command(flags) < 0) {
+    fprintf(stderr, "Failed to watch the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int parse_id(const char *arg, uint64_t *out) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long long value = strtoull(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || value == 0) {
+    fprintf(stderr, "Invalid task id: %s\n", arg);
+    return -1;
+  }
+  *out = (uint64_t)value;
+  return 0;
+}
+
+static int parse_sort(const char *arg, query_order_t *order) {
+  int field = query_order_field(arg);
+  if (field < 0) {
+    fprintf(stderr, "Unknown sort: %s (id, created, done)\n", arg);
+    return -1;
+  }
+  order->field = (query_field_t)field;
+  return 0;
+}
+
+static int parse_top(const char *arg, query_order_t *order) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long long value = strtoull(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || value == 0) {
+    fprintf(stderr, "Invalid top: %s\n", arg);
+    return -1;
+  }
+  order->top = (size_t)value;
+  return 0;
+}
+
+/* query and export are the same thing with a different default format */
+static int __query_main(int argc, char *argv[], int format, const char *usage) {
+  int flags = 0;
+  const char *src = NULL;
+  /* --top and --desc alone keep the id order */
+  query_order_t order = {.field = QUERY_FIELD_ID};
+  bool ordered = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--explain") == 0) {
+      flags |= QUERY_EXPLAIN;
+    } else if (strcmp(argv[i], "--include-archive") == 0) {
+      flags |= QUERY_WITH_ARCHIVE;
+    } else if (strcmp(argv[i], "--sort") == 0 && i + 1 < argc) {
+      if (parse_sort(argv[++i], &order) < 0) { return EXIT_FAILURE; }
+      ordered = true;
+    } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      if (parse_top(argv[++i], &order) < 0) { return EXIT_FAILURE; }
+      ordered = true;
+    } else if (strcmp(argv[i], "--desc") == 0) {
+      order.desc = true;
+      ordered = true;
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      format = output_format_from_name(argv[++i]);
+      if (format < 0) {
+        fprintf(stderr, "Unknown format: %s (plain, tsv, json)\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (src == NULL) {
+      src = argv[i];
+    } else {
+      fprintf(stderr, "Usage: %s\n", usage);
+      return EXIT_FAILURE;
+    }
+  }
+  if (n_dbs > 1) {
+    if (flags & QUERY_EXPLAIN) {
+      fprintf(stderr, "--explain takes a single db\n");
+      return EXIT_FAILURE;
+    }
+    if (multi_query_command(dbs, n_dbs, src, flags, format, ordered ? &order : NULL) < 0) {
+      fprintf(stderr, "Failed to query the dbs!");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+  if (query_command(src, flags, format, ordered ? &order : NULL) < 0) {
+    fprintf(stderr, "Failed to query the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int query_main(int argc, char *argv[]) {
+  return __query_main(argc, argv, OUTPUT_PLAIN,
+                      "query [--explain] [--include-archive] [--format f] [--sort f] [--top k] "
+                      "[--desc] <query>");
+}
+
+static int export_main(int argc, char *argv[]) {
+  return __query_main(argc, argv, OUTPUT_JSON,
+                      "export [--include-archive] [--format f] [--sort f] [--top k] [--desc] "
+                      "[query]");
+}
+
+static int find_main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: find <word>\n");
+    return EXIT_FAILURE;
+  }
+  if (find_command(argv[1], PRINT_EXCEPT_DELETED) < 0) {
+    fprintf(stderr, "Failed to search the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int search_main(int argc, char *argv[]) {
+  int flags = TRIGRAM_NONE;
+  const char *text = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rebuild") == 0) {
+      flags |= TRIGRAM_REBUILD;
+    } else if (text == NULL && argv[i][0] != '-') {
+      text = argv[i];
+    } else {
+      fprintf(stderr, "Usage: search [--rebuild] <text>\n");
+      return EXIT_FAILURE;
+    }
+  }
+  if (text == NULL && !(flags & TRIGRAM_REBUILD)) {
+    fprintf(stderr, "Usage: search [--rebuild] <text>\n");
+    return EXIT_FAILURE;
+  }
+  if (search_command(text, flags) < 0) {
+    fprintf(stderr, "Failed to search the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int perf_report_main(int argc, char *argv[]) {
+  uint32_t days = PERF_DEFAULT_DAYS;
+  const char *command = NULL;
+  for (int i = 1; i < argc; i++) {
+    char *end;
+    if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+      unsigned long value = strtoul(argv[++i], &end, 10);
+      if (*end != '\0' || value == 0 || value > PERF_DAYS) {
+        fprintf(stderr, "--days takes 1 to %d\n", PERF_DAYS);
+        return EXIT_FAILURE;
+      }
+      days = (uint32_t)value;
+    } else if (command == NULL && argv[i][0] != '-') {
+      command = argv[i];
+    } else {
+      fprintf(stderr, "Usage: perf-report [--days n] [command]\n");
+      return EXIT_FAILURE;
+    }
+  }
+  if (perf_report_command(command, days) < 0) {
+    fprintf(stderr, "Failed to read the run times!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int undone_main(int argc, char *argv[]) {
+  uint64_t id;
+  if (argc != 2 || parse_id(argv[1], &id) < 0) { return EXIT_FAILURE; }
+  if (mark_task_undone(id) < 0) {
+    fprintf(stderr, "Failed to update the provided task");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int delete_main(int argc, char *argv[]) {
+  uint64_t id;
+  if (argc != 2 || parse_id(argv[1], &id) < 0) { return EXIT_FAILURE; }
+  if (delete_task_command(id) < 0) {
+    fprintf(stderr, "Failed to delete the provided task");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int compact_main(int argc, char *argv[]) {
+  (void)argv;
+  if (argc != 1) { return EXIT_FAILURE; }
+  if (compact_command() < 0) {
+    fprintf(stderr, "Failed to compact the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int seal_main(int argc, char *argv[]) {
+  (void)argv;
+  if (argc != 1) { return EXIT_FAILURE; }
+  if (seal_command() < 0) {
+    fprintf(stderr, "Failed to seal the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int segments_main(int argc, char *argv[]) {
+  int verify = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verify") == 0) {
+      verify = 1;
+    } else {
+      fprintf(stderr, "Unknown segments option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (segments_command(verify) < 0) {
+    fprintf(stderr, "Failed to read the segments!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int archive_main(int argc, char *argv[]) {
+  uint64_t days = ARCHIVE_DEFAULT_DAYS;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--older-than") == 0 && i + 1 < argc) {
+      char *end = NULL;
+      errno = 0;
+      unsigned long long value = strtoull(argv[++i], &end, 10);
+      if (errno != 0 || end == argv[i] || *end != '\0') {
+        fprintf(stderr, "Invalid days: %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      days = value;
+    } else {
+      fprintf(stderr, "Usage: archive [--older-than <days>]\n");
+      return EXIT_FAILURE;
+    }
+  }
+  if (archive_command(days) < 0) {
+    fprintf(stderr, "Failed to archive the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int backup_main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: backup <dir>\n");
+    return EXIT_FAILURE;
+  }
+  if (backup_command(argv[1]) < 0) {
+    fprintf(stderr, "Failed to back up the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int restore_main(int argc, char *argv[]) {
+  int flags = RESTORE_NONE;
+  const char *dir = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--force") == 0) {
+      flags |= RESTORE_FORCE;
+    } else if (dir == NULL && argv[i][0] != '-') {
+      dir = argv[i];
+    } else {
+      dir = NULL;
+      break;
+    }
+  }
+  if (dir == NULL) {
+    fprintf(stderr, "Usage: restore [--force] <dir>\n");
+    return EXIT_FAILURE;
+  }
+  if (restore_command(dir, flags) < 0) {
+    fprintf(stderr, "Failed to restore the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int merge_main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: merge <other.db>\n");
+    return EXIT_FAILURE;
+  }
+  if (merge_command(argv[1]) < 0) {
+    fprintf(stderr, "Failed to merge the db!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int fsck_main(int argc, char *argv[]) {
+  int dry_run = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--dry-run") == 0) {
+      dry_run = 1;
+    } else {
+      fprintf(stderr, "Unknown fsck option: %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (fsck_command(dry_run) < 0) {
+    fprintf(stderr, "The db has problems that were not repaired!\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int feature_main(int argc, char *argv[]) {
+  if (argc != 1 && argc != 3) {
+    fprintf(stderr, "Usage: feature [enable|disable <feature>]\n");
+    return EXIT_FAILURE;
+  }
+  if (feature_command(argc == 3 ? argv[1] : NULL, argc == 3 ? argv[2] : NULL) < 0) {
+    fprintf(stderr, "Failed to update db features!");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/* commands are dispatched on the first argument, the flags below are
+ * kept for everything that existed before commands */
+typedef struct {
+  const char *name;
+  int (*run)(int, char *[]);
+  bool multi; /* takes several dbs */
+} command_t;
+
+static const command_t commands[] = {
+    {"stats", stats_main, false},
+    {"tags", tags_main, false},
+    {"overdue", overdue_main, false},
+    {"upcoming", upcoming_main, false},
+    {"watch", watch_main, false},
+    {"query", query_main, true},
+    {"export", export_main, true},
+    {"find", find_main, false},
+    {"search", search_main, false},
+    {"undone", undone_main, false},
+    {"delete", delete_main, false},
+    {"compact", compact_main, false},
+    {"seal", seal_main, false},
+    {"segments", segments_main, false},
+    {"archive", archive_main, false},
+    {"backup", backup_main, false},
+    {"restore", restore_main, false},
+    {"merge", merge_main, false},
+    {"fsck", fsck_main, false},
+    {"feature", feature_main, false},
+    {"perf-report", perf_report_main, false},
+};
+
 int main(int argc, char *argv[]) {
+  perf_start();
+  if (trace_init() < 0) { fprintf(stderr, "Failed to start tracing\n"); }
+  /* io_uring where the kernel has it, plain POSIX otherwise */
+  const storage_t *uring = storage_uring();
+  if (uring != NULL) { storage_use(uring); }
+
+  /* `--db` comes before everything else */
+  int skip = 0;
+  while (skip + 2 < argc && strcmp(argv[skip + 1], "--db") == 0) {
+    if (multi_add_paths(argv[skip + 2], &dbs, &n_dbs) < 0) {
+      fprintf(stderr, "Invalid db: %s\n", argv[skip + 2]);
+      exit(EXIT_FAILURE);
+    }
+    skip += 2;
+  }
+  if (skip > 0) {
+    if (n_dbs == 0) {
+      fprintf(stderr, "No dbs found in %s\n", argv[skip]);
+      exit(EXIT_FAILURE);
+    }
+    if (n_dbs == 1) { db_use_path(dbs[0]); }
+    argv[skip] = argv[0];
+    argv += skip;
+    argc -= skip;
+  }
+
+  if (argc > 1 && argv[1][0] != '-') {
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+      if (strcmp(argv[1], commands[i].name) != 0) { continue; }
+      if (n_dbs > 1 && !commands[i].multi) {
+        fprintf(stderr, "%s takes a single db\n", commands[i].name);
+        exit(EXIT_FAILURE);
+      }
+      /* runs over several dbs are not recorded, they have no one size */
+      if (n_dbs <= 1) { perf_command(commands[i].name); }
+      return commands[i].run(argc - 1, argv + 1);
+    }
+    fprintf(stderr, "Unknown command: %s\n", argv[1]);
+    print_usage(argv);
+    exit(EXIT_FAILURE);
+  }
+
+  /* the options of -a and -l, both only run once all of them are parsed */
+  static const struct option long_options[] = {
+      {"tag", required_argument, NULL, 'g'},
+      {"due", required_argument, NULL, 'D'},
+      {"sort", required_argument, NULL, 's'},
+      {"top", required_argument, NULL, 't'},
+      {"desc", no_argument, NULL, 'r'},
+      {"include-archive", no_argument, NULL, 'A'},
+      {"as-of", required_argument, NULL, 'O'},
+      {NULL, 0, NULL, 0},
+  };
+  const char *list = NULL;
+  const char *task = NULL;
+  char *tags[TAGS_MAX_PER_TASK + 1];
+  size_t n_tags = 0;
+  uint64_t due_at = 0;
+  query_order_t order = {.field = QUERY_FIELD_ID};
+  bool ordered = false;
+  bool archived = false;
+  uint64_t as_of = 0;
+
   int opt;
   /* parse flags right now `init` is a flag and does not take
    * an argument will have to think on how to approach this */
-  while ((opt = getopt(argc, argv, "ia:k:l:")) != -1) {
+  while ((opt = getopt_long(argc, argv, "ia:k:l:", long_options, NULL)) != -1) {
+    /* several dbs are only ever listed */
+    if (n_dbs > 1 && (opt == 'i' || opt == 'a' || opt == 'k')) {
+      fprintf(stderr, "-%c takes a single db\n", opt);
+      exit(EXIT_FAILURE);
+    }
     switch (opt) {
     /* TODO: Right now init via flag; need a command like `todoctl init` */
     case 'i': {
+      perf_command("init");
       if (create_new_todo_db() < 0) { exit(EXIT_FAILURE); }
       printf("Created .todo.db file at home directory...\n");
       break;
@@ -32,6 +617,7 @@ int main(int argc, char *argv[]) {
     case 'k': {
       const char *task_id = optarg;
       long long value = atoi(task_id);
+      perf_command("done");
       if (mark_task_done(value)) {
         fprintf(stderr, "Failed to update the provided task");
         exit(EXIT_FAILURE);
@@ -39,11 +625,25 @@ int main(int argc, char *argv[]) {
       break;
     }
 
-    /* Add a new task */
+    /* Add a new task, its tags may still follow */
     case 'a': {
-      const char *task = optarg;
-      if (add_task_command(task) < 0) {
-        fprintf(stderr, "Failed to add task!");
+      if (task != NULL) {
+        fprintf(stderr, "-a takes a single task\n");
+        exit(EXIT_FAILURE);
+      }
+      task = optarg;
+      break;
+    }
+
+    case 'g': {
+      /* one more than allowed so the add can complain about it */
+      if (n_tags <= TAGS_MAX_PER_TASK) { tags[n_tags++] = optarg; }
+      break;
+    }
+
+    case 'D': {
+      if (due_parse(optarg, get_time_in_millis(), &due_at) < 0) {
+        fprintf(stderr, "Invalid due time: %s\n", optarg);
         exit(EXIT_FAILURE);
       }
       break;
@@ -51,14 +651,36 @@ int main(int argc, char *argv[]) {
 
     /* list all the tasks */
     case 'l': {
-      const char *ask = optarg;
-      int flags = PRINT_ONLY_ACTIVE;
-      if (strcmp(ask, "all") == 0) { flags = PRINT_ALL; }
-      if (strcmp(ask, "active") == 0) { flags = PRINT_ONLY_ACTIVE; }
-
-      // TODO: Add implementation for limits in this command
-      if (list_tasks_command(flags) < 0) {
-        fprintf(stderr, "Failed to list tasks!");
+      list = optarg;
+      break;
+    }
+
+    case 's': {
+      if (parse_sort(optarg, &order) < 0) { exit(EXIT_FAILURE); }
+      ordered = true;
+      break;
+    }
+
+    case 't': {
+      if (parse_top(optarg, &order) < 0) { exit(EXIT_FAILURE); }
+      ordered = true;
+      break;
+    }
+
+    case 'r': {
+      order.desc = true;
+      ordered = true;
+      break;
+    }
+
+    case 'A': {
+      archived = true;
+      break;
+    }
+
+    case 'O': {
+      if (history_parse_time(optarg, get_time_in_millis(), &as_of) < 0) {
+        fprintf(stderr, "Invalid time: %s\n", optarg);
         exit(EXIT_FAILURE);
       }
       break;
@@ -76,5 +698,38 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (task != NULL) {
+    perf_command("add");
+    if (add_task_command(task, tags, n_tags, due_at) < 0) {
+      fprintf(stderr, "Failed to add task!");
+      exit(EXIT_FAILURE);
+    }
+  } else if (n_tags > 0 || due_at > 0) {
+    fprintf(stderr, "%s only applies to -a\n", n_tags > 0 ? "--tag" : "--due");
+    exit(EXIT_FAILURE);
+  }
+
+  if (list != NULL) {
+    int flags = PRINT_ONLY_ACTIVE | PRINT_EXCEPT_DELETED;
+    if (strcmp(list, "all") == 0) { flags = PRINT_ALL; }
+    if (strcmp(list, "active") == 0) { flags = PRINT_ONLY_ACTIVE | PRINT_EXCEPT_DELETED; }
+    if (archived) { flags |= PRINT_WITH_ARCHIVE; }
+    if (n_dbs <= 1) { perf_command("list"); }
+    if (as_of > 0 && n_dbs > 1) {
+      fprintf(stderr, "--as-of takes a single db\n");
+      exit(EXIT_FAILURE);
+    }
+    int rc = n_dbs > 1  ? multi_list_tasks_command(dbs, n_dbs, flags, ordered ? &order : NULL)
+             : as_of > 0 ? list_tasks_as_of_command(flags, ordered ? &order : NULL, as_of)
+                         : list_tasks_command(flags, ordered ? &order : NULL);
+    if (rc < 0) {
+      fprintf(stderr, "Failed to list tasks!");
+      exit(EXIT_FAILURE);
+    }
+  } else if (ordered || archived || as_of > 0) {
+    fprintf(stderr, "--sort, --top, --desc, --include-archive and --as-of only apply to -l\n");
+    exit(EXIT_FAILURE);
+  }
+
   return 0;
 }
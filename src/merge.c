@@ -0,0 +1,358 @@
+#include "todoctl/merge.h"
+#include "todoctl/backup.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+#include "todoctl/storage.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <inttypes.h>
+
+/* entries in a row sorted by creation time, starting at a byte offset */
+typedef struct {
+  uint64_t offset;
+  uint32_t entries;
+} merge_run_t;
+
+typedef struct {
+  merge_run_t *runs;
+  size_t count;
+  size_t cap;
+  uint64_t offset; /* of the next entry */
+  uint64_t prev_created;
+} merge_runs_t;
+
+/* one run, read a chunk at a time with the entry at its head decoded as a
+ * view into the chunk */
+typedef struct {
+  int fd;
+  storage_stream_t stream;
+  entry_codec_t codec;
+  char *buf;
+  size_t cap;
+  size_t len;
+  size_t pos;
+  uint32_t left; /* entries of the run not decoded yet */
+  uint64_t next; /* byte offset of the next entry */
+  bool has;      /* `head` is an entry, false once the run is exhausted */
+  todo_entry_t head;
+  uint64_t head_offset;
+  uint32_t checksum; /* of the text of `head` */
+} merge_cursor_t;
+
+/* the entries to append, committed once the next one does not fit */
+typedef struct {
+  int fd;
+  db_header_t header; /* as committed */
+  char *buf;
+  size_t len;
+  uint32_t entries;
+  uint64_t last_id;
+  char text[MAX_TODO_TEXT_LENGTH + 1]; /* `encode_entry` wants the text terminated */
+} merge_out_t;
+
+static int __collect_run(void *ctx, todo_entry_t *view) {
+  merge_runs_t *r = ctx;
+  if (r->count == 0 || view->_created_at < r->prev_created) {
+    if (r->count == r->cap) {
+      size_t cap = r->cap ? r->cap * 2 : 4;
+      merge_run_t *grown = realloc(r->runs, sizeof(merge_run_t) * cap);
+      if (grown == NULL) { return STATUS_ERROR; }
+      r->runs = grown;
+      r->cap = cap;
+    }
+    r->runs[r->count++] = (merge_run_t){.offset = r->offset, .entries = 0};
+  }
+  r->runs[r->count - 1].entries++;
+  r->prev_created = view->_created_at;
+  r->offset += entry_encoded_size(view);
+  return 0;
+}
+
+/* the runs of a db, a db only ever added to is a single one */
+static int __find_runs(int fd, const db_header_t *header, merge_runs_t *out) {
+  memset(out, 0, sizeof(merge_runs_t));
+  out->offset = sizeof(db_header_t);
+  int rc = entry_scan(fd, header, __collect_run, out);
+  if (rc < 0) {
+    free(out->runs);
+    out->runs = NULL;
+  }
+  return rc;
+}
+
+/* decodes the next entry, the view of the previous one is gone after */
+static int __cursor_next(merge_cursor_t *c) {
+  c->has = false;
+  if (c->left == 0) { return 0; }
+  for (;;) {
+    size_t consumed = 0;
+    int rc = entry_codec_next(&c->codec, c->buf + c->pos, c->len - c->pos, &c->head, &consumed);
+    if (rc == 0) {
+      c->pos += consumed;
+      c->left--;
+      c->has = true;
+      c->head_offset = c->next;
+      c->next += consumed;
+      c->checksum = crc32_update(0, c->head.entry_raw_data, c->head.entry_raw_data_len);
+      return 0;
+    }
+    if (rc != TODOCTL_ERR_INCOMPLETE_ENTRY) { return rc; }
+
+    memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+    c->len -= c->pos;
+    c->pos = 0;
+    /* see `entry_scan`, an entry says how big it is */
+    if (c->len >= 4) {
+      uint32_t total_length = schema_get_32(c->buf + ENTRY_OFFSET(LENGTH));
+      if (total_length > c->cap) {
+        char *grown = realloc(c->buf, total_length);
+        if (grown == NULL) { return STATUS_ERROR; }
+        c->buf = grown;
+        c->cap = total_length;
+      }
+    }
+    ssize_t r = storage_stream_read(&c->stream, c->buf + c->len, c->cap - c->len);
+    if (r <= 0) {
+      DEBUG_ERROR("db ends before its last entry\n");
+#ifdef DEBUG
+      perror("storage_stream_read()");
+#endif
+      return TODOCTL_ERR_CORRUPTED_DB;
+    }
+    c->len += (size_t)r;
+  }
+}
+
+static int __cursor_open(merge_cursor_t *c, int fd, const db_header_t *header,
+                         const merge_run_t *run) {
+  c->fd = fd;
+  c->cap = MERGE_CHUNK;
+  c->left = run->entries;
+  c->next = run->offset;
+  if ((c->buf = malloc(c->cap)) == NULL) {
+    DEBUG_ERROR("failed to allocate merge buffer\n");
+    return STATUS_ERROR;
+  }
+  entry_codec_init(&c->codec, header);
+  if (storage_stream_open(&c->stream, fd, run->offset) < 0) {
+    DEBUG_ERROR("failed to open merge stream\n");
+    return STATUS_ERROR;
+  }
+  return __cursor_next(c);
+}
+
+static void __cursor_close(merge_cursor_t *c) {
+  if (c->buf == NULL) { return; }
+  storage_stream_close(&c->stream);
+  free(c->buf);
+}
+
+/* orders the heads by creation time, then by checksum so the copies of a
+ * task created in the same millisecond as another still meet */
+static int __compare(const merge_cursor_t *a, const merge_cursor_t *b) {
+  if (a->head._created_at != b->head._created_at) {
+    return a->head._created_at < b->head._created_at ? -1 : 1;
+  }
+  if (a->checksum != b->checksum) { return a->checksum < b->checksum ? -1 : 1; }
+  return 0;
+}
+
+static bool __same_task(const merge_cursor_t *a, const merge_cursor_t *b) {
+  return __compare(a, b) == 0 && a->head.entry_raw_data_len == b->head.entry_raw_data_len &&
+         memcmp(a->head.entry_raw_data, b->head.entry_raw_data, a->head.entry_raw_data_len) == 0;
+}
+
+/* the run with the oldest head, -1 once all of them are exhausted */
+static int __oldest(const merge_cursor_t *cursors, size_t n) {
+  int best = -1;
+  for (size_t i = 0; i < n; i++) {
+    if (cursors[i].has && (best < 0 || __compare(&cursors[i], &cursors[best]) < 0)) {
+      best = (int)i;
+    }
+  }
+  return best;
+}
+
+/* appends the batch and commits it with the header */
+static int __commit(merge_out_t *out) {
+  if (out->entries == 0) { return 0; }
+  db_header_t update = out->header;
+  if ((uint64_t)update.filesize + out->len > UINT32_MAX ||
+      (uint64_t)update._entries + out->entries > UINT32_MAX) {
+    DEBUG_ERROR("merged db is too big\n");
+    return TODOCTL_ERR_BUFFER_TOO_SMALL;
+  }
+  update.filesize += (uint32_t)out->len;
+  update._entries += out->entries;
+  update._last_entry_id = out->last_id;
+  struct iovec iov = {.iov_base = out->buf, .iov_len = out->len};
+  if (db_append_commit(out->fd, &iov, 1, &update) < 0) { return STATUS_ERROR; }
+  out->header = update;
+  out->len = 0;
+  out->entries = 0;
+  return 0;
+}
+
+/* adds an entry of the other db, under its own id when that is past every
+ * id the db had or was given so far */
+static int __append(merge_out_t *out, const todo_entry_t *view, merge_report_t *report) {
+  if (view->entry_raw_data_len > MAX_TODO_TEXT_LENGTH) { return TODOCTL_ERR_TODO_TOO_LONG; }
+  todo_entry_t entry = *view;
+  memcpy(out->text, view->entry_raw_data, view->entry_raw_data_len);
+  out->text[view->entry_raw_data_len] = '\0';
+  entry.entry_raw_data = out->text;
+  if (entry.entry_id <= out->last_id) {
+    entry.entry_id = out->last_id + 1;
+    report->remapped++;
+  }
+
+  size_t size = entry_encoded_size(&entry);
+  if (out->len + size > MERGE_BATCH && __commit(out) < 0) { return STATUS_ERROR; }
+  size_t written = 0;
+  if (encode_entry(&entry, out->buf + out->len, MERGE_BATCH - out->len, &written) < 0) {
+    return STATUS_ERROR;
+  }
+  out->len += written;
+  out->entries++;
+  out->last_id = entry.entry_id;
+  report->added++;
+  return 0;
+}
+
+/* writes a time the other side has over the entry in place, the same
+ * patch done and delete make */
+static int __patch(int fd, const db_header_t *header, uint64_t at, uint64_t value) {
+  if ((header->_flags & DB_FEATURE_BACKUP) && backup_record_patch(at) < 0) {
+    return STATUS_ERROR;
+  }
+  char field[8];
+  schema_put_64(field, value);
+  if (storage_write_at(fd, field, sizeof(field), at) < 0) {
+    DEBUG_ERROR("failed to write update for entry\n");
+#ifdef DEBUG
+    perror("storage_write_at()");
+#endif
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+static int __take_over(int fd, const db_header_t *header, const merge_cursor_t *local,
+                       const merge_cursor_t *other, merge_report_t *report) {
+  const todo_entry_t *mine = &local->head, *theirs = &other->head;
+  bool done = mine->_done_at == 0 && theirs->_done_at > 0;
+  bool deleted = mine->_deleted_at == 0 && theirs->_deleted_at > 0;
+  if (done &&
+      __patch(fd, header, local->head_offset + ENTRY_DONE_AT_OFFSET, theirs->_done_at) < 0) {
+    return STATUS_ERROR;
+  }
+  if (deleted && __patch(fd, header, local->head_offset + ENTRY_DELETED_AT_OFFSET,
+                         theirs->_deleted_at) < 0) {
+    return STATUS_ERROR;
+  }
+  if (done || deleted) { report->updated++; }
+  report->duplicates++;
+  return 0;
+}
+
+/* walks the runs of both dbs oldest first, the runs of the db are only
+ * read to tell which entries of the other one it has */
+static int __merge(merge_cursor_t *local, size_t n_local, merge_cursor_t *other, size_t n_other,
+                   merge_out_t *out, merge_report_t *report) {
+  int rc = 0;
+  while (rc == 0) {
+    int o = __oldest(other, n_other);
+    if (o < 0) { break; }
+    int l = __oldest(local, n_local);
+    int cmp = l < 0 ? 1 : __compare(&local[l], &other[o]);
+    if (cmp < 0 || (cmp == 0 && !__same_task(&local[l], &other[o]))) {
+      rc = __cursor_next(&local[l]);
+    } else if (cmp > 0) {
+      if ((rc = __append(out, &other[o].head, report)) == 0) { rc = __cursor_next(&other[o]); }
+    } else {
+      rc = __take_over(out->fd, &out->header, &local[l], &other[o], report);
+      if (rc == 0 && (rc = __cursor_next(&local[l])) == 0) { rc = __cursor_next(&other[o]); }
+    }
+  }
+  if (rc == 0) { rc = __commit(out); }
+  return rc;
+}
+
+/* opens a cursor on every run of a db */
+static int __open_runs(int fd, const db_header_t *header, merge_cursor_t **out, size_t *n_out,
+                       merge_report_t *report) {
+  merge_runs_t runs;
+  int rc = __find_runs(fd, header, &runs);
+  if (rc < 0) { return rc; }
+  merge_cursor_t *cursors = calloc(runs.count + 1, sizeof(merge_cursor_t));
+  if (cursors == NULL) { rc = STATUS_ERROR; }
+  for (size_t i = 0; i < runs.count && rc == 0; i++) {
+    rc = __cursor_open(&cursors[i], fd, header, &runs.runs[i]);
+  }
+  free(runs.runs);
+  *out = cursors;
+  *n_out = runs.count;
+  report->runs += (uint32_t)runs.count;
+  return rc;
+}
+
+static void __close_runs(merge_cursor_t *cursors, size_t n) {
+  for (size_t i = 0; cursors != NULL && i < n; i++) { __cursor_close(&cursors[i]); }
+  free(cursors);
+}
+
+int db_merge(int fd, const char *other_path, merge_report_t *report) {
+  TRACE_FUNC();
+  if (fd < 0 || other_path == NULL || report == NULL) { return STATUS_ERROR; }
+  memset(report, 0, sizeof(merge_report_t));
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  struct stat local_st, other_st;
+  if (stat(path, &local_st) < 0 || stat(other_path, &other_st) < 0) {
+    fprintf(stderr, "Can not read %s\n", other_path);
+    return TODOCTL_ERR_DB_DOES_NOT_EXIST;
+  }
+  if (local_st.st_dev == other_st.st_dev && local_st.st_ino == other_st.st_ino) {
+    fprintf(stderr, "%s is the db itself\n", other_path);
+    return STATUS_ERROR;
+  }
+
+  merge_out_t *out = calloc(1, sizeof(merge_out_t));
+  if (out == NULL) { return STATUS_ERROR; }
+  out->fd = fd;
+  db_header_t other;
+  int other_fd;
+  if (read_header(fd, &out->header) < 0 || storage_open(other_path, O_RDONLY, &other_fd) < 0) {
+    fprintf(stderr, "Can not read %s\n", other_path);
+    free(out);
+    return TODOCTL_ERR_DB_DOES_NOT_EXIST;
+  }
+  int rc = read_header(other_fd, &other);
+  if (rc == 0 && ((out->header._flags | other._flags) & MERGE_UNSUPPORTED)) {
+    fprintf(stderr, "merge reads the db files alone, it can not merge dbs with delta-log, "
+                    "segments, blobs or intern\n");
+    rc = STATUS_ERROR;
+  }
+  out->last_id = out->header._last_entry_id;
+  report->local = out->header._entries;
+
+  /* the db is only read up to what was committed when the merge started */
+  db_header_t local = out->header;
+  merge_cursor_t *mine = NULL, *theirs = NULL;
+  size_t n_mine = 0, n_theirs = 0;
+  if (rc == 0) { rc = __open_runs(fd, &local, &mine, &n_mine, report); }
+  if (rc == 0) { rc = __open_runs(other_fd, &other, &theirs, &n_theirs, report); }
+  if (rc == 0 && (out->buf = malloc(MERGE_BATCH)) == NULL) { rc = STATUS_ERROR; }
+  if (rc == 0) { rc = __merge(mine, n_mine, theirs, n_theirs, out, report); }
+
+  __close_runs(mine, n_mine);
+  __close_runs(theirs, n_theirs);
+  storage_close(other_fd);
+  free(out->buf);
+  free(out);
+  return rc;
+}
@@ -0,0 +1,260 @@
+#include "todoctl/multi.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/dict.h"
+#include "todoctl/errors.h"
+#include "todoctl/segment.h"
+
+#include <dirent.h>
+#include <pthread.h>
+
+static int __add_path(const char *path, char ***paths, size_t *n) {
+  char *copy = strdup(path);
+  char **grown = realloc(*paths, sizeof(char *) * (*n + 1));
+  if (copy == NULL || grown == NULL) {
+    DEBUG_ERROR("failed to grow db list\n");
+    free(copy);
+    if (grown != NULL) { *paths = grown; }
+    return STATUS_ERROR;
+  }
+  *paths = grown;
+  (*paths)[(*n)++] = copy;
+  return 0;
+}
+
+static int __compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int __add_dir(const char *dir, char ***paths, size_t *n) {
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    DEBUG_ERROR("failed to open db directory\n");
+#ifdef DEBUG
+    perror("opendir()");
+#endif
+    return STATUS_ERROR;
+  }
+
+  size_t first = *n;
+  size_t suffix = strlen(MULTI_DB_SUFFIX);
+  struct dirent *ent;
+  int rc = 0;
+  while (rc == 0 && (ent = readdir(d)) != NULL) {
+    size_t len = strlen(ent->d_name);
+    if (len <= suffix || strcmp(ent->d_name + len - suffix, MULTI_DB_SUFFIX) != 0) { continue; }
+
+    char path[DB_PATH_MAX];
+    int written = snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if (written < 0 || (size_t)written >= sizeof(path)) {
+      rc = TODOCTL_ERR_BUFFER_TOO_SMALL;
+      break;
+    }
+    /* `.todo.db.d` and friends are sidecars, only plain files are dbs */
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) { continue; }
+    rc = __add_path(path, paths, n);
+  }
+  closedir(d);
+
+  /* readdir order is whatever the filesystem likes */
+  qsort(*paths + first, *n - first, sizeof(char *), __compare_names);
+  return rc;
+}
+
+int multi_add_paths(const char *arg, char ***paths, size_t *n) {
+  if (arg == NULL || paths == NULL || n == NULL) { return STATUS_ERROR; }
+  char *list = strdup(arg);
+  if (list == NULL) { return STATUS_ERROR; }
+
+  int rc = 0;
+  char *save = NULL;
+  for (char *path = strtok_r(list, ",", &save); path != NULL && rc == 0;
+       path = strtok_r(NULL, ",", &save)) {
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+      rc = __add_dir(path, paths, n);
+    } else {
+      rc = __add_path(path, paths, n);
+    }
+  }
+  free(list);
+  return rc;
+}
+
+void multi_free_paths(char **paths, size_t n) {
+  if (paths == NULL) { return; }
+  for (size_t i = 0; i < n; i++) { free(paths[i]); }
+  free(paths);
+}
+
+typedef struct {
+  const char *path;
+  todo_entry_t **entries;
+  size_t n;
+  int rc;
+} multi_db_t;
+
+typedef struct {
+  multi_db_t *dbs;
+  size_t n_dbs;
+  const char *src;
+  bool archive;
+  const query_order_t *order;
+  int index;
+  int threads;
+} multi_worker_t;
+
+/* the same as a query on a single db, only against another path */
+static int __read_db(multi_db_t *db, const char *src, bool archive, const query_order_t *order) {
+  if (validate_db_exists(NULL) < 0) { return STATUS_ERROR; }
+
+  query_t q;
+  if (query_compile(src, &q, NULL, 0) < 0) { return TODOCTL_ERR_INVALID_QUERY; }
+  if (query_order(&q, order) < 0 || (archive && query_with_archive(&q) < 0)) {
+    query_free(&q);
+    return TODOCTL_ERR_INVALID_QUERY;
+  }
+  segment_range_t range;
+  segment_range_from_query(&q, &range, NULL);
+  int rc = db_read_entries(&range, &db->entries, &db->n);
+  if (rc == 0) { query_sort(&q, db->entries, db->n); }
+  query_free(&q);
+
+  /* long texts are read here, later on nobody knows which blob file */
+  for (size_t i = 0; rc == 0 && i < db->n; i++) { rc = entry_load_text(db->entries[i]); }
+  return rc;
+}
+
+/* dbs are handed out round robin */
+static void *__multi_worker(void *arg) {
+  multi_worker_t *w = arg;
+  for (size_t i = (size_t)w->index; i < w->n_dbs; i += (size_t)w->threads) {
+    multi_db_t *db = &w->dbs[i];
+    db_use_path(db->path);
+    db->rc = __read_db(db, w->src, w->archive, w->order);
+    dict_close();
+  }
+  db_use_path(NULL);
+  return NULL;
+}
+
+static void __run_workers(multi_worker_t *proto, int threads) {
+  pthread_t tids[MULTI_MAX_THREADS];
+  multi_worker_t workers[MULTI_MAX_THREADS];
+  int started = 0;
+  for (int i = 0; i < threads; i++) {
+    workers[i] = *proto;
+    workers[i].index = i;
+    workers[i].threads = threads;
+  }
+  /* the calling thread takes the first share itself */
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&tids[i], NULL, __multi_worker, &workers[i]) != 0) { break; }
+    started++;
+  }
+  if (started < threads - 1) {
+    /* fewer threads than planned, hand the shares out again */
+    for (int i = 1; i <= started; i++) { pthread_join(tids[i], NULL); }
+    for (size_t i = 0; i < proto->n_dbs; i++) {
+      db_free_entries(proto->dbs[i].entries, proto->dbs[i].n);
+      proto->dbs[i].entries = NULL;
+      proto->dbs[i].n = 0;
+    }
+    workers[0].threads = 1;
+    __multi_worker(&workers[0]);
+    return;
+  }
+  __multi_worker(&workers[0]);
+  for (int i = 1; i < threads; i++) { pthread_join(tids[i], NULL); }
+}
+
+/* every db is sorted, the merge takes the head that comes first until the
+ * top is reached. Entries that are not taken are freed */
+static int __merge(const query_t *q, multi_db_t *dbs, size_t n_dbs, todo_entry_t ***out,
+                   size_t *n) {
+  size_t total = 0;
+  for (size_t i = 0; i < n_dbs; i++) { total += dbs[i].n; }
+  if (q->order.top > 0 && total > q->order.top) { total = q->order.top; }
+
+  todo_entry_t **merged = malloc(sizeof(todo_entry_t *) * (total > 0 ? total : 1));
+  size_t *heads = calloc(n_dbs, sizeof(size_t));
+  if (merged == NULL || heads == NULL) {
+    DEBUG_ERROR("failed to allocate merged entries\n");
+    free(merged);
+    free(heads);
+    return STATUS_ERROR;
+  }
+
+  /* the number of dbs is small, a scan over the heads beats a heap */
+  for (size_t k = 0; k < total; k++) {
+    size_t best = n_dbs;
+    for (size_t i = 0; i < n_dbs; i++) {
+      if (heads[i] == dbs[i].n) { continue; }
+      if (best == n_dbs ||
+          query_ranks_before(q, dbs[i].entries[heads[i]], dbs[best].entries[heads[best]])) {
+        best = i;
+      }
+    }
+    merged[k] = dbs[best].entries[heads[best]++];
+  }
+
+  for (size_t i = 0; i < n_dbs; i++) {
+    for (size_t j = heads[i]; j < dbs[i].n; j++) {
+      free(dbs[i].entries[j]->entry_raw_data);
+      free(dbs[i].entries[j]);
+    }
+    free(dbs[i].entries);
+    dbs[i].entries = NULL;
+  }
+  free(heads);
+  *out = merged;
+  *n = total;
+  return 0;
+}
+
+int multi_read_entries(char *const *paths, size_t n_paths, const char *src, bool archive,
+                       const query_order_t *order, todo_entry_t ***out, size_t *n) {
+  if (paths == NULL || out == NULL || n == NULL) { return STATUS_ERROR; }
+  *out = NULL;
+  *n = 0;
+
+  /* the order is checked once here, the workers only compile what works */
+  query_order_t by_created = {.field = QUERY_FIELD_CREATED};
+  if (order == NULL) { order = &by_created; }
+  query_t q;
+  if (query_compile(src, &q, NULL, 0) < 0) { return TODOCTL_ERR_INVALID_QUERY; }
+  if (query_order(&q, order) < 0) {
+    query_free(&q);
+    return TODOCTL_ERR_INVALID_QUERY;
+  }
+
+  multi_db_t *dbs = calloc(n_paths > 0 ? n_paths : 1, sizeof(multi_db_t));
+  if (dbs == NULL) {
+    query_free(&q);
+    return STATUS_ERROR;
+  }
+  for (size_t i = 0; i < n_paths; i++) { dbs[i].path = paths[i]; }
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = online < 1 ? 1 : online > MULTI_MAX_THREADS ? MULTI_MAX_THREADS : (int)online;
+  if ((size_t)threads > n_paths) { threads = n_paths > 0 ? (int)n_paths : 1; }
+  multi_worker_t proto = {
+      .dbs = dbs, .n_dbs = n_paths, .src = src, .archive = archive, .order = order};
+  __run_workers(&proto, threads);
+
+  int rc = 0;
+  for (size_t i = 0; i < n_paths; i++) {
+    if (dbs[i].rc < 0) {
+      fprintf(stderr, "Failed to read %s\n", dbs[i].path);
+      rc = dbs[i].rc;
+    }
+  }
+  if (rc == 0) { rc = __merge(&q, dbs, n_paths, out, n); }
+  if (rc < 0) {
+    for (size_t i = 0; i < n_paths; i++) { db_free_entries(dbs[i].entries, dbs[i].n); }
+  }
+  free(dbs);
+  query_free(&q);
+  return rc;
+}
@@ -0,0 +1,224 @@
+#include "todoctl/output.h"
+#include "todoctl/blob.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+static const struct {
+  const char *name;
+  int format;
+} output_formats[] = {
+    {"plain", OUTPUT_PLAIN},
+    {"tsv", OUTPUT_TSV},
+    {"json", OUTPUT_JSON},
+};
+
+int output_format_from_name(const char *name) {
+  if (name == NULL) { return -1; }
+  for (size_t i = 0; i < sizeof(output_formats) / sizeof(output_formats[0]); i++) {
+    if (strcmp(output_formats[i].name, name) == 0) { return output_formats[i].format; }
+  }
+  return -1;
+}
+
+int output_open(output_t *w, int fd, int format) {
+  if (w == NULL || fd < 0) { return STATUS_ERROR; }
+  memset(w, 0, sizeof(output_t));
+  w->buf = malloc(OUTPUT_BUFFER_SIZE);
+  if (w->buf == NULL) {
+    DEBUG_ERROR("failed to allocate output buffer\n");
+    return STATUS_ERROR;
+  }
+  w->fd = fd;
+  w->format = format;
+  return 0;
+}
+
+void output_close(output_t *w) {
+  if (w == NULL) { return; }
+  free(w->buf);
+  w->buf = NULL;
+}
+
+/* the buffer bytes written since the last mark become the next iovec */
+static void __close_span(output_t *w) {
+  if (w->len == w->mark) { return; }
+  w->iov[w->iovcnt].iov_base = w->buf + w->mark;
+  w->iov[w->iovcnt].iov_len = w->len - w->mark;
+  w->iovcnt++;
+  w->mark = w->len;
+}
+
+int output_flush(output_t *w) {
+  TRACE_FUNC();
+  if (w->error) { return STATUS_ERROR; }
+  __close_span(w);
+  if (w->iovcnt > 0 && writev_all(w->fd, w->iov, w->iovcnt) < 0) {
+    DEBUG_ERROR("failed to write output\n");
+#ifdef DEBUG
+    perror("writev()");
+#endif
+    w->error = 1;
+  }
+  w->iovcnt = 0;
+  w->len = 0;
+  w->mark = 0;
+  return w->error ? STATUS_ERROR : 0;
+}
+
+static int __put(output_t *w, const char *s, size_t n) {
+  while (n > 0) {
+    if (w->len == OUTPUT_BUFFER_SIZE && output_flush(w) < 0) { return STATUS_ERROR; }
+    size_t room = OUTPUT_BUFFER_SIZE - w->len;
+    size_t take = n < room ? n : room;
+    memcpy(w->buf + w->len, s, take);
+    w->len += take;
+    s += take;
+    n -= take;
+  }
+  return 0;
+}
+
+static int __put_u64(output_t *w, uint64_t value) {
+  /* digits come out backwards, fill the scratch from the end */
+  char digits[20];
+  size_t i = sizeof(digits);
+  do {
+    digits[--i] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  return __put(w, digits + i, sizeof(digits) - i);
+}
+
+/* queues memory owned by somebody else, it has to stay put until a flush */
+static int __put_ref(output_t *w, const char *s, size_t n) {
+  /* keep a slot free for the buffer bytes that come after */
+  if (w->iovcnt + 3 > OUTPUT_IOV_MAX && output_flush(w) < 0) { return STATUS_ERROR; }
+  __close_span(w);
+  w->iov[w->iovcnt].iov_base = (void *)s;
+  w->iov[w->iovcnt].iov_len = n;
+  w->iovcnt++;
+  return 0;
+}
+
+static bool __needs_escape(int format, unsigned char c) {
+  switch (format) {
+  case OUTPUT_TSV: return c == '\t' || c == '\n' || c == '\\';
+  case OUTPUT_JSON: return c < 0x20 || c == '"' || c == '\\';
+  default: return false;
+  }
+}
+
+static int __put_escaped(output_t *w, const char *s, size_t n) {
+  static const char hex[] = "0123456789abcdef";
+  size_t run = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (!__needs_escape(w->format, c)) { continue; }
+
+    /* everything up to here goes out as is */
+    if (__put(w, s + run, i - run) < 0) { return STATUS_ERROR; }
+    run = i + 1;
+
+    char esc[6] = {'\\', 0, 0, 0, 0, 0};
+    size_t esc_len = 2;
+    switch (c) {
+    case '\n': esc[1] = 'n'; break;
+    case '\t': esc[1] = 't'; break;
+    case '\r': esc[1] = 'r'; break;
+    case '\\': esc[1] = '\\'; break;
+    case '"': esc[1] = '"'; break;
+    default:
+      esc[1] = 'u';
+      esc[2] = '0';
+      esc[3] = '0';
+      esc[4] = hex[c >> 4];
+      esc[5] = hex[c & 0xF];
+      esc_len = 6;
+      break;
+    }
+    if (__put(w, esc, esc_len) < 0) { return STATUS_ERROR; }
+  }
+  return __put(w, s + run, n - run);
+}
+
+static int __text_chunk(void *ctx, const char *chunk, size_t n) {
+  return __put_escaped((output_t *)ctx, chunk, n);
+}
+
+static int __put_text(output_t *w, const todo_entry_t *entry) {
+  if (entry->_in_blob && entry->entry_raw_data == NULL) {
+    return blob_stream(entry->_blob_offset, entry->entry_raw_data_len, __text_chunk, w);
+  }
+
+  const char *text = entry->entry_raw_data;
+  size_t n = entry->entry_raw_data_len;
+  if (n >= OUTPUT_ZERO_COPY_MIN) {
+    size_t i = 0;
+    while (i < n && !__needs_escape(w->format, (unsigned char)text[i])) { i++; }
+    if (i == n) { return __put_ref(w, text, n); }
+  }
+  return __put_escaped(w, text, n);
+}
+
+int output_begin(output_t *w) {
+  if (w->format == OUTPUT_JSON) { return __put(w, "[", 1); }
+  return 0;
+}
+
+int output_entry(output_t *w, const todo_entry_t *entry) {
+  if (w == NULL || entry == NULL || w->error) { return STATUS_ERROR; }
+
+  int rc = 0;
+  switch (w->format) {
+  case OUTPUT_PLAIN:
+    rc |= __put_u64(w, entry->entry_id);
+    rc |= __put(w, ": ", 2);
+    rc |= __put_text(w, entry);
+    rc |= __put(w, "\n", 1);
+    break;
+
+  case OUTPUT_TSV:
+    rc |= __put_u64(w, entry->entry_id);
+    rc |= __put(w, "\t", 1);
+    rc |= __put_u64(w, entry->_created_at);
+    rc |= __put(w, "\t", 1);
+    rc |= __put_u64(w, entry->_done_at);
+    rc |= __put(w, "\t", 1);
+    rc |= __put_u64(w, entry->_deleted_at);
+    rc |= __put(w, "\t", 1);
+    rc |= __put_text(w, entry);
+    rc |= __put(w, "\n", 1);
+    break;
+
+  case OUTPUT_JSON:
+    rc |= w->count > 0 ? __put(w, ",\n", 2) : __put(w, "\n", 1);
+    rc |= __put(w, "{\"id\":", 6);
+    rc |= __put_u64(w, entry->entry_id);
+    rc |= __put(w, ",\"created_at\":", 14);
+    rc |= __put_u64(w, entry->_created_at);
+    rc |= __put(w, ",\"done_at\":", 11);
+    rc |= __put_u64(w, entry->_done_at);
+    rc |= __put(w, ",\"deleted_at\":", 14);
+    rc |= __put_u64(w, entry->_deleted_at);
+    rc |= __put(w, ",\"text\":\"", 9);
+    rc |= __put_text(w, entry);
+    rc |= __put(w, "\"}", 2);
+    break;
+
+  default: return STATUS_ERROR;
+  }
+
+  if (rc != 0) { return STATUS_ERROR; }
+  w->count++;
+  return 0;
+}
+
+int output_end(output_t *w) {
+  if (w->format == OUTPUT_JSON) {
+    int rc = w->count > 0 ? __put(w, "\n]\n", 3) : __put(w, "]\n", 2);
+    if (rc < 0) { return rc; }
+  }
+  return output_flush(w);
+}
@@ -0,0 +1,291 @@
+#include "todoctl/perf.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/storage.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <time.h>
+
+static struct {
+  uint64_t start; /* see `trace_now` */
+  const char *name;
+} perf;
+
+/* local days since the epoch */
+static uint64_t __day_of(uint64_t millis) {
+  time_t t = (time_t)(millis / 1000);
+  struct tm tm_info;
+  localtime_r(&t, &tm_info);
+  return (uint64_t)((int64_t)t + tm_info.tm_gmtoff) / 86400;
+}
+
+static uint32_t __bucket_of(uint64_t us) {
+  if (us < PERF_SUB_BUCKETS) { return (uint32_t)us; }
+  uint32_t shift = (uint32_t)(63 - __builtin_clzll(us)) - PERF_SUB_BITS;
+  uint64_t bucket =
+      (uint64_t)(shift + 1) * PERF_SUB_BUCKETS + ((us >> shift) & (PERF_SUB_BUCKETS - 1));
+  return bucket < PERF_BUCKETS ? (uint32_t)bucket : PERF_BUCKETS - 1;
+}
+
+/* the highest value that lands in a bucket */
+static uint64_t __bucket_high(uint32_t bucket) {
+  if (bucket < PERF_SUB_BUCKETS) { return bucket; }
+  uint32_t shift = bucket / PERF_SUB_BUCKETS - 1;
+  uint64_t low = (uint64_t)(PERF_SUB_BUCKETS + bucket % PERF_SUB_BUCKETS) << shift;
+  return low + (1ULL << shift) - 1;
+}
+
+/* FNV-1a, never 0 which marks a free slot */
+static uint64_t __hash(const char *name) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char *p = name; *p != '\0'; p++) {
+    hash ^= (unsigned char)*p;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash | 1;
+}
+
+/* maps the ring, a writer creates it. A new file is all zeros which is an
+ * empty ring, the holes take no space until a day is written */
+static int __map(bool writer, perf_ring_t **out) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(PERF_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, writer ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open perf ring\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  struct stat st;
+  int rc = fstat(fd, &st) < 0 ? STATUS_ERROR : 0;
+  if (rc == 0 && st.st_size == 0) {
+    /* two writers growing it at once grow it to the same size */
+    rc = !writer ? TODOCTL_ERR_DB_DOES_NOT_EXIST
+                 : ftruncate(fd, sizeof(perf_ring_t)) < 0 ? STATUS_ERROR : 0;
+  } else if (rc == 0 && st.st_size != (off_t)sizeof(perf_ring_t)) {
+    DEBUG_ERROR("perf ring has the wrong size\n");
+    rc = TODOCTL_ERR_CORRUPTED_DB;
+  }
+  void *map = MAP_FAILED;
+  if (rc == 0) {
+    map = mmap(NULL, sizeof(perf_ring_t), writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+               fd, 0);
+    if (map == MAP_FAILED) {
+      DEBUG_ERROR("failed to map perf ring\n");
+#ifdef DEBUG
+      perror("mmap()");
+#endif
+      rc = STATUS_ERROR;
+    }
+  }
+  close(fd);
+  if (rc < 0) { return rc; }
+
+  perf_ring_t *ring = map;
+  uint64_t magic = __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE);
+  if (magic == 0 && writer) {
+    /* racing writers store the same values, the magic goes last */
+    __atomic_store_n(&ring->version, PERF_VERSION, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->commands, PERF_COMMANDS, __ATOMIC_RELAXED);
+    __atomic_compare_exchange_n(&ring->magic, &magic, PERF_MAGIC, false, __ATOMIC_ACQ_REL,
+                                __ATOMIC_ACQUIRE);
+    magic = PERF_MAGIC;
+  }
+  if (magic == 0) {
+    rc = TODOCTL_ERR_DB_DOES_NOT_EXIST;
+  } else if (magic != PERF_MAGIC) {
+    DEBUG_ERROR("invalid perf ring magic\n");
+    rc = TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  } else if (__atomic_load_n(&ring->version, __ATOMIC_RELAXED) != PERF_VERSION ||
+             __atomic_load_n(&ring->commands, __ATOMIC_RELAXED) != PERF_COMMANDS) {
+    DEBUG_ERROR("invalid perf ring version\n");
+    rc = TODOCTL_ERR_INVALID_VERSION;
+  }
+  if (rc < 0) {
+    munmap(map, sizeof(perf_ring_t));
+    return rc;
+  }
+  *out = ring;
+  return 0;
+}
+
+/* the slot of a command, probing from its hash. A writer claims a free
+ * one, a reader stops at it */
+static perf_command_t *__slot(perf_ring_t *ring, const char *name, bool claim) {
+  uint64_t key = __hash(name);
+  for (uint32_t i = 0; i < PERF_COMMANDS; i++) {
+    perf_command_t *slot = &ring->slots[(key + i) % PERF_COMMANDS];
+    uint64_t seen = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (seen == 0 && claim &&
+        __atomic_compare_exchange_n(&slot->key, &seen, key, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+      /* a report before the copy shows the slot without a name */
+      strncpy(slot->name, name, PERF_NAME_MAX);
+      return slot;
+    }
+    if (seen == key) { return slot; }
+    if (seen == 0) { return NULL; }
+  }
+  return NULL;
+}
+
+static void __add(perf_day_t *day, uint64_t today, uint64_t us, uint64_t db_bytes,
+                  uint64_t entries) {
+  uint64_t seen = __atomic_load_n(&day->day, __ATOMIC_ACQUIRE);
+  if (seen != today) {
+    /* a clock behind the ring or a clear under way, the sample is dropped */
+    if ((seen & PERF_RESETTING) || seen > today) { return; }
+    if (!__atomic_compare_exchange_n(&day->day, &seen, today | PERF_RESETTING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return;
+    }
+    /* the slot held a day PERF_DAYS ago, it starts over */
+    __atomic_store_n(&day->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&day->sum_us, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&day->max_us, 0, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < PERF_BUCKETS; i++) {
+      __atomic_store_n(&day->buckets[i], 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&day->day, today, __ATOMIC_RELEASE);
+  }
+
+  __atomic_fetch_add(&day->buckets[__bucket_of(us)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&day->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&day->sum_us, us, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&day->max_us, __ATOMIC_RELAXED);
+  while (us > max && !__atomic_compare_exchange_n(&day->max_us, &max, us, true, __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED)) {}
+  __atomic_store_n(&day->db_bytes, db_bytes, __ATOMIC_RELAXED);
+  __atomic_store_n(&day->entries, entries, __ATOMIC_RELAXED);
+}
+
+int perf_record(const char *name, uint64_t us, uint64_t db_bytes, uint64_t entries) {
+  if (name == NULL) { return STATUS_ERROR; }
+  perf_ring_t *ring;
+  int rc = __map(true, &ring);
+  if (rc < 0) { return rc; }
+  perf_command_t *slot = __slot(ring, name, true);
+  /* every slot taken, the run goes unrecorded */
+  if (slot != NULL) {
+    uint64_t today = __day_of(get_time_in_millis());
+    __add(&slot->days[today % PERF_DAYS], today, us, db_bytes, entries);
+  }
+  munmap(ring, sizeof(perf_ring_t));
+  return 0;
+}
+
+/* records the named run against the db as it is now, at exit so the runs
+ * that fail halfway count too */
+static void __flush(void) {
+  uint64_t us = (trace_now() - perf.start) / 1000;
+  char path[DB_PATH_MAX];
+  struct stat st;
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0 || stat(path, &st) < 0) { return; }
+  int fd;
+  if (storage_open(path, O_RDONLY, &fd) < 0) { return; }
+  db_header_t header;
+  int rc = read_header(fd, &header);
+  storage_close(fd);
+  if (rc < 0 || !(header._flags & DB_FEATURE_PERF)) { return; }
+  if (perf_record(perf.name, us, header.filesize, header._entries) < 0) {
+    DEBUG_WARN("failed to record the run\n");
+  }
+}
+
+void perf_start(void) { perf.start = trace_now(); }
+
+int perf_command(const char *name) {
+  if (name == NULL) { return STATUS_ERROR; }
+  /* the first name sticks, `-a x -l all` is an add */
+  if (perf.name != NULL) { return 0; }
+  perf.name = name;
+  if (atexit(__flush) != 0) {
+    DEBUG_ERROR("failed to register the perf recorder\n");
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+static void __format_us(uint64_t us, char *buf, size_t len) {
+  if (us < 1000) {
+    snprintf(buf, len, "%" PRIu64 "us", us);
+  } else if (us < 1000000) {
+    snprintf(buf, len, "%.1fms", (double)us / 1000);
+  } else {
+    snprintf(buf, len, "%.2fs", (double)us / 1000000);
+  }
+}
+
+/* the highest value of the bucket holding the p-th percentile */
+static uint64_t __percentile(const uint32_t *buckets, uint64_t total, uint32_t p) {
+  uint64_t rank = (total * p + 99) / 100;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < PERF_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= rank) { return __bucket_high(i); }
+  }
+  return __bucket_high(PERF_BUCKETS - 1);
+}
+
+static void __print_day(FILE *stream, const perf_day_t *day, uint64_t when) {
+  uint32_t buckets[PERF_BUCKETS];
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < PERF_BUCKETS; i++) {
+    buckets[i] = __atomic_load_n(&day->buckets[i], __ATOMIC_RELAXED);
+    total += buckets[i];
+  }
+  if (total == 0) { return; }
+
+  char date[16], p50[16], p99[16], max[16];
+  time_t t = (time_t)(when * 86400);
+  struct tm tm_info;
+  gmtime_r(&t, &tm_info);
+  strftime(date, sizeof(date), "%Y-%m-%d", &tm_info);
+  /* a bucket's highest value can lie past the slowest run in it */
+  uint64_t slowest = __atomic_load_n(&day->max_us, __ATOMIC_RELAXED);
+  uint64_t at_50 = __percentile(buckets, total, 50), at_99 = __percentile(buckets, total, 99);
+  __format_us(at_50 < slowest ? at_50 : slowest, p50, sizeof(p50));
+  __format_us(at_99 < slowest ? at_99 : slowest, p99, sizeof(p99));
+  __format_us(slowest, max, sizeof(max));
+  fprintf(stream, "  %s  runs %-6" PRIu64 " p50 %-8s p99 %-8s max %-8s entries %-8" PRIu64
+                  " db %.1f KiB\n",
+          date, total, p50, p99, max, __atomic_load_n(&day->entries, __ATOMIC_RELAXED),
+          (double)__atomic_load_n(&day->db_bytes, __ATOMIC_RELAXED) / 1024);
+}
+
+int perf_print(FILE *stream, const char *command, uint32_t days) {
+  TRACE_FUNC();
+  if (stream == NULL) { return STATUS_ERROR; }
+  if (days == 0 || days > PERF_DAYS) { days = PERF_DAYS; }
+  perf_ring_t *ring;
+  int rc = __map(false, &ring);
+  if (rc < 0) { return rc; }
+
+  uint64_t today = __day_of(get_time_in_millis());
+  const perf_command_t *only = command != NULL ? __slot(ring, command, false) : NULL;
+  for (uint32_t i = 0; i < PERF_COMMANDS; i++) {
+    const perf_command_t *slot = &ring->slots[i];
+    if (__atomic_load_n(&slot->key, __ATOMIC_ACQUIRE) == 0) { continue; }
+    if (command != NULL && slot != only) { continue; }
+    char name[PERF_NAME_MAX + 1];
+    memcpy(name, slot->name, PERF_NAME_MAX);
+    name[PERF_NAME_MAX] = '\0';
+    fprintf(stream, "%s\n", name[0] != '\0' ? name : "?");
+    /* oldest first, a slot still holding a day from before is skipped */
+    for (uint64_t when = today >= days ? today - days + 1 : 0; when <= today; when++) {
+      const perf_day_t *day = &slot->days[when % PERF_DAYS];
+      if (__atomic_load_n(&day->day, __ATOMIC_ACQUIRE) != when) { continue; }
+      __print_day(stream, day, when);
+    }
+  }
+  munmap(ring, sizeof(perf_ring_t));
+  return 0;
+}
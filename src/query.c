@@ -0,0 +1,723 @@
+#include "todoctl/query.h"
+#include "todoctl/debug.h"
+#include "todoctl/delta.h"
+#include "todoctl/errors.h"
+#include "todoctl/tags.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+static const struct {
+  const char *name;
+  query_field_t field;
+} query_fields[] = {
+    {"id", QUERY_FIELD_ID},           {"created", QUERY_FIELD_CREATED},
+    {"done", QUERY_FIELD_DONE},       {"deleted", QUERY_FIELD_DELETED},
+    {"text", QUERY_FIELD_TEXT},       {"word", QUERY_FIELD_WORD},
+    {"tag", QUERY_FIELD_TAG},
+};
+
+static const char *query_ops[] = {"=", "!=", "<", "<=", ">", ">=", "~"};
+
+static int __fail(char *err, size_t n, const char *fmt, ...) {
+  if (err != NULL && n > 0) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(err, n, fmt, args);
+    va_end(args);
+  }
+  return TODOCTL_ERR_INVALID_QUERY;
+}
+
+static void __skip_spaces(const char **p) {
+  while (isspace((unsigned char)**p)) { (*p)++; }
+}
+
+static int __parse_op(const char **p, query_op_t *op) {
+  const char *s = *p;
+  if (s[0] == '!' && s[1] == '=') {
+    *op = QUERY_OP_NE;
+    *p += 2;
+  } else if (s[0] == '<' && s[1] == '=') {
+    *op = QUERY_OP_LE;
+    *p += 2;
+  } else if (s[0] == '>' && s[1] == '=') {
+    *op = QUERY_OP_GE;
+    *p += 2;
+  } else if (s[0] == '=') {
+    *op = QUERY_OP_EQ;
+    *p += 1;
+  } else if (s[0] == '<') {
+    *op = QUERY_OP_LT;
+    *p += 1;
+  } else if (s[0] == '>') {
+    *op = QUERY_OP_GT;
+    *p += 1;
+  } else if (s[0] == '~') {
+    *op = QUERY_OP_CONTAINS;
+    *p += 1;
+  } else {
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+/* a value is either quoted or runs until the next space */
+static int __parse_value(const char **p, const char **value, size_t *len) {
+  const char *s = *p;
+  if (*s == '"' || *s == '\'') {
+    char quote = *s++;
+    const char *end = strchr(s, quote);
+    if (end == NULL) { return STATUS_ERROR; }
+    *value = s;
+    *len = (size_t)(end - s);
+    *p = end + 1;
+    return 0;
+  }
+
+  const char *start = s;
+  while (*s != '\0' && !isspace((unsigned char)*s)) { s++; }
+  if (s == start) { return STATUS_ERROR; }
+  *value = start;
+  *len = (size_t)(s - start);
+  *p = s;
+  return 0;
+}
+
+static int __parse_number(const char *value, size_t len, uint64_t *out) {
+  if (len == 0 || len > 20) { return STATUS_ERROR; }
+  uint64_t result = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (!isdigit((unsigned char)value[i])) { return STATUS_ERROR; }
+    uint64_t digit = (uint64_t)(value[i] - '0');
+    /* a literal that does not fit is an error, not whatever it wraps to */
+    if (result > (UINT64_MAX - digit) / 10) { return STATUS_ERROR; }
+    result = result * 10 + digit;
+  }
+  *out = result;
+  return 0;
+}
+
+/* YYYY-MM-DD at local midnight, or plain millis */
+static int __parse_time(const char *value, size_t len, uint64_t *out) {
+  if (__parse_number(value, len, out) == 0) { return 0; }
+
+  char buf[16];
+  if (len != 10) { return STATUS_ERROR; }
+  memcpy(buf, value, len);
+  buf[len] = '\0';
+
+  struct tm tm_info;
+  memset(&tm_info, 0, sizeof(tm_info));
+  if (sscanf(buf, "%4d-%2d-%2d", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday) != 3) {
+    return STATUS_ERROR;
+  }
+  tm_info.tm_year -= 1900;
+  tm_info.tm_mon -= 1;
+  tm_info.tm_isdst = -1;
+  time_t t = mktime(&tm_info);
+  if (t < 0) { return STATUS_ERROR; }
+  *out = (uint64_t)t * 1000;
+  return 0;
+}
+
+/* intersects [min, max] with what the predicate allows, max 0 is unbounded */
+static void __narrow(uint64_t *min, uint64_t *max, query_op_t op, uint64_t value, bool *empty) {
+  /* ids and timestamps start at 1, nothing is at or below 0 */
+  uint64_t lo = 0, hi = 0;
+  switch (op) {
+  case QUERY_OP_EQ: lo = hi = value; break;
+  case QUERY_OP_GT:
+    /* nothing is above the largest value */
+    if (value == UINT64_MAX) {
+      *empty = true;
+      return;
+    }
+    lo = value + 1;
+    break;
+  case QUERY_OP_GE: lo = value; break;
+  case QUERY_OP_LT: hi = value > 0 ? value - 1 : 0; break;
+  case QUERY_OP_LE: hi = value; break;
+  default: return;
+  }
+  if ((op == QUERY_OP_EQ || op == QUERY_OP_LT || op == QUERY_OP_LE) && hi == 0) {
+    *empty = true;
+    return;
+  }
+
+  if (lo > *min) { *min = lo; }
+  if (hi != 0 && (*max == 0 || hi < *max)) { *max = hi; }
+  if (*max != 0 && *min > *max) { *empty = true; }
+}
+
+static int __add_pred(query_t *q, const query_pred_t *pred, char *err, size_t n) {
+  bool is_text = pred->field == QUERY_FIELD_TEXT || pred->field == QUERY_FIELD_WORD;
+  bool is_tag = pred->field == QUERY_FIELD_TAG;
+  size_t *count = is_tag ? &q->n_tags : is_text ? &q->n_text : &q->n_meta;
+  if (*count == QUERY_MAX_PREDICATES) {
+    return __fail(err, n, "too many predicates, at most %d", QUERY_MAX_PREDICATES);
+  }
+  if (is_tag) {
+    q->tags[q->n_tags++] = *pred;
+  } else if (is_text) {
+    q->text[q->n_text++] = *pred;
+  } else {
+    q->meta[q->n_meta++] = *pred;
+  }
+  return 0;
+}
+
+static int __compile_pred(query_t *q, const char *name, size_t name_len, query_op_t op,
+                          const char *value, size_t len, char *err, size_t n) {
+  query_pred_t pred;
+  memset(&pred, 0, sizeof(pred));
+  pred.op = op;
+
+  bool known = false;
+  for (size_t i = 0; i < sizeof(query_fields) / sizeof(query_fields[0]); i++) {
+    if (strlen(query_fields[i].name) == name_len &&
+        strncmp(query_fields[i].name, name, name_len) == 0) {
+      pred.field = query_fields[i].field;
+      known = true;
+    }
+  }
+  if (!known) { return __fail(err, n, "unknown field '%.*s'", (int)name_len, name); }
+  if ((op == QUERY_OP_CONTAINS) != (pred.field == QUERY_FIELD_TEXT)) {
+    return __fail(err, n, "'%.*s' does not support '%s'", (int)name_len, name, query_ops[op]);
+  }
+
+  switch (pred.field) {
+  case QUERY_FIELD_ID:
+    if (__parse_number(value, len, &pred.value) < 0) {
+      return __fail(err, n, "invalid id '%.*s'", (int)len, value);
+    }
+    __narrow(&q->min_id, &q->max_id, op, pred.value, &q->empty);
+    break;
+
+  case QUERY_FIELD_CREATED:
+    if (__parse_time(value, len, &pred.value) < 0) {
+      return __fail(err, n, "invalid time '%.*s'", (int)len, value);
+    }
+    __narrow(&q->min_created, &q->max_created, op, pred.value, &q->empty);
+    break;
+
+  case QUERY_FIELD_DONE:
+  case QUERY_FIELD_DELETED: {
+    /* done=true is done_at != 0, done=false is done_at = 0 */
+    bool is_true = len == 4 && strncmp(value, "true", 4) == 0;
+    bool is_false = len == 5 && strncmp(value, "false", 5) == 0;
+    if (is_true || is_false) {
+      if (op != QUERY_OP_EQ && op != QUERY_OP_NE) {
+        return __fail(err, n, "'%.*s' only compares to true/false with = or !=", (int)name_len,
+                      name);
+      }
+      pred.op = (is_true == (op == QUERY_OP_EQ)) ? QUERY_OP_NE : QUERY_OP_EQ;
+      pred.value = 0;
+    } else if (__parse_time(value, len, &pred.value) < 0) {
+      return __fail(err, n, "invalid value '%.*s'", (int)len, value);
+    }
+    break;
+  }
+
+  case QUERY_FIELD_TEXT:
+    pred.text = malloc(len + 1);
+    if (pred.text == NULL) { return STATUS_ERROR; }
+    for (size_t i = 0; i < len; i++) { pred.text[i] = (char)tolower((unsigned char)value[i]); }
+    pred.text[len] = '\0';
+    pred.text_len = len;
+    break;
+
+  case QUERY_FIELD_WORD: {
+    char token[TEXT_TOKEN_MAX + 1];
+    size_t pos = 0;
+    size_t token_len = text_next_token(value, len, &pos, token);
+    size_t rest = pos;
+    char unused[TEXT_TOKEN_MAX];
+    if (token_len == 0 || text_next_token(value, len, &rest, unused) != 0) {
+      return __fail(err, n, "'word' takes a single word, got '%.*s'", (int)len, value);
+    }
+    pred.text = malloc(token_len + 1);
+    if (pred.text == NULL) { return STATUS_ERROR; }
+    memcpy(pred.text, token, token_len);
+    pred.text[token_len] = '\0';
+    pred.text_len = token_len;
+    break;
+  }
+
+  case QUERY_FIELD_TAG:
+    if (op != QUERY_OP_EQ && op != QUERY_OP_NE) {
+      return __fail(err, n, "'tag' only compares with = or !=");
+    }
+    pred.text = malloc(len + 1);
+    if (pred.text == NULL) { return STATUS_ERROR; }
+    memcpy(pred.text, value, len);
+    pred.text[len] = '\0';
+    if (!tags_valid_name(pred.text)) {
+      free(pred.text);
+      return __fail(err, n, "invalid tag '%.*s'", (int)len, value);
+    }
+    pred.text_len = len;
+    break;
+  }
+
+  int rc = __add_pred(q, &pred, err, n);
+  if (rc < 0) {
+    free(pred.text);
+    return rc;
+  }
+  if (pred.field == QUERY_FIELD_WORD && q->word == NULL) { q->word = pred.text; }
+  return 0;
+}
+
+int query_compile(const char *src, query_t *q, char *err, size_t n) {
+  if (q == NULL) { return STATUS_ERROR; }
+  memset(q, 0, sizeof(query_t));
+  if (src == NULL) { return 0; }
+
+  const char *p = src;
+  __skip_spaces(&p);
+  while (*p != '\0') {
+    const char *name = p;
+    while (isalpha((unsigned char)*p)) { p++; }
+    size_t name_len = (size_t)(p - name);
+    if (name_len == 0) {
+      query_free(q);
+      return __fail(err, n, "expected a field at '%s'", name);
+    }
+
+    __skip_spaces(&p);
+    query_op_t op;
+    if (__parse_op(&p, &op) < 0) {
+      query_free(q);
+      return __fail(err, n, "expected an operator after '%.*s'", (int)name_len, name);
+    }
+
+    __skip_spaces(&p);
+    const char *value;
+    size_t len;
+    if (__parse_value(&p, &value, &len) < 0) {
+      query_free(q);
+      return __fail(err, n, "expected a value after '%.*s%s'", (int)name_len, name,
+                    query_ops[op]);
+    }
+
+    int rc = __compile_pred(q, name, name_len, op, value, len, err, n);
+    if (rc < 0) {
+      query_free(q);
+      return rc;
+    }
+
+    __skip_spaces(&p);
+    if (*p == '\0') { break; }
+    if (strncmp(p, "and", 3) != 0 || (p[3] != '\0' && !isspace((unsigned char)p[3]))) {
+      query_free(q);
+      return __fail(err, n, "expected 'and' at '%s'", p);
+    }
+    p += 3;
+    __skip_spaces(&p);
+    if (*p == '\0') {
+      query_free(q);
+      return __fail(err, n, "expected a predicate after 'and'");
+    }
+  }
+  return 0;
+}
+
+void query_free(query_t *q) {
+  if (q == NULL) { return; }
+  for (size_t i = 0; i < q->n_text; i++) { free(q->text[i].text); }
+  for (size_t i = 0; i < q->n_tags; i++) { free(q->tags[i].text); }
+  q->n_text = 0;
+  q->n_tags = 0;
+  q->word = NULL;
+  bitmap_free(q->candidates);
+  free(q->candidates);
+  q->candidates = NULL;
+}
+
+static bool __compare(uint64_t lhs, query_op_t op, uint64_t rhs) {
+  switch (op) {
+  case QUERY_OP_EQ: return lhs == rhs;
+  case QUERY_OP_NE: return lhs != rhs;
+  case QUERY_OP_LT: return lhs < rhs;
+  case QUERY_OP_LE: return lhs <= rhs;
+  case QUERY_OP_GT: return lhs > rhs;
+  case QUERY_OP_GE: return lhs >= rhs;
+  default: return false;
+  }
+}
+
+bool query_match_meta(const query_t *q, const query_record_t *record) {
+  for (size_t i = 0; i < q->n_meta; i++) {
+    const query_pred_t *pred = &q->meta[i];
+    uint64_t value = 0;
+    switch (pred->field) {
+    case QUERY_FIELD_ID: value = record->entry_id; break;
+    case QUERY_FIELD_CREATED: value = record->created_at; break;
+    case QUERY_FIELD_DONE: value = record->done_at; break;
+    case QUERY_FIELD_DELETED: value = record->deleted_at; break;
+    default: break;
+    }
+    if (!__compare(value, pred->op, pred->value)) { return false; }
+  }
+  return true;
+}
+
+/* case insensitive, the needle is lowercased already */
+static bool __contains(const char *hay, size_t n, const char *needle, size_t m) {
+  if (m == 0) { return true; }
+  for (size_t i = 0; i + m <= n; i++) {
+    size_t j = 0;
+    while (j < m && tolower((unsigned char)hay[i + j]) == needle[j]) { j++; }
+    if (j == m) { return true; }
+  }
+  return false;
+}
+
+bool query_match_text(const query_t *q, const todo_entry_t *entry) {
+  if (q->n_text == 0) { return true; }
+  if (entry->entry_raw_data == NULL) { return false; }
+  for (size_t i = 0; i < q->n_text; i++) {
+    const query_pred_t *pred = &q->text[i];
+    bool match = pred->field == QUERY_FIELD_WORD
+                     ? text_has_token(entry->entry_raw_data, entry->entry_raw_data_len, pred->text)
+                     : __contains(entry->entry_raw_data, entry->entry_raw_data_len, pred->text,
+                                  pred->text_len);
+    if (!match) { return false; }
+  }
+  return true;
+}
+
+/* turns a borrowed view into an entry that owns its text, a text loaded
+ * from the blob file already is owned and moves over as is */
+static todo_entry_t *__materialize(const todo_entry_t *view) {
+  todo_entry_t *entry = malloc(sizeof(todo_entry_t));
+  if (entry == NULL) {
+    DEBUG_ERROR("failed to alloc entry\n");
+    return NULL;
+  }
+  *entry = *view;
+  if (view->_in_blob) { return entry; }
+
+  entry->entry_raw_data = malloc(view->entry_raw_data_len + 1);
+  if (entry->entry_raw_data == NULL) {
+    DEBUG_ERROR("failed alloc raw data bytes\n");
+    free(entry);
+    return NULL;
+  }
+  memcpy(entry->entry_raw_data, view->entry_raw_data, view->entry_raw_data_len);
+  entry->entry_raw_data[view->entry_raw_data_len] = '\0';
+  return entry;
+}
+
+static int __push(todo_entry_t ***out, size_t *n, size_t *cap, todo_entry_t *entry) {
+  if (*n == *cap) {
+    size_t new_cap = *cap < 16 ? 16 : *cap * 2;
+    todo_entry_t **grown = realloc(*out, sizeof(todo_entry_t *) * new_cap);
+    if (grown == NULL) {
+      DEBUG_ERROR("failed to grow entries\n");
+      return STATUS_ERROR;
+    }
+    *out = grown;
+    *cap = new_cap;
+  }
+  (*out)[(*n)++] = entry;
+  return 0;
+}
+
+static uint64_t __sort_key(const query_t *q, const todo_entry_t *entry) {
+  switch (q->order.field) {
+  case QUERY_FIELD_CREATED: return entry->_created_at;
+  case QUERY_FIELD_DONE: return entry->_done_at;
+  default: return entry->entry_id;
+  }
+}
+
+/* true if `a` comes after `b` in the requested order, ties go by id */
+static bool __ranks_after(const query_t *q, uint64_t a_key, uint64_t a_id, uint64_t b_key,
+                          uint64_t b_id) {
+  bool after = a_key != b_key ? a_key > b_key : a_id > b_id;
+  return q->order.desc ? !after : after;
+}
+
+static bool __entry_after(const query_t *q, const todo_entry_t *a, const todo_entry_t *b) {
+  return __ranks_after(q, __sort_key(q, a), a->entry_id, __sort_key(q, b), b->entry_id);
+}
+
+/* the heap keeps the entry that ranks last at the root */
+static void __sift_down(const query_t *q, todo_entry_t **heap, size_t n, size_t i) {
+  for (;;) {
+    size_t last = i, left = 2 * i + 1, right = 2 * i + 2;
+    if (left < n && __entry_after(q, heap[left], heap[last])) { last = left; }
+    if (right < n && __entry_after(q, heap[right], heap[last])) { last = right; }
+    if (last == i) { return; }
+    todo_entry_t *tmp = heap[i];
+    heap[i] = heap[last];
+    heap[last] = tmp;
+    i = last;
+  }
+}
+
+static void __sift_up(const query_t *q, todo_entry_t **heap, size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!__entry_after(q, heap[i], heap[parent])) { return; }
+    todo_entry_t *tmp = heap[i];
+    heap[i] = heap[parent];
+    heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+static bool __heap_full(const query_t *q, size_t n) {
+  return q->ordered && q->order.top > 0 && n >= q->order.top;
+}
+
+/* adds a match to the heap, pushing out the last one once it is full */
+static int __offer(query_t *q, todo_entry_t ***out, size_t *n, size_t *cap, todo_entry_t *entry) {
+  if (__heap_full(q, *n)) {
+    todo_entry_t *evicted = (*out)[0];
+    free(evicted->entry_raw_data);
+    free(evicted);
+    (*out)[0] = entry;
+    __sift_down(q, *out, *n, 0);
+    return 0;
+  }
+  if (__push(out, n, cap, entry) < 0) { return STATUS_ERROR; }
+  __sift_up(q, *out, *n - 1);
+  return 0;
+}
+
+int query_order_field(const char *name) {
+  if (name == NULL) { return -1; }
+  if (strcmp(name, "id") == 0) { return QUERY_FIELD_ID; }
+  if (strcmp(name, "created") == 0) { return QUERY_FIELD_CREATED; }
+  if (strcmp(name, "done") == 0) { return QUERY_FIELD_DONE; }
+  return -1;
+}
+
+int query_order(query_t *q, const query_order_t *order) {
+  if (q == NULL || order == NULL) { return STATUS_ERROR; }
+  if (order->field != QUERY_FIELD_ID && order->field != QUERY_FIELD_CREATED &&
+      order->field != QUERY_FIELD_DONE) {
+    return TODOCTL_ERR_INVALID_QUERY;
+  }
+  /* tasks that are not done have no time to sort by */
+  if (order->field == QUERY_FIELD_DONE) {
+    if (q->n_meta == QUERY_MAX_PREDICATES) { return TODOCTL_ERR_INVALID_QUERY; }
+    q->meta[q->n_meta++] =
+        (query_pred_t){.field = QUERY_FIELD_DONE, .op = QUERY_OP_NE, .value = 0};
+  }
+  q->order = *order;
+  q->ordered = true;
+  return 0;
+}
+
+bool query_wants_ids(const query_t *q, uint64_t min_id, uint64_t max_id) {
+  if (q == NULL || q->candidates == NULL) { return true; }
+  return bitmap_intersects_range(q->candidates, min_id, max_id);
+}
+
+bool query_top_wants(const query_t *q, todo_entry_t *const *kept, size_t n, uint64_t min_id,
+                     uint64_t max_id, uint64_t min_created, uint64_t max_created) {
+  if (q == NULL || !__heap_full(q, n)) { return true; }
+
+  /* the best key anything in the bounds can have, done times are not
+   * tracked per segment */
+  uint64_t best;
+  switch (q->order.field) {
+  case QUERY_FIELD_ID: best = q->order.desc ? max_id : min_id; break;
+  case QUERY_FIELD_CREATED: best = q->order.desc ? max_created : min_created; break;
+  default: return true;
+  }
+  uint64_t last = __sort_key(q, kept[0]);
+  return q->order.desc ? best >= last : best <= last;
+}
+
+bool query_ranks_before(const query_t *q, const todo_entry_t *a, const todo_entry_t *b) {
+  return __entry_after(q, b, a);
+}
+
+void query_sort(const query_t *q, todo_entry_t **entries, size_t n) {
+  if (q == NULL || !q->ordered || n < 2) { return; }
+  /* what is left of the heap keeps handing its last entry to the back */
+  for (size_t end = n - 1; end > 0; end--) {
+    todo_entry_t *tmp = entries[0];
+    entries[0] = entries[end];
+    entries[end] = tmp;
+    __sift_down(q, entries, end, 0);
+  }
+}
+
+/* checks one decoded record against the plan, matches are appended */
+static int __visit(query_t *q, todo_entry_t *view, const delta_map_t *deltas,
+                   uint64_t skip_through, todo_entry_t ***out, size_t *n, size_t *cap) {
+  TRACE_SPAN("query_filter");
+  q->scanned++;
+  if (view->entry_id <= skip_through) { return 0; }
+  /* the tag index already knows the ids that can match */
+  if (q->candidates != NULL && !bitmap_contains(q->candidates, view->entry_id)) {
+    q->rejected_index++;
+    return 0;
+  }
+
+  /* metadata first, nothing has been copied for records that fail here */
+  delta_map_apply(deltas, view);
+  query_record_t record = {
+      .entry_id = view->entry_id,
+      .created_at = view->_created_at,
+      .deleted_at = view->_deleted_at,
+      .done_at = view->_done_at,
+  };
+  if (!query_match_meta(q, &record)) {
+    q->rejected_meta++;
+    return 0;
+  }
+  /* a full heap only takes what ranks before its last entry */
+  if (__heap_full(q, *n) &&
+      !__ranks_after(q, __sort_key(q, (*out)[0]), (*out)[0]->entry_id, __sort_key(q, view),
+                     view->entry_id)) {
+    q->rejected_top++;
+    return 0;
+  }
+
+  /* inline texts are still checked in place, only blob texts get loaded */
+  if (q->n_text > 0 && view->_in_blob && entry_load_text(view) < 0) { return STATUS_ERROR; }
+  if (!query_match_text(q, view)) {
+    q->rejected_text++;
+    if (view->_in_blob) { free(view->entry_raw_data); }
+    return 0;
+  }
+
+  todo_entry_t *entry = __materialize(view);
+  if (entry == NULL) {
+    if (view->_in_blob) { free(view->entry_raw_data); }
+    return STATUS_ERROR;
+  }
+  int rc = q->ordered ? __offer(q, out, n, cap, entry) : __push(out, n, cap, entry);
+  if (rc < 0) {
+    free(entry->entry_raw_data);
+    free(entry);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+typedef struct {
+  query_t *q;
+  const delta_map_t *deltas;
+  uint64_t skip_through;
+  todo_entry_t ***out;
+  size_t *n;
+  size_t cap;
+} scan_ctx_t;
+
+static int __scan_visit(void *ctx, todo_entry_t *view) {
+  scan_ctx_t *scan = ctx;
+  return __visit(scan->q, view, scan->deltas, scan->skip_through, scan->out, scan->n, &scan->cap);
+}
+
+int query_scan(int fd, const db_header_t *header, uint64_t skip_through, query_t *q,
+               todo_entry_t ***out, size_t *n) {
+  if (header == NULL || q == NULL || out == NULL || n == NULL) { return STATUS_ERROR; }
+  if (q->empty || header->_entries == 0) { return 0; }
+
+  delta_map_t deltas;
+  memset(&deltas, 0, sizeof(deltas));
+  if ((header->_flags & DB_FEATURE_DELTA_LOG) && delta_map_load(&deltas) < 0) {
+    DEBUG_ERROR("failed to load the delta log\n");
+    return STATUS_ERROR;
+  }
+
+  /* records are decoded straight out of big reads, see entry_scan */
+  scan_ctx_t scan = {
+      .q = q, .deltas = &deltas, .skip_through = skip_through, .out = out, .n = n, .cap = *n};
+  int rc = entry_scan(fd, header, __scan_visit, &scan);
+  delta_map_free(&deltas);
+  return rc;
+}
+
+int query_scan_buffer(const char *buf, size_t len, uint32_t entries, query_t *q,
+                      todo_entry_t ***out, size_t *n) {
+  if (buf == NULL || q == NULL || out == NULL || n == NULL) { return STATUS_ERROR; }
+  if (q->empty) { return 0; }
+
+  db_header_t header = {._flags = DB_FLAG_COMPACT_RECORDS};
+  entry_codec_t codec;
+  entry_codec_init(&codec, &header);
+  delta_map_t deltas;
+  memset(&deltas, 0, sizeof(deltas));
+
+  size_t cap = *n, pos = 0;
+  for (uint32_t i = 0; i < entries; i++) {
+    todo_entry_t view;
+    size_t consumed = 0;
+    int rc = entry_codec_next(&codec, buf + pos, len - pos, &view, &consumed);
+    /* the whole buffer is there, a cut entry can not be completed */
+    if (rc == TODOCTL_ERR_INCOMPLETE_ENTRY) { return TODOCTL_ERR_CORRUPTED_DB; }
+    if (rc < 0) { return rc; }
+    pos += consumed;
+    if ((rc = __visit(q, &view, &deltas, 0, out, n, &cap)) < 0) { return rc; }
+  }
+  return 0;
+}
+
+int query_with_archive(query_t *q) {
+  if (q == NULL) { return STATUS_ERROR; }
+  q->archive = true;
+  if (q->ordered) { return 0; }
+  query_order_t by_id = {.field = QUERY_FIELD_ID};
+  return query_order(q, &by_id);
+}
+
+void query_explain(const query_t *q, FILE *stream) {
+  if (q == NULL || stream == NULL) { return; }
+  static const char *names[] = {"id", "created", "done", "deleted", "text", "word", "tag"};
+
+  fprintf(stream, "plan:\n");
+  if (q->empty) { fprintf(stream, "  bounds contradict, nothing is read\n"); }
+  fprintf(stream, "  segments: id %" PRIu64 "-", q->min_id);
+  if (q->max_id != 0) {
+    fprintf(stream, "%" PRIu64, q->max_id);
+  } else {
+    fputc('*', stream);
+  }
+  fprintf(stream, " created %" PRIu64 "-", q->min_created);
+  if (q->max_created != 0) {
+    fprintf(stream, "%" PRIu64, q->max_created);
+  } else {
+    fputc('*', stream);
+  }
+  if (q->word != NULL) { fprintf(stream, " filter '%s'", q->word); }
+  fputc('\n', stream);
+  for (size_t i = 0; i < q->n_meta; i++) {
+    fprintf(stream, "  on record: %s %s %" PRIu64 "\n", names[q->meta[i].field],
+            query_ops[q->meta[i].op], q->meta[i].value);
+  }
+  for (size_t i = 0; i < q->n_text; i++) {
+    fprintf(stream, "  on text:   %s %s '%s'\n", names[q->text[i].field], query_ops[q->text[i].op],
+            q->text[i].text);
+  }
+  for (size_t i = 0; i < q->n_tags; i++) {
+    fprintf(stream, "  on index:  tag %s '%s'\n", query_ops[q->tags[i].op], q->tags[i].text);
+  }
+  if (q->candidates != NULL) {
+    fprintf(stream, "  index:     %" PRIu64 " candidate ids\n", bitmap_cardinality(q->candidates));
+  }
+  if (q->archive) { fprintf(stream, "  archive:   read too\n"); }
+  if (q->ordered) {
+    fprintf(stream, "  order:     %s %s", names[q->order.field], q->order.desc ? "desc" : "asc");
+    if (q->order.top > 0) { fprintf(stream, ", top %zu kept in a heap", q->order.top); }
+    fputc('\n', stream);
+  }
+  fprintf(stream, "scanned %" PRIu64 ", rejected %" PRIu64 " on the record, %" PRIu64
+                  " on the text, %" PRIu64 " by the heap",
+          q->scanned, q->rejected_meta, q->rejected_text, q->rejected_top);
+  if (q->n_tags > 0 || q->candidates != NULL) {
+    fprintf(stream, ", %" PRIu64 " by the index", q->rejected_index);
+  }
+  fputc('\n', stream);
+}
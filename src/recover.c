@@ -0,0 +1,403 @@
+#include "todoctl/recover.h"
+#include "todoctl/blob.h"
+#include "todoctl/debug.h"
+#include "todoctl/delta.h"
+#include "todoctl/dict.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+#include "todoctl/segment.h"
+#include "todoctl/storage.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+
+static int __map(int fd, uint64_t size, const char **out) {
+  if (storage_map(fd, size, out) < 0) {
+    DEBUG_ERROR("failed to map db file\n");
+#ifdef DEBUG
+    perror("storage_map()");
+#endif
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+/* cuts the file after the last good entry and commits the header */
+static int __commit(int fd, const db_header_t *header, uint64_t good_bytes, uint64_t size) {
+  if (size > good_bytes && storage_truncate(fd, good_bytes) < 0) {
+    DEBUG_ERROR("failed to truncate the db\n");
+#ifdef DEBUG
+    perror("storage_truncate()");
+#endif
+    return STATUS_ERROR;
+  }
+  if (db_commit_header(fd, header) < 0) { return STATUS_ERROR; }
+  if (storage_sync(fd) < 0) {
+    DEBUG_ERROR("failed to sync the db\n");
+#ifdef DEBUG
+    perror("storage_sync()");
+#endif
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int db_recover(int fd, recover_report_t *report) {
+  recover_report_t unused;
+  if (report == NULL) { report = &unused; }
+  memset(report, 0, sizeof(recover_report_t));
+
+  db_header_t header;
+  uint64_t size;
+  if (read_header(fd, &header) < 0) { return STATUS_ERROR; }
+  if (storage_size(fd, &size) < 0) { return STATUS_ERROR; }
+  if (size == header.filesize) { return 0; }
+
+  /* the checkpoint can not be trusted when it is stale (written before
+   * the add committed FILESIZE) or points past the end of the file, the
+   * whole file is walked then */
+  uint64_t start = header.filesize;
+  uint32_t known = header._entries;
+  uint64_t last_id = header._last_entry_id;
+  if (header.filesize < sizeof(db_header_t) || header.filesize > size ||
+      (header.filesize == sizeof(db_header_t) && header._entries > 0)) {
+    start = sizeof(db_header_t);
+    known = 0;
+    last_id = 0;
+  }
+
+  const char *map;
+  if (__map(fd, size, &map) < 0) { return STATUS_ERROR; }
+
+  uint64_t at = start;
+  uint32_t walked = 0;
+  while (at < size) {
+    todo_entry_t view;
+    size_t consumed = 0;
+    if (entry_validate(map + at, (size_t)(size - at), &view, &consumed) < 0) { break; }
+    if (view.entry_id <= last_id) { break; }
+    last_id = view.entry_id;
+    at += consumed;
+    walked++;
+  }
+  storage_unmap(map, size);
+
+  /* never give up on entries the header says were committed */
+  if (known + walked < header._entries) {
+    DEBUG_ERROR("committed entries are damaged\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  db_header_t update = header;
+  update._entries = known + walked;
+  update._last_entry_id = last_id > header._last_entry_id ? last_id : header._last_entry_id;
+  update.filesize = (uint32_t)at;
+  if (__commit(fd, &update, at, size) < 0) { return STATUS_ERROR; }
+
+  report->kept = update._entries - header._entries;
+  report->dropped = size - at;
+  return 0;
+}
+
+/*----------------------------------------------------------------
+ * fsck
+ *----------------------------------------------------------------*/
+
+typedef struct {
+  const char *map;
+  const uint64_t *offsets; /* where each entry starts, one more for the end */
+  uint64_t blob_size;
+  uint64_t dict_size;
+  size_t from;
+  size_t to;
+
+  uint64_t *ids; /* the id of every entry, 0 for a damaged one */
+} fsck_slice_t;
+
+typedef struct {
+  const segment_info_t *seg;
+  char path[DB_PATH_MAX];
+  int rc;
+} fsck_segment_t;
+
+typedef struct {
+  fsck_slice_t *slices;
+  size_t n_slices;
+  fsck_segment_t *segments;
+  size_t n_segments;
+  int index;
+  int threads;
+} fsck_worker_t;
+
+static bool __entry_ok(const fsck_slice_t *s, size_t i, todo_entry_t *view) {
+  size_t n = (size_t)(s->offsets[i + 1] - s->offsets[i]);
+  size_t consumed = 0;
+  if (entry_validate(s->map + s->offsets[i], n, view, &consumed) < 0 || consumed != n) {
+    return false;
+  }
+  if (view->_in_blob && view->_blob_offset + BLOB_HEADER_SIZE > s->blob_size) { return false; }
+  if (view->_interned && view->_text_id + DICT_HEADER_SIZE > s->dict_size) { return false; }
+  return true;
+}
+
+static void __check_slice(fsck_slice_t *s) {
+  for (size_t i = s->from; i < s->to; i++) {
+    todo_entry_t view;
+    s->ids[i] = __entry_ok(s, i, &view) ? view.entry_id : 0;
+  }
+}
+
+/* ids have to keep increasing. An entry out of step with the one before
+ * or with the one after it, or past the last id the header committed, is
+ * damaged on its own and does not take the entries after it along. Clears
+ * the ids of the damaged entries, returns the last id kept */
+static uint64_t __check_ids(uint64_t *ids, const uint64_t *offsets, size_t n,
+                            const db_header_t *header, uint64_t file_bytes) {
+  bool trusted = header->filesize >= sizeof(db_header_t) && header->filesize <= file_bytes;
+  uint64_t last_id = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t id = ids[i];
+    bool ok = id > last_id;
+    if (ok && trusted && offsets[i] < header->filesize && id > header->_last_entry_id) {
+      ok = false;
+    }
+    /* an id jumping ahead only shows against the next one */
+    if (ok && i + 1 < n && ids[i + 1] > last_id && ids[i + 1] <= id) { ok = false; }
+    if (!ok) {
+      ids[i] = 0;
+      continue;
+    }
+    last_id = id;
+  }
+  return last_id;
+}
+
+/* writes the db again without its damaged entries */
+static int __rewrite_without(const char *map, const uint64_t *offsets, const uint64_t *ids,
+                             size_t n, const db_header_t *update) {
+  size_t len = (size_t)(update->filesize - sizeof(db_header_t));
+  char *buf = malloc(len > 0 ? len : 1);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate the repaired db\n");
+    return STATUS_ERROR;
+  }
+  size_t at = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (ids[i] == 0) { continue; }
+    size_t size = (size_t)(offsets[i + 1] - offsets[i]);
+    memcpy(buf + at, map + offsets[i], size);
+    at += size;
+  }
+  int rc = rewrite_db(update, buf, at);
+  free(buf);
+  return rc;
+}
+
+/* tasks are handed out round robin, slices first */
+static void *__fsck_worker(void *arg) {
+  fsck_worker_t *w = arg;
+  size_t total = w->n_slices + w->n_segments;
+  for (size_t t = (size_t)w->index; t < total; t += (size_t)w->threads) {
+    if (t < w->n_slices) {
+      __check_slice(&w->slices[t]);
+    } else {
+      fsck_segment_t *seg = &w->segments[t - w->n_slices];
+      seg->rc = segment_verify_file(seg->seg, seg->path);
+    }
+  }
+  return NULL;
+}
+
+static int __run_workers(fsck_worker_t *proto, int threads) {
+  pthread_t tids[FSCK_MAX_THREADS];
+  fsck_worker_t workers[FSCK_MAX_THREADS];
+  int started = 0;
+  for (int i = 0; i < threads; i++) {
+    workers[i] = *proto;
+    workers[i].index = i;
+    workers[i].threads = threads;
+  }
+  /* the calling thread takes the first share itself */
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&tids[i], NULL, __fsck_worker, &workers[i]) != 0) { break; }
+    started++;
+  }
+  if (started < threads - 1) {
+    /* fewer threads than planned, hand the shares out again */
+    for (int i = 1; i <= started; i++) { pthread_join(tids[i], NULL); }
+    workers[0].threads = 1;
+    __fsck_worker(&workers[0]);
+    return 1;
+  }
+  __fsck_worker(&workers[0]);
+  for (int i = 1; i < threads; i++) { pthread_join(tids[i], NULL); }
+  return threads;
+}
+
+static uint64_t __sidecar_size(const char *suffix) {
+  char path[DB_PATH_MAX];
+  struct stat st;
+  if (db_resolve_path(suffix, path, sizeof(path)) < 0 || stat(path, &st) < 0) { return 0; }
+  return (uint64_t)st.st_size;
+}
+
+/* finds where each entry starts from the length prefixes alone, stops at
+ * the first prefix that can not be right */
+static int __find_entries(const char *map, uint64_t size, uint64_t **out, size_t *n) {
+  size_t cap = 1024, len = 0;
+  uint64_t *offsets = malloc(sizeof(uint64_t) * cap);
+  if (offsets == NULL) { return STATUS_ERROR; }
+
+  uint64_t at = sizeof(db_header_t);
+  for (;;) {
+    if (len + 1 == cap) {
+      uint64_t *grown = realloc(offsets, sizeof(uint64_t) * cap * 2);
+      if (grown == NULL) {
+        free(offsets);
+        return STATUS_ERROR;
+      }
+      offsets = grown;
+      cap *= 2;
+    }
+    offsets[len] = at;
+    if (at + 4 > size) { break; }
+    uint32_t total_length = schema_get_32(map + at + ENTRY_OFFSET(LENGTH));
+    if (total_length < ENTRY_HEADER_SIZE || total_length > size - at) { break; }
+    at += total_length;
+    len++;
+  }
+  *out = offsets;
+  *n = len;
+  return 0;
+}
+
+int db_fsck(bool repair, fsck_report_t *report) {
+  if (report == NULL) { return STATUS_ERROR; }
+  memset(report, 0, sizeof(fsck_report_t));
+
+  int fd;
+  int rc = db_lock_raw(&fd);
+  if (rc < 0) { return rc; }
+
+  if (read_header(fd, &report->header) < 0 || storage_size(fd, &report->file_bytes) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+  if (report->file_bytes < sizeof(db_header_t)) {
+    DEBUG_ERROR("db is shorter than its header\n");
+    db_unlock(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  const char *map = NULL;
+  uint64_t *offsets = NULL;
+  size_t n = 0;
+  manifest_t manifest = {0};
+  uint64_t *ids = NULL;
+  fsck_slice_t *slices = NULL;
+  fsck_segment_t *segments = NULL;
+  if ((rc = __map(fd, report->file_bytes, &map)) < 0) { goto out; }
+  if ((rc = __find_entries(map, report->file_bytes, &offsets, &n)) < 0) { goto out; }
+  if ((report->header._flags & DB_FEATURE_SEGMENTS) && (rc = manifest_load(&manifest)) < 0) {
+    goto out;
+  }
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = online < 1 ? 1 : online > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : (int)online;
+  size_t n_slices = n / FSCK_MIN_SLICE;
+  if (n_slices < 1) { n_slices = n > 0 ? 1 : 0; }
+  if (n_slices > (size_t)threads) { n_slices = (size_t)threads; }
+  size_t tasks = n_slices + manifest.count;
+  if ((size_t)threads > tasks) { threads = tasks > 0 ? (int)tasks : 1; }
+
+  ids = calloc(n + 1, sizeof(uint64_t));
+  slices = calloc(n_slices + 1, sizeof(fsck_slice_t));
+  segments = calloc(manifest.count + 1, sizeof(fsck_segment_t));
+  if (ids == NULL || slices == NULL || segments == NULL) {
+    rc = STATUS_ERROR;
+    goto out;
+  }
+  uint64_t blob_size = __sidecar_size(BLOB_SUFFIX);
+  uint64_t dict_size = __sidecar_size(DICT_SUFFIX);
+  for (size_t i = 0; i < n_slices; i++) {
+    slices[i].map = map;
+    slices[i].offsets = offsets;
+    slices[i].blob_size = blob_size;
+    slices[i].dict_size = dict_size;
+    slices[i].ids = ids;
+    slices[i].from = n * i / n_slices;
+    slices[i].to = n * (i + 1) / n_slices;
+  }
+  /* paths are resolved here, `wordexp` is not for threads */
+  for (uint32_t i = 0; i < manifest.count; i++) {
+    segments[i].seg = &manifest.segments[i];
+    if (segment_path(manifest.segments[i].seq, segments[i].path, DB_PATH_MAX) < 0) {
+      rc = STATUS_ERROR;
+      goto out;
+    }
+  }
+
+  fsck_worker_t proto = {
+      .slices = slices,
+      .n_slices = n_slices,
+      .segments = segments,
+      .n_segments = manifest.count,
+  };
+  report->threads = __run_workers(&proto, threads);
+
+  /* the entries to keep end after the last good one, damaged entries
+   * before it are dropped one by one, the ones after it are a tail */
+  uint64_t last_id = __check_ids(ids, offsets, n, &report->header, report->file_bytes);
+  size_t tail = n;
+  while (tail > 0 && ids[tail - 1] == 0) { tail--; }
+  report->tail_at = offsets[tail];
+  report->good_bytes = offsets[tail];
+  for (size_t i = 0; i < tail; i++) {
+    if (ids[i] != 0) {
+      report->entries++;
+    } else {
+      report->bad_entries++;
+      report->good_bytes -= offsets[i + 1] - offsets[i];
+    }
+  }
+  /* entries the header counts that are gone are damage, not a torn tail */
+  uint64_t committed = report->header.filesize < report->file_bytes ? report->header.filesize
+                                                                    : report->file_bytes;
+  report->bad_entry = tail < n || report->tail_at < committed;
+
+  report->segments = manifest.count;
+  for (uint32_t i = 0; i < manifest.count; i++) {
+    if (segments[i].rc < 0) { report->bad_segments++; }
+    if (manifest.segments[i].max_id > last_id) { last_id = manifest.segments[i].max_id; }
+  }
+  if (manifest.sealed_through_id > last_id) { last_id = manifest.sealed_through_id; }
+  report->last_entry_id = last_id;
+
+  const db_header_t *header = &report->header;
+  bool consistent = header->_entries == report->entries &&
+                    header->filesize == report->good_bytes &&
+                    header->_last_entry_id >= last_id && report->file_bytes == report->good_bytes;
+  if (repair && !consistent) {
+    db_header_t update = *header;
+    update._entries = report->entries;
+    update.filesize = (uint32_t)report->good_bytes;
+    if (last_id > update._last_entry_id) { update._last_entry_id = last_id; }
+    rc = report->bad_entries > 0 ? __rewrite_without(map, offsets, ids, tail, &update)
+                                 : __commit(fd, &update, report->good_bytes, report->file_bytes);
+    if (rc < 0) { goto out; }
+    report->header_fixed = true;
+  }
+  if ((rc = delta_repair(repair, &report->delta_torn)) < 0) { goto out; }
+  report->delta_fixed = repair && report->delta_torn > 0;
+  rc = 0;
+
+out:
+  storage_unmap(map, report->file_bytes);
+  free(offsets);
+  free(ids);
+  free(slices);
+  free(segments);
+  manifest_free(&manifest);
+  db_unlock(fd);
+  return rc;
+}
@@ -0,0 +1,714 @@
+#include "todoctl/segment.h"
+#include "todoctl/archive.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/schema.h"
+#include "todoctl/storage.h"
+#include "todoctl/tags.h"
+#include "todoctl/trace.h"
+#include "todoctl/trigram.h"
+#include "todoctl/util.h"
+
+#include <inttypes.h>
+
+int segment_path(uint64_t seq, char *out, size_t n) {
+  char dir[DB_PATH_MAX];
+  if (db_resolve_path(SEGMENT_DIR_SUFFIX, dir, sizeof(dir)) < 0) { return STATUS_ERROR; }
+  int written = snprintf(out, n, "%s/seg-%06" PRIu64 ".db", dir, seq);
+  if (written < 0 || (size_t)written >= n) { return TODOCTL_ERR_BUFFER_TOO_SMALL; }
+  return 0;
+}
+
+int manifest_load(manifest_t *out) {
+  if (out == NULL) { return STATUS_ERROR; }
+  memset(out, 0, sizeof(manifest_t));
+  out->next_seq = 1;
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(MANIFEST_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) { return 0; }
+    DEBUG_ERROR("failed to open manifest\n");
+    return STATUS_ERROR;
+  }
+
+  char head[MANIFEST_HEADER_SIZE];
+  if (read(fd, head, sizeof(head)) != (ssize_t)sizeof(head)) {
+    DEBUG_ERROR("failed to read manifest header\n");
+    close(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  if (schema_get_64(head) != MANIFEST_MAGIC) {
+    DEBUG_ERROR("invalid manifest magic\n");
+    close(fd);
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(head + 8) != MANIFEST_VERSION) {
+    DEBUG_ERROR("invalid manifest version\n");
+    close(fd);
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+
+  out->count = schema_get_32(head + 12);
+  out->next_seq = schema_get_64(head + 16);
+  out->sealed_through_id = schema_get_64(head + 24);
+  if (out->count == 0) {
+    close(fd);
+    return 0;
+  }
+
+  size_t body_len = (size_t)out->count * MANIFEST_ENTRY_SIZE;
+  char *body = malloc(body_len);
+  out->segments = calloc(out->count, sizeof(segment_info_t));
+  if (body == NULL || out->segments == NULL) {
+    DEBUG_ERROR("failed to allocate manifest\n");
+    free(body);
+    manifest_free(out);
+    close(fd);
+    return STATUS_ERROR;
+  }
+  if (read(fd, body, body_len) != (ssize_t)body_len) {
+    DEBUG_ERROR("manifest is shorter than its count\n");
+    free(body);
+    manifest_free(out);
+    close(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  close(fd);
+
+  for (uint32_t i = 0; i < out->count; i++) {
+    const char *rec = body + (size_t)i * MANIFEST_ENTRY_SIZE;
+    segment_info_t *seg = &out->segments[i];
+    seg->seq = schema_get_64(rec);
+    seg->min_id = schema_get_64(rec + 8);
+    seg->max_id = schema_get_64(rec + 16);
+    seg->min_created = schema_get_64(rec + 24);
+    seg->max_created = schema_get_64(rec + 32);
+    seg->entries = schema_get_32(rec + 40);
+    seg->checksum = schema_get_32(rec + 44);
+    seg->size = schema_get_64(rec + 48);
+    seg->flags = schema_get_32(rec + 56);
+  }
+
+  free(body);
+  return 0;
+}
+
+int manifest_store(const manifest_t *manifest) {
+  if (manifest == NULL) { return STATUS_ERROR; }
+
+  size_t len = MANIFEST_HEADER_SIZE + (size_t)manifest->count * MANIFEST_ENTRY_SIZE;
+  char *buf = calloc(1, len);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate manifest buffer\n");
+    return STATUS_ERROR;
+  }
+
+  schema_put_64(buf, MANIFEST_MAGIC);
+  schema_put_32(buf + 8, MANIFEST_VERSION);
+  schema_put_32(buf + 12, manifest->count);
+  schema_put_64(buf + 16, manifest->next_seq);
+  schema_put_64(buf + 24, manifest->sealed_through_id);
+  for (uint32_t i = 0; i < manifest->count; i++) {
+    char *rec = buf + MANIFEST_HEADER_SIZE + (size_t)i * MANIFEST_ENTRY_SIZE;
+    const segment_info_t *seg = &manifest->segments[i];
+    schema_put_64(rec, seg->seq);
+    schema_put_64(rec + 8, seg->min_id);
+    schema_put_64(rec + 16, seg->max_id);
+    schema_put_64(rec + 24, seg->min_created);
+    schema_put_64(rec + 32, seg->max_created);
+    schema_put_32(rec + 40, seg->entries);
+    schema_put_32(rec + 44, seg->checksum);
+    schema_put_64(rec + 48, seg->size);
+    schema_put_32(rec + 56, seg->flags);
+  }
+
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (db_resolve_path(MANIFEST_SUFFIX, path, sizeof(path)) < 0 ||
+      db_resolve_path(MANIFEST_SUFFIX ".tmp", tmp_path, sizeof(tmp_path)) < 0) {
+    free(buf);
+    return STATUS_ERROR;
+  }
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    free(buf);
+    return STATUS_ERROR;
+  }
+  if (write(fd, buf, len) != (ssize_t)len || fsync(fd) < 0) {
+    perror("write()");
+    close(fd);
+    unlink(tmp_path);
+    free(buf);
+    return STATUS_ERROR;
+  }
+  close(fd);
+  free(buf);
+
+  /* the rename is what publishes the new set of segments */
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+void manifest_free(manifest_t *manifest) {
+  if (manifest == NULL) { return; }
+  free(manifest->segments);
+  manifest->segments = NULL;
+  manifest->count = 0;
+}
+
+int segment_find(const manifest_t *manifest, uint64_t entry_id) {
+  if (manifest == NULL || manifest->count == 0) { return -1; }
+
+  /* segments never overlap and are ordered by id */
+  size_t lo = 0, hi = manifest->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const segment_info_t *seg = &manifest->segments[mid];
+    if (entry_id < seg->min_id) {
+      hi = mid;
+    } else if (entry_id > seg->max_id) {
+      lo = mid + 1;
+    } else {
+      return (int)mid;
+    }
+  }
+  return -1;
+}
+
+bool segment_overlaps(const segment_info_t *seg, const segment_range_t *range) {
+  if (range == NULL) { return true; }
+  if (range->max_id != 0 && seg->min_id > range->max_id) { return false; }
+  if (seg->max_id < range->min_id) { return false; }
+  if (range->max_created != 0 && seg->min_created > range->max_created) { return false; }
+  if (seg->max_created < range->min_created) { return false; }
+  return true;
+}
+
+typedef struct {
+  uint64_t entry_id;
+  const char *token;
+} bloom_key_t;
+
+/* a segment without a filter or with an unreadable one may hold anything */
+static bool __probe(const segment_info_t *seg, const bloom_key_t *key, bloom_counters_t *counters) {
+  if (!(seg->flags & SEGMENT_FLAG_BLOOM)) { return true; }
+
+  int fd;
+  db_header_t header;
+  if (segment_open(seg, &fd, &header) < 0) { return true; }
+  bloom_t bloom;
+  int rc = bloom_read(fd, (off_t)seg->size, &bloom);
+  storage_close(fd);
+  if (rc < 0) { return true; }
+
+  bool maybe = key->token != NULL ? bloom_has_token(&bloom, key->token, strlen(key->token))
+                                  : bloom_has_id(&bloom, key->entry_id);
+  bloom_free(&bloom);
+  if (counters != NULL) {
+    counters->probes++;
+    if (!maybe) { counters->skips++; }
+  }
+  return maybe;
+}
+
+bool segment_may_hold_id(const segment_info_t *seg, uint64_t entry_id,
+                         bloom_counters_t *counters) {
+  bloom_key_t key = {.entry_id = entry_id, .token = NULL};
+  return __probe(seg, &key, counters);
+}
+
+int segment_open(const segment_info_t *seg, int *out_fd, db_header_t *header) {
+  char path[DB_PATH_MAX];
+  if (segment_path(seg->seq, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+
+  int fd;
+  if (storage_open(path, O_RDONLY, &fd) < 0) {
+    DEBUG_ERROR("failed to open segment %" PRIu64 "\n", seg->seq);
+#ifdef DEBUG
+    perror("storage_open()");
+#endif
+    return TODOCTL_ERR_DB_DOES_NOT_EXIST;
+  }
+  if (read_header(fd, header) < 0 || header->magic != DB_MAGIC) {
+    storage_close(fd);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  *out_fd = fd;
+  return 0;
+}
+
+static int __file_checksum(const char *path, uint32_t *crc, uint64_t *size) {
+  int fd;
+  if (storage_open(path, O_RDONLY, &fd) < 0) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+
+  char buf[64 * 1024];
+  *crc = 0;
+  *size = 0;
+  ssize_t n;
+  while ((n = storage_read_at(fd, buf, sizeof(buf), *size)) > 0) {
+    *crc = crc32_update(*crc, buf, (size_t)n);
+    *size += (uint64_t)n;
+  }
+  storage_close(fd);
+  return n < 0 ? STATUS_ERROR : 0;
+}
+
+int segment_verify(const segment_info_t *seg) {
+  char path[DB_PATH_MAX];
+  if (segment_path(seg->seq, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  return segment_verify_file(seg, path);
+}
+
+int segment_verify_file(const segment_info_t *seg, const char *path) {
+  uint32_t crc;
+  uint64_t size;
+  int rc = __file_checksum(path, &crc, &size);
+  if (rc < 0) { return rc; }
+  if (size != seg->size || crc != seg->checksum) {
+    DEBUG_ERROR("segment %" PRIu64 " does not match the manifest\n", seg->seq);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  return 0;
+}
+
+/* appends the entries of an open db file to a growing array, skipping ids
+ * up to `skip_through` */
+static int __append_entries(int fd, const db_header_t *header, uint64_t skip_through,
+                            query_t *filter, todo_entry_t ***out, size_t *n) {
+  if (header->_entries == 0) { return 0; }
+  if (filter != NULL) { return query_scan(fd, header, skip_through, filter, out, n); }
+
+  todo_entry_t **grown = realloc(*out, sizeof(todo_entry_t *) * (*n + header->_entries));
+  if (grown == NULL) {
+    DEBUG_ERROR("failed to grow entries\n");
+    return STATUS_ERROR;
+  }
+  *out = grown;
+
+  if (read_entries_from_db(fd, header, grown + *n, NULL, NULL) < 0) { return STATUS_ERROR; }
+
+  size_t kept = *n;
+  for (size_t i = *n; i < *n + header->_entries; i++) {
+    if (grown[i]->entry_id <= skip_through) {
+      free(grown[i]->entry_raw_data);
+      free(grown[i]);
+      continue;
+    }
+    grown[kept++] = grown[i];
+  }
+  *n = kept;
+  return 0;
+}
+
+void segment_range_from_query(query_t *q, segment_range_t *range, bloom_counters_t *counters) {
+  memset(range, 0, sizeof(segment_range_t));
+  range->min_id = q->min_id;
+  range->max_id = q->max_id;
+  range->min_created = q->min_created;
+  range->max_created = q->max_created;
+  range->token = q->word;
+  range->counters = counters;
+  range->filter = q;
+}
+
+int segment_read_sealed(const manifest_t *manifest, const segment_range_t *range,
+                        todo_entry_t ***out, size_t *n) {
+  TRACE_FUNC();
+  const query_t *q = range != NULL ? range->filter : NULL;
+  bool desc = q != NULL && q->ordered && q->order.desc;
+  for (uint32_t k = 0; k < manifest->count; k++) {
+    /* a descending top-k wants the newest segments first */
+    const segment_info_t *seg = &manifest->segments[desc ? manifest->count - 1 - k : k];
+    /* the whole point, segments outside the range are never opened */
+    if (!segment_overlaps(seg, range)) { continue; }
+    /* nor the ones holding no id the tag index allows */
+    if (q != NULL && !query_wants_ids(q, seg->min_id, seg->max_id)) { continue; }
+    /* nor are the ones that cannot beat anything a full top-k holds */
+    if (q != NULL && !query_top_wants(q, *out, *n, seg->min_id, seg->max_id, seg->min_created,
+                                      seg->max_created)) {
+      continue;
+    }
+    bloom_key_t key = {.entry_id = 0, .token = range != NULL ? range->token : NULL};
+    if (key.token != NULL && !__probe(seg, &key, range->counters)) { continue; }
+
+    int fd;
+    db_header_t header;
+    if (segment_open(seg, &fd, &header) < 0) { return STATUS_ERROR; }
+    size_t before = *n;
+    int rc = __append_entries(fd, &header, 0, range != NULL ? range->filter : NULL, out, n);
+    storage_close(fd);
+    if (rc < 0) { return rc; }
+
+    /* the filter let us in for nothing, with a query the other predicates
+     * may have dropped the entries so we can only tell for a lone word.
+     * A top-k heap reorders what it holds, the new entries are not at the
+     * end anymore */
+    if (key.token != NULL && range->counters != NULL && (seg->flags & SEGMENT_FLAG_BLOOM) &&
+        (q == NULL || (!q->ordered && q->n_meta == 0 && q->n_text == 1))) {
+      bool found = false;
+      for (size_t j = before; j < *n && !found; j++) {
+        found = entry_load_text((*out)[j]) == 0 &&
+                text_has_token((*out)[j]->entry_raw_data, (*out)[j]->entry_raw_data_len,
+                               key.token);
+      }
+      if (!found) { range->counters->false_positives++; }
+    }
+  }
+  return 0;
+}
+
+int db_read_entries(const segment_range_t *range, todo_entry_t ***out, size_t *n) {
+  TRACE_FUNC();
+  if (out == NULL || n == NULL) { return STATUS_ERROR; }
+  *out = NULL;
+  *n = 0;
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(NULL, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd;
+  if (storage_open(path, O_RDONLY, &fd) < 0) {
+    DEBUG_ERROR("failed to open db file\n");
+#ifdef DEBUG
+    perror("storage_open()");
+#endif
+    return STATUS_ERROR;
+  }
+
+  db_header_t header;
+  if (read_header(fd, &header) < 0) {
+    storage_close(fd);
+    return STATUS_ERROR;
+  }
+
+  manifest_t manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  int rc = 0;
+  /* a descending top-k reads the newest entries first, a full heap then
+   * lets whole segments be skipped */
+  query_t *filter = range != NULL ? range->filter : NULL;
+  /* tag predicates are answered by the index before anything is read */
+  if (filter != NULL && (rc = tags_resolve(filter)) < 0) {
+    storage_close(fd);
+    return rc;
+  }
+  /* and substrings by the trigram index, when there is one */
+  if (filter != NULL && (header._flags & DB_FEATURE_TRIGRAMS) &&
+      (rc = trigram_resolve(filter)) < 0) {
+    storage_close(fd);
+    return rc;
+  }
+  bool newest_first = filter != NULL && filter->ordered && filter->order.desc;
+  if (header._flags & DB_FEATURE_SEGMENTS) { rc = manifest_load(&manifest); }
+  if (rc == 0 && newest_first) {
+    rc = __append_entries(fd, &header, manifest.sealed_through_id, filter, out, n);
+  }
+  if (rc == 0 && (header._flags & DB_FEATURE_SEGMENTS)) {
+    rc = segment_read_sealed(&manifest, range, out, n);
+  }
+  if (rc == 0 && !newest_first) {
+    rc = __append_entries(fd, &header, manifest.sealed_through_id, filter, out, n);
+  }
+  /* the archive is cold, it is only read when asked for */
+  if (rc == 0 && filter != NULL && filter->archive) { rc = archive_read_entries(filter, out, n); }
+
+  manifest_free(&manifest);
+  storage_close(fd);
+  if (rc < 0) {
+    db_free_entries(*out, *n);
+    *out = NULL;
+    *n = 0;
+  }
+  return rc;
+}
+
+void db_free_entries(todo_entry_t **entries, size_t n) {
+  if (entries == NULL) { return; }
+  for (size_t i = 0; i < n; i++) {
+    free(entries[i]->entry_raw_data);
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+/* writes the entries as a new sealed segment and fills in its info */
+static int __write_segment(manifest_t *manifest, todo_entry_t **entries, size_t n, uint32_t flags,
+                           segment_info_t *out) {
+  /* written once and only ever read front to back, so every entry can be
+   * encoded relative to the one before */
+  char *buf = NULL;
+  size_t len = 0;
+  if (encode_entries_compact(entries, n, &buf, &len) < 0) { return STATUS_ERROR; }
+
+  memset(out, 0, sizeof(segment_info_t));
+  out->seq = manifest->next_seq++;
+  out->entries = (uint32_t)n;
+  out->min_id = entries[0]->entry_id;
+  out->max_id = entries[n - 1]->entry_id;
+  out->min_created = UINT64_MAX;
+  for (size_t i = 0; i < n; i++) {
+    if (entries[i]->_created_at < out->min_created) { out->min_created = entries[i]->_created_at; }
+    if (entries[i]->_created_at > out->max_created) { out->max_created = entries[i]->_created_at; }
+  }
+
+  db_header_t header;
+  memset(&header, 0, sizeof(header));
+  header._entries = (uint32_t)n;
+  header._last_entry_id = out->max_id;
+  header._flags = flags | DB_FLAG_COMPACT_RECORDS;
+
+  char dir[DB_PATH_MAX];
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(SEGMENT_DIR_SUFFIX, dir, sizeof(dir)) < 0 ||
+      segment_path(out->seq, path, sizeof(path)) < 0) {
+    free(buf);
+    return STATUS_ERROR;
+  }
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    perror("mkdir()");
+    free(buf);
+    return STATUS_ERROR;
+  }
+
+  int rc = write_db_file(path, &header, buf, len);
+  free(buf);
+  if (rc < 0) { return rc; }
+
+  /* the filter goes after the entries, readers of the entries stop before */
+  size_t keys = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (entry_load_text(entries[i]) < 0) { return STATUS_ERROR; }
+    keys += bloom_entry_keys(entries[i]);
+  }
+  bloom_t bloom;
+  if (bloom_init(&bloom, keys) < 0) { return STATUS_ERROR; }
+  for (size_t i = 0; i < n; i++) { bloom_add_entry(&bloom, entries[i]); }
+  int fd;
+  if (storage_open(path, O_WRONLY, &fd) < 0) {
+    bloom_free(&bloom);
+    return STATUS_ERROR;
+  }
+  rc = bloom_write(fd, &bloom);
+  if (rc == 0 && storage_sync(fd) < 0) { rc = STATUS_ERROR; }
+  storage_close(fd);
+  bloom_free(&bloom);
+  if (rc < 0) { return rc; }
+  out->flags |= SEGMENT_FLAG_BLOOM | SEGMENT_FLAG_COMPACT;
+
+  /* sealed for good, nothing should ever write to it again */
+  chmod(path, 0444);
+  return __file_checksum(path, &out->checksum, &out->size);
+}
+
+int segment_seal(void) {
+  int fd;
+  if (db_lock(&fd) < 0) { return STATUS_ERROR; }
+
+  db_header_t header;
+  manifest_t manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  if (read_header(fd, &header) < 0 || manifest_load(&manifest) < 0) {
+    db_unlock(fd);
+    return STATUS_ERROR;
+  }
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  int rc = __append_entries(fd, &header, manifest.sealed_through_id, NULL, &entries, &n);
+
+  uint32_t flags = header._flags | DB_FEATURE_SEGMENTS | DB_FEATURE_DELTA_LOG;
+  if (rc == 0 && n > 0) {
+    segment_info_t seg;
+    rc = __write_segment(&manifest, entries, n, flags, &seg);
+    if (rc == 0) {
+      segment_info_t *grown =
+          realloc(manifest.segments, sizeof(segment_info_t) * (manifest.count + 1));
+      if (grown == NULL) {
+        rc = STATUS_ERROR;
+      } else {
+        manifest.segments = grown;
+        manifest.segments[manifest.count++] = seg;
+        manifest.sealed_through_id = seg.max_id;
+        rc = manifest_store(&manifest);
+      }
+    }
+  }
+
+  /* the segment is published, the active db starts over empty. The last
+   * id stays so new entries keep counting from where we are */
+  if (rc == 0) {
+    db_header_t active = header;
+    active._entries = 0;
+    active._flags = flags;
+    rc = rewrite_db(&active, NULL, 0);
+  }
+  if (rc == 0 && n > 0) {
+    printf("sealed %zu entries into segment %" PRIu64 "\n", n,
+           manifest.segments[manifest.count - 1].seq);
+  }
+
+  db_free_entries(entries, n);
+  manifest_free(&manifest);
+  db_unlock(fd);
+  return rc;
+}
+
+static bool __has_deltas_in(const delta_map_t *map, const segment_info_t *seg) {
+  for (size_t i = 0; i < map->cap; i++) {
+    uint64_t id = map->slots[i].entry_id;
+    if (id != 0 && id >= seg->min_id && id <= seg->max_id) { return true; }
+  }
+  return false;
+}
+
+int segment_fold_deltas(const delta_map_t *map) {
+  if (map == NULL || map->len == 0) { return 0; }
+
+  manifest_t manifest;
+  if (manifest_load(&manifest) < 0) { return STATUS_ERROR; }
+
+  uint64_t *retired = calloc(manifest.count + 1, sizeof(uint64_t));
+  if (retired == NULL) {
+    manifest_free(&manifest);
+    return STATUS_ERROR;
+  }
+
+  /* sealed segments are immutable, a segment with deltas is replaced by a
+   * new one holding the folded entries */
+  size_t n_retired = 0;
+  int rc = 0;
+  for (uint32_t i = 0; i < manifest.count && rc == 0; i++) {
+    segment_info_t *seg = &manifest.segments[i];
+    if (!__has_deltas_in(map, seg)) { continue; }
+
+    int fd;
+    db_header_t header;
+    if ((rc = segment_open(seg, &fd, &header)) < 0) { break; }
+    todo_entry_t **entries = NULL;
+    size_t n = 0;
+    rc = __append_entries(fd, &header, 0, NULL, &entries, &n);
+    storage_close(fd);
+
+    segment_info_t folded;
+    if (rc == 0 && n > 0) { rc = __write_segment(&manifest, entries, n, header._flags, &folded); }
+    if (rc == 0 && n > 0) {
+      retired[n_retired++] = seg->seq;
+      *seg = folded;
+    }
+    db_free_entries(entries, n);
+  }
+
+  if (rc == 0 && n_retired > 0) { rc = manifest_store(&manifest); }
+
+  /* only once the new manifest is in place nobody reads the old files */
+  for (size_t i = 0; rc == 0 && i < n_retired; i++) {
+    char path[DB_PATH_MAX];
+    if (segment_path(retired[i], path, sizeof(path)) == 0) { storage_remove(path); }
+  }
+
+  free(retired);
+  manifest_free(&manifest);
+  return rc;
+}
+
+static bool __holds_id(const uint64_t *ids, size_t n, uint64_t id) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ids[mid] < id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < n && ids[lo] == id;
+}
+
+/* true if any of the sorted ids falls into the id range of the segment */
+static bool __has_ids_in(const uint64_t *ids, size_t n, const segment_info_t *seg) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ids[mid] < seg->min_id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < n && ids[lo] <= seg->max_id;
+}
+
+int segment_drop_ids(const uint64_t *ids, size_t n_ids) {
+  if (ids == NULL || n_ids == 0) { return 0; }
+
+  manifest_t manifest;
+  if (manifest_load(&manifest) < 0) { return STATUS_ERROR; }
+
+  uint64_t *retired = calloc(manifest.count + 1, sizeof(uint64_t));
+  if (retired == NULL) {
+    manifest_free(&manifest);
+    return STATUS_ERROR;
+  }
+
+  /* like folding deltas, a segment that loses entries is replaced by a
+   * new one holding the rest and one that loses all of them goes away */
+  size_t n_retired = 0;
+  uint32_t kept_segments = 0;
+  int rc = 0;
+  for (uint32_t i = 0; i < manifest.count && rc == 0; i++) {
+    segment_info_t seg = manifest.segments[i];
+    if (!__has_ids_in(ids, n_ids, &seg)) {
+      manifest.segments[kept_segments++] = seg;
+      continue;
+    }
+
+    int fd;
+    db_header_t header;
+    if ((rc = segment_open(&seg, &fd, &header)) < 0) { break; }
+    todo_entry_t **entries = NULL;
+    size_t n = 0;
+    rc = __append_entries(fd, &header, 0, NULL, &entries, &n);
+    storage_close(fd);
+
+    size_t kept = 0;
+    for (size_t j = 0; rc == 0 && j < n; j++) {
+      if (__holds_id(ids, n_ids, entries[j]->entry_id)) {
+        free(entries[j]->entry_raw_data);
+        free(entries[j]);
+        continue;
+      }
+      entries[kept++] = entries[j];
+    }
+    if (rc < 0) { kept = n; }
+
+    segment_info_t rest;
+    if (rc == 0 && kept > 0) { rc = __write_segment(&manifest, entries, kept, header._flags, &rest); }
+    if (rc == 0) {
+      retired[n_retired++] = seg.seq;
+      if (kept > 0) { manifest.segments[kept_segments++] = rest; }
+    }
+    db_free_entries(entries, kept);
+  }
+  if (rc == 0) {
+    manifest.count = kept_segments;
+    if (n_retired > 0) { rc = manifest_store(&manifest); }
+  }
+
+  /* only once the new manifest is in place nobody reads the old files */
+  for (size_t i = 0; rc == 0 && i < n_retired; i++) {
+    char path[DB_PATH_MAX];
+    if (segment_path(retired[i], path, sizeof(path)) == 0) { storage_remove(path); }
+  }
+
+  free(retired);
+  manifest_free(&manifest);
+  return rc;
+}
@@ -0,0 +1,315 @@
+#include "todoctl/stats.h"
+#include "todoctl/archive.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/schema.h"
+#include "todoctl/segment.h"
+#include "todoctl/util.h"
+
+#include <inttypes.h>
+#include <sys/file.h>
+
+static const uint64_t latency_bounds_ms[STATS_LATENCY_BUCKETS - 1] = {
+    60ULL * 1000,           /* 1 minute */
+    10ULL * 60 * 1000,      /* 10 minutes */
+    60ULL * 60 * 1000,      /* 1 hour */
+    6ULL * 60 * 60 * 1000,  /* 6 hours */
+    24ULL * 60 * 60 * 1000, /* 1 day */
+    7ULL * 24 * 60 * 60 * 1000,
+    30ULL * 24 * 60 * 60 * 1000,
+};
+
+static const char *latency_labels[STATS_LATENCY_BUCKETS] = {
+    "< 1m", "< 10m", "< 1h", "< 6h", "< 1d", "< 7d", "< 30d", ">= 30d",
+};
+
+static const char *field_names[STATS_FIELDS] = {
+    "magic",      "version", "total",          "open",    "done",    "deleted",
+    "today",      "done_today", "latency_sum_ms", "hist[0]", "hist[1]", "hist[2]",
+    "hist[3]",    "hist[4]", "hist[5]",        "hist[6]", "hist[7]", "bloom_probes",
+    "bloom_skips", "bloom_false_positives",
+};
+
+uint64_t stats_day_of(uint64_t millis) {
+  time_t t = (time_t)(millis / 1000);
+  struct tm tm_info;
+  localtime_r(&t, &tm_info);
+  return (uint64_t)(tm_info.tm_year + 1900) * 1000 + (uint64_t)tm_info.tm_yday;
+}
+
+static size_t __latency_bucket(uint64_t latency_ms) {
+  size_t i = 0;
+  for (; i < STATS_LATENCY_BUCKETS - 1; i++) {
+    if (latency_ms < latency_bounds_ms[i]) { break; }
+  }
+  return i;
+}
+
+static void __stats_init(db_stats_t *stats) {
+  memset(stats, 0, sizeof(db_stats_t));
+  stats->magic = STATS_MAGIC;
+  stats->version = STATS_VERSION;
+}
+
+static void __adjust(uint64_t *counter, int sign) {
+  if (sign > 0) {
+    (*counter)++;
+  } else if (*counter > 0) {
+    (*counter)--;
+  }
+}
+
+/* adds (sign 1) or removes (sign -1) what a single entry contributes to
+ * the counters, deleted wins over done which wins over open */
+static void __account(db_stats_t *stats, const todo_entry_t *entry, int sign) {
+  if (entry->_deleted_at > 0) {
+    __adjust(&stats->deleted, sign);
+  } else if (entry->_done_at > 0) {
+    __adjust(&stats->done, sign);
+
+    uint64_t day = stats_day_of(entry->_done_at);
+    if (sign > 0 && day > stats->today) {
+      stats->today = day;
+      stats->done_today = 0;
+    }
+    if (stats->today == day) { __adjust(&stats->done_today, sign); }
+
+    uint64_t latency =
+        entry->_done_at > entry->_created_at ? entry->_done_at - entry->_created_at : 0;
+    if (sign > 0) {
+      stats->latency_sum_ms += latency;
+    } else {
+      stats->latency_sum_ms -= latency < stats->latency_sum_ms ? latency : stats->latency_sum_ms;
+    }
+    __adjust(&stats->latency_hist[__latency_bucket(latency)], sign);
+  } else {
+    __adjust(&stats->open, sign);
+  }
+}
+
+static int __open_stats(int flags) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(STATS_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open stats file\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  return fd;
+}
+
+static int __read_stats(int fd, db_stats_t *out) {
+  char raw[STATS_FIELDS * sizeof(uint64_t)];
+  ssize_t n = pread(fd, raw, sizeof(raw), 0);
+  if (n < (ssize_t)(STATS_V1_FIELDS * sizeof(uint64_t))) {
+    DEBUG_ERROR("failed to read stats block\n");
+    return STATUS_ERROR;
+  }
+
+  /* fields a shorter, older block does not have start out at zero */
+  memset(out, 0, sizeof(db_stats_t));
+  uint64_t *fields = (uint64_t *)out;
+  for (size_t i = 0; i < (size_t)n / sizeof(uint64_t); i++) {
+    fields[i] = schema_get_64(raw + i * 8);
+  }
+
+  if (out->magic != STATS_MAGIC) {
+    DEBUG_ERROR("invalid magic in stats block\n");
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (out->version == 1) { out->version = STATS_VERSION; }
+  if (out->version != STATS_VERSION) {
+    DEBUG_ERROR("invalid stats version\n");
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+  return 0;
+}
+
+static int __write_stats(int fd, const db_stats_t *stats) {
+  char raw[STATS_FIELDS * sizeof(uint64_t)];
+  const uint64_t *fields = (const uint64_t *)stats;
+  for (size_t i = 0; i < STATS_FIELDS; i++) { schema_put_64(raw + i * 8, fields[i]); }
+
+  if (pwrite(fd, raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) {
+    DEBUG_ERROR("failed to write stats block\n");
+#ifdef DEBUG
+    perror("pwrite()");
+#endif
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+int stats_reset(void) {
+  db_stats_t stats;
+  __stats_init(&stats);
+  return stats_store(&stats);
+}
+
+int stats_load(db_stats_t *out) {
+  if (out == NULL) { return STATUS_ERROR; }
+  int fd = __open_stats(O_RDONLY);
+  if (fd < 0) { return fd; }
+  int rc = __read_stats(fd, out);
+  close(fd);
+  return rc;
+}
+
+int stats_store(const db_stats_t *stats) {
+  if (stats == NULL) { return STATUS_ERROR; }
+  int fd = __open_stats(O_RDWR | O_CREAT);
+  if (fd < 0) { return fd; }
+  flock(fd, LOCK_EX);
+  int rc = __write_stats(fd, stats);
+  flock(fd, LOCK_UN);
+  close(fd);
+  return rc;
+}
+
+typedef struct {
+  const todo_entry_t *before;
+  const todo_entry_t *after;
+  const bloom_counters_t *bloom;
+} stats_change_t;
+
+/* read, modify and write the stats block under an exclusive lock so two
+ * concurrent invocations don't lose each others updates */
+static int __update_stats(const stats_change_t *change) {
+  int fd = __open_stats(O_RDWR);
+  /* db created before stats existed, `stats --rebuild` will create it */
+  if (fd == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (fd < 0) { return fd; }
+
+  flock(fd, LOCK_EX);
+  db_stats_t stats;
+  int rc = __read_stats(fd, &stats);
+  if (rc == 0) {
+    if (change->before == NULL && change->after != NULL) { stats.total++; }
+    if (change->before != NULL) { __account(&stats, change->before, -1); }
+    if (change->after != NULL) { __account(&stats, change->after, 1); }
+    if (change->bloom != NULL) {
+      stats.bloom_probes += change->bloom->probes;
+      stats.bloom_skips += change->bloom->skips;
+      stats.bloom_false_positives += change->bloom->false_positives;
+    }
+    rc = __write_stats(fd, &stats);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  return rc;
+}
+
+int stats_record_add(const todo_entry_t *entry) {
+  if (entry == NULL) { return STATUS_ERROR; }
+  stats_change_t change = {.before = NULL, .after = entry, .bloom = NULL};
+  return __update_stats(&change);
+}
+
+int stats_record_done(const todo_entry_t *entry) {
+  if (entry == NULL) { return STATUS_ERROR; }
+  todo_entry_t before = *entry;
+  before._done_at = 0;
+  return stats_record_change(&before, entry);
+}
+
+int stats_record_change(const todo_entry_t *before, const todo_entry_t *after) {
+  if (before == NULL || after == NULL) { return STATUS_ERROR; }
+  stats_change_t change = {.before = before, .after = after, .bloom = NULL};
+  return __update_stats(&change);
+}
+
+int stats_record_bloom(const bloom_counters_t *counters) {
+  if (counters == NULL) { return STATUS_ERROR; }
+  if (counters->probes == 0) { return 0; }
+  stats_change_t change = {.before = NULL, .after = NULL, .bloom = counters};
+  return __update_stats(&change);
+}
+
+int stats_scan(db_stats_t *out) {
+  if (out == NULL) { return STATUS_ERROR; }
+  __stats_init(out);
+  out->today = stats_day_of(get_time_in_millis());
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (db_read_entries(NULL, &entries, &n) < 0) { return STATUS_ERROR; }
+  /* archived tasks still count, they only moved */
+  if (archive_read_entries(NULL, &entries, &n) < 0) {
+    db_free_entries(entries, n);
+    return STATUS_ERROR;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    const todo_entry_t *entry = entries[i];
+    out->total++;
+    if (entry->_deleted_at > 0) {
+      out->deleted++;
+    } else if (entry->_done_at > 0) {
+      out->done++;
+      if (stats_day_of(entry->_done_at) == out->today) { out->done_today++; }
+      uint64_t latency =
+          entry->_done_at > entry->_created_at ? entry->_done_at - entry->_created_at : 0;
+      out->latency_sum_ms += latency;
+      out->latency_hist[__latency_bucket(latency)]++;
+    } else {
+      out->open++;
+    }
+  }
+
+  db_free_entries(entries, n);
+  return 0;
+}
+
+int stats_compare(const db_stats_t *expected, const db_stats_t *actual, FILE *stream) {
+  if (expected == NULL || actual == NULL) { return STATUS_ERROR; }
+
+  /* `done_today` is only meaningful for the day it was recorded on */
+  db_stats_t lhs = *expected;
+  db_stats_t rhs = *actual;
+  uint64_t today = stats_day_of(get_time_in_millis());
+  if (lhs.today != today) { lhs.done_today = 0; }
+  if (rhs.today != today) { rhs.done_today = 0; }
+  lhs.today = rhs.today = today;
+
+  const uint64_t *a = (const uint64_t *)&lhs;
+  const uint64_t *b = (const uint64_t *)&rhs;
+  int rc = 0;
+  for (size_t i = 0; i < STATS_SCANNED_FIELDS; i++) {
+    if (a[i] == b[i]) { continue; }
+    if (stream != NULL) {
+      fprintf(stream, "mismatch %-14s counters=%" PRIu64 " scan=%" PRIu64 "\n", field_names[i],
+              b[i], a[i]);
+    }
+    rc = TODOCTL_ERR_STATS_MISMATCH;
+  }
+  return rc;
+}
+
+void stats_print(const db_stats_t *stats) {
+  if (stats == NULL) { return; }
+  uint64_t done_today = stats->today == stats_day_of(get_time_in_millis()) ? stats->done_today : 0;
+
+  printf("total:        %" PRIu64 "\n", stats->total);
+  printf("open:         %" PRIu64 "\n", stats->open);
+  printf("done:         %" PRIu64 "\n", stats->done);
+  printf("deleted:      %" PRIu64 "\n", stats->deleted);
+  printf("done today:   %" PRIu64 "\n", done_today);
+  if (stats->done > 0) {
+    printf("time to done: %.1fs (mean)\n", (double)stats->latency_sum_ms / stats->done / 1000.0);
+  }
+  for (size_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+    printf("  %-7s %" PRIu64 "\n", latency_labels[i], stats->latency_hist[i]);
+  }
+  if (stats->bloom_probes > 0) {
+    /* of the segments that lacked the key, how many the filter let through */
+    uint64_t negatives = stats->bloom_skips + stats->bloom_false_positives;
+    double fpr = negatives > 0 ? (double)stats->bloom_false_positives / negatives * 100.0 : 0.0;
+    printf("bloom:        %" PRIu64 " probes, %" PRIu64 " segments skipped, %" PRIu64
+           " false positives (%.2f%%)\n",
+           stats->bloom_probes, stats->bloom_skips, stats->bloom_false_positives, fpr);
+  }
+}
@@ -0,0 +1,316 @@
+#include "todoctl/storage.h"
+#include "todoctl/errors.h"
+#include "todoctl/util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*----------------------------------------------------------------
+ * POSIX
+ *----------------------------------------------------------------*/
+
+static int __posix_open(const char *path, int flags, int *out) {
+  int fd = open(path, flags, 0644);
+  if (fd < 0) { return STATUS_ERROR; }
+  *out = fd;
+  return 0;
+}
+
+static int __posix_close(int fd) { return close(fd); }
+
+static ssize_t __posix_read_at(int fd, void *buf, size_t n, uint64_t offset) {
+  return pread(fd, buf, n, (off_t)offset);
+}
+
+static ssize_t __posix_write_at(int fd, const void *buf, size_t n, uint64_t offset) {
+  return pwrite(fd, buf, n, (off_t)offset);
+}
+
+static ssize_t __posix_append(int fd, const struct iovec *iov, int iovcnt, uint64_t *offset) {
+  off_t end = lseek(fd, 0, SEEK_END);
+  if (end < 0) { return STATUS_ERROR; }
+  *offset = (uint64_t)end;
+  return writev(fd, iov, iovcnt);
+}
+
+static int __posix_sync(int fd) { return fsync(fd); }
+
+static int __posix_size(int fd, uint64_t *out) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) { return STATUS_ERROR; }
+  *out = (uint64_t)st.st_size;
+  return 0;
+}
+
+static int __posix_truncate(int fd, uint64_t size) { return ftruncate(fd, (off_t)size); }
+
+static int __posix_lock(int fd) { return flock(fd, LOCK_EX); }
+
+static int __posix_unlock(int fd) { return flock(fd, LOCK_UN); }
+
+static bool __posix_is_current(int fd, const char *path) {
+  struct stat held, current;
+  return fstat(fd, &held) == 0 && stat(path, &current) == 0 && held.st_ino == current.st_ino;
+}
+
+static int __posix_map(int fd, uint64_t n, const char **out) {
+  void *map = mmap(NULL, (size_t)n, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) { return STATUS_ERROR; }
+  *out = map;
+  return 0;
+}
+
+static void __posix_unmap(const char *map, uint64_t n) { munmap((void *)map, (size_t)n); }
+
+const storage_t storage_posix = {
+    .name = "posix",
+    .open = __posix_open,
+    .close = __posix_close,
+    .read_at = __posix_read_at,
+    .write_at = __posix_write_at,
+    .append = __posix_append,
+    .sync = __posix_sync,
+    .size = __posix_size,
+    .truncate = __posix_truncate,
+    .lock = __posix_lock,
+    .unlock = __posix_unlock,
+    .is_current = __posix_is_current,
+    .rename = rename,
+    .remove = unlink,
+    .map = __posix_map,
+    .unmap = __posix_unmap,
+};
+
+/*----------------------------------------------------------------
+ * Dispatch
+ *----------------------------------------------------------------*/
+
+static const storage_t *backend = &storage_posix;
+
+void storage_use(const storage_t *storage) { backend = storage != NULL ? storage : &storage_posix; }
+
+const storage_t *storage_current(void) { return backend; }
+
+int storage_open(const char *path, int flags, int *out) {
+  if (path == NULL || out == NULL) {
+    errno = EINVAL;
+    return STATUS_ERROR;
+  }
+  return backend->open(path, flags, out);
+}
+
+int storage_close(int h) { return backend->close(h); }
+
+ssize_t storage_read_at(int h, void *buf, size_t n, uint64_t offset) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r = backend->read_at(h, (char *)buf + done, n - done, offset + done);
+    if (r < 0 && errno == EINTR) { continue; }
+    if (r < 0) { return STATUS_ERROR; }
+    if (r == 0) { break; }
+    done += (size_t)r;
+  }
+  return (ssize_t)done;
+}
+
+int storage_write_at(int h, const void *buf, size_t n, uint64_t offset) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t w = backend->write_at(h, (const char *)buf + done, n - done, offset + done);
+    if (w < 0 && errno == EINTR) { continue; }
+    if (w <= 0) { return STATUS_ERROR; }
+    done += (size_t)w;
+  }
+  return 0;
+}
+
+int storage_append(int h, const struct iovec *iov, int iovcnt, uint64_t *offset) {
+  uint64_t at;
+  ssize_t w;
+  do {
+    w = backend->append(h, iov, iovcnt, &at);
+  } while (w < 0 && errno == EINTR);
+  if (w < 0) { return STATUS_ERROR; }
+  if (offset != NULL) { *offset = at; }
+
+  /* the rest of a short append goes right behind what made it */
+  size_t done = (size_t)w, skip = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    size_t end = skip + iov[i].iov_len;
+    if (end > done) {
+      size_t from = done - skip;
+      if (storage_write_at(h, (const char *)iov[i].iov_base + from, iov[i].iov_len - from,
+                           at + done) < 0) {
+        return STATUS_ERROR;
+      }
+      done = end;
+    }
+    skip = end;
+  }
+  return 0;
+}
+
+int storage_sync(int h) { return backend->sync(h); }
+
+int storage_size(int h, uint64_t *out) { return backend->size(h, out); }
+
+int storage_truncate(int h, uint64_t size) { return backend->truncate(h, size); }
+
+int storage_lock(int h) { return backend->lock(h); }
+
+int storage_unlock(int h) { return backend->unlock(h); }
+
+bool storage_is_current(int h, const char *path) { return backend->is_current(h, path); }
+
+int storage_rename(const char *from, const char *to) { return backend->rename(from, to); }
+
+int storage_remove(const char *path) { return backend->remove(path); }
+
+int storage_map(int h, uint64_t n, const char **out) {
+  *out = NULL;
+  if (n == 0) { return 0; }
+  return backend->map(h, n, out);
+}
+
+void storage_unmap(const char *map, uint64_t n) {
+  if (map != NULL) { backend->unmap(map, n); }
+}
+
+int storage_write_batch(int h, const storage_write_t *parts, int n) {
+  if (n <= 0) { return 0; }
+  if (backend->write_batch != NULL) { return backend->write_batch(h, parts, n); }
+  for (int i = 0; i < n; i++) {
+    if (storage_write_at(h, parts[i].buf, parts[i].len, parts[i].offset) < 0) {
+      return STATUS_ERROR;
+    }
+  }
+  return 0;
+}
+
+/*----------------------------------------------------------------
+ * Streams
+ *----------------------------------------------------------------*/
+
+static int __start_chunk(storage_stream_t *s) {
+  storage_chunk_t *c = &s->chunks[(s->head + s->count) % s->depth];
+  if (c->buf == NULL && (c->buf = malloc(s->chunk_size)) == NULL) { return STATUS_ERROR; }
+  c->offset = s->next;
+  c->len = s->end - s->next < s->chunk_size ? (size_t)(s->end - s->next) : s->chunk_size;
+  memset(&c->ticket, 0, sizeof(c->ticket));
+
+  if (backend->read_start != NULL) {
+    if (backend->read_start(s->handle, c->buf, c->len, c->offset, &c->ticket) < 0) {
+      c->ticket.done = true; /* never went out, nothing to wait for */
+      return STATUS_ERROR;
+    }
+  } else {
+    c->ticket.result = storage_read_at(s->handle, c->buf, c->len, c->offset);
+    c->ticket.error = errno;
+    c->ticket.done = true;
+  }
+  s->next += c->len;
+  s->count++;
+  return 0;
+}
+
+/* keeps as many chunks in flight as the depth allows */
+static int __fill(storage_stream_t *s) {
+  while (s->count < s->depth && s->next < s->end) {
+    if (__start_chunk(s) < 0) { return STATUS_ERROR; }
+  }
+  return 0;
+}
+
+static storage_chunk_t *__head(storage_stream_t *s) {
+  storage_chunk_t *c = &s->chunks[s->head];
+  while (!c->ticket.done) {
+    if (backend->wait() < 0) { return NULL; }
+  }
+  if (c->ticket.result < 0) {
+    errno = c->ticket.error;
+    return NULL;
+  }
+  /* a short read before the end, the rest is read right away */
+  if ((size_t)c->ticket.result < c->len) {
+    size_t got = (size_t)c->ticket.result;
+    ssize_t r = storage_read_at(s->handle, c->buf + got, c->len - got, c->offset + got);
+    if (r < 0) { return NULL; }
+    c->ticket.result += r;
+    /* the file shrank, what is left is read directly */
+    if ((size_t)c->ticket.result < c->len) { s->end = c->offset + (uint64_t)c->ticket.result; }
+  }
+  return c;
+}
+
+int storage_stream_open(storage_stream_t *s, int h, uint64_t offset) {
+  if (s == NULL) { return STATUS_ERROR; }
+  memset(s, 0, sizeof(storage_stream_t));
+  s->handle = h;
+  s->pos = s->next = offset;
+  if (storage_size(h, &s->end) < 0) { return STATUS_ERROR; }
+  if (s->end < offset) { s->end = offset; }
+
+  /* small files get a small chunk */
+  uint64_t left = s->end - offset;
+  s->chunk_size = left < STORAGE_STREAM_CHUNK ? (left > 0 ? (size_t)left : 1) : STORAGE_STREAM_CHUNK;
+  s->depth = backend->read_start != NULL ? STORAGE_STREAM_DEPTH : 1;
+  /* with nothing to overlap the first read waits for the first caller */
+  return s->depth > 1 ? __fill(s) : 0;
+}
+
+ssize_t storage_stream_read(storage_stream_t *s, void *buf, size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    bool idle = s->count == 0;
+    /* past what was there at open, or a big read a chunk would only copy */
+    if (s->pos >= s->end || (idle && s->depth == 1 && n - done >= s->chunk_size / 2)) {
+      size_t want = n - done;
+      ssize_t r = storage_read_at(s->handle, (char *)buf + done, want, s->pos);
+      if (r < 0) { return STATUS_ERROR; }
+      s->pos += (uint64_t)r;
+      done += (size_t)r;
+      if ((size_t)r < want) { break; }
+      continue;
+    }
+    if (idle) {
+      s->next = s->pos;
+      if (__fill(s) < 0) { return STATUS_ERROR; }
+    }
+
+    storage_chunk_t *c = __head(s);
+    if (c == NULL) { return STATUS_ERROR; }
+    uint64_t c_end = c->offset + (uint64_t)c->ticket.result;
+    if (s->pos >= c_end) {
+      if (s->pos >= s->end) { continue; }
+      s->head = (s->head + 1) % s->depth;
+      s->count--;
+      if (__fill(s) < 0) { return STATUS_ERROR; }
+      continue;
+    }
+    size_t take = c_end - s->pos < n - done ? (size_t)(c_end - s->pos) : n - done;
+    memcpy((char *)buf + done, c->buf + (s->pos - c->offset), take);
+    s->pos += take;
+    done += take;
+  }
+  return (ssize_t)done;
+}
+
+void storage_stream_close(storage_stream_t *s) {
+  if (s == NULL) { return; }
+  for (int i = 0; i < s->depth; i++) {
+    storage_chunk_t *c = &s->chunks[i];
+    /* the kernel may still write into a chunk in flight, it has to land */
+    bool landed = c->buf == NULL || c->ticket.done;
+    while (!landed && backend->wait() == 0) { landed = c->ticket.done; }
+    if (landed) { free(c->buf); }
+    c->buf = NULL;
+  }
+  s->count = 0;
+}
@@ -0,0 +1,379 @@
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEM_SECTOR_SIZE 512
+
+typedef struct {
+  char *path; /* NULL once removed or renamed over, open handles keep it */
+  char *data;
+  size_t len;
+  size_t cap;
+} mem_file_t;
+
+typedef struct {
+  mem_file_t *file; /* NULL for a closed handle */
+  int flags;
+} mem_handle_t;
+
+static struct {
+  mem_file_t **files;
+  size_t n_files;
+  mem_handle_t *handles;
+  size_t n_handles;
+  size_t fail_after;
+} mem = {.fail_after = SIZE_MAX};
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static mem_file_t *__find(const char *path) {
+  for (size_t i = 0; i < mem.n_files; i++) {
+    if (mem.files[i]->path != NULL && strcmp(mem.files[i]->path, path) == 0) {
+      return mem.files[i];
+    }
+  }
+  return NULL;
+}
+
+static mem_file_t *__create(const char *path) {
+  mem_file_t **grown = realloc(mem.files, sizeof(mem_file_t *) * (mem.n_files + 1));
+  if (grown == NULL) { return NULL; }
+  mem.files = grown;
+
+  mem_file_t *file = calloc(1, sizeof(mem_file_t));
+  if (file == NULL || (file->path = strdup(path)) == NULL) {
+    free(file);
+    return NULL;
+  }
+  mem.files[mem.n_files++] = file;
+  return file;
+}
+
+static mem_handle_t *__handle(int h, bool writing) {
+  if (h < 0 || (size_t)h >= mem.n_handles || mem.handles[h].file == NULL ||
+      (writing && (mem.handles[h].flags & O_ACCMODE) == O_RDONLY)) {
+    errno = EBADF;
+    return NULL;
+  }
+  return &mem.handles[h];
+}
+
+static int __open(const char *path, int flags, int *out) {
+  mem_file_t *file = __find(path);
+  if (file != NULL && (flags & O_CREAT) && (flags & O_EXCL)) {
+    errno = EEXIST;
+    return STATUS_ERROR;
+  }
+  if (file == NULL && !(flags & O_CREAT)) {
+    errno = ENOENT;
+    return STATUS_ERROR;
+  }
+  if (file == NULL && (file = __create(path)) == NULL) {
+    errno = ENOMEM;
+    return STATUS_ERROR;
+  }
+  if (flags & O_TRUNC) { file->len = 0; }
+
+  size_t h = 0;
+  while (h < mem.n_handles && mem.handles[h].file != NULL) { h++; }
+  if (h == mem.n_handles) {
+    mem_handle_t *grown = realloc(mem.handles, sizeof(mem_handle_t) * (mem.n_handles + 16));
+    if (grown == NULL) {
+      errno = ENOMEM;
+      return STATUS_ERROR;
+    }
+    memset(grown + mem.n_handles, 0, sizeof(mem_handle_t) * 16);
+    mem.handles = grown;
+    mem.n_handles += 16;
+  }
+  mem.handles[h].file = file;
+  mem.handles[h].flags = flags;
+  *out = (int)h;
+  return 0;
+}
+
+static int __close(int h) {
+  mem_handle_t *handle = __handle(h, false);
+  if (handle == NULL) { return STATUS_ERROR; }
+  handle->file = NULL;
+  return 0;
+}
+
+static ssize_t __read_at(int h, void *buf, size_t n, uint64_t offset) {
+  mem_handle_t *handle = __handle(h, false);
+  if (handle == NULL) { return STATUS_ERROR; }
+  const mem_file_t *file = handle->file;
+  if (offset >= file->len) { return 0; }
+  size_t take = file->len - (size_t)offset < n ? file->len - (size_t)offset : n;
+  memcpy(buf, file->data + offset, take);
+  return (ssize_t)take;
+}
+
+static ssize_t __write_at(int h, const void *buf, size_t n, uint64_t offset) {
+  mem_handle_t *handle = __handle(h, true);
+  if (handle == NULL) { return STATUS_ERROR; }
+
+  mem_file_t *file = handle->file;
+
+  /* injected faults, first a short write and then nothing. Like on a disk
+   * an overwrite within one sector lands whole or not at all */
+  if (mem.fail_after != SIZE_MAX) {
+    bool atomic = n > 0 && offset + n <= file->len &&
+                  offset / MEM_SECTOR_SIZE == (offset + n - 1) / MEM_SECTOR_SIZE;
+    if (mem.fail_after == 0 || (atomic && n > mem.fail_after)) {
+      mem.fail_after = 0;
+      errno = EIO;
+      return STATUS_ERROR;
+    }
+    if (n > mem.fail_after) { n = mem.fail_after; }
+    mem.fail_after -= n;
+  }
+
+  size_t end = (size_t)offset + n;
+  if (end > file->cap) {
+    size_t cap = file->cap == 0 ? 4096 : file->cap;
+    while (cap < end) { cap *= 2; }
+    char *grown = realloc(file->data, cap);
+    if (grown == NULL) {
+      errno = ENOSPC;
+      return STATUS_ERROR;
+    }
+    file->data = grown;
+    file->cap = cap;
+  }
+  /* a write past the end leaves a hole of zeroes like a real file */
+  if (offset > file->len) { memset(file->data + file->len, 0, (size_t)offset - file->len); }
+  memcpy(file->data + offset, buf, n);
+  if (end > file->len) { file->len = end; }
+  return (ssize_t)n;
+}
+
+static ssize_t __append(int h, const struct iovec *iov, int iovcnt, uint64_t *offset) {
+  mem_handle_t *handle = __handle(h, true);
+  if (handle == NULL) { return STATUS_ERROR; }
+  *offset = handle->file->len;
+
+  size_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    ssize_t w = __write_at(h, iov[i].iov_base, iov[i].iov_len, *offset + done);
+    if (w < 0) { return done > 0 ? (ssize_t)done : STATUS_ERROR; }
+    done += (size_t)w;
+    if ((size_t)w < iov[i].iov_len) { break; }
+  }
+  return (ssize_t)done;
+}
+
+static int __sync(int h) { return __handle(h, false) != NULL ? 0 : STATUS_ERROR; }
+
+static int __size(int h, uint64_t *out) {
+  mem_handle_t *handle = __handle(h, false);
+  if (handle == NULL) { return STATUS_ERROR; }
+  *out = handle->file->len;
+  return 0;
+}
+
+static int __truncate(int h, uint64_t size) {
+  mem_handle_t *handle = __handle(h, true);
+  if (handle == NULL) { return STATUS_ERROR; }
+  if (size > handle->file->len) {
+    char zero = 0;
+    return __write_at(h, &zero, 1, size - 1) == 1 ? 0 : STATUS_ERROR;
+  }
+  handle->file->len = (size_t)size;
+  return 0;
+}
+
+static int __lock(int h) { return __handle(h, false) != NULL ? 0 : STATUS_ERROR; }
+
+static bool __is_current(int h, const char *path) {
+  mem_handle_t *handle = __handle(h, false);
+  return handle != NULL && handle->file == __find(path);
+}
+
+static int __rename(const char *from, const char *to) {
+  mem_file_t *file = __find(from);
+  if (file == NULL) {
+    errno = ENOENT;
+    return STATUS_ERROR;
+  }
+  char *path = strdup(to);
+  if (path == NULL) {
+    errno = ENOMEM;
+    return STATUS_ERROR;
+  }
+  /* whoever still has the old file open keeps reading it */
+  mem_file_t *replaced = __find(to);
+  if (replaced != NULL) {
+    free(replaced->path);
+    replaced->path = NULL;
+  }
+  free(file->path);
+  file->path = path;
+  return 0;
+}
+
+static int __remove(const char *path) {
+  mem_file_t *file = __find(path);
+  if (file == NULL) {
+    errno = ENOENT;
+    return STATUS_ERROR;
+  }
+  free(file->path);
+  file->path = NULL;
+  return 0;
+}
+
+/* the data itself, valid until the next write grows the file */
+static int __map(int h, uint64_t n, const char **out) {
+  mem_handle_t *handle = __handle(h, false);
+  if (handle == NULL) { return STATUS_ERROR; }
+  if (n > handle->file->len) {
+    errno = EINVAL;
+    return STATUS_ERROR;
+  }
+  *out = handle->file->data;
+  return 0;
+}
+
+static void __unmap(const char *map, uint64_t n) {
+  (void)map;
+  (void)n;
+}
+
+/* every operation holds the lock, `fsck` checks segments from several
+ * threads */
+static int __mem_open(const char *path, int flags, int *out) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __open(path, flags, out);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_close(int h) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __close(h);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static ssize_t __mem_read_at(int h, void *buf, size_t n, uint64_t offset) {
+  pthread_mutex_lock(&mem_lock);
+  ssize_t rc = __read_at(h, buf, n, offset);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static ssize_t __mem_write_at(int h, const void *buf, size_t n, uint64_t offset) {
+  pthread_mutex_lock(&mem_lock);
+  ssize_t rc = __write_at(h, buf, n, offset);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static ssize_t __mem_append(int h, const struct iovec *iov, int iovcnt, uint64_t *offset) {
+  pthread_mutex_lock(&mem_lock);
+  ssize_t rc = __append(h, iov, iovcnt, offset);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_sync(int h) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __sync(h);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_size(int h, uint64_t *out) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __size(h, out);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_truncate(int h, uint64_t size) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __truncate(h, size);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_lock(int h) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __lock(h);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static bool __mem_is_current(int h, const char *path) {
+  pthread_mutex_lock(&mem_lock);
+  bool current = __is_current(h, path);
+  pthread_mutex_unlock(&mem_lock);
+  return current;
+}
+
+static int __mem_rename(const char *from, const char *to) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __rename(from, to);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_remove(const char *path) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __remove(path);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+static int __mem_map(int h, uint64_t n, const char **out) {
+  pthread_mutex_lock(&mem_lock);
+  int rc = __map(h, n, out);
+  pthread_mutex_unlock(&mem_lock);
+  return rc;
+}
+
+const storage_t storage_memory = {
+    .name = "memory",
+    .open = __mem_open,
+    .close = __mem_close,
+    .read_at = __mem_read_at,
+    .write_at = __mem_write_at,
+    .append = __mem_append,
+    .sync = __mem_sync,
+    .size = __mem_size,
+    .truncate = __mem_truncate,
+    .lock = __mem_lock,
+    .unlock = __mem_lock,
+    .is_current = __mem_is_current,
+    .rename = __mem_rename,
+    .remove = __mem_remove,
+    .map = __mem_map,
+    .unmap = __unmap,
+};
+
+void storage_memory_reset(void) {
+  pthread_mutex_lock(&mem_lock);
+  for (size_t i = 0; i < mem.n_files; i++) {
+    free(mem.files[i]->path);
+    free(mem.files[i]->data);
+    free(mem.files[i]);
+  }
+  free(mem.files);
+  free(mem.handles);
+  memset(&mem, 0, sizeof(mem));
+  mem.fail_after = SIZE_MAX;
+  pthread_mutex_unlock(&mem_lock);
+}
+
+void storage_memory_fail_after(size_t n) {
+  pthread_mutex_lock(&mem_lock);
+  mem.fail_after = n;
+  pthread_mutex_unlock(&mem_lock);
+}
@@ -0,0 +1,309 @@
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/storage.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 32
+
+/* no liburing, the rings are set up and driven with the raw system calls
+ * and shared memory layout from <linux/io_uring.h> */
+typedef struct {
+  int fd;
+  unsigned sq_entries;
+  unsigned cq_entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_len;
+  size_t cq_map_len;
+  size_t sqes_len;
+  unsigned queued;    /* in the submission queue, not handed to the kernel yet */
+  unsigned in_flight; /* queued or submitted, not completed */
+} ring_t;
+
+/* a ring belongs to one thread, completions come back to whoever asked */
+static _Thread_local ring_t *thread_ring;
+static _Thread_local bool thread_ring_failed;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void __ring_free(void *arg) {
+  ring_t *r = arg;
+  if (r == NULL) { return; }
+  if (r->sqes != NULL && r->sqes != MAP_FAILED) { munmap(r->sqes, r->sqes_len); }
+  if (r->cq_map != NULL && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) {
+    munmap(r->cq_map, r->cq_map_len);
+  }
+  if (r->sq_map != NULL && r->sq_map != MAP_FAILED) { munmap(r->sq_map, r->sq_map_len); }
+  close(r->fd);
+  free(r);
+}
+
+static void __make_key(void) { pthread_key_create(&ring_key, __ring_free); }
+
+static ring_t *__ring_setup(void) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (fd < 0) { return NULL; }
+  /* READ and WRITE came in 5.6, FAST_POLL is the first flag after them */
+  if (!(p.features & IORING_FEAT_FAST_POLL)) {
+    close(fd);
+    return NULL;
+  }
+
+  ring_t *r = calloc(1, sizeof(ring_t));
+  if (r == NULL) {
+    close(fd);
+    return NULL;
+  }
+  r->fd = fd;
+  r->sq_entries = p.sq_entries;
+  r->cq_entries = p.cq_entries;
+  r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && r->cq_map_len > r->sq_map_len) { r->sq_map_len = r->cq_map_len; }
+
+  r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+  r->cq_map = single ? r->sq_map
+                     : mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                            IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+  if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+    DEBUG_ERROR("failed to map the io_uring queues\n");
+    __ring_free(r);
+    return NULL;
+  }
+
+  char *sq = r->sq_map;
+  r->sq_head = (unsigned *)(sq + p.sq_off.head);
+  r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  char *cq = r->cq_map;
+  r->cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return r;
+}
+
+/* the ring of this thread, set up on first use */
+static ring_t *__ring(void) {
+  if (thread_ring != NULL || thread_ring_failed) { return thread_ring; }
+  pthread_once(&ring_key_once, __make_key);
+  thread_ring = __ring_setup();
+  if (thread_ring == NULL) {
+    thread_ring_failed = true;
+    return NULL;
+  }
+  pthread_setspecific(ring_key, thread_ring);
+  return thread_ring;
+}
+
+/* hands the queued entries to the kernel, waiting for `min_complete` */
+static int __enter(ring_t *r, unsigned min_complete) {
+  for (;;) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = (int)syscall(__NR_io_uring_enter, r->fd, r->queued, min_complete, flags, NULL, 0);
+    if (ret < 0 && errno == EINTR) { continue; }
+    if (ret < 0) {
+      DEBUG_ERROR("io_uring_enter failed\n");
+#ifdef DEBUG
+      perror("io_uring_enter()");
+#endif
+      return STATUS_ERROR;
+    }
+    r->queued -= (unsigned)ret;
+    return 0;
+  }
+}
+
+/* fills in the tickets of every completion there is, returns how many */
+static unsigned __reap(ring_t *r) {
+  unsigned head = *r->cq_head;
+  unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  unsigned reaped = 0;
+  for (; head != tail; head++, reaped++) {
+    const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    storage_ticket_t *ticket = (storage_ticket_t *)(uintptr_t)cqe->user_data;
+    ticket->result = cqe->res < 0 ? STATUS_ERROR : cqe->res;
+    ticket->error = cqe->res < 0 ? -cqe->res : 0;
+    ticket->done = true;
+    r->in_flight--;
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  return reaped;
+}
+
+static int __wait(ring_t *r) {
+  if (r->in_flight == 0) {
+    errno = EINVAL;
+    return STATUS_ERROR;
+  }
+  while (__reap(r) == 0) {
+    if (__enter(r, 1) < 0) { return STATUS_ERROR; }
+  }
+  return 0;
+}
+
+static int __queue(ring_t *r, uint8_t opcode, int fd, const void *buf, size_t n, uint64_t offset,
+                   uint8_t flags, storage_ticket_t *ticket) {
+  /* never more in flight than the completion queue holds */
+  if (r->in_flight >= r->cq_entries && __wait(r) < 0) { return STATUS_ERROR; }
+  if (r->queued == r->sq_entries && __enter(r, 0) < 0) { return STATUS_ERROR; }
+
+  unsigned tail = *r->sq_tail;
+  unsigned index = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->flags = flags;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = n > UINT32_MAX ? UINT32_MAX : (uint32_t)n;
+  sqe->off = offset;
+  sqe->user_data = (uint64_t)(uintptr_t)ticket;
+  r->sq_array[index] = index;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  memset(ticket, 0, sizeof(storage_ticket_t));
+  r->queued++;
+  r->in_flight++;
+  return 0;
+}
+
+static int __uring_read_start(int fd, void *buf, size_t n, uint64_t offset,
+                              storage_ticket_t *ticket) {
+  ring_t *r = __ring();
+  if (r == NULL) {
+    errno = ENOSYS;
+    return STATUS_ERROR;
+  }
+  return __queue(r, IORING_OP_READ, fd, buf, n, offset, 0, ticket);
+}
+
+static int __uring_wait(void) {
+  ring_t *r = __ring();
+  if (r == NULL) {
+    errno = ENOSYS;
+    return STATUS_ERROR;
+  }
+  /* whatever was queued since the last wait goes out now */
+  if (r->queued > 0 && __enter(r, 0) < 0) { return STATUS_ERROR; }
+  return __wait(r);
+}
+
+static int __write_all(int fd, const char *buf, size_t n, uint64_t offset) {
+  while (n > 0) {
+    ssize_t w = pwrite(fd, buf, n, (off_t)offset);
+    if (w < 0 && errno == EINTR) { continue; }
+    if (w <= 0) { return STATUS_ERROR; }
+    buf += w;
+    n -= (size_t)w;
+    offset += (uint64_t)w;
+  }
+  return 0;
+}
+
+/* takes the last `n` entries back out of the submission queue as far as
+ * the kernel has not picked them up, their tickets fail */
+static void __retract(ring_t *r, storage_ticket_t *tickets, int n) {
+  unsigned back = r->queued < (unsigned)n ? r->queued : (unsigned)n;
+  __atomic_store_n(r->sq_tail, *r->sq_tail - back, __ATOMIC_RELEASE);
+  r->queued -= back;
+  r->in_flight -= back;
+  for (int i = n - (int)back; i < n; i++) {
+    tickets[i] = (storage_ticket_t){.result = STATUS_ERROR, .error = ECANCELED, .done = true};
+  }
+}
+
+/* the kernel writes into the tickets and reads the buffers until every
+ * one of them is done, nothing may return before */
+static void __drain(ring_t *r, storage_ticket_t *tickets, int n) {
+  for (int i = 0; i < n; i++) {
+    while (!tickets[i].done) {
+      if (__reap(r) == 0) { __enter(r, 1); }
+    }
+  }
+}
+
+/* the parts are linked so each one starts after the one before it is
+ * done, a part that came back short or failed is written again with the
+ * ones after it (cancelled by the broken link) the plain way */
+static int __uring_write_batch(int fd, const storage_write_t *parts, int n) {
+  ring_t *r = __ring();
+  storage_ticket_t tickets[URING_ENTRIES / 2];
+  int max = URING_ENTRIES / 2;
+
+  for (int first = 0; first < n;) {
+    int count = n - first < max ? n - first : max;
+    int queued = 0;
+    for (int i = 0; r != NULL && i < count; i++, queued++) {
+      const storage_write_t *part = &parts[first + i];
+      uint8_t flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+      if (__queue(r, IORING_OP_WRITE, fd, part->buf, part->len, part->offset, flags,
+                  &tickets[i]) < 0) {
+        break;
+      }
+    }
+    /* what never reached the kernel is written the plain way below */
+    if (queued > 0 && __enter(r, 0) < 0) { __retract(r, tickets, queued); }
+    __drain(r, tickets, queued);
+
+    int redo = queued;
+    for (int i = 0; i < queued; i++) {
+      if (tickets[i].result != (ssize_t)parts[first + i].len) {
+        redo = i;
+        break;
+      }
+    }
+    for (int i = redo; i < count; i++) {
+      const storage_write_t *part = &parts[first + i];
+      if (__write_all(fd, part->buf, part->len, part->offset) < 0) { return STATUS_ERROR; }
+    }
+    first += count;
+  }
+  return 0;
+}
+
+static storage_t uring_storage;
+static bool uring_usable;
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+
+static void __probe(void) {
+  const char *forced = getenv(STORAGE_ENV);
+  if (forced != NULL && strcmp(forced, "posix") == 0) { return; }
+  if (__ring() == NULL) { return; }
+
+  /* everything but the batched paths stays POSIX */
+  uring_storage = storage_posix;
+  uring_storage.name = "io_uring";
+  uring_storage.read_start = __uring_read_start;
+  uring_storage.wait = __uring_wait;
+  uring_storage.write_batch = __uring_write_batch;
+  uring_usable = true;
+}
+
+const storage_t *storage_uring(void) {
+  pthread_once(&uring_once, __probe);
+  return uring_usable ? &uring_storage : NULL;
+}
@@ -0,0 +1,418 @@
+#include "todoctl/tags.h"
+#include "todoctl/archive.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/segment.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <ctype.h>
+
+bool tags_valid_name(const char *name) {
+  if (name == NULL) { return false; }
+  size_t len = strlen(name);
+  if (len == 0 || len > TAGS_NAME_MAX) { return false; }
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)name[i];
+    if (!islower(c) && !isdigit(c) && c != '-' && c != '_') { return false; }
+  }
+  return true;
+}
+
+void tags_free(tags_index_t *index) {
+  if (index == NULL) { return; }
+  for (size_t i = 0; i < index->count; i++) { bitmap_free(&index->sets[i].ids); }
+  free(index->sets);
+  index->sets = NULL;
+  index->count = 0;
+}
+
+/* the slot of the set with the name, or where it would go */
+static bool __find_set(const tags_index_t *index, const char *name, size_t *idx) {
+  size_t lo = 0, hi = index->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(index->sets[mid].name, name);
+    if (cmp == 0) {
+      *idx = mid;
+      return true;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *idx = lo;
+  return false;
+}
+
+bitmap_t *tags_find(tags_index_t *index, const char *name, bool create) {
+  if (index == NULL || name == NULL || strlen(name) > TAGS_NAME_MAX) { return NULL; }
+  size_t idx;
+  if (__find_set(index, name, &idx)) { return &index->sets[idx].ids; }
+  if (!create) { return NULL; }
+
+  tags_set_t *grown = realloc(index->sets, sizeof(tags_set_t) * (index->count + 1));
+  if (grown == NULL) {
+    DEBUG_ERROR("failed to grow tag index\n");
+    return NULL;
+  }
+  index->sets = grown;
+  memmove(&index->sets[idx + 1], &index->sets[idx], sizeof(tags_set_t) * (index->count - idx));
+  index->count++;
+  tags_set_t *set = &index->sets[idx];
+  memset(set, 0, sizeof(tags_set_t));
+  strcpy(set->name, name);
+  bitmap_init(&set->ids);
+  return &set->ids;
+}
+
+static int __read_file(const char *path, char **out, size_t *len) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open tag index\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+  char *buf = malloc(st.st_size > 0 ? (size_t)st.st_size : 1);
+  if (buf == NULL) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+  ssize_t n = pread(fd, buf, (size_t)st.st_size, 0);
+  close(fd);
+  if (n != (ssize_t)st.st_size) {
+    DEBUG_ERROR("failed to read tag index\n");
+    free(buf);
+    return STATUS_ERROR;
+  }
+  *out = buf;
+  *len = (size_t)st.st_size;
+  return 0;
+}
+
+int tags_load(tags_index_t *out) {
+  TRACE_FUNC();
+  if (out == NULL) { return STATUS_ERROR; }
+  memset(out, 0, sizeof(tags_index_t));
+
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(TAGS_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  char *buf;
+  size_t len;
+  int rc = __read_file(path, &buf, &len);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (rc < 0) { return rc; }
+
+  if (len < TAGS_HEADER_SIZE || schema_get_64(buf) != TAGS_MAGIC) {
+    DEBUG_ERROR("invalid tag index magic\n");
+    free(buf);
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(buf + 8) != TAGS_VERSION) {
+    DEBUG_ERROR("invalid tag index version\n");
+    free(buf);
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+
+  uint32_t count = schema_get_32(buf + 12);
+  size_t pos = TAGS_HEADER_SIZE;
+  for (uint32_t i = 0; i < count && rc == 0; i++) {
+    size_t name_len = pos < len ? (uint8_t)buf[pos] : 0;
+    if (name_len == 0 || name_len > TAGS_NAME_MAX || len - pos - 1 < name_len) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    char name[TAGS_NAME_MAX + 1];
+    memcpy(name, buf + pos + 1, name_len);
+    name[name_len] = '\0';
+    pos += 1 + name_len;
+
+    bitmap_t *set = tags_find(out, name, true);
+    size_t used = 0;
+    if (set == NULL) {
+      rc = STATUS_ERROR;
+    } else if (set->count > 0) {
+      /* a name twice is damage too */
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+    } else {
+      rc = bitmap_deserialize(set, buf + pos, len - pos, &used);
+      pos += used;
+    }
+  }
+  free(buf);
+  if (rc < 0) {
+    DEBUG_ERROR("tag index is corrupted\n");
+    tags_free(out);
+  }
+  return rc;
+}
+
+int tags_store(const tags_index_t *index) {
+  TRACE_FUNC();
+  if (index == NULL) { return STATUS_ERROR; }
+
+  size_t len = TAGS_HEADER_SIZE;
+  for (size_t i = 0; i < index->count; i++) {
+    len += 1 + strlen(index->sets[i].name) + bitmap_serialized_size(&index->sets[i].ids);
+  }
+  char *buf = malloc(len);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate tag index buffer\n");
+    return STATUS_ERROR;
+  }
+  schema_put_64(buf, TAGS_MAGIC);
+  schema_put_32(buf + 8, TAGS_VERSION);
+  schema_put_32(buf + 12, (uint32_t)index->count);
+  size_t pos = TAGS_HEADER_SIZE;
+  for (size_t i = 0; i < index->count; i++) {
+    size_t name_len = strlen(index->sets[i].name);
+    buf[pos] = (char)name_len;
+    memcpy(buf + pos + 1, index->sets[i].name, name_len);
+    pos += 1 + name_len;
+    bitmap_serialize(&index->sets[i].ids, buf + pos);
+    pos += bitmap_serialized_size(&index->sets[i].ids);
+  }
+
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (db_resolve_path(TAGS_SUFFIX, path, sizeof(path)) < 0 ||
+      db_resolve_path(TAGS_SUFFIX ".tmp", tmp_path, sizeof(tmp_path)) < 0) {
+    free(buf);
+    return STATUS_ERROR;
+  }
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    free(buf);
+    return STATUS_ERROR;
+  }
+  if (write(fd, buf, len) != (ssize_t)len || fsync(fd) < 0) {
+    perror("write()");
+    close(fd);
+    unlink(tmp_path);
+    free(buf);
+    return STATUS_ERROR;
+  }
+  close(fd);
+  free(buf);
+
+  /* tags are recorded nowhere else, a torn index would lose them */
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+/* rebuilds the state sets from every entry, archived ones included */
+static int __scan_states(tags_index_t *index) {
+  /* adding a set moves the others, look them up once all are there */
+  if (tags_find(index, TAGS_ALL, true) == NULL || tags_find(index, TAGS_DONE, true) == NULL ||
+      tags_find(index, TAGS_DELETED, true) == NULL) {
+    return STATUS_ERROR;
+  }
+  bitmap_t *all = tags_find(index, TAGS_ALL, false);
+  bitmap_t *done = tags_find(index, TAGS_DONE, false);
+  bitmap_t *deleted = tags_find(index, TAGS_DELETED, false);
+  bitmap_free(all);
+  bitmap_free(done);
+  bitmap_free(deleted);
+
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  if (db_read_entries(NULL, &entries, &n) < 0) { return STATUS_ERROR; }
+  if (archive_read_entries(NULL, &entries, &n) < 0) {
+    db_free_entries(entries, n);
+    return STATUS_ERROR;
+  }
+  int rc = 0;
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    rc = bitmap_add(all, entries[i]->entry_id);
+    if (rc == 0 && entries[i]->_done_at > 0) { rc = bitmap_add(done, entries[i]->entry_id); }
+    if (rc == 0 && entries[i]->_deleted_at > 0) { rc = bitmap_add(deleted, entries[i]->entry_id); }
+  }
+  db_free_entries(entries, n);
+  return rc;
+}
+
+/* load, change and store under the db lock, writers of the index are
+ * serialized with each other and with appends */
+typedef int (*tags_change_fn)(tags_index_t *, const void *);
+
+static int __update(tags_change_fn change, const void *arg) {
+  int fd;
+  if (db_lock_raw(&fd) < 0) { return STATUS_ERROR; }
+  tags_index_t index;
+  int rc = tags_load(&index);
+  if (rc == 0) { rc = change(&index, arg); }
+  if (rc == 0) { rc = tags_store(&index); }
+  tags_free(&index);
+  db_unlock(fd);
+  return rc;
+}
+
+typedef struct {
+  uint64_t id;
+  char *const *tags;
+  size_t n;
+} tags_add_t;
+
+static int __add(tags_index_t *index, const void *arg) {
+  const tags_add_t *add = arg;
+  /* the first tagged task finds no state sets, the scan sees it too */
+  if (tags_find(index, TAGS_ALL, false) == NULL && __scan_states(index) < 0) {
+    return STATUS_ERROR;
+  }
+  bitmap_t *all = tags_find(index, TAGS_ALL, true);
+  if (all == NULL || bitmap_add(all, add->id) < 0) { return STATUS_ERROR; }
+  for (size_t i = 0; i < add->n; i++) {
+    if (!tags_valid_name(add->tags[i])) { return TODOCTL_ERR_INVALID_TAG; }
+    bitmap_t *set = tags_find(index, add->tags[i], true);
+    if (set == NULL || bitmap_add(set, add->id) < 0) { return STATUS_ERROR; }
+  }
+  return 0;
+}
+
+int tags_record_add(uint64_t id, char *const *tags, size_t n) {
+  TRACE_FUNC();
+  if (n > 0 && tags == NULL) { return STATUS_ERROR; }
+  tags_add_t add = {.id = id, .tags = tags, .n = n};
+  return __update(__add, &add);
+}
+
+static int __move(bitmap_t *set, uint64_t id, bool member) {
+  if (set == NULL) { return STATUS_ERROR; }
+  if (member) { return bitmap_add(set, id); }
+  bitmap_remove(set, id);
+  return 0;
+}
+
+static int __change(tags_index_t *index, const void *arg) {
+  const todo_entry_t *entry = arg;
+  /* nothing was ever tagged, the first tag builds the sets */
+  if (tags_find(index, TAGS_ALL, false) == NULL) { return 0; }
+  if (__move(tags_find(index, TAGS_DONE, true), entry->entry_id, entry->_done_at > 0) < 0) {
+    return STATUS_ERROR;
+  }
+  return __move(tags_find(index, TAGS_DELETED, true), entry->entry_id, entry->_deleted_at > 0);
+}
+
+int tags_record_change(const todo_entry_t *entry) {
+  TRACE_FUNC();
+  if (entry == NULL) { return STATUS_ERROR; }
+  return __update(__change, entry);
+}
+
+static int __rebuild(tags_index_t *index, const void *arg) {
+  (void)arg;
+  if (__scan_states(index) < 0) { return STATUS_ERROR; }
+
+  /* compacted away tasks take their tags with them */
+  bitmap_t *all = tags_find(index, TAGS_ALL, false);
+  for (size_t i = 0; i < index->count; i++) {
+    bitmap_t *set = &index->sets[i].ids;
+    if (set == all) { continue; }
+    bitmap_t kept;
+    if (bitmap_and(&kept, set, all) < 0) { return STATUS_ERROR; }
+    bitmap_free(set);
+    *set = kept;
+  }
+  return 0;
+}
+
+int tags_rebuild(void) {
+  TRACE_FUNC();
+  return __update(__rebuild, NULL);
+}
+
+/* narrows the candidates to (keep) or away from (!keep) a set, a missing
+ * set is an empty one */
+static int __narrow(bitmap_t *candidates, const bitmap_t *set, bool keep) {
+  bitmap_t empty;
+  bitmap_init(&empty);
+  if (set == NULL) { set = &empty; }
+  bitmap_t result;
+  int rc = keep ? bitmap_and(&result, candidates, set) : bitmap_andnot(&result, candidates, set);
+  if (rc < 0) { return rc; }
+  bitmap_free(candidates);
+  *candidates = result;
+  return 0;
+}
+
+int tags_resolve(query_t *q) {
+  TRACE_FUNC();
+  if (q == NULL) { return STATUS_ERROR; }
+  if (q->n_tags == 0 || q->candidates != NULL || q->empty) { return 0; }
+
+  tags_index_t index;
+  int rc = tags_load(&index);
+  if (rc < 0) { return rc; }
+
+  /* without an index nothing is tagged, `tag!=x` alone holds for all */
+  const bitmap_t *all = tags_find(&index, TAGS_ALL, false);
+  bitmap_t *candidates = calloc(1, sizeof(bitmap_t));
+  if (candidates == NULL) {
+    tags_free(&index);
+    return STATUS_ERROR;
+  }
+
+  bool started = false;
+  for (size_t i = 0; i < q->n_tags && rc == 0; i++) {
+    if (q->tags[i].op != QUERY_OP_EQ) { continue; }
+    const bitmap_t *set = tags_find(&index, q->tags[i].text, false);
+    if (!started) {
+      bitmap_t empty;
+      bitmap_init(&empty);
+      rc = bitmap_copy(candidates, set != NULL ? set : &empty);
+      started = true;
+    } else {
+      rc = __narrow(candidates, set, true);
+    }
+  }
+  if (!started && all == NULL) {
+    /* no positive tag and no index, the tag predicates do not narrow */
+    free(candidates);
+    tags_free(&index);
+    return 0;
+  }
+  if (rc == 0 && !started) { rc = bitmap_copy(candidates, all); }
+  for (size_t i = 0; i < q->n_tags && rc == 0; i++) {
+    if (q->tags[i].op != QUERY_OP_NE) { continue; }
+    rc = __narrow(candidates, tags_find(&index, q->tags[i].text, false), false);
+  }
+
+  /* done=false and friends are state sets too, the records still get
+   * checked against them */
+  for (size_t i = 0; i < q->n_meta && rc == 0; i++) {
+    const query_pred_t *pred = &q->meta[i];
+    if ((pred->field != QUERY_FIELD_DONE && pred->field != QUERY_FIELD_DELETED) ||
+        pred->value != 0 || (pred->op != QUERY_OP_EQ && pred->op != QUERY_OP_NE)) {
+      continue;
+    }
+    const char *name = pred->field == QUERY_FIELD_DONE ? TAGS_DONE : TAGS_DELETED;
+    rc = __narrow(candidates, tags_find(&index, name, false), pred->op == QUERY_OP_NE);
+  }
+  tags_free(&index);
+
+  if (rc < 0) {
+    bitmap_free(candidates);
+    free(candidates);
+    return rc;
+  }
+  q->candidates = candidates;
+  if (candidates->count == 0) { q->empty = true; }
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include "todoctl/trace.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+bool trace_on = false;
+
+typedef struct {
+  const char *name;
+  uint64_t start;
+  uint64_t dur;
+  uint32_t tid;
+} trace_event_t;
+
+static struct {
+  const char *path;
+  uint64_t origin;
+  trace_event_t *events;
+  size_t n;
+  size_t cap;
+  uint64_t dropped;
+  uint32_t threads;
+} trace;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* small numbers read better in the viewer than kernel thread ids */
+static _Thread_local uint32_t trace_tid;
+
+uint64_t trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int trace_init(void) {
+  const char *path = getenv(TRACE_ENV);
+  if (path == NULL || *path == '\0') { return 0; }
+  if (atexit(trace_flush) != 0) {
+    DEBUG_ERROR("failed to register the trace writer\n");
+    return STATUS_ERROR;
+  }
+  trace.path = path;
+  trace.origin = trace_now();
+  trace_on = true;
+  return 0;
+}
+
+void trace_record(const char *name, uint64_t start) {
+  uint64_t end = trace_now();
+  pthread_mutex_lock(&trace_lock);
+  if (trace_tid == 0) { trace_tid = ++trace.threads; }
+  if (trace.n == trace.cap && trace.cap < TRACE_MAX_EVENTS) {
+    size_t cap = trace.cap == 0 ? 4096 : trace.cap * 2;
+    trace_event_t *grown = realloc(trace.events, sizeof(trace_event_t) * cap);
+    if (grown != NULL) {
+      trace.events = grown;
+      trace.cap = cap;
+    }
+  }
+  if (trace.n < trace.cap) {
+    trace.events[trace.n++] = (trace_event_t){
+        .name = name, .start = start, .dur = end - start, .tid = trace_tid};
+  } else {
+    trace.dropped++;
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/* microseconds with the nanoseconds as a fraction, what the format wants */
+static void __put_micros(FILE *f, uint64_t ns) {
+  fprintf(f, "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000);
+}
+
+void trace_flush(void) {
+  if (!trace_on) { return; }
+  /* whatever still ends after this is not recorded */
+  trace_on = false;
+
+  pthread_mutex_lock(&trace_lock);
+  FILE *f = fopen(trace.path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to write the trace to %s\n", trace.path);
+    pthread_mutex_unlock(&trace_lock);
+    return;
+  }
+
+  long pid = (long)getpid();
+  fprintf(f, "{\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":1,"
+             "\"args\":{\"name\":\"todoctl\"}}",
+          pid);
+  for (size_t i = 0; i < trace.n; i++) {
+    const trace_event_t *ev = &trace.events[i];
+    /* names are function names and literals, nothing to escape */
+    fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"todoctl\",\"ph\":\"X\",\"ts\":", ev->name);
+    __put_micros(f, ev->start >= trace.origin ? ev->start - trace.origin : 0);
+    fprintf(f, ",\"dur\":");
+    __put_micros(f, ev->dur);
+    fprintf(f, ",\"pid\":%ld,\"tid\":%u}", pid, ev->tid);
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%" PRIu64 "}}\n",
+          trace.dropped);
+  if (fclose(f) != 0) { fprintf(stderr, "Failed to write the trace to %s\n", trace.path); }
+
+  free(trace.events);
+  trace.events = NULL;
+  trace.n = trace.cap = 0;
+  pthread_mutex_unlock(&trace_lock);
+}
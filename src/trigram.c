@@ -0,0 +1,661 @@
+#include "todoctl/trigram.h"
+#include "todoctl/archive.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/errors.h"
+#include "todoctl/segment.h"
+#include "todoctl/trace.h"
+#include "todoctl/util.h"
+
+#include <ctype.h>
+
+#define TRIGRAM_RECORD_HEAD 12
+
+typedef struct {
+  uint32_t keys;
+  uint64_t base;   /* where the postings end and the tail starts */
+  uint64_t length; /* committed bytes, the header included */
+} trigram_head_t;
+
+typedef struct {
+  trigram_t key;
+  bitmap_t ids;
+} trigram_set_t;
+
+typedef struct {
+  trigram_t key;
+  uint64_t id;
+} trigram_pair_t;
+
+static void __put_key(char *buf, trigram_t key) {
+  buf[0] = (char)(key >> 16);
+  buf[1] = (char)(key >> 8);
+  buf[2] = (char)key;
+}
+
+static trigram_t __get_key(const char *buf) {
+  const unsigned char *p = (const unsigned char *)buf;
+  return (trigram_t)p[0] << 16 | (trigram_t)p[1] << 8 | p[2];
+}
+
+/* words are letters and digits, the same ones `find` tokenizes on */
+static unsigned char __fold(char c) {
+  unsigned char u = (unsigned char)c;
+  return isalnum(u) ? (unsigned char)tolower(u) : 0;
+}
+
+static int __push_key(trigram_t **keys, size_t *n, size_t *cap, trigram_t key) {
+  if (*n == *cap) {
+    size_t new_cap = *cap < 16 ? 16 : *cap * 2;
+    trigram_t *grown = realloc(*keys, sizeof(trigram_t) * new_cap);
+    if (grown == NULL) {
+      DEBUG_ERROR("failed to grow trigrams\n");
+      return STATUS_ERROR;
+    }
+    *keys = grown;
+    *cap = new_cap;
+  }
+  (*keys)[(*n)++] = key;
+  return 0;
+}
+
+/* the trigrams of the word in text[start, end), padded in front and behind
+ * as asked */
+static int __word(const char *text, size_t start, size_t end, bool front, bool back,
+                  trigram_t **keys, size_t *n, size_t *cap) {
+  size_t pad = front ? 2 : 0;
+  size_t len = end - start;
+  size_t total = pad + len + (back ? 1 : 0);
+  for (size_t i = 0; i + 3 <= total; i++) {
+    trigram_t key = 0;
+    for (size_t j = i; j < i + 3; j++) {
+      unsigned char c = ' ';
+      if (j >= pad && j - pad < len) { c = __fold(text[start + j - pad]); }
+      key = key << 8 | c;
+    }
+    if (__push_key(keys, n, cap, key) < 0) { return STATUS_ERROR; }
+  }
+  return 0;
+}
+
+static int __compare_ids(const void *a, const void *b) {
+  uint64_t ia = *(const uint64_t *)a, ib = *(const uint64_t *)b;
+  return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+static int __compare_keys(const void *a, const void *b) {
+  trigram_t ka = *(const trigram_t *)a, kb = *(const trigram_t *)b;
+  return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+/* sorts and drops the duplicates */
+static size_t __settle_keys(trigram_t *keys, size_t n) {
+  if (n == 0) { return 0; }
+  qsort(keys, n, sizeof(trigram_t), __compare_keys);
+  size_t kept = 1;
+  for (size_t i = 1; i < n; i++) {
+    if (keys[i] != keys[kept - 1]) { keys[kept++] = keys[i]; }
+  }
+  return kept;
+}
+
+int trigram_extract(const char *text, size_t len, bool fragment, trigram_t **out, size_t *n_out) {
+  if (out == NULL || n_out == NULL || (len > 0 && text == NULL)) { return STATUS_ERROR; }
+  *out = NULL;
+  *n_out = 0;
+
+  trigram_t *keys = NULL;
+  size_t n = 0, cap = 0, i = 0;
+  int rc = 0;
+  while (i < len && rc == 0) {
+    if (__fold(text[i]) == 0) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < len && __fold(text[i]) != 0) { i++; }
+    /* a fragment may start or end inside a word of the text */
+    rc = __word(text, start, i, !fragment || start > 0, !fragment || i < len, &keys, &n, &cap);
+  }
+  if (rc < 0) {
+    free(keys);
+    return rc;
+  }
+  *out = keys;
+  *n_out = __settle_keys(keys, n);
+  return 0;
+}
+
+static int __open_index(int flags, int *out) {
+  char path[DB_PATH_MAX];
+  if (db_resolve_path(TRIGRAM_SUFFIX, path, sizeof(path)) < 0) { return STATUS_ERROR; }
+  int fd = open(path, flags, 0644);
+  if (fd < 0) {
+    if (errno == ENOENT) { return TODOCTL_ERR_DB_DOES_NOT_EXIST; }
+    DEBUG_ERROR("failed to open trigram index\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return STATUS_ERROR;
+  }
+  *out = fd;
+  return 0;
+}
+
+static int __read_head(int fd, trigram_head_t *head) {
+  char buf[TRIGRAM_HEADER_SIZE];
+  ssize_t n = pread(fd, buf, sizeof(buf), 0);
+  /* a file that never got its header is an empty index */
+  if (n == 0) {
+    head->keys = 0;
+    head->base = TRIGRAM_HEADER_SIZE;
+    head->length = TRIGRAM_HEADER_SIZE;
+    return 0;
+  }
+  if (n != (ssize_t)sizeof(buf) || schema_get_64(buf) != TRIGRAM_MAGIC) {
+    DEBUG_ERROR("invalid trigram index magic\n");
+    return TODOCTL_ERR_INVALID_HEADER_MAGIC;
+  }
+  if (schema_get_32(buf + 8) != TRIGRAM_VERSION) {
+    DEBUG_ERROR("invalid trigram index version\n");
+    return TODOCTL_ERR_INVALID_VERSION;
+  }
+  head->keys = schema_get_32(buf + 12);
+  head->base = schema_get_64(buf + 16);
+  head->length = schema_get_64(buf + 24);
+  if (head->base < TRIGRAM_HEADER_SIZE + (uint64_t)head->keys * TRIGRAM_SLOT_SIZE ||
+      head->length < head->base) {
+    DEBUG_ERROR("trigram index is corrupted\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  return 0;
+}
+
+static void __encode_head(char *buf, const trigram_head_t *head) {
+  schema_put_64(buf, TRIGRAM_MAGIC);
+  schema_put_32(buf + 8, TRIGRAM_VERSION);
+  schema_put_32(buf + 12, head->keys);
+  schema_put_64(buf + 16, head->base);
+  schema_put_64(buf + 24, head->length);
+}
+
+static void __free_sets(trigram_set_t *sets, size_t n) {
+  for (size_t i = 0; i < n; i++) { bitmap_free(&sets[i].ids); }
+  free(sets);
+}
+
+static int __push_pair(trigram_pair_t **pairs, size_t *n, size_t *cap, trigram_t key, uint64_t id) {
+  if (*n == *cap) {
+    size_t new_cap = *cap < 64 ? 64 : *cap * 2;
+    trigram_pair_t *grown = realloc(*pairs, sizeof(trigram_pair_t) * new_cap);
+    if (grown == NULL) {
+      DEBUG_ERROR("failed to grow trigram pairs\n");
+      return STATUS_ERROR;
+    }
+    *pairs = grown;
+    *cap = new_cap;
+  }
+  (*pairs)[(*n)++] = (trigram_pair_t){.key = key, .id = id};
+  return 0;
+}
+
+static int __compare_pairs(const void *a, const void *b) {
+  const trigram_pair_t *pa = a, *pb = b;
+  if (pa->key != pb->key) { return pa->key < pb->key ? -1 : 1; }
+  return pa->id < pb->id ? -1 : pa->id > pb->id ? 1 : 0;
+}
+
+/* the (trigram, id) pairs of the adds in the tail */
+static int __load_tail(int fd, const trigram_head_t *head, trigram_pair_t **out, size_t *n) {
+  *out = NULL;
+  *n = 0;
+  size_t len = (size_t)(head->length - head->base);
+  if (len == 0) { return 0; }
+  char *tail = malloc(len);
+  if (tail == NULL) { return STATUS_ERROR; }
+  if (pread(fd, tail, len, (off_t)head->base) != (ssize_t)len) {
+    DEBUG_ERROR("trigram index is shorter than its length\n");
+    free(tail);
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+
+  size_t pos = 0, cap = 0;
+  int rc = 0;
+  while (pos < len && rc == 0) {
+    if (len - pos < TRIGRAM_RECORD_HEAD) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    uint64_t id = schema_get_64(tail + pos);
+    uint32_t count = schema_get_32(tail + pos + 8);
+    pos += TRIGRAM_RECORD_HEAD;
+    if ((len - pos) / 3 < count) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    for (uint32_t i = 0; i < count && rc == 0; i++, pos += 3) {
+      rc = __push_pair(out, n, &cap, __get_key(tail + pos), id);
+    }
+  }
+  free(tail);
+  if (rc < 0) {
+    DEBUG_ERROR("trigram index tail is corrupted\n");
+    free(*out);
+    *out = NULL;
+    *n = 0;
+  }
+  return rc;
+}
+
+/* the posting list of one trigram, left empty when it has none */
+static int __read_posting(int fd, const trigram_head_t *head, trigram_t key, bitmap_t *out) {
+  char slot[TRIGRAM_SLOT_SIZE];
+  uint32_t lo = 0, hi = head->keys;
+  bool found = false;
+  while (lo < hi && !found) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (pread(fd, slot, sizeof(slot),
+              (off_t)(TRIGRAM_HEADER_SIZE + (uint64_t)mid * TRIGRAM_SLOT_SIZE)) !=
+        (ssize_t)sizeof(slot)) {
+      return TODOCTL_ERR_CORRUPTED_DB;
+    }
+    trigram_t other = __get_key(slot);
+    if (other == key) {
+      found = true;
+    } else if (other < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (!found) { return 0; }
+
+  uint64_t offset = schema_get_64(slot + 3);
+  uint32_t size = schema_get_32(slot + 11);
+  if (offset < TRIGRAM_HEADER_SIZE + (uint64_t)head->keys * TRIGRAM_SLOT_SIZE ||
+      offset + size > head->base) {
+    DEBUG_ERROR("trigram index slot is out of bounds\n");
+    return TODOCTL_ERR_CORRUPTED_DB;
+  }
+  char *buf = malloc(size > 0 ? size : 1);
+  if (buf == NULL) { return STATUS_ERROR; }
+  size_t used;
+  int rc = TODOCTL_ERR_CORRUPTED_DB;
+  if (pread(fd, buf, size, (off_t)offset) == (ssize_t)size) {
+    rc = bitmap_deserialize(out, buf, size, &used);
+  }
+  free(buf);
+  return rc;
+}
+
+/* every posting list, in trigram order */
+static int __load_sets(int fd, const trigram_head_t *head, trigram_set_t **out, size_t *n) {
+  *out = NULL;
+  *n = 0;
+  size_t len = (size_t)(head->base - TRIGRAM_HEADER_SIZE);
+  if (head->keys == 0) { return 0; }
+  char *body = malloc(len);
+  trigram_set_t *sets = calloc(head->keys, sizeof(trigram_set_t));
+  if (body == NULL || sets == NULL) {
+    free(body);
+    free(sets);
+    return STATUS_ERROR;
+  }
+  int rc = 0;
+  if (pread(fd, body, len, TRIGRAM_HEADER_SIZE) != (ssize_t)len) { rc = TODOCTL_ERR_CORRUPTED_DB; }
+
+  size_t loaded = 0;
+  for (; loaded < head->keys && rc == 0; loaded++) {
+    const char *slot = body + (size_t)loaded * TRIGRAM_SLOT_SIZE;
+    uint64_t offset = schema_get_64(slot + 3);
+    uint32_t size = schema_get_32(slot + 11);
+    if (offset < TRIGRAM_HEADER_SIZE || offset + size > head->base) {
+      rc = TODOCTL_ERR_CORRUPTED_DB;
+      break;
+    }
+    size_t used;
+    sets[loaded].key = __get_key(slot);
+    bitmap_init(&sets[loaded].ids);
+    rc = bitmap_deserialize(&sets[loaded].ids, body + (offset - TRIGRAM_HEADER_SIZE), size, &used);
+  }
+  free(body);
+  if (rc < 0) {
+    DEBUG_ERROR("trigram index is corrupted\n");
+    __free_sets(sets, loaded);
+    return rc;
+  }
+  *out = sets;
+  *n = head->keys;
+  return 0;
+}
+
+/* merges pairs sorted by trigram into the sets, trigrams new to them get
+ * sets of their own */
+static int __merge(trigram_set_t **sets, size_t *n, const trigram_pair_t *pairs, size_t n_pairs) {
+  trigram_set_t *merged = malloc(sizeof(trigram_set_t) * (*n + n_pairs + 1));
+  if (merged == NULL) {
+    DEBUG_ERROR("failed to allocate trigram sets\n");
+    return STATUS_ERROR;
+  }
+  size_t i = 0, j = 0, m = 0;
+  int rc = 0;
+  while ((i < *n || j < n_pairs) && rc == 0) {
+    bool old = i < *n && (j >= n_pairs || (*sets)[i].key <= pairs[j].key);
+    trigram_set_t set;
+    if (old) {
+      set = (*sets)[i++];
+    } else {
+      set.key = pairs[j].key;
+      bitmap_init(&set.ids);
+    }
+    for (; j < n_pairs && pairs[j].key == set.key && rc == 0; j++) {
+      rc = bitmap_add(&set.ids, pairs[j].id);
+    }
+    merged[m++] = set;
+  }
+  if (rc < 0) {
+    __free_sets(merged, m);
+    for (; i < *n; i++) { bitmap_free(&(*sets)[i].ids); }
+  }
+  free(*sets);
+  *sets = rc < 0 ? NULL : merged;
+  *n = rc < 0 ? 0 : m;
+  return rc;
+}
+
+/* replaces the index with the sets and an empty tail */
+static int __store(const trigram_set_t *sets, size_t n) {
+  trigram_head_t head = {.keys = (uint32_t)n};
+  head.base = TRIGRAM_HEADER_SIZE + (uint64_t)n * TRIGRAM_SLOT_SIZE;
+  for (size_t i = 0; i < n; i++) { head.base += bitmap_serialized_size(&sets[i].ids); }
+  head.length = head.base;
+
+  char *buf = malloc((size_t)head.length);
+  if (buf == NULL) {
+    DEBUG_ERROR("failed to allocate trigram index buffer\n");
+    return STATUS_ERROR;
+  }
+  __encode_head(buf, &head);
+  uint64_t offset = TRIGRAM_HEADER_SIZE + (uint64_t)n * TRIGRAM_SLOT_SIZE;
+  for (size_t i = 0; i < n; i++) {
+    char *slot = buf + TRIGRAM_HEADER_SIZE + i * TRIGRAM_SLOT_SIZE;
+    size_t size = bitmap_serialized_size(&sets[i].ids);
+    __put_key(slot, sets[i].key);
+    schema_put_64(slot + 3, offset);
+    schema_put_32(slot + 11, (uint32_t)size);
+    bitmap_serialize(&sets[i].ids, buf + offset);
+    offset += size;
+  }
+
+  char path[DB_PATH_MAX];
+  char tmp_path[DB_PATH_MAX];
+  if (db_resolve_path(TRIGRAM_SUFFIX, path, sizeof(path)) < 0 ||
+      db_resolve_path(TRIGRAM_SUFFIX ".tmp", tmp_path, sizeof(tmp_path)) < 0) {
+    free(buf);
+    return STATUS_ERROR;
+  }
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open()");
+    free(buf);
+    return STATUS_ERROR;
+  }
+  if (write(fd, buf, (size_t)head.length) != (ssize_t)head.length || fsync(fd) < 0) {
+    perror("write()");
+    close(fd);
+    unlink(tmp_path);
+    free(buf);
+    return STATUS_ERROR;
+  }
+  close(fd);
+  free(buf);
+
+  if (rename(tmp_path, path) < 0) {
+    perror("rename()");
+    unlink(tmp_path);
+    return STATUS_ERROR;
+  }
+  return 0;
+}
+
+/* folds the tail into the postings */
+static int __fold_tail(int fd, const trigram_head_t *head) {
+  trigram_set_t *sets;
+  size_t n;
+  int rc = __load_sets(fd, head, &sets, &n);
+  if (rc < 0) { return rc; }
+  trigram_pair_t *pairs;
+  size_t n_pairs;
+  if ((rc = __load_tail(fd, head, &pairs, &n_pairs)) < 0) {
+    __free_sets(sets, n);
+    return rc;
+  }
+  if (n_pairs > 0) { qsort(pairs, n_pairs, sizeof(trigram_pair_t), __compare_pairs); }
+  rc = __merge(&sets, &n, pairs, n_pairs);
+  free(pairs);
+  if (rc == 0) { rc = __store(sets, n); }
+  __free_sets(sets, n);
+  return rc;
+}
+
+int trigram_record_add(uint64_t id, const char *text, size_t len) {
+  TRACE_FUNC();
+  trigram_t *keys;
+  size_t n;
+  if (trigram_extract(text, len, false, &keys, &n) < 0) { return STATUS_ERROR; }
+  if (n == 0) {
+    free(keys);
+    return 0;
+  }
+  size_t record_len = TRIGRAM_RECORD_HEAD + n * 3;
+  char *record = malloc(record_len);
+  if (record == NULL) {
+    free(keys);
+    return STATUS_ERROR;
+  }
+  schema_put_64(record, id);
+  schema_put_32(record + 8, (uint32_t)n);
+  for (size_t i = 0; i < n; i++) { __put_key(record + TRIGRAM_RECORD_HEAD + i * 3, keys[i]); }
+  free(keys);
+
+  int lock;
+  if (db_lock_raw(&lock) < 0) {
+    free(record);
+    return STATUS_ERROR;
+  }
+  int fd = -1;
+  int rc = __open_index(O_RDWR | O_CREAT, &fd);
+  trigram_head_t head;
+  if (rc == 0 && (rc = __read_head(fd, &head)) == 0) {
+    /* the record lands first, the header moving past it commits it */
+    char header[TRIGRAM_HEADER_SIZE];
+    uint64_t offset = head.length;
+    head.length += record_len;
+    __encode_head(header, &head);
+    if (pwrite(fd, record, record_len, (off_t)offset) != (ssize_t)record_len ||
+        fdatasync(fd) < 0 ||
+        pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(fd) < 0) {
+      DEBUG_ERROR("failed to append to trigram index\n");
+#ifdef DEBUG
+      perror("pwrite()");
+#endif
+      rc = STATUS_ERROR;
+    }
+  }
+  /* a lookup reads the whole tail, it stays small next to the postings */
+  uint64_t tail = rc == 0 ? head.length - head.base : 0;
+  if (rc == 0 && tail > TRIGRAM_TAIL_MIN && tail > (head.base - TRIGRAM_HEADER_SIZE) / 4) {
+    rc = __fold_tail(fd, &head);
+  }
+  if (fd >= 0) { close(fd); }
+  db_unlock(lock);
+  free(record);
+  return rc;
+}
+
+int trigram_rebuild(void) {
+  TRACE_FUNC();
+  int lock;
+  if (db_lock_raw(&lock) < 0) { return STATUS_ERROR; }
+  todo_entry_t **entries = NULL;
+  size_t n = 0;
+  int rc = db_read_entries(NULL, &entries, &n);
+  if (rc == 0 && (rc = archive_read_entries(NULL, &entries, &n)) < 0) {
+    db_free_entries(entries, n);
+  }
+  if (rc < 0) {
+    db_unlock(lock);
+    return rc;
+  }
+
+  trigram_pair_t *pairs = NULL;
+  size_t n_pairs = 0, cap = 0;
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    trigram_t *keys = NULL;
+    size_t n_keys = 0;
+    rc = entry_load_text(entries[i]);
+    if (rc == 0) {
+      rc = trigram_extract(entries[i]->entry_raw_data, entries[i]->entry_raw_data_len, false,
+                           &keys, &n_keys);
+    }
+    for (size_t k = 0; rc == 0 && k < n_keys; k++) {
+      rc = __push_pair(&pairs, &n_pairs, &cap, keys[k], entries[i]->entry_id);
+    }
+    free(keys);
+  }
+  db_free_entries(entries, n);
+
+  trigram_set_t *sets = NULL;
+  size_t n_sets = 0;
+  if (rc == 0 && n_pairs > 0) {
+    qsort(pairs, n_pairs, sizeof(trigram_pair_t), __compare_pairs);
+    rc = __merge(&sets, &n_sets, pairs, n_pairs);
+  }
+  free(pairs);
+  if (rc == 0) { rc = __store(sets, n_sets); }
+  __free_sets(sets, n_sets);
+  db_unlock(lock);
+  return rc;
+}
+
+/* the ids in at least `min` of the lists, counted over their merged ids */
+static int __at_least(const bitmap_t *postings, size_t n, size_t min, bitmap_t *out) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; i++) { total += bitmap_cardinality(&postings[i]); }
+  if (total == 0) { return 0; }
+  uint64_t *all = malloc(sizeof(uint64_t) * total);
+  if (all == NULL) {
+    DEBUG_ERROR("failed to allocate trigram counts\n");
+    return STATUS_ERROR;
+  }
+  size_t pos = 0;
+  int rc = 0;
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    uint64_t *ids;
+    size_t count;
+    if ((rc = bitmap_to_array(&postings[i], &ids, &count)) < 0) { break; }
+    if (count > 0) { memcpy(all + pos, ids, sizeof(uint64_t) * count); }
+    pos += count;
+    free(ids);
+  }
+  if (rc == 0 && pos > 0) { qsort(all, pos, sizeof(uint64_t), __compare_ids); }
+  for (size_t i = 0; i < pos && rc == 0;) {
+    size_t run = 1;
+    while (i + run < pos && all[i + run] == all[i]) { run++; }
+    if (run >= min) { rc = bitmap_add(out, all[i]); }
+    i += run;
+  }
+  free(all);
+  return rc;
+}
+
+int trigram_lookup(const trigram_t *keys, size_t n, size_t min, bitmap_t *out) {
+  TRACE_FUNC();
+  if (out == NULL || (n > 0 && keys == NULL)) { return STATUS_ERROR; }
+  bitmap_init(out);
+  if (min == 0) { min = 1; }
+  if (n == 0 || min > n) { return 0; }
+
+  int fd;
+  int rc = __open_index(O_RDONLY, &fd);
+  if (rc == TODOCTL_ERR_DB_DOES_NOT_EXIST) { return 0; }
+  if (rc < 0) { return rc; }
+  trigram_head_t head;
+  bitmap_t *postings = calloc(n, sizeof(bitmap_t));
+  if (postings == NULL) { rc = STATUS_ERROR; }
+  if (rc == 0) { rc = __read_head(fd, &head); }
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    rc = __read_posting(fd, &head, keys[i], &postings[i]);
+  }
+
+  /* the adds not folded yet */
+  trigram_pair_t *pairs = NULL;
+  size_t n_pairs = 0;
+  if (rc == 0) { rc = __load_tail(fd, &head, &pairs, &n_pairs); }
+  close(fd);
+  for (size_t i = 0; i < n_pairs && rc == 0; i++) {
+    const trigram_t *hit = bsearch(&pairs[i].key, keys, n, sizeof(trigram_t), __compare_keys);
+    if (hit != NULL) { rc = bitmap_add(&postings[hit - keys], pairs[i].id); }
+  }
+  free(pairs);
+
+  if (rc == 0 && min < n) { rc = __at_least(postings, n, min, out); }
+  if (rc == 0 && min == n) { rc = bitmap_copy(out, &postings[0]); }
+  for (size_t i = 1; i < n && rc == 0 && min == n; i++) {
+    bitmap_t kept;
+    if ((rc = bitmap_and(&kept, out, &postings[i])) < 0) { break; }
+    bitmap_free(out);
+    *out = kept;
+  }
+  for (size_t i = 0; postings != NULL && i < n; i++) { bitmap_free(&postings[i]); }
+  free(postings);
+  if (rc < 0) { bitmap_free(out); }
+  return rc;
+}
+
+int trigram_resolve(query_t *q) {
+  TRACE_FUNC();
+  if (q == NULL) { return STATUS_ERROR; }
+  if (q->n_text == 0 || q->empty) { return 0; }
+
+  /* every predicate has to hold, so every trigram of every one of them */
+  trigram_t *keys = NULL;
+  size_t n = 0, cap = 0;
+  int rc = 0;
+  for (size_t i = 0; i < q->n_text && rc == 0; i++) {
+    trigram_t *found = NULL;
+    size_t n_found = 0;
+    rc = trigram_extract(q->text[i].text, q->text[i].text_len, true, &found, &n_found);
+    for (size_t k = 0; rc == 0 && k < n_found; k++) { rc = __push_key(&keys, &n, &cap, found[k]); }
+    free(found);
+  }
+  if (rc < 0 || n == 0) {
+    /* fragments shorter than a trigram do not narrow */
+    free(keys);
+    return rc;
+  }
+  n = __settle_keys(keys, n);
+
+  bitmap_t *found = calloc(1, sizeof(bitmap_t));
+  if (found == NULL) { rc = STATUS_ERROR; }
+  if (rc == 0) { rc = trigram_lookup(keys, n, n, found); }
+  free(keys);
+  if (rc == 0 && q->candidates != NULL) {
+    bitmap_t kept;
+    rc = bitmap_and(&kept, q->candidates, found);
+    bitmap_free(found);
+    if (rc == 0) {
+      bitmap_free(q->candidates);
+      *q->candidates = kept;
+    }
+    free(found);
+    found = NULL;
+  }
+  if (rc < 0) {
+    free(found);
+    return rc;
+  }
+  if (found != NULL) { q->candidates = found; }
+  if (q->candidates->count == 0) { q->empty = true; }
+  return 0;
+}
@@ -1,5 +1,8 @@
 #include "todoctl/util.h"
+#include <ctype.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 uint64_t get_time_in_millis(void) {
   struct timeval tv;
@@ -27,3 +30,130 @@ int convert_to_uint64(const char *str, long long *out_int) {
   *out_int = result_long;
   return 0;
 }
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t n) {
+  static uint32_t table[256];
+  static int table_ready = 0;
+  if (!table_ready) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1; }
+      table[i] = c;
+    }
+    table_ready = 1;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)buf;
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) { crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8); }
+  return ~crc;
+}
+
+int writev_all(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n < 0) { return -1; }
+
+    /* skip what went out, a short write can stop in the middle of a buffer */
+    size_t left = (size_t)n;
+    while (iovcnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+  return 0;
+}
+
+size_t varint_put(uint64_t value, char *out) {
+  size_t i = 0;
+  while (value >= 0x80) {
+    out[i++] = (char)((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out[i++] = (char)value;
+  return i;
+}
+
+static uint64_t __load_le64(const unsigned char *p) {
+  uint64_t word;
+  memcpy(&word, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+size_t varint_get(const char *buf, size_t n, uint64_t *out) {
+  const unsigned char *p = (const unsigned char *)buf;
+
+  /* flags, gaps between ids and lengths of short texts all fit one byte */
+  if (n > 0 && p[0] < 0x80) {
+    *out = p[0];
+    return 1;
+  }
+
+  /* with 8 bytes at hand the end of the varint is the first byte without
+   * the high bit, found for all of them at once instead of a branch per
+   * byte. The 7 bit groups are then squeezed together without a loop */
+  if (n >= 8) {
+    uint64_t word = __load_le64(p);
+    uint64_t stops = ~word & 0x8080808080808080ULL;
+    if (stops != 0) {
+      size_t len = (size_t)__builtin_ctzll(stops) / 8 + 1;
+      if (len < 8) { word &= (1ULL << (len * 8)) - 1; }
+      *out = (word & 0x7FULL) | ((word >> 1) & (0x7FULL << 7)) | ((word >> 2) & (0x7FULL << 14)) |
+             ((word >> 3) & (0x7FULL << 21)) | ((word >> 4) & (0x7FULL << 28)) |
+             ((word >> 5) & (0x7FULL << 35)) | ((word >> 6) & (0x7FULL << 42)) |
+             ((word >> 7) & (0x7FULL << 49));
+      return len;
+    }
+  }
+
+  /* near the end of the buffer or longer than 8 bytes */
+  uint64_t value = 0;
+  for (size_t i = 0; i < n && i < VARINT_MAX_LEN; i++) {
+    value |= (uint64_t)(p[i] & 0x7F) << (7 * i);
+    if (!(p[i] & 0x80)) {
+      *out = value;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+uint64_t zigzag_encode(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t zigzag_decode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+size_t text_next_token(const char *text, size_t n, size_t *pos, char *out) {
+  size_t i = *pos;
+  while (i < n && !isalnum((unsigned char)text[i])) { i++; }
+
+  size_t len = 0;
+  for (; i < n && isalnum((unsigned char)text[i]); i++) {
+    if (len < TEXT_TOKEN_MAX) { out[len++] = (char)tolower((unsigned char)text[i]); }
+  }
+  *pos = i;
+  return len;
+}
+
+int text_has_token(const char *text, size_t n, const char *token) {
+  size_t token_len = strlen(token);
+  char buf[TEXT_TOKEN_MAX];
+  size_t pos = 0;
+  size_t len;
+  while ((len = text_next_token(text, n, &pos, buf)) > 0) {
+    if (len == token_len && memcmp(buf, token, len) == 0) { return 1; }
+  }
+  return 0;
+}
@@ -0,0 +1,421 @@
+#include "todoctl/watch.h"
+#include "todoctl/db.h"
+#include "todoctl/debug.h"
+#include "todoctl/delta.h"
+#include "todoctl/entry.h"
+#include "todoctl/errors.h"
+#include "todoctl/segment.h"
+
+#include <inttypes.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+typedef struct {
+  uint64_t entry_id;
+  off_t status_offset; /* where `deleted_at` and `done_at` of this entry live in the file */
+  uint64_t done_at;    /* as last reported */
+  uint64_t deleted_at;
+} watched_entry_t;
+
+typedef struct {
+  char path[DB_PATH_MAX];
+  int fd;
+  ino_t inode;
+  off_t offset; /* first byte we have not decoded yet */
+  uint64_t sealed_through_id; /* active entries up to here were sealed already */
+
+  char log_path[DB_PATH_MAX];
+  off_t log_offset; /* first byte of the delta log we have not decoded yet */
+
+  char *buf;
+  size_t buf_len;
+  size_t buf_cap;
+
+  watched_entry_t *tracked; /* every entry of the active db, in file order */
+  size_t tracked_len;
+  size_t tracked_cap;
+  char *status_buf; /* WATCH_READ_CHUNK bytes of the file around their status fields */
+
+  FILE *out;
+  int flags;
+  bool snapshot; /* true while decoding what existed before we started */
+} watch_state_t;
+
+static void __emit_text(FILE *out, const char *text, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    switch (text[i]) {
+    case '\n': fputs("\\n", out); break;
+    case '\t': fputs("\\t", out); break;
+    case '\\': fputs("\\\\", out); break;
+    default: fputc(text[i], out); break;
+    }
+  }
+}
+
+static void __emit_add(FILE *out, todo_entry_t *entry) {
+  /* a text that can not be read is still an add, just without the text */
+  if (entry_load_text(entry) < 0) { DEBUG_WARN("failed to read text of a long entry\n"); }
+  fprintf(out, "add\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t", entry->entry_id, entry->_created_at,
+          entry->_done_at);
+  if (entry->entry_raw_data != NULL) {
+    __emit_text(out, entry->entry_raw_data, entry->entry_raw_data_len);
+  }
+  fputc('\n', out);
+  if (entry->_deleted_at > 0) {
+    fprintf(out, "delete\t%" PRIu64 "\t%" PRIu64 "\n", entry->entry_id, entry->_deleted_at);
+  }
+}
+
+/* sealed segments never change in place, they are sent once per snapshot
+ * and their status changes only ever show up in the delta log */
+static int __emit_sealed(watch_state_t *state) {
+  manifest_t manifest;
+  if (manifest_load(&manifest) < 0) { return STATUS_ERROR; }
+  state->sealed_through_id = manifest.sealed_through_id;
+
+  int rc = 0;
+  if (!(state->snapshot && (state->flags & WATCH_ONLY_NEW))) {
+    todo_entry_t **entries = NULL;
+    size_t n = 0;
+    rc = segment_read_sealed(&manifest, NULL, &entries, &n);
+    for (size_t i = 0; rc == 0 && i < n; i++) { __emit_add(state->out, entries[i]); }
+    db_free_entries(entries, n);
+  }
+  manifest_free(&manifest);
+  return rc;
+}
+
+static int __track(watch_state_t *state, const todo_entry_t *entry, off_t entry_offset) {
+  if (state->tracked_len == state->tracked_cap) {
+    size_t new_cap = state->tracked_cap == 0 ? 64 : state->tracked_cap * 2;
+    watched_entry_t *grown = realloc(state->tracked, new_cap * sizeof(watched_entry_t));
+    if (grown == NULL) {
+      DEBUG_ERROR("failed to grow watched entries\n");
+      return STATUS_ERROR;
+    }
+    state->tracked = grown;
+    state->tracked_cap = new_cap;
+  }
+  state->tracked[state->tracked_len] = (watched_entry_t){
+      .entry_id = entry->entry_id,
+      .status_offset = entry_offset + (off_t)ENTRY_DELETED_AT_OFFSET,
+      .done_at = entry->_done_at,
+      .deleted_at = entry->_deleted_at,
+  };
+  state->tracked_len++;
+  return 0;
+}
+
+static int __watch_open(watch_state_t *state) {
+  state->fd = open(state->path, O_RDONLY);
+  if (state->fd < 0) {
+    DEBUG_ERROR("failed to open db file\n");
+#ifdef DEBUG
+    perror("open()");
+#endif
+    return TODOCTL_ERR_DB_DOES_NOT_EXIST;
+  }
+  if (validate_db_exists(&state->fd) < 0) {
+    close(state->fd);
+    state->fd = -1;
+    return STATUS_ERROR;
+  }
+
+  struct stat st;
+  if (fstat(state->fd, &st) < 0) {
+    close(state->fd);
+    state->fd = -1;
+    return STATUS_ERROR;
+  }
+  state->inode = st.st_ino;
+  if (__emit_sealed(state) < 0) {
+    close(state->fd);
+    state->fd = -1;
+    return STATUS_ERROR;
+  }
+  state->offset = sizeof(db_header_t);
+  state->log_offset = 0;
+  /* like the entries, the changes logged before we started are not news */
+  struct stat log_st;
+  if (state->snapshot && (state->flags & WATCH_ONLY_NEW) && stat(state->log_path, &log_st) == 0) {
+    state->log_offset = log_st.st_size - log_st.st_size % DELTA_RECORD_SIZE;
+  }
+  state->buf_len = 0;
+  state->tracked_len = 0;
+  return 0;
+}
+
+static int __watch_reset(watch_state_t *state) {
+  if (state->fd >= 0) { close(state->fd); }
+  fputs("reset\n", state->out);
+  state->snapshot = false;
+  return __watch_open(state);
+}
+
+/* decode every complete entry sitting in the buffer, whatever is left is
+ * the beginning of an entry that is still being appended */
+static int __decode_pending(watch_state_t *state) {
+  size_t pos = 0;
+  while (pos < state->buf_len) {
+    todo_entry_t entry;
+    size_t consumed = 0;
+    int rc = decode_entry(state->buf + pos, state->buf_len - pos, &entry, &consumed);
+    if (rc == TODOCTL_ERR_INCOMPLETE_ENTRY) { break; }
+    if (rc < 0) { return rc; }
+
+    off_t entry_offset = state->offset + (off_t)pos;
+    if (entry.entry_id <= state->sealed_through_id) {
+      /* already sent as part of a sealed segment */
+      free(entry.entry_raw_data);
+      pos += consumed;
+      continue;
+    }
+    if (!(state->snapshot && (state->flags & WATCH_ONLY_NEW))) { __emit_add(state->out, &entry); }
+    if (__track(state, &entry, entry_offset) < 0) {
+      free(entry.entry_raw_data);
+      return STATUS_ERROR;
+    }
+
+    free(entry.entry_raw_data);
+    pos += consumed;
+  }
+
+  memmove(state->buf, state->buf + pos, state->buf_len - pos);
+  state->buf_len -= pos;
+  state->offset += (off_t)pos;
+  return 0;
+}
+
+/* read and decode only what was appended after the last decoded entry */
+static int __catch_up(watch_state_t *state) {
+  struct stat st;
+  if (stat(state->path, &st) < 0 || st.st_ino != state->inode ||
+      st.st_size < state->offset + (off_t)state->buf_len) {
+    if (__watch_reset(state) < 0) { return STATUS_ERROR; }
+    if (fstat(state->fd, &st) < 0) { return STATUS_ERROR; }
+  }
+
+  off_t read_at = state->offset + (off_t)state->buf_len;
+  while (read_at < st.st_size) {
+    size_t want = WATCH_READ_CHUNK;
+    /* a single entry may be larger than a chunk, make room for all of it */
+    if (state->buf_len >= 4) {
+      uint32_t total_length = schema_get_32(state->buf + ENTRY_OFFSET(LENGTH));
+      if (total_length > state->buf_len + want) { want = total_length - state->buf_len; }
+    }
+    if (state->buf_cap < state->buf_len + want) {
+      char *grown = realloc(state->buf, state->buf_len + want);
+      if (grown == NULL) {
+        DEBUG_ERROR("failed to grow watch buffer\n");
+        return STATUS_ERROR;
+      }
+      state->buf = grown;
+      state->buf_cap = state->buf_len + want;
+    }
+
+    ssize_t n = pread(state->fd, state->buf + state->buf_len, want, read_at);
+    if (n < 0) {
+      DEBUG_ERROR("failed to read appended entries\n");
+#ifdef DEBUG
+      perror("pread()");
+#endif
+      return STATUS_ERROR;
+    }
+    if (n == 0) { break; }
+    state->buf_len += (size_t)n;
+    read_at += n;
+
+    if (__decode_pending(state) < 0) { return STATUS_ERROR; }
+  }
+
+  state->snapshot = false;
+  return 0;
+}
+
+#define WATCH_STATUS_SIZE (ENTRY_DONE_AT_OFFSET + 8 - ENTRY_DELETED_AT_OFFSET)
+
+/* reports what changed in the status fields of a watched entry */
+static void __emit_status(watch_state_t *state, watched_entry_t *watched, const char *status) {
+  uint64_t deleted_at = schema_get_64(status);
+  uint64_t done_at = schema_get_64(status + ENTRY_DONE_AT_OFFSET - ENTRY_DELETED_AT_OFFSET);
+  if (done_at != watched->done_at) {
+    if (done_at == 0) {
+      fprintf(state->out, "undone\t%" PRIu64 "\n", watched->entry_id);
+    } else {
+      fprintf(state->out, "done\t%" PRIu64 "\t%" PRIu64 "\n", watched->entry_id, done_at);
+    }
+    watched->done_at = done_at;
+  }
+  if (deleted_at != watched->deleted_at) {
+    fprintf(state->out, "delete\t%" PRIu64 "\t%" PRIu64 "\n", watched->entry_id, deleted_at);
+    watched->deleted_at = deleted_at;
+  }
+}
+
+/* without the delta log done, undone and delete are written in place,
+ * re-read `deleted_at` and `done_at` of every entry and report what
+ * changed since the last look. The entries sit in file order, so the
+ * file is read front to back a chunk at a time, not an entry at a time */
+static int __check_status(watch_state_t *state) {
+  db_header_t header;
+  if (state->tracked_len == 0) { return 0; }
+  if (read_header(state->fd, &header) < 0) { return STATUS_ERROR; }
+  if (header._flags & DB_FEATURE_DELTA_LOG) { return 0; }
+
+  if (state->status_buf == NULL) {
+    state->status_buf = malloc(WATCH_READ_CHUNK);
+    if (state->status_buf == NULL) {
+      DEBUG_ERROR("failed to allocate watch status buffer\n");
+      return STATUS_ERROR;
+    }
+  }
+
+  size_t i = 0;
+  while (i < state->tracked_len) {
+    off_t from = state->tracked[i].status_offset;
+    size_t end = i + 1;
+    while (end < state->tracked_len &&
+           state->tracked[end].status_offset + WATCH_STATUS_SIZE - from <= WATCH_READ_CHUNK) {
+      end++;
+    }
+    size_t len = (size_t)(state->tracked[end - 1].status_offset - from) + WATCH_STATUS_SIZE;
+    if (pread(state->fd, state->status_buf, len, from) != (ssize_t)len) {
+      DEBUG_ERROR("failed to read the status of watched entries\n");
+      return STATUS_ERROR;
+    }
+    for (; i < end; i++) {
+      watched_entry_t *watched = &state->tracked[i];
+      __emit_status(state, watched, state->status_buf + (watched->status_offset - from));
+    }
+  }
+  return 0;
+}
+
+/* with the delta log enabled status changes are appended there instead */
+static int __catch_up_log(watch_state_t *state) {
+  int fd = open(state->log_path, O_RDONLY);
+  if (fd < 0) { return errno == ENOENT ? 0 : STATUS_ERROR; }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return STATUS_ERROR;
+  }
+  /* compaction folded the log into the db and emptied it */
+  if (st.st_size < state->log_offset) { state->log_offset = 0; }
+
+  char chunk[DELTA_RECORD_SIZE * 256];
+  while (state->log_offset + DELTA_RECORD_SIZE <= st.st_size) {
+    ssize_t n = pread(fd, chunk, sizeof(chunk), state->log_offset);
+    if (n < 0) {
+      DEBUG_ERROR("failed to read the delta log\n");
+      close(fd);
+      return STATUS_ERROR;
+    }
+
+    size_t pos = 0;
+    for (; pos + DELTA_RECORD_SIZE <= (size_t)n; pos += DELTA_RECORD_SIZE) {
+      delta_kind_t kind;
+      uint64_t entry_id, timestamp;
+      if (delta_decode(chunk + pos, &kind, &entry_id, &timestamp) < 0) {
+        close(fd);
+        return STATUS_ERROR;
+      }
+      switch (kind) {
+      case DELTA_DONE:
+        fprintf(state->out, "done\t%" PRIu64 "\t%" PRIu64 "\n", entry_id, timestamp);
+        break;
+      case DELTA_UNDONE: fprintf(state->out, "undone\t%" PRIu64 "\n", entry_id); break;
+      case DELTA_DELETE:
+        fprintf(state->out, "delete\t%" PRIu64 "\t%" PRIu64 "\n", entry_id, timestamp);
+        break;
+      }
+    }
+    if (pos == 0) { break; }
+    state->log_offset += (off_t)pos;
+  }
+
+  close(fd);
+  return 0;
+}
+
+static int __process(watch_state_t *state) {
+  if (__catch_up(state) < 0) { return STATUS_ERROR; }
+  if (__check_status(state) < 0) { return STATUS_ERROR; }
+  if (__catch_up_log(state) < 0) { return STATUS_ERROR; }
+  fflush(state->out);
+  return 0;
+}
+
+int watch_db(FILE *out, int flags) {
+  if (out == NULL) { return STATUS_ERROR; }
+
+  watch_state_t state;
+  memset(&state, 0, sizeof(state));
+  state.fd = -1;
+  state.out = out;
+  state.flags = flags;
+  state.snapshot = true;
+  if (db_resolve_path(NULL, state.path, sizeof(state.path)) < 0 ||
+      db_resolve_path(DELTA_SUFFIX, state.log_path, sizeof(state.log_path)) < 0) {
+    return STATUS_ERROR;
+  }
+  if (__watch_open(&state) < 0) { return STATUS_ERROR; }
+
+  int rc = __process(&state);
+
+#ifdef __linux__
+  int ifd = inotify_init1(IN_CLOEXEC);
+  int wd = ifd < 0 ? -1 : inotify_add_watch(ifd, state.path, IN_MODIFY | IN_CLOSE_WRITE);
+  if (wd < 0) { DEBUG_WARN("inotify unavailable, falling back to polling\n"); }
+  /* the log is created by the first delta, until then the timeout covers it */
+  int log_wd = wd < 0 ? -1 : inotify_add_watch(ifd, state.log_path, IN_MODIFY);
+#else
+  int ifd = -1;
+  int wd = -1;
+#endif
+
+  while (rc == 0) {
+    struct pollfd pfd = {.fd = ifd, .events = POLLIN, .revents = 0};
+    /* the timeout also catches the file being replaced underneath us */
+    int ready = poll(wd < 0 ? NULL : &pfd, wd < 0 ? 0 : 1, WATCH_POLL_INTERVAL_MS);
+    if (ready < 0 && errno != EINTR) {
+      rc = STATUS_ERROR;
+      break;
+    }
+
+#ifdef __linux__
+    if (ready > 0) {
+      char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+      if (read(ifd, events, sizeof(events)) < 0 && errno != EAGAIN) {
+        rc = STATUS_ERROR;
+        break;
+      }
+    }
+#endif
+
+    ino_t inode = state.inode;
+    rc = __process(&state);
+#ifdef __linux__
+    if (rc == 0 && wd >= 0 && inode != state.inode) {
+      inotify_rm_watch(ifd, wd);
+      wd = inotify_add_watch(ifd, state.path, IN_MODIFY | IN_CLOSE_WRITE);
+    }
+    if (rc == 0 && wd >= 0 && log_wd < 0) {
+      log_wd = inotify_add_watch(ifd, state.log_path, IN_MODIFY);
+    }
+#else
+    (void)inode;
+#endif
+  }
+
+  if (ifd >= 0) { close(ifd); }
+  if (state.fd >= 0) { close(state.fd); }
+  free(state.buf);
+  free(state.tracked);
+  free(state.status_buf);
+  return rc;
+}
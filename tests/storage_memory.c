@@ -0,0 +1,121 @@
+/*
+ * storage_memory.c -- runs the db and recovery paths on the memory backend
+ *
+ * Author: frostzt
+ * Date: 2026-10-19
+ */
+
+#include "todoctl/commands.h"
+#include "todoctl/db.h"
+#include "todoctl/errors.h"
+#include "todoctl/recover.h"
+#include "todoctl/storage.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_TASKS 64
+#define TEST_FAULTS 160 /* bytes into an add where its writes start failing */
+
+#define CHECK(cond)                                                                                \
+  do {                                                                                             \
+    if (!(cond)) {                                                                                 \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);                                   \
+      return STATUS_ERROR;                                                                         \
+    }                                                                                              \
+  } while (0)
+
+/* fsck without repairing, the db has to hold only good entries */
+static int __expect_clean(fsck_report_t *report) {
+  CHECK(db_fsck(false, report) == 0);
+  CHECK(report->bad_entries == 0 && !report->bad_entry);
+  CHECK(report->good_bytes == report->file_bytes);
+  return 0;
+}
+
+static int __test_paths(void) {
+  CHECK(create_new_todo_db() == 0);
+  for (int i = 0; i < TEST_TASKS; i++) {
+    char task[32];
+    snprintf(task, sizeof(task), "task %d", i);
+    CHECK(add_task_command(task, NULL, 0, 0) == 0);
+  }
+  uint64_t last = 0;
+  CHECK(get_last_entry(&last) == 0 && last > 0);
+
+  /* ids start at the db's first id and go up by one */
+  uint64_t first = last - TEST_TASKS + 1;
+  CHECK(mark_task_done(first) == 0);
+  CHECK(mark_task_undone(first) == 0);
+  CHECK(mark_task_done(first + 1) == 0);
+  CHECK(delete_task_command(first + 2) == 0);
+  CHECK(list_tasks_command(0, NULL) == 0);
+  fsck_report_t report;
+  CHECK(__expect_clean(&report) == 0 && report.entries == TEST_TASKS);
+
+  /* deleted entries stay, compact only folds the deltas in */
+  CHECK(compact_command() == 0);
+  CHECK(__expect_clean(&report) == 0 && report.entries == TEST_TASKS);
+  return 0;
+}
+
+/* every add is cut off at a different byte, the next lock has to drop the
+ * torn tail and leave the committed entries alone. An entry that made it
+ * out whole is rolled forward even if its commit did not */
+static int __test_faults(void) {
+  CHECK(create_new_todo_db() == 0);
+  CHECK(add_task_command("before the faults", NULL, 0, 0) == 0);
+  uint64_t first = 0;
+  uint64_t last = 0;
+  CHECK(get_last_entry(&first) == 0);
+  uint32_t entries = 1;
+  for (size_t n = 0; n < TEST_FAULTS; n++) {
+    storage_memory_fail_after(n);
+    add_task_command("written while the disk fails", NULL, 0, 0);
+    storage_memory_fail_after(SIZE_MAX);
+
+    /* the lock recovers the tail before anything else reads the db */
+    CHECK(add_task_command("after the fault", NULL, 0, 0) == 0);
+    fsck_report_t report;
+    CHECK(__expect_clean(&report) == 0);
+    CHECK(report.entries == entries + 1 || report.entries == entries + 2);
+    CHECK(get_last_entry(&last) == 0 && last - first + 1 == report.entries);
+    entries = report.entries;
+  }
+
+  /* what the lock did not see is repaired by fsck */
+  storage_memory_fail_after(8);
+  add_task_command("left for fsck", NULL, 0, 0);
+  storage_memory_fail_after(SIZE_MAX);
+  fsck_report_t report;
+  CHECK(db_fsck(true, &report) == 0);
+  CHECK(report.entries == entries || report.entries == entries + 1);
+  CHECK(__expect_clean(&report) == 0);
+  return 0;
+}
+
+int main(void) {
+  /* the sidecars are plain files next to the db path */
+  char dir[] = "/tmp/todoctl-test-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp()");
+    return EXIT_FAILURE;
+  }
+  char path[sizeof(dir) + 16];
+  snprintf(path, sizeof(path), "%s/test.db", dir);
+  db_use_path(path);
+  storage_use(&storage_memory);
+
+  int failed = 0;
+  if (__test_paths() < 0) { failed++; }
+  storage_memory_reset();
+  if (__test_faults() < 0) { failed++; }
+  storage_memory_reset();
+
+  char cmd[sizeof(dir) + 16];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) { fprintf(stderr, "failed to remove %s\n", dir); }
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}